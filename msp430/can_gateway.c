@@ -0,0 +1,155 @@
+/* can_gateway.c
+ * Two-controller store-and-forward gateway; see can_gateway.h
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "can_gateway.h"
+#ifdef MCP2515_RX_TIMESTAMP
+#include "can_timer.h"
+#endif
+
+#ifndef MCP2515_RX_RING_SIZE
+#error "can_gateway.c needs MCP2515_RX_RING_SIZE"
+#endif
+
+#ifdef MCP2515_STATS
+#define CAN_GATEWAY_STAT(dev, expr) ((dev)->stats.expr)
+#else
+#define CAN_GATEWAY_STAT(dev, expr)
+#endif
+
+/* Forward everything as-is both ways at priority 0, between a and b, both already set up with can_init_dev() and
+ * can_speed_dev() and receiving what should cross (their own filters are the cheapest place to drop frames, being
+ * free of SPI I/O).  The gateway owns both RX rings from here on.
+ */
+void can_gateway_init(struct can_gateway *gw, can_dev_t *a, can_dev_t *b)
+{
+	memset(gw, 0, sizeof(struct can_gateway));
+	gw->dir[0].from = a;
+	gw->dir[0].to = b;
+	gw->dir[1].from = b;
+	gw->dir[1].to = a;
+}
+
+/* Rules for direction dir (0: A to B, 1: B to A), checked in order; deflt is the prio for frames none match.
+ * The table is used in place, so it may be const in flash.
+ */
+void can_gateway_rules(struct can_gateway *gw, uint8_t dir, const struct can_gateway_rule *rules, uint8_t n,
+		       uint8_t deflt)
+{
+	gw->dir[dir].rules = rules;
+	gw->dir[dir].n_rules = n;
+	gw->dir[dir].deflt = deflt;
+}
+
+/* Apply d's rules to f, rewriting its ID in place if the matching rule changes it.
+ * Returns the prio to send it with, or -1 if it isn't to be forwarded.
+ */
+int can_gateway_map(const struct can_gateway_dir *d, can_frame_t *f)
+{
+	const struct can_gateway_rule *r = d->rules;
+	uint32_t key, out;
+	uint8_t i, prio = d->deflt, ext = can_frame_is_ext(f);
+
+	key = can_parse_msgid(&f->sidh);
+	if (ext)
+		key |= CAN_GATEWAY_EXT;
+	// A received standard RTR has it in SIDL (SRR), but a TXB takes it in DLC whatever the kind
+	if (!ext && (f->sidl & 0x10))
+		f->dlc |= 0x40;
+	f->dlc &= 0x4F;
+	for (i=0; i < d->n_rules; i++, r++) {
+		if ((key & r->mask) == r->id) {
+			prio = r->prio;
+			out = (key & r->keep) | r->set;
+			if (out != key && prio != CAN_GATEWAY_DROP)
+				can_frame_set_id(f, out & ~CAN_GATEWAY_EXT, !!(out & CAN_GATEWAY_EXT));
+			break;
+		}
+	}
+	return prio == CAN_GATEWAY_DROP ? -1 : prio;
+}
+
+// The ring is full, so can_isr() has to leave new frames in the RXBs
+#define CAN_GATEWAY_RING_FULL(dev) ((uint8_t)((dev)->rxring_head - (dev)->rxring_tail) >= MCP2515_RX_RING_SIZE)
+
+#if defined(MCP2515_STATS) && defined(MCP2515_RX_TIMESTAMP)
+/* Account for the far-side TXBs we loaded that have been retired since the last look: their frames are on the wire.
+ * The driver's can_tx_sent_dev() has them even if can_isr() has refilled the TXB since; the gateway is its only user.
+ */
+static void can_gateway_sent(struct can_gateway_dir *d)
+{
+	uint8_t i, done = d->txb & can_tx_sent_dev(d->to);
+	uint32_t now, lat;
+
+	if (!done)
+		return;
+	now = can_timer_now();
+	for (i=0; i < 3; i++) {
+		if ( !(done & (1 << i)) )
+			continue;
+		lat = now - d->stamp[i];
+		d->from->stats.fwd_lat_ticks += lat;
+		if (lat > d->from->stats.fwd_lat_max)
+			d->from->stats.fwd_lat_max = lat;
+	}
+	d->txb &= ~done;
+}
+#endif
+
+/* Forward what d->from's RX ring holds for as long as d->to has a TXB free; the rest stays in the ring, head first,
+ * for the next call.  Returns frames handed over.
+ */
+static int can_gateway_pump(struct can_gateway_dir *d)
+{
+	can_frame_t *f;
+	int prio, txb, n = 0;
+
+	#if defined(MCP2515_STATS) && defined(MCP2515_RX_TIMESTAMP)
+	can_gateway_sent(d);
+	#endif
+	while ( (f = can_recv_peek_dev(d->from)) ) {
+		// Map only once: a remapped ID might match a different rule the second time round
+		if (!d->held) {
+			if ( (prio = can_gateway_map(d, f)) < 0 ) {
+				CAN_GATEWAY_STAT(d->from, fwd_filtered++);
+				can_recv_drop_dev(d->from);
+				continue;
+			}
+			d->held = prio + 1;
+		}
+		if ( (txb = can_send_txb_dev(d->to, f, d->held - 1)) < 0 ) {
+			if (!CAN_GATEWAY_RING_FULL(d->from))
+				break;  // Wait in the ring for a TXB
+			/* Far side's segment is saturated or it's bus-off.  The oldest frame gives way, so the near side's RXBs
+			 * keep draining and it's the stalest traffic that's lost.
+			 */
+			CAN_GATEWAY_STAT(d->from, fwd_drop++);
+		} else {
+			CAN_GATEWAY_STAT(d->from, fwd++);
+			#if defined(MCP2515_STATS) && defined(MCP2515_RX_TIMESTAMP)
+			if (d->txb & (1 << txb))
+				can_gateway_sent(d);  // Our last frame in it must have gone since the look above
+			d->txb |= 1 << txb;
+			d->stamp[txb] = can_recv_stamp_dev(d->from);
+			#endif
+			n++;
+		}
+		d->held = 0;
+		can_recv_drop_dev(d->from);  // The TXB has its own copy now
+	}
+	return n;
+}
+
+/* Forward whatever the far sides have TXBs for.  Call it from the main loop after the IRQ handlers, whenever either
+ * ring has frames or a TXB has completed; frames still waiting need another call once the far side's TX-complete
+ * IRQ comes in.
+ * Returns the number of frames forwarded.
+ */
+int can_gateway_poll(struct can_gateway *gw)
+{
+	return can_gateway_pump(&gw->dir[0]) + can_gateway_pump(&gw->dir[1]);
+}
@@ -0,0 +1,52 @@
+/* can_gateway.h
+ * Store-and-forward gateway between two controllers, splitting one bus into two segments.  can_gateway_poll() takes
+ * each frame at the head of one side's RX ring, looks its ID up in that direction's rules and rewrites the ID in place
+ * if the rule says to.  The ring slot then waits until a TXB on the other side is free and goes in with
+ * can_send_txb_dev(), so the frame goes from RXB to ring to TXB with no copy in between; the ring is the queue, and
+ * the slot is only released once the TXB has it.  Needs MCP2515_RX_RING_SIZE, whose size sets how big a burst each
+ * direction absorbs while the far segment is busy.  With MCP2515_STATS each controller's stats count the frames
+ * forwarded from it, filtered out and dropped, plus (with MCP2515_RX_TIMESTAMP) the latency from reception to the
+ * far side's TX-complete.
+ */
+#ifndef CAN_GATEWAY_H
+#define CAN_GATEWAY_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+#define CAN_GATEWAY_EXT 0x80000000UL  // Set in rule IDs for 29-bit extended IDs
+#define CAN_GATEWAY_DROP 0xFF         // Rule prio: don't forward
+
+/* A frame matches when (ID & mask) == id, the ID having CAN_GATEWAY_EXT set if it is extended; it is then sent on
+ * as (ID & keep) | set.  keep 0xFFFFFFFF with set 0 leaves it unchanged; keep CAN_GATEWAY_EXT | 0x700 with set 0x080
+ * moves a standard 0x00-0xFF block up to 0x080-0x17F; clearing CAN_GATEWAY_EXT in the result sends it standard.
+ */
+struct can_gateway_rule {
+	uint32_t id, mask;
+	uint32_t keep, set;
+	uint8_t prio;               // can_send_frame() priority on the far side, or CAN_GATEWAY_DROP
+};
+
+struct can_gateway_dir {
+	can_dev_t *from, *to;
+	const struct can_gateway_rule *rules;  // First match wins
+	uint8_t n_rules;
+	uint8_t deflt;              // prio for frames no rule matches, or CAN_GATEWAY_DROP
+	uint8_t held;               // 1 + prio of the ring head, already mapped and waiting for a TXB; 0 if not mapped yet
+	#if defined(MCP2515_STATS) && defined(MCP2515_RX_TIMESTAMP)
+	uint8_t txb;                // TXBs on the far side holding frames from here, not yet seen to complete
+	uint32_t stamp[3];          // ... and their reception times
+	#endif
+};
+
+struct can_gateway {
+	struct can_gateway_dir dir[2];  // A to B, B to A
+};
+
+/* Function prototypes */
+void can_gateway_init(struct can_gateway *, can_dev_t *, can_dev_t *);
+void can_gateway_rules(struct can_gateway *, uint8_t, const struct can_gateway_rule *, uint8_t, uint8_t);
+int can_gateway_poll(struct can_gateway *);
+int can_gateway_map(const struct can_gateway_dir *, can_frame_t *);
+
+#endif
@@ -0,0 +1,288 @@
+/* can_isotp.c
+ * ISO 15765-2 (ISO-TP) transport on top of can_send()/can_recv(); see can_isotp.h
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_isotp.h"
+
+/* Protocol control info, upper nybble of byte 0 */
+#define ISOTP_PCI_SF 0x00
+#define ISOTP_PCI_FF 0x10
+#define ISOTP_PCI_CF 0x20
+#define ISOTP_PCI_FC 0x30
+
+/* Flow status */
+#define ISOTP_FS_CTS 0
+#define ISOTP_FS_WAIT 1
+#define ISOTP_FS_OVFLW 2
+
+/* tx_state */
+#define ISOTP_TX_IDLE 0
+#define ISOTP_TX_FIRST 1  // SF or FF waiting for a TX buffer
+#define ISOTP_TX_WAIT_FC 2
+#define ISOTP_TX_CF 3
+#define ISOTP_TX_DONE 4
+#define ISOTP_TX_ERROR 5
+
+/* rx_state */
+#define ISOTP_RX_IDLE 0
+#define ISOTP_RX_CF 1
+#define ISOTP_RX_DONE 2
+#define ISOTP_RX_ERROR 3
+
+void can_isotp_init(struct can_isotp *l, uint32_t tx_id, uint32_t rx_id, uint8_t is_ext, uint8_t *rxbuf, uint16_t rxsize)
+{
+	memset(l, 0, sizeof(struct can_isotp));
+	l->tx_id = tx_id;
+	l->rx_id = rx_id;
+	l->is_ext = is_ext;
+	l->dev = &can_dev0;
+	l->rx_buf = rxbuf;
+	l->rx_size = rxsize;
+}
+
+/* Address, pad and send one frame whose payload was built in place in f->data.  Without the driver's TX
+ * queue there's only ever one of ours in the controller at a time, since the MCP2515 would send a later frame
+ * in a higher-numbered TXB of the same priority first; which TXB it is doesn't matter (TXB0 may be reserved).
+ */
+static int can_isotp_frame(struct can_isotp *l, can_frame_t *f, uint8_t len)
+{
+	#ifdef CAN_ISOTP_PAD
+	memset(f->data+len, CAN_ISOTP_PAD, 8-len);
+	len = 8;
+	#endif
+	#ifndef MCP2515_TX_QUEUE_SIZE
+	if (!can_tx_idle_dev(l->dev))
+		return -1;
+	#endif
+	can_frame_set_id(f, l->tx_id, l->is_ext);
+	f->dlc = len;
+	return can_send_frame_dev(l->dev, f, CAN_ISOTP_PRIO);
+}
+
+/* Send (or retry later from can_isotp_poll()) a flow control frame */
+static void can_isotp_fc(struct can_isotp *l, uint8_t fs)
+{
+	can_frame_t f;
+	uint8_t *frame = f.data;
+
+	frame[0] = ISOTP_PCI_FC | fs;
+	frame[1] = CAN_ISOTP_BS;
+	frame[2] = CAN_ISOTP_STMIN;
+	if (can_isotp_frame(l, &f, 3) < 0)
+		l->rx_fc = frame[0];
+	else
+		l->rx_fc = 0;
+}
+
+// STmin as sent on the wire to timer ticks; reserved values mean the longest gap (127ms)
+static uint32_t can_isotp_stmin(uint8_t st)
+{
+	if (st <= 0x7F)
+		return CAN_TIMER_MS(st);
+	if (st >= 0xF1 && st <= 0xF9)
+		return CAN_TIMER_US((uint16_t)(st - 0xF0) * 100);
+	return CAN_TIMER_MS(0x7F);
+}
+
+/* Start sending len bytes from buf; buf must stay untouched until can_isotp_poll() reports DONE or ERROR.
+ * Returns 0, or -1 if a send is already in progress or len is out of range.
+ */
+int can_isotp_send(struct can_isotp *l, const uint8_t *buf, uint16_t len)
+{
+	if (l->tx_state != ISOTP_TX_IDLE || !len || len > 4095)
+		return -1;
+	l->tx_buf = buf;
+	l->tx_len = len;
+	l->tx_pos = 0;
+	l->tx_state = ISOTP_TX_FIRST;
+	can_isotp_poll(l);
+	return 0;
+}
+
+/* Hand every received frame to this; returns 1 if it belonged to the link, 0 if not */
+int can_isotp_input(struct can_isotp *l, uint32_t msgid, uint8_t is_ext, const uint8_t *data, int len)
+{
+	uint16_t n;
+
+	if (msgid != l->rx_id || !is_ext != !l->is_ext || len < 1)
+		return 0;
+
+	switch (data[0] & 0xF0) {
+		case ISOTP_PCI_SF:
+			n = data[0] & 0x0F;
+			if (!n || n > 7 || n > len-1 || l->rx_state == ISOTP_RX_DONE)
+				break;  // Malformed, or the last message hasn't been collected yet
+			if (n > l->rx_size) {
+				l->rx_state = ISOTP_RX_ERROR;
+				break;
+			}
+			memcpy(l->rx_buf, data+1, n);
+			l->rx_len = n;
+			l->rx_state = ISOTP_RX_DONE;
+			break;
+
+		case ISOTP_PCI_FF:
+			n = ((uint16_t)(data[0] & 0x0F) << 8) | data[1];
+			if (len < 8 || n < 8)
+				break;
+			if (n > l->rx_size || l->rx_state == ISOTP_RX_DONE) {
+				can_isotp_fc(l, ISOTP_FS_OVFLW);
+				break;
+			}
+			memcpy(l->rx_buf, data+2, 6);
+			l->rx_len = n;
+			l->rx_pos = 6;
+			l->rx_seq = 1;
+			l->rx_bs_left = CAN_ISOTP_BS;
+			l->rx_state = ISOTP_RX_CF;
+			l->rx_deadline = can_timer_now() + CAN_TIMER_MS(CAN_ISOTP_TIMEOUT_MS);
+			can_isotp_fc(l, ISOTP_FS_CTS);
+			break;
+
+		case ISOTP_PCI_CF:
+			if (l->rx_state != ISOTP_RX_CF)
+				break;
+			n = l->rx_len - l->rx_pos;
+			if (n > 7)
+				n = 7;
+			if ( (data[0] & 0x0F) != l->rx_seq || len-1 < n ) {
+				l->rx_state = ISOTP_RX_ERROR;  // Lost a frame
+				break;
+			}
+			memcpy(l->rx_buf + l->rx_pos, data+1, n);
+			l->rx_pos += n;
+			l->rx_seq = (l->rx_seq + 1) & 0x0F;
+			l->rx_deadline = can_timer_now() + CAN_TIMER_MS(CAN_ISOTP_TIMEOUT_MS);
+			if (l->rx_pos >= l->rx_len) {
+				l->rx_state = ISOTP_RX_DONE;
+			} else if (CAN_ISOTP_BS && !--l->rx_bs_left) {
+				l->rx_bs_left = CAN_ISOTP_BS;
+				can_isotp_fc(l, ISOTP_FS_CTS);
+			}
+			break;
+
+		case ISOTP_PCI_FC:
+			if (l->tx_state != ISOTP_TX_WAIT_FC || len < 3)
+				break;
+			switch (data[0] & 0x0F) {
+				case ISOTP_FS_CTS:
+					l->tx_bs = l->tx_bs_left = data[1];
+					l->tx_gap = can_isotp_stmin(data[2]);
+					l->tx_next = can_timer_now();
+					l->tx_state = ISOTP_TX_CF;
+					can_isotp_poll(l);
+					break;
+				case ISOTP_FS_WAIT:
+					l->tx_deadline = can_timer_now() + CAN_TIMER_MS(CAN_ISOTP_TIMEOUT_MS);
+					break;
+				default:
+					l->tx_state = ISOTP_TX_ERROR;  // Overflow; the receiver can't take it
+			}
+			break;
+
+		default:
+			return 0;
+	}
+	return 1;
+}
+
+/* can_isotp_input() on a frame as it came from can_recv_frame() or can_recv_peek() */
+int can_isotp_input_frame(struct can_isotp *l, const can_frame_t *f)
+{
+	return can_isotp_input(l, can_frame_id(f), can_frame_is_ext(f), f->data, can_frame_len(f));
+}
+
+/* Move the transmit side along as far as TX buffers (or the TX queue) and STmin allow, retry a pending flow
+ * control frame and check timeouts.  Run it from the main loop whenever the link may have work to do; a
+ * nonzero STmin arms can_timer_alarm() so an LPM sleep gets woken for the next frame.
+ */
+int can_isotp_poll(struct can_isotp *l)
+{
+	can_frame_t f;
+	uint8_t *frame = f.data;
+	uint8_t n;
+
+	if (l->rx_fc)
+		can_isotp_fc(l, l->rx_fc & 0x0F);
+	if (l->rx_state == ISOTP_RX_CF && can_timer_expired(l->rx_deadline))
+		l->rx_state = ISOTP_RX_ERROR;
+
+	switch (l->tx_state) {
+		case ISOTP_TX_FIRST:
+			if (l->tx_len <= 7) {
+				frame[0] = ISOTP_PCI_SF | l->tx_len;
+				memcpy(frame+1, l->tx_buf, l->tx_len);
+				if (can_isotp_frame(l, &f, 1 + l->tx_len) >= 0)
+					l->tx_state = ISOTP_TX_DONE;
+			} else {
+				frame[0] = ISOTP_PCI_FF | (l->tx_len >> 8);
+				frame[1] = (uint8_t)l->tx_len;
+				memcpy(frame+2, l->tx_buf, 6);
+				if (can_isotp_frame(l, &f, 8) >= 0) {
+					l->tx_pos = 6;
+					l->tx_seq = 1;
+					l->tx_deadline = can_timer_now() + CAN_TIMER_MS(CAN_ISOTP_TIMEOUT_MS);
+					l->tx_state = ISOTP_TX_WAIT_FC;
+				}
+			}
+			break;
+
+		case ISOTP_TX_WAIT_FC:
+			if (can_timer_expired(l->tx_deadline))
+				l->tx_state = ISOTP_TX_ERROR;
+			break;
+
+		case ISOTP_TX_CF:
+			while (l->tx_state == ISOTP_TX_CF) {
+				if (l->tx_gap && !can_timer_expired(l->tx_next)) {
+					can_timer_alarm(l->tx_next);
+					break;
+				}
+				n = (l->tx_len - l->tx_pos > 7) ? 7 : l->tx_len - l->tx_pos;
+				frame[0] = ISOTP_PCI_CF | l->tx_seq;
+				memcpy(frame+1, l->tx_buf + l->tx_pos, n);
+				if (can_isotp_frame(l, &f, 1+n) < 0)
+					break;  // Come back once a TX buffer frees up
+				l->tx_pos += n;
+				l->tx_seq = (l->tx_seq + 1) & 0x0F;
+				l->tx_next = can_timer_now() + l->tx_gap;
+				if (l->tx_pos >= l->tx_len) {
+					l->tx_state = ISOTP_TX_DONE;
+				} else if (l->tx_bs && !--l->tx_bs_left) {
+					l->tx_deadline = can_timer_now() + CAN_TIMER_MS(CAN_ISOTP_TIMEOUT_MS);
+					l->tx_state = ISOTP_TX_WAIT_FC;
+				}
+			}
+			break;
+
+		case ISOTP_TX_DONE:
+			l->tx_state = ISOTP_TX_IDLE;
+			return CAN_ISOTP_DONE;
+
+		case ISOTP_TX_ERROR:
+			l->tx_state = ISOTP_TX_IDLE;
+			return CAN_ISOTP_ERROR;
+	}
+	return (l->tx_state == ISOTP_TX_IDLE) ? CAN_ISOTP_IDLE : CAN_ISOTP_BUSY;
+}
+
+/* Length of a completely received message, now in the rx buffer; 0 if none yet, -1 (once) if a reception
+ * failed.  Collecting a message lets the link accept the next one; the buffer stays intact until it starts.
+ */
+int can_isotp_recv(struct can_isotp *l)
+{
+	if (l->rx_state == ISOTP_RX_DONE) {
+		l->rx_state = ISOTP_RX_IDLE;
+		return l->rx_len;
+	}
+	if (l->rx_state == ISOTP_RX_ERROR) {
+		l->rx_state = ISOTP_RX_IDLE;
+		return -1;
+	}
+	return 0;
+}
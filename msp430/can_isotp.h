@@ -0,0 +1,52 @@
+/* can_isotp.h
+ * ISO 15765-2 (ISO-TP) transport on top of can_send()/can_recv(): single, first, consecutive and
+ * flow-control frames with block size & STmin, classic CAN, up to 4095 bytes per message.
+ * Messages are sent straight out of the caller's buffer and reassembled straight into another one;
+ * nothing blocks, the main loop feeds received frames to can_isotp_input() and runs can_isotp_poll().
+ * Needs can_timer.c for STmin and the N_Bs/N_Cr timeouts.
+ */
+#ifndef CAN_ISOTP_H
+#define CAN_ISOTP_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/* User configuration */
+#define CAN_ISOTP_BS 0              // Block size we ask senders for (0 = one flow control per message)
+#define CAN_ISOTP_STMIN 0           // Separation time we ask senders for; ms 0-127, or 0xF1-0xF9 for 100-900us
+#define CAN_ISOTP_TIMEOUT_MS 1000   // How long to wait for a flow control frame or the next consecutive frame
+#define CAN_ISOTP_PRIO 2            // TX buffer priority for everything we send
+#define CAN_ISOTP_PAD 0xCC          // Pad frames out to 8 bytes with this; comment out to send short frames
+
+/* can_isotp_poll() return values */
+#define CAN_ISOTP_IDLE 0
+#define CAN_ISOTP_BUSY 1
+#define CAN_ISOTP_DONE 2    // Reported once, then back to IDLE
+#define CAN_ISOTP_ERROR -1  // Timeout or receiver overflow; reported once, then back to IDLE
+
+/* One point-to-point link: we send on tx_id and listen on rx_id */
+struct can_isotp {
+	uint32_t tx_id, rx_id;
+	uint8_t is_ext;
+	can_dev_t *dev;  // Controller the link sends on; can_isotp_init() sets can_dev0
+
+	const uint8_t *tx_buf;
+	uint16_t tx_len, tx_pos;
+	uint8_t tx_state, tx_seq, tx_bs, tx_bs_left;
+	uint32_t tx_gap, tx_next, tx_deadline;
+
+	uint8_t *rx_buf;
+	uint16_t rx_size, rx_len, rx_pos;
+	uint8_t rx_state, rx_seq, rx_bs_left, rx_fc;
+	uint32_t rx_deadline;
+};
+
+/* Function prototypes */
+void can_isotp_init(struct can_isotp *, uint32_t, uint32_t, uint8_t, uint8_t *, uint16_t);
+int can_isotp_send(struct can_isotp *, const uint8_t *, uint16_t);
+int can_isotp_input(struct can_isotp *, uint32_t, uint8_t, const uint8_t *, int);
+int can_isotp_input_frame(struct can_isotp *, const can_frame_t *);
+int can_isotp_poll(struct can_isotp *);
+int can_isotp_recv(struct can_isotp *);
+
+#endif
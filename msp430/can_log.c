@@ -0,0 +1,337 @@
+/* can_log.c
+ * Binary bus logger; see can_log.h for the record format
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "msp430_spi.h"
+#include "can_timer.h"
+#include "can_log.h"
+
+#ifndef MCP2515_RX_RING_SIZE
+#error "can_log.c needs MCP2515_RX_RING_SIZE"
+#endif
+#if CAN_LOG_BUF_SIZE < 32 || CAN_LOG_BUF_SIZE > 32768
+#error "CAN_LOG_BUF_SIZE must be from 32 to 32768"
+#endif
+
+#define CAN_LOG_DELTA_MAX 0x00FFFFFFUL
+#define CAN_LOG_SYNC_LEN 7
+#define CAN_LOG_LOST_LEN 3
+
+static uint8_t *can_log_put32(uint8_t *p, uint32_t v)
+{
+	*p++ = v;
+	*p++ = v >> 8;
+	*p++ = v >> 16;
+	*p++ = v >> 24;
+	return p;
+}
+
+/* Encode f at out with delta ticks (below 2^24) since the last record.
+ * Returns the record's length, CAN_LOG_RECORD_MAX at most.
+ */
+uint8_t can_log_record(uint8_t *out, const can_frame_t *f, uint32_t delta)
+{
+	uint8_t *p = out + 1, ext = can_frame_is_ext(f), len, ds;
+	uint32_t id = can_parse_msgid(&f->sidh);
+
+	len = f->dlc & 0x0F;
+	ds = delta > 0xFFFF ? 2 : delta > 0xFF ? 1 : 0;
+	out[0] = len | (ds << 4);
+	if (ext)
+		out[0] |= 0x80;
+	if (ext ? (f->dlc & 0x40) : (f->sidl & 0x10)) {
+		out[0] |= 0x40;  // RTR; the DLC is kept but no data is sent
+		len = 0;
+	}
+	if (len > 8)
+		len = 8;
+
+	*p++ = delta;
+	if (ds) {
+		*p++ = delta >> 8;
+		if (ds > 1)
+			*p++ = delta >> 16;
+	}
+	if (ext) {
+		p = can_log_put32(p, id);
+	} else {
+		*p++ = id;
+		*p++ = id >> 8;
+	}
+	memcpy(p, f->data, len);
+	return p + len - out;
+}
+
+static void can_log_sync(struct can_log *l, uint32_t now)
+{
+	uint8_t *p = l->buf[l->fill] + l->len;
+
+	*p++ = CAN_LOG_SYNC;
+	*p++ = 'C';
+	*p++ = 'L';
+	can_log_put32(p, now);
+	l->len += CAN_LOG_SYNC_LEN;
+	l->last = now;
+}
+
+static void can_log_lost(struct can_log *l)
+{
+	uint8_t *p = l->buf[l->fill] + l->len;
+
+	*p++ = CAN_LOG_LOST;
+	*p++ = l->lost;
+	*p = l->lost >> 8;
+	l->len += CAN_LOG_LOST_LEN;
+	l->lost = 0;
+}
+
+/* Hand buf[fill] to the output and carry on in the other buffer, which starts with a SYNC.
+ * Returns 0 if the other buffer is still with the output.
+ */
+static int can_log_swap(struct can_log *l)
+{
+	uint8_t n = l->fill;
+	uint16_t len = l->len;
+
+	if (l->busy)
+		return 0;
+	l->busy = 1;
+	l->fill ^= 1;
+	l->len = 0;
+	l->bytes += len;
+	l->out(l, l->buf[n], len);  // May call can_log_done() before it returns
+	return 1;
+}
+
+/* Start logging dev's RX ring to out; out_arg is left in the struct for out's use.
+ * min_len is the least a buffer is handed over with: 1 to stream, CAN_LOG_BUF_SIZE for whole flash pages.
+ */
+void can_log_start(struct can_log *l, can_dev_t *dev, can_log_out_t out, void *out_arg, uint16_t min_len)
+{
+	uint8_t *p;
+
+	memset(l, 0, sizeof(struct can_log));
+	l->dev = dev;
+	l->out = out;
+	l->out_arg = out_arg;
+	l->min_len = min_len ? min_len : 1;
+
+	p = l->buf[0];
+	*p++ = CAN_LOG_START;
+	*p++ = 'C';
+	*p++ = 'L';
+	*p++ = CAN_LOG_VERSION;
+	p = can_log_put32(p, CAN_TIMER_HZ);
+	*p++ = CAN_LOG_BUF_SIZE & 0xFF;
+	*p++ = CAN_LOG_BUF_SIZE >> 8;
+	l->len = p - l->buf[0];
+	can_log_sync(l, can_timer_now());
+}
+
+/* Log every frame waiting in the RX ring, then hand the buffer over if the output is idle and it has min_len in it.
+ * A frame that fits in neither buffer is dropped and counted, and a CAN_LOG_LOST record says so once there's room.
+ * Returns the number of frames logged.
+ */
+int can_log_poll(struct can_log *l)
+{
+	can_frame_t *f;
+	uint8_t rec[CAN_LOG_RECORD_MAX], n, sync;
+	uint32_t now;
+	int count = 0;
+
+	while ( (f = can_recv_peek_dev(l->dev)) ) {
+		#ifdef MCP2515_RX_TIMESTAMP
+		now = can_recv_stamp_dev(l->dev);
+		#else
+		now = can_timer_now();
+		#endif
+		sync = !l->len || now - l->last > CAN_LOG_DELTA_MAX;
+		n = can_log_record(rec, f, sync ? 0 : now - l->last);
+		if (l->len + (sync ? CAN_LOG_SYNC_LEN : 0) + (l->lost ? CAN_LOG_LOST_LEN : 0) + n > CAN_LOG_BUF_SIZE) {
+			if (!can_log_swap(l)) {
+				if (l->lost != 0xFFFF)
+					l->lost++;
+				l->dropped++;
+				can_recv_drop_dev(l->dev);
+				continue;
+			}
+			sync = 1;
+			n = can_log_record(rec, f, 0);
+		}
+		if (sync)
+			can_log_sync(l, now);
+		if (l->lost)
+			can_log_lost(l);
+		memcpy(l->buf[l->fill] + l->len, rec, n);
+		l->len += n;
+		l->last = now;
+		l->frames++;
+		count++;
+		can_recv_drop_dev(l->dev);
+	}
+
+	if (l->len >= l->min_len)
+		can_log_swap(l);
+	return count;
+}
+
+/* Hand over whatever is in the buffer now, regardless of min_len, e.g. before powering down.
+ * Returns 1 if it went, 0 if there was nothing or the output is still busy with the other buffer.
+ */
+int can_log_flush(struct can_log *l)
+{
+	if (l->busy)
+		return 0;
+	if (l->lost && l->len + CAN_LOG_LOST_LEN <= CAN_LOG_BUF_SIZE) {
+		if (!l->len)
+			can_log_sync(l, l->last);
+		can_log_lost(l);  // Frames dropped since the last one logged
+	}
+	if (!l->len)
+		return 0;
+	return can_log_swap(l);
+}
+
+// For the output, from an ISR if need be: the buffer it was last given can be filled again
+void can_log_done(struct can_log *l)
+{
+	l->busy = 0;
+}
+
+/* SPI NOR flash output */
+#define CAN_LOG_FLASH_WREN 0x06
+#define CAN_LOG_FLASH_PP 0x02
+#define CAN_LOG_FLASH_RDSR 0x05
+#define CAN_LOG_FLASH_BE64 0xD8
+#define CAN_LOG_FLASH_WIP 0x01
+#define CAN_LOG_FLASH_BLOCK 0x10000UL
+
+/* The flash shares the SPI bus with the MCP2515, and can_isr() does SPI I/O of its own, so it's held off for each
+ * flash transaction.  That goes by the controllers' port interrupts, as around the driver's own transactions, so
+ * everything else (a DMA completion included) still runs.
+ */
+static void can_log_flash_select(struct can_log_flash *fl)
+{
+	can_isr_hold();
+	*fl->cs_out &= ~fl->cs_bit;
+}
+
+static void can_log_flash_deselect(struct can_log_flash *fl)
+{
+	*fl->cs_out |= fl->cs_bit;
+	can_isr_release();
+}
+
+static void can_log_flash_cmd(struct can_log_flash *fl, uint8_t cmd, uint32_t addr, const uint8_t *data, uint16_t len)
+{
+	can_log_flash_select(fl);
+	spi_transfer(cmd);
+	if (cmd != CAN_LOG_FLASH_WREN) {
+		spi_transfer(addr >> 16);
+		spi_transfer16(addr);
+	}
+	if (len)
+		spi_write_block(data, len);
+	can_log_flash_deselect(fl);
+}
+
+static uint8_t can_log_flash_status(struct can_log_flash *fl)
+{
+	uint8_t s;
+
+	can_log_flash_select(fl);
+	spi_transfer(CAN_LOG_FLASH_RDSR);
+	s = spi_transfer(0xFF);
+	can_log_flash_deselect(fl);
+	return s;
+}
+
+/* Log to flash from start (a multiple of CAN_LOG_BUF_SIZE) up to end; CS on cs_out/cs_dir bit cs_bit.
+ * Pass fl as can_log_start()'s out_arg, with can_log_flash_out() as out.
+ */
+void can_log_flash_init(struct can_log_flash *fl, volatile uint8_t *cs_out, volatile uint8_t *cs_dir, uint8_t cs_bit,
+			uint32_t start, uint32_t end)
+{
+	memset(fl, 0, sizeof(struct can_log_flash));
+	fl->cs_out = cs_out;
+	fl->cs_dir = cs_dir;
+	fl->cs_bit = cs_bit;
+	fl->addr = start;
+	fl->end = end;
+	*cs_out |= cs_bit;
+	*cs_dir |= cs_bit;
+}
+
+/* Erase the log area a 64KB block at a time, waiting for each; start should be block aligned.
+ * Takes around a second per block, so do it before can_log_start().
+ */
+void can_log_flash_erase(struct can_log_flash *fl)
+{
+	uint32_t a;
+
+	for (a = fl->addr & ~(CAN_LOG_FLASH_BLOCK - 1); a < fl->end; a += CAN_LOG_FLASH_BLOCK) {
+		can_log_flash_cmd(fl, CAN_LOG_FLASH_WREN, 0, 0, 0);
+		can_log_flash_cmd(fl, CAN_LOG_FLASH_BE64, a, 0, 0);
+		while (can_log_flash_status(fl) & CAN_LOG_FLASH_WIP)
+			;
+	}
+}
+
+/* Program the next CAN_LOG_FLASH_BURST bytes of the page in progress.  Each burst is a page program of its own
+ * (WREN, PP), the bus only held for a few dozen bytes at a time, so can_isr() keeps up with a full bus between them.
+ */
+static void can_log_flash_burst(struct can_log_flash *fl)
+{
+	uint16_t n = fl->left > CAN_LOG_FLASH_BURST ? CAN_LOG_FLASH_BURST : fl->left;
+
+	can_log_flash_cmd(fl, CAN_LOG_FLASH_WREN, 0, 0, 0);
+	can_log_flash_cmd(fl, CAN_LOG_FLASH_PP, fl->pp, fl->buf, n);
+	fl->buf += n;
+	fl->pp += n;
+	fl->left -= n;
+}
+
+/* can_log_out_t: program one page, the first burst of it right away.  A short buffer (from can_log_flush()) leaves
+ * the rest of its page erased, which reads back as CAN_LOG_PAD, so every buffer still starts on a CAN_LOG_BUF_SIZE
+ * boundary.
+ */
+void can_log_flash_out(struct can_log *l, const uint8_t *buf, uint16_t len)
+{
+	struct can_log_flash *fl = l->out_arg;
+
+	fl->log = l;
+	if (fl->full || fl->addr + CAN_LOG_BUF_SIZE > fl->end) {
+		fl->full = 1;
+		can_log_done(l);
+		return;
+	}
+	fl->buf = buf;
+	fl->left = len;
+	fl->pp = fl->addr;
+	fl->addr += CAN_LOG_BUF_SIZE;
+	fl->programming = 1;
+	if (len)
+		can_log_flash_burst(fl);
+}
+
+/* Call from the main loop: once a burst has finished, start the next, and once the page is done give its buffer
+ * back to the logger.  Returns 1 while one is still in progress.
+ */
+int can_log_flash_poll(struct can_log_flash *fl)
+{
+	if (!fl->programming)
+		return 0;
+	if (can_log_flash_status(fl) & CAN_LOG_FLASH_WIP)
+		return 1;
+	if (fl->left) {
+		can_log_flash_burst(fl);
+		return 1;
+	}
+	fl->programming = 0;
+	can_log_done(fl->log);
+	return 0;
+}
@@ -0,0 +1,93 @@
+/* can_log.h
+ * Binary bus logger: takes frames from the RX ring and packs them into compact records in one of two buffers, handing
+ * each buffer to an output (UART DMA, SPI NOR flash, ...) while the other one fills, so the log keeps up with a full
+ * bus as long as the output does on average.  Needs MCP2515_RX_RING_SIZE and can_timer.c; with MCP2515_RX_TIMESTAMP
+ * the records carry the driver's receive stamps, otherwise the time can_log_poll() got to each frame.
+ * examples/logger/can_log_decode.py turns a log back into candump or Vector ASC text.
+ *
+ * Record format, little-endian throughout.  The first byte is a header:
+ *   bit 7 EXT, bit 6 RTR, bits 5-4 stamp size (0-2: 1-3 bytes of delta follow, 3: a special record), bits 3-0 DLC
+ * then the delta from the previous record's time in can_timer ticks, the ID (2 bytes standard, 4 extended) and
+ * min(DLC, 8) data bytes (none for an RTR).  A standard 8-byte frame usually takes 12 or 13 bytes.
+ * Special records, header 0x30 | type:
+ *   CAN_LOG_START  'C' 'L' version, tick rate (4 bytes, Hz), buffer size (2): once, at can_log_start()
+ *   CAN_LOG_SYNC   'C' 'L' absolute time (4 bytes): first in every buffer, or when a delta won't fit in 3 bytes
+ *   CAN_LOG_LOST   frames dropped because both buffers were full (2 bytes)
+ *   0xFF           padding to the end of the buffer (erased flash)
+ * Records never straddle buffers, so every buffer decodes on its own from its SYNC; a reader that joins a UART
+ * stream late, or loses a buffer, picks up again at the next 0x31 'C' 'L'.
+ */
+#ifndef CAN_LOG_H
+#define CAN_LOG_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/* User configuration */
+#ifndef CAN_LOG_BUF_SIZE
+#define CAN_LOG_BUF_SIZE 256  // Bytes per buffer, two of them; one SPI NOR page
+#endif
+#ifndef CAN_LOG_FLASH_BURST
+#define CAN_LOG_FLASH_BURST 32  // Bytes per flash page program command; can_isr() is held off for each one
+#endif
+
+#define CAN_LOG_VERSION 1
+#define CAN_LOG_START 0x30
+#define CAN_LOG_SYNC 0x31
+#define CAN_LOG_LOST 0x32
+#define CAN_LOG_PAD 0xFF
+#define CAN_LOG_RECORD_MAX 17  // Header, 3-byte delta, extended ID and 8 data bytes
+
+struct can_log;
+
+/* Start writing out len bytes at buf; call can_log_done() (from an ISR if need be) once buf may be reused */
+typedef void (*can_log_out_t)(struct can_log *, const uint8_t *, uint16_t);
+
+struct can_log {
+	can_dev_t *dev;
+	can_log_out_t out;
+	void *out_arg;              // For the output's own use
+	uint16_t min_len;           // Don't hand a buffer over with less than this in it (1: as soon as the output is idle)
+
+	uint8_t buf[2][CAN_LOG_BUF_SIZE];
+	uint16_t len;               // Bytes in buf[fill]
+	uint8_t fill;               // Buffer records are going into
+	volatile uint8_t busy;      // The other buffer is with the output
+	uint32_t last;              // Time of the last record
+	uint16_t lost;              // Frames dropped and not yet reported in a CAN_LOG_LOST record
+
+	uint32_t frames;            // Frames logged since can_log_start()
+	uint32_t dropped;           // ... and dropped
+	uint32_t bytes;             // Bytes handed to the output
+};
+
+/* Function prototypes */
+void can_log_start(struct can_log *, can_dev_t *, can_log_out_t, void *, uint16_t);
+int can_log_poll(struct can_log *);
+int can_log_flush(struct can_log *);
+void can_log_done(struct can_log *);
+uint8_t can_log_record(uint8_t *, const can_frame_t *, uint32_t);
+
+/* SPI NOR flash output (25-series: WREN 0x06, PP 0x02, RDSR 0x05, 64KB block erase 0xD8, 3-byte addresses) on the
+ * MCP2515's SPI bus with its own CS pin.  Pages go out whole from can_log_poll() (set min_len to
+ * CAN_LOG_BUF_SIZE, which must divide the page size), programmed CAN_LOG_FLASH_BURST bytes at a time so can_isr()
+ * gets the bus back between bursts; can_log_flash_poll() issues the rest and finishes each page off.
+ */
+struct can_log_flash {
+	struct can_log *log;
+	volatile uint8_t *cs_out, *cs_dir;
+	uint8_t cs_bit;
+	uint32_t addr, end;         // Next page to program, end of the log area
+	const uint8_t *buf;         // Rest of the page in progress
+	uint16_t left;              // ... its length
+	uint32_t pp;                // ... and where it goes
+	uint8_t programming;        // A page program is in progress
+	uint8_t full;               // Reached end; everything since is dropped
+};
+
+void can_log_flash_init(struct can_log_flash *, volatile uint8_t *, volatile uint8_t *, uint8_t, uint32_t, uint32_t);
+void can_log_flash_erase(struct can_log_flash *);
+void can_log_flash_out(struct can_log *, const uint8_t *, uint16_t);
+int can_log_flash_poll(struct can_log_flash *);
+
+#endif
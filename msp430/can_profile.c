@@ -0,0 +1,152 @@
+/* can_profile.c
+ * Listen-only bus profiler; see can_profile.h
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_profile.h"
+
+#ifndef MCP2515_RX_RING_SIZE
+#error "can_profile.c needs MCP2515_RX_RING_SIZE"
+#endif
+#if defined(MCP2515_STD_ONLY) || defined(MCP2515_EXT_ONLY) || defined(MCP2515_NO_ROLLOVER)
+#error "can_profile.c takes both kinds of ID with RXB0 rolling over; not for MCP2515_STD_ONLY, _EXT_ONLY or _NO_ROLLOVER builds"
+#endif
+#if CAN_PROFILE_IDS & (CAN_PROFILE_IDS - 1) || CAN_PROFILE_IDS > 128
+#error "CAN_PROFILE_IDS must be a power of 2 no larger than 128"
+#endif
+
+/* Frame lengths without stuff bits: SOF, arbitration, control, data, CRC, ACK and EOF fields plus the 3-bit
+ * intermission.  Stuffing applies to the first CAN_PROFILE_STUFFABLE bits (SOF through CRC); at worst it adds one
+ * bit for every 4 after the first.
+ */
+#define CAN_PROFILE_BITS_STD 47
+#define CAN_PROFILE_BITS_EXT 67
+#define CAN_PROFILE_STUFFABLE_STD 34
+#define CAN_PROFILE_STUFFABLE_EXT 54
+
+/* Put dev in listen-only mode with both RXBs taking every frame (RXB0 rolling over into RXB1), and start counting.
+ * bitrate is what can_speed() was given; window_ms is the load averaging window.
+ * Returns 0, or -1 for a zero window or a bitrate under 1 kbit/s.
+ */
+int can_profile_start(struct can_profile *p, can_dev_t *dev, uint32_t bitrate, uint16_t window_ms)
+{
+	if (!window_ms || bitrate < 1000)
+		return -1;
+	memset(p, 0, sizeof(struct can_profile));
+	p->dev = dev;
+	p->bitrate = bitrate;
+	p->window = CAN_TIMER_MS(window_ms);
+
+	can_rx_mode_dev(dev, 0, MCP2515_RXB0CTRL_MODE_RECV_ALL);
+	can_rx_mode_dev(dev, 1, MCP2515_RXB1CTRL_MODE_RECV_ALL);
+	can_ioctl_dev(dev, MCP2515_OPTION_ROLLOVER, 1);
+	can_ioctl_dev(dev, MCP2515_OPTION_LISTEN_ONLY, 1);
+	p->start = can_timer_now();
+	return 0;
+}
+
+// Back to normal mode; the RX modes are left for the application to set up again
+void can_profile_stop(struct can_profile *p)
+{
+	can_ioctl_dev(p->dev, MCP2515_OPTION_LISTEN_ONLY, 0);
+}
+
+// Count one frame: its ID's slot (linear probing over a fold of the ID) and its share of the window's bits
+void can_profile_frame(struct can_profile *p, const can_frame_t *f)
+{
+	uint8_t ext = f->sidl & 0x08, len, n;
+	uint16_t stuffable, h;
+	uint32_t key;
+	struct can_profile_id *e;
+
+	len = f->dlc & 0x0F;
+	if (len > 8)
+		len = 8;
+	if (ext ? (f->dlc & 0x40) : (f->sidl & 0x10))
+		len = 0;  // RTR; the DLC is sent but no data
+	stuffable = (ext ? CAN_PROFILE_STUFFABLE_EXT : CAN_PROFILE_STUFFABLE_STD) + 8*len;
+	p->bits += (ext ? CAN_PROFILE_BITS_EXT : CAN_PROFILE_BITS_STD) + 8*len;
+	p->stuff += (stuffable - 1) >> 2;
+	p->frames++;
+
+	key = can_parse_msgid(&f->sidh);
+	if (ext)
+		key |= CAN_PROFILE_EXT;
+	h = (uint16_t)key ^ (uint16_t)(key >> 16);
+	h = (h ^ (h >> 5)) & (CAN_PROFILE_IDS - 1);
+	for (n=CAN_PROFILE_IDS; n; n--, h=(h+1) & (CAN_PROFILE_IDS - 1)) {
+		e = &p->ids[h];
+		if (!e->count) {
+			e->key = key;
+			e->count = 1;
+			p->n_ids++;
+			return;
+		}
+		if (e->key == key) {
+			e->count++;
+			return;
+		}
+	}
+	p->untracked++;
+}
+
+/* Count every frame waiting in the ring, and close the load window once it's over.
+ * Returns 1 when load, load_max and load_peak have just been updated, else 0.
+ */
+int can_profile_poll(struct can_profile *p)
+{
+	can_frame_t *f;
+	uint32_t now, ms;
+	uint64_t cap, load;
+
+	while ( (f = can_recv_peek_dev(p->dev)) ) {
+		can_profile_frame(p, f);
+		can_recv_drop_dev(p->dev);
+	}
+
+	now = can_timer_now();
+	if (now - p->start < p->window)
+		return 0;
+	/* 64-bit: bits * 1000 passes 2^32 after ~4.3 Mbit, a few seconds of a busy bus or a window overrun by a
+	 * main loop that fell behind.  Once per window, so the libgcc division doesn't matter.
+	 */
+	ms = (now - p->start) / (CAN_TIMER_HZ / 1000);  // As it actually ran, a little over the window
+	cap = (uint64_t)p->bitrate * ms / 1000;         // Bit times that went by
+	if (!cap)
+		cap = 1;
+	load = (uint64_t)p->bits * 1000 / cap;
+	p->load = load > 1000 ? 1000 : load;
+	load = ((uint64_t)p->bits + p->stuff) * 1000 / cap;
+	p->load_max = load > 1000 ? 1000 : load;  // Worst-case stuffing can't all have happened on a full bus
+	if (p->load_max > p->load_peak)
+		p->load_peak = p->load_max;
+	p->bits = 0;
+	p->stuff = 0;
+	p->start = now;
+	return 1;
+}
+
+/* Copy the n busiest IDs to out, busiest first.  Returns how many were copied (fewer if fewer IDs were seen). */
+uint8_t can_profile_top(const struct can_profile *p, struct can_profile_id *out, uint8_t n)
+{
+	uint8_t i, j, got = 0;
+	const struct can_profile_id *e;
+
+	if (!n)
+		return 0;
+	for (i=0; i < CAN_PROFILE_IDS; i++) {
+		e = &p->ids[i];
+		if (!e->count || (got == n && e->count <= out[n-1].count))
+			continue;
+		if (got < n)
+			got++;
+		for (j=got-1; j > 0 && out[j-1].count < e->count; j--)
+			out[j] = out[j-1];
+		out[j] = *e;
+	}
+	return got;
+}
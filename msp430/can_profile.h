@@ -0,0 +1,45 @@
+/* can_profile.h
+ * Bus profiler: puts a controller in listen-only, receive-everything mode, counts frames per ID in a small hash
+ * table and estimates bus load over fixed windows from each frame's length.  Frames come from the RX ring, which
+ * can_isr() fills as they arrive, so counting keeps up with a fully loaded bus as long as can_profile_poll() is run
+ * often enough for the ring not to fill.  Needs MCP2515_RX_RING_SIZE and can_timer.c.
+ */
+#ifndef CAN_PROFILE_H
+#define CAN_PROFILE_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/* User configuration */
+#ifndef CAN_PROFILE_IDS
+#define CAN_PROFILE_IDS 64  // Distinct IDs tracked (a power of 2, up to 128); 8 bytes each
+#endif
+
+#define CAN_PROFILE_EXT 0x80000000UL  // Set in can_profile_id.key for 29-bit extended IDs
+
+struct can_profile_id {
+	uint32_t key;               // ID | CAN_PROFILE_EXT
+	uint32_t count;             // Frames seen, 0 for an unused slot
+};
+
+struct can_profile {
+	can_dev_t *dev;
+	struct can_profile_id ids[CAN_PROFILE_IDS];
+	uint8_t n_ids;
+	uint32_t frames;            // Frames seen since can_profile_start()
+	uint32_t untracked;         // ... of those, with IDs that didn't fit in ids[]
+
+	uint32_t bitrate, window, start;  // Window length and start in can_timer ticks
+	uint32_t bits, stuff;       // This window so far: bits on the wire (up to and including IFS), worst-case stuff bits
+	uint16_t load, load_max;    // Last complete window, in 0.1%: without stuff bits, with worst-case stuffing
+	uint16_t load_peak;         // Highest load_max since can_profile_start()
+};
+
+/* Function prototypes */
+int can_profile_start(struct can_profile *, can_dev_t *, uint32_t, uint16_t);
+void can_profile_stop(struct can_profile *);
+void can_profile_frame(struct can_profile *, const can_frame_t *);
+int can_profile_poll(struct can_profile *);
+uint8_t can_profile_top(const struct can_profile *, struct can_profile_id *, uint8_t);
+
+#endif
@@ -0,0 +1,178 @@
+/* can_sched.c
+ * Periodic frame scheduler on Timer0_A CCR0; see can_sched.h
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_sched.h"
+
+#if defined(CAN_TIMER_CAPTURE) && CAN_TIMER_CAPTURE == 0
+#error "can_sched.c needs CCR0 of Timer0_A; set CAN_TIMER_CAPTURE to 2"
+#endif
+
+// Sorted by next deadline, soonest first
+static struct can_sched *can_sched_q[CAN_SCHED_MAX];
+static uint8_t can_sched_n;
+
+static void can_sched_miss(struct can_sched *s)
+{
+	s->missed++;
+	#ifdef MCP2515_STATS
+	s->dev->stats.sched_miss++;
+	#endif
+}
+
+/* Move entry i back past the ones due no later than it, after its deadline moved out; equal deadlines take
+ * turns that way.
+ */
+static void can_sched_sort(uint8_t i)
+{
+	struct can_sched *s = can_sched_q[i];
+
+	for (; i+1 < can_sched_n && (int32_t)(can_sched_q[i+1]->next - s->next) <= 0; i++)
+		can_sched_q[i] = can_sched_q[i+1];
+	can_sched_q[i] = s;
+}
+
+/* Point CCR0 at the head's deadline, or a hop of 0x4000 ticks towards it when that's over half a 16-bit period
+ * out, so the slip test below stays unambiguous.  Interrupts must be off.
+ */
+static void can_sched_arm()
+{
+	uint32_t now, d;
+
+	if (!can_sched_n) {
+		TA0CCTL0 = 0;
+		return;
+	}
+	now = can_timer_now();
+	d = can_sched_q[0]->next - now;
+	if ((int32_t)d <= 0) {
+		TA0CCTL0 = CCIE | CCIFG;  // Already due
+		return;
+	}
+	TA0CCR0 = d < 0x8000UL ? (uint16_t)can_sched_q[0]->next : (uint16_t)now + 0x4000;
+	TA0CCTL0 = CCIE;
+	if ((int16_t)(TA0R - TA0CCR0) >= 0)  // Slipped past while loading CCR0
+		TA0CCTL0 |= CCIFG;
+}
+
+// Run after can_timer_init()
+void can_sched_init()
+{
+	TA0CCTL0 = 0;
+	can_sched_n = 0;
+}
+
+/* Send s every period ticks (under 2^31), the first time at can_timer_now() time first.  Frames sharing a period
+ * can be spread over it by giving them first = t0, t0 + period/4 and so on.
+ * Returns 0, or -1 if the table is full, s is already in it, or its hot slot isn't available in this build.
+ */
+int can_sched_add(struct can_sched *s, uint32_t period, uint32_t first)
+{
+	uint8_t i;
+	uint16_t sr;
+
+	if (!period || period >= 0x80000000UL || (s->frame.dlc & 0x0F) > 8)
+		return -1;
+	#ifndef MCP2515_TX_HOT
+	if (s->hot != CAN_SCHED_QUEUE)
+		return -1;
+	#endif
+	s->period = period;
+	s->next = first;
+	s->due = 0;
+	s->missed = 0;
+
+	sr = __get_SR_register() & GIE;
+	_DINT();
+	for (i=0; i < can_sched_n; i++) {
+		if (can_sched_q[i] == s)
+			break;
+	}
+	if (i < can_sched_n || can_sched_n == CAN_SCHED_MAX) {
+		__bis_SR_register(sr);
+		return -1;
+	}
+	for (i=can_sched_n++; i > 0 && (int32_t)(can_sched_q[i-1]->next - first) > 0; i--)
+		can_sched_q[i] = can_sched_q[i-1];
+	can_sched_q[i] = s;
+	can_sched_arm();
+	__bis_SR_register(sr);
+	return 0;
+}
+
+// Take s out of the table; one already marked due isn't sent.  Returns -1 if it wasn't in it.
+int can_sched_remove(struct can_sched *s)
+{
+	uint8_t i;
+	uint16_t sr;
+	int ret = -1;
+
+	sr = __get_SR_register() & GIE;
+	_DINT();
+	for (i=0; i < can_sched_n; i++) {
+		if (can_sched_q[i] == s) {
+			for (can_sched_n--; i < can_sched_n; i++)
+				can_sched_q[i] = can_sched_q[i+1];
+			s->due = 0;
+			can_sched_arm();
+			ret = 0;
+			break;
+		}
+	}
+	__bis_SR_register(sr);
+	return ret;
+}
+
+/* Send every frame on dev marked due.  Called by can_isr(), so it never lands in the middle of another SPI
+ * transaction; a send that fails (no TXB, queue full, hot slot still busy) counts as a miss.
+ */
+void can_sched_run(can_dev_t *dev)
+{
+	uint8_t i;
+	int ret;
+	struct can_sched *s;
+
+	for (i=0; i < can_sched_n; i++) {
+		s = can_sched_q[i];
+		if (s->dev != dev || !s->due)
+			continue;
+		s->due = 0;
+		#ifdef MCP2515_TX_HOT
+		if (s->hot != CAN_SCHED_QUEUE)
+			ret = can_hot_send_dev(dev, s->hot, s->frame.data, s->frame.dlc & 0x0F);
+		else
+		#endif
+		ret = can_send_frame_dev(dev, &s->frame, s->prio);
+		if (ret < 0)
+			can_sched_miss(s);
+	}
+}
+
+/* Mark every frame whose deadline has come due and advance it by a period.  Periods already gone by are skipped
+ * (and counted as misses) rather than sent back to back.  Setting the INT pin's PxIFG runs the port ISR, and
+ * with it can_isr(), as soon as this returns or, if the driver has it masked, once the SPI transaction ends.
+ */
+#pragma vector=TIMER0_A0_VECTOR
+__interrupt void can_sched_isr(void)
+{
+	uint32_t now = can_timer_now();
+	struct can_sched *s;
+
+	while (can_sched_n) {
+		s = can_sched_q[0];
+		if ((int32_t)(now - s->next) < 0)
+			break;
+		if (s->due)
+			can_sched_miss(s);  // Still waiting from last time
+		s->due = 1;
+		for (s->next += s->period; (int32_t)(now - s->next) >= 0; s->next += s->period)
+			can_sched_miss(s);
+		can_sched_sort(0);
+		*s->dev->irq_ifg |= s->dev->irq_bit;
+	}
+	can_sched_arm();
+}
@@ -0,0 +1,42 @@
+/* can_sched.h
+ * Periodic frame scheduler: a table of cyclic frames kept sorted by next deadline, timed by CCR0 of Timer0_A
+ * (on top of can_timer.c's free-running timebase).  Deadlines advance by whole periods from a common epoch,
+ * so frames don't drift no matter how late one is sent, and phase offsets within a period spread the bus load.
+ * The CCR0 interrupt only marks frames due and sets the controller's INT pin flag in PxIFG; the frames are then
+ * sent by can_isr(), which the driver keeps off the SPI bus in the middle of a transaction.
+ * Needs MCP2515_TX_SCHED and MCP2515_RX_RING_SIZE defined for the driver.
+ */
+#ifndef CAN_SCHED_H
+#define CAN_SCHED_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/* User configuration */
+#ifndef CAN_SCHED_MAX
+#define CAN_SCHED_MAX 8    // Frames in the table at once
+#endif
+
+#define CAN_SCHED_QUEUE 0xFF  // hot value: send with can_send_frame() (a free TXB, or the TX queue)
+
+/* One periodic frame.  Fill in dev, frame, prio and hot before can_sched_add(); frame.data may be changed in place
+ * afterwards, with interrupts off if a frame going out half-updated would matter.
+ */
+struct can_sched {
+	can_dev_t *dev;
+	can_frame_t frame;
+	uint8_t prio;
+	uint8_t hot;            // CAN_SCHED_QUEUE, or a TXB reserved with can_hot_reserve() (MCP2515_TX_HOT), sent with can_hot_send()
+	uint32_t period;        // can_timer ticks, e.g. CAN_TIMER_MS(10)
+	uint32_t next;          // Next deadline, can_timer_now() time
+	volatile uint8_t due;   // Marked due, not sent yet
+	uint16_t missed;        // Deadlines passed while still due, plus sends that failed
+};
+
+/* Function prototypes */
+void can_sched_init();
+int can_sched_add(struct can_sched *, uint32_t, uint32_t);
+int can_sched_remove(struct can_sched *);
+void can_sched_run(can_dev_t *);
+
+#endif
@@ -0,0 +1,134 @@
+/* can_timer.c
+ * Free-running 32-bit timebase on Timer0_A; see can_timer.h
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include "can_timer.h"
+
+#ifdef CAN_TIMER_CAPTURE
+#define CAN_TIMER_PASTE(reg, n) reg##n
+#define CAN_TIMER_REG(reg, n) CAN_TIMER_PASTE(reg, n)
+#define CAN_TIMER_CAP_CCTL CAN_TIMER_REG(TA0CCTL, CAN_TIMER_CAPTURE)
+#define CAN_TIMER_CAP_CCR CAN_TIMER_REG(TA0CCR, CAN_TIMER_CAPTURE)
+#endif
+
+volatile uint16_t can_timer_hi;
+volatile uint8_t can_timer_fired;
+uint32_t can_timer_when;
+volatile uint8_t can_timer_armed;
+
+void can_timer_init()
+{
+	can_timer_hi = 0;
+	can_timer_fired = 0;
+	can_timer_armed = 0;
+	TA0CCTL1 = 0;
+	#ifdef CAN_TIMER_CAPTURE
+	CAN_TIMER_CAP_CCTL = CAN_TIMER_CAPTURE_CM | CAN_TIMER_CAPTURE_CCIS | SCS | CAP;  // Polled by can_timer_stamp(), no interrupt
+	#endif
+	TA0CTL = TASSEL_2 | CAN_TIMER_ID | MC_2 | TACLR | TAIE;
+}
+
+uint32_t can_timer_now()
+{
+	uint16_t sr, hi, lo;
+
+	sr = __get_SR_register() & GIE;
+	_DINT();
+	hi = can_timer_hi;
+	lo = TA0R;
+	if ( (TA0CTL & TAIFG) && lo < 0x8000 )
+		hi++;  // Wrapped but the overflow ISR hasn't run yet (we're in an ISR or have interrupts off)
+	__bis_SR_register(sr);
+	return ((uint32_t)hi << 16) | lo;
+}
+
+/* Time a received frame gets stamped with: the last INT/SOF edge captured, if one came in since the previous call,
+ * otherwise now.  The capture is extended to 32 bits against now, so it has to be collected within one 16-bit
+ * period of the timer (32ms at 2MHz).
+ */
+uint32_t can_timer_stamp()
+{
+	#ifdef CAN_TIMER_CAPTURE
+	uint16_t cap;
+	uint32_t now;
+
+	if (CAN_TIMER_CAP_CCTL & CCIFG) {
+		cap = CAN_TIMER_CAP_CCR;
+		CAN_TIMER_CAP_CCTL &= ~(CCIFG | COV);
+		now = can_timer_now();  // Read after the capture so it can't be older
+		return now - (uint16_t)((uint16_t)now - cap);
+	}
+	#endif
+	return can_timer_now();
+}
+
+int can_timer_expired(uint32_t when)
+{
+	return (int32_t)(can_timer_now() - when) >= 0;
+}
+
+/* Load CCR1 with the alarm time if it's less than half a 16-bit period away, else with a hop 0x4000 ticks
+ * on, after which the ISR comes back here: further out than that, a compare can't be told from one that has
+ * just been missed.  Interrupts must be off.
+ * Returns 1 if the alarm time has already passed.
+ */
+static uint8_t can_timer_arm()
+{
+	uint32_t now = can_timer_now(), d = can_timer_when - now;
+
+	if ((int32_t)d <= 0) {
+		can_timer_armed = 0;
+		can_timer_fired = 1;
+		TA0CCTL1 = 0;
+		return 1;
+	}
+	TA0CCR1 = d < 0x8000UL ? (uint16_t)can_timer_when : (uint16_t)now + 0x4000;
+	TA0CCTL1 = CCIE;
+	if ((int16_t)(TA0R - TA0CCR1) >= 0)  // Slipped past while loading CCR1
+		TA0CCTL1 |= CCIFG;
+	return 0;
+}
+
+/* Set can_timer_fired and wake the CPU from LPM at 'when' (a can_timer_now() value) */
+void can_timer_alarm(uint32_t when)
+{
+	uint16_t sr;
+
+	sr = __get_SR_register() & GIE;
+	_DINT();
+	can_timer_when = when;
+	can_timer_fired = 0;
+	can_timer_armed = 1;
+	TA0CCTL1 = 0;
+	can_timer_arm();
+	__bis_SR_register(sr);
+}
+
+void can_timer_cancel()
+{
+	uint16_t sr;
+
+	sr = __get_SR_register() & GIE;
+	_DINT();
+	can_timer_armed = 0;
+	can_timer_fired = 0;
+	TA0CCTL1 = 0;
+	__bis_SR_register(sr);
+}
+
+// CCR1 and overflow for Timer0_A
+#pragma vector=TIMER0_A1_VECTOR
+__interrupt void can_timer_isr(void)
+{
+	if (TA0CCTL1 & CCIFG) {
+		TA0CCTL1 = 0;
+		if (can_timer_armed && can_timer_arm())  // Either the alarm itself, or a hop short of it
+			__bic_SR_register_on_exit(LPM4_bits);
+	}
+	if (TA0CTL & TAIFG) {
+		TA0CTL &= ~TAIFG;
+		can_timer_hi++;
+	}
+}
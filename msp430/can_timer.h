@@ -0,0 +1,45 @@
+/* can_timer.h
+ * Free-running 32-bit timebase on Timer0_A for pacing, timeouts and timestamps in the MCP2515 library.
+ * TA0 counts continuously off SMCLK (so it keeps running in LPM0) and its overflow interrupt supplies
+ * the upper 16 bits; CCR1 provides a one-shot alarm that wakes the CPU from LPM.
+ */
+#ifndef CAN_TIMER_H
+#define CAN_TIMER_H
+
+#include <stdint.h>
+
+/* User configuration */
+#ifndef CAN_TIMER_ID
+#define CAN_TIMER_ID ID_3            // Input divider applied to SMCLK
+#endif
+#ifndef CAN_TIMER_HZ
+#define CAN_TIMER_HZ 2000000UL       // Resulting tick rate; 16MHz SMCLK / 8
+#endif
+
+/* Receive timestamps: when defined, CCRn of Timer0_A (0 or 2; CCR1 is the alarm) captures the MCP2515's INT
+ * falling edge, or the rising edge of its SOF output (MCP2515_OPTION_SOFOUT) with CAN_TIMER_CAPTURE_CM set to CM_1.
+ * Route the pin to that CCR's input by setting its PxSEL bit; CCI0A is P1.1 on the G2xx3.
+ */
+//#define CAN_TIMER_CAPTURE 0
+#ifndef CAN_TIMER_CAPTURE_CCIS
+#define CAN_TIMER_CAPTURE_CCIS CCIS_0  // CCInA
+#endif
+#ifndef CAN_TIMER_CAPTURE_CM
+#define CAN_TIMER_CAPTURE_CM CM_2      // Falling edge
+#endif
+
+#define CAN_TIMER_MS(ms) ((uint32_t)(ms) * (CAN_TIMER_HZ / 1000))
+#define CAN_TIMER_US(us) ((uint32_t)(us) * (CAN_TIMER_HZ / 1000) / 1000)
+
+/* Set by the alarm interrupt, cleared by can_timer_alarm() */
+extern volatile uint8_t can_timer_fired;
+
+/* Function prototypes */
+void can_timer_init();
+uint32_t can_timer_now();
+int can_timer_expired(uint32_t);
+void can_timer_alarm(uint32_t);
+void can_timer_cancel();
+uint32_t can_timer_stamp();
+
+#endif
@@ -0,0 +1,190 @@
+/* can_whitelist.c
+ * ID whitelist to mask & filter compiler; see can_whitelist.h
+ *
+ * Each filter covers a group of wanted IDs, and the RXB's mask has to leave out every bit that differs
+ * within any of its groups, so the cost of a group is the number of bits its IDs disagree on.  IDs are
+ * merged greedily, cheapest pair first, until the groups fit the filters, then every way of sharing them
+ * out between RXB0 (2 filters) and RXB1 (4 filters) is scored by the IDs its two masks would let in.
+ * Standard and extended IDs can't share a mask, so a mixed list gives each kind an RXB of its own.
+ */
+
+#include <stdint.h>
+#include "mcp2515.h"
+#include "can_whitelist.h"
+
+#define CAN_WL_WIDTH(ext) ((ext) ? 0x1FFFFFFFUL : 0x000007FFUL)
+
+/* A group of wanted IDs: one of them, and the bits where any two of them differ */
+struct can_wl_group {
+	uint32_t id, diff;
+};
+
+static uint8_t can_wl_bits(uint32_t v)
+{
+	uint8_t n = 0;
+
+	while (v) {
+		v &= v - 1;
+		n++;
+	}
+	return n;
+}
+
+/* One group per list entry of the given kind, starting at g; returns how many */
+static uint8_t can_wl_load(struct can_wl_group *g, const uint32_t *ids, uint8_t n, uint8_t ext)
+{
+	uint8_t i, cnt = 0;
+
+	for (i=0; i < n; i++) {
+		if ( !(ids[i] & CAN_WHITELIST_EXT) != !ext )
+			continue;
+		g[cnt].id = ids[i] & CAN_WL_WIDTH(ext);
+		g[cnt].diff = 0;
+		cnt++;
+	}
+	return cnt;
+}
+
+/* Merge the pair of groups that costs the fewest mask bits until at most k are left */
+static uint8_t can_wl_cluster(struct can_wl_group *g, uint8_t cnt, uint8_t k)
+{
+	uint8_t i, j, bi = 0, bj = 1, c, best;
+
+	while (cnt > k) {
+		best = 0xFF;
+		for (i=0; i < cnt; i++) {
+			for (j=i+1; j < cnt; j++) {
+				c = can_wl_bits(g[i].diff | g[j].diff | (g[i].id ^ g[j].id));
+				if (c < best) {
+					best = c;
+					bi = i;
+					bj = j;
+				}
+			}
+		}
+		g[bi].diff |= g[bj].diff | (g[bi].id ^ g[bj].id);
+		g[bj] = g[--cnt];
+	}
+	return cnt;
+}
+
+/* IDs let in by the groups in sel (bitmap) sharing one mask, which is returned in *mask */
+static uint32_t can_wl_cost(const struct can_wl_group *g, uint8_t sel, uint8_t ext, uint32_t *mask)
+{
+	uint8_t i, j, distinct = 0;
+	uint32_t diff = 0;
+
+	for (i=0; i < 8; i++) {
+		if (sel & (1 << i))
+			diff |= g[i].diff;
+	}
+	*mask = CAN_WL_WIDTH(ext) & ~diff;
+
+	// Groups the mask makes identical only count once
+	for (i=0; i < 8; i++) {
+		if ( !(sel & (1 << i)) )
+			continue;
+		for (j=0; j < i; j++) {
+			if ( (sel & (1 << j)) && !((g[i].id ^ g[j].id) & *mask) )
+				break;
+		}
+		if (j == i)
+			distinct++;
+	}
+	return (uint32_t)distinct << can_wl_bits(diff & CAN_WL_WIDTH(ext));
+}
+
+/* Program one RXB with the groups in sel; spare filters repeat the first one.  An RXB with no groups gets
+ * a full-width mask and a wanted ID (fallback) so it lets nothing extra in.
+ */
+static void can_wl_program(can_dev_t *dev, uint8_t rxb, const struct can_wl_group *g, uint8_t sel, uint8_t ext, uint32_t fallback)
+{
+	uint8_t i, filt = 0;
+	uint32_t mask, first = fallback;
+
+	if (sel)
+		can_wl_cost(g, sel, ext, &mask);
+	else
+		mask = CAN_WL_WIDTH(ext);
+	can_rx_setmask_dev(dev, rxb, mask, ext);
+
+	for (i=0; i < 8; i++) {
+		if ( !(sel & (1 << i)) )
+			continue;
+		if (!filt)
+			first = g[i].id & mask;
+		can_rx_setfilter_dev(dev, rxb, filt++, g[i].id & mask);
+	}
+	while (filt < (rxb ? 4 : 2))
+		can_rx_setfilter_dev(dev, rxb, filt++, first);
+	can_rx_mode_dev(dev, rxb, MCP2515_RXB0CTRL_MODE_RECV_STD_OR_EXT);
+}
+
+/* Mixed list: kind ext0 goes to RXB0, the other kind to RXB1.  Returns the IDs let in; programs them if dev is set. */
+static uint32_t can_wl_mixed(can_dev_t *dev, struct can_wl_group *g, const uint32_t *ids, uint8_t n, uint8_t ext0)
+{
+	uint8_t c0, c1;
+	uint32_t mask, in;
+
+	c0 = can_wl_cluster(g, can_wl_load(g, ids, n, ext0), 2);
+	c1 = can_wl_cluster(g+c0, can_wl_load(g+c0, ids, n, !ext0), 4);
+	in = can_wl_cost(g, (1 << c0) - 1, ext0, &mask);
+	in += can_wl_cost(g, ((1 << c1) - 1) << c0, !ext0, &mask);
+	if (dev) {
+		can_wl_program(dev, 0, g, (1 << c0) - 1, ext0, 0);
+		can_wl_program(dev, 1, g, ((1 << c1) - 1) << c0, !ext0, 0);
+	}
+	return in;
+}
+
+/* Program masks & filters to receive the n IDs in ids (extended ones OR'd with CAN_WHITELIST_EXT), and set both
+ * RXBs to use them.  *false_pos gets the most IDs that could come through without being on the list, and so still
+ * need a software check; 0 means the hardware filters are exact.  Returns 0, or -1 if the list is empty or too long.
+ */
+int can_rx_whitelist_dev(can_dev_t *dev, const uint32_t *ids, uint8_t n, uint32_t *false_pos)
+{
+	struct can_wl_group g[CAN_WHITELIST_MAX];
+	uint8_t i, j, cnt, nstd = 0, wanted = 0, sel, best_sel = 0, ext;
+	uint32_t mask, in, best = 0xFFFFFFFFUL;
+
+	if (!n || n > CAN_WHITELIST_MAX)
+		return -1;
+	for (i=0; i < n; i++) {
+		if ( !(ids[i] & CAN_WHITELIST_EXT) )
+			nstd++;
+		for (j=0; j < i && ids[j] != ids[i]; j++)
+			;
+		if (j == i)
+			wanted++;  // Duplicates only count once
+	}
+
+	if (nstd && nstd < n) {
+		// Try each kind in RXB0 (2 filters) and keep whichever lets fewer unwanted IDs in
+		ext = can_wl_mixed(0, g, ids, n, 1) < can_wl_mixed(0, g, ids, n, 0);
+		in = can_wl_mixed(dev, g, ids, n, ext);
+	} else {
+		ext = !nstd;
+		cnt = can_wl_cluster(g, can_wl_load(g, ids, n, ext), 6);
+		for (sel=0; sel < (1 << cnt); sel++) {
+			if (can_wl_bits(sel) > 2 || cnt - can_wl_bits(sel) > 4)
+				continue;
+			in = can_wl_cost(g, sel, ext, &mask) + can_wl_cost(g, ((1 << cnt) - 1) & ~sel, ext, &mask);
+			if (in < best) {
+				best = in;
+				best_sel = sel;
+			}
+		}
+		in = best;
+		can_wl_program(dev, 0, g, best_sel, ext, g[0].id);
+		can_wl_program(dev, 1, g, ((1 << cnt) - 1) & ~best_sel, ext, g[0].id);
+	}
+
+	if (false_pos)
+		*false_pos = in - wanted;
+	return 0;
+}
+
+int can_rx_whitelist(const uint32_t *ids, uint8_t n, uint32_t *false_pos)
+{
+	return can_rx_whitelist_dev(&can_dev0, ids, n, false_pos);
+}
@@ -0,0 +1,21 @@
+/* can_whitelist.h
+ * Compile a list of wanted CAN IDs into the MCP2515's 2 masks and 6 filters (RXM0 + RXF0-1 for RXB0,
+ * RXM1 + RXF2-5 for RXB1), letting as few unwanted IDs through as a greedy search can find, and program
+ * them with can_rx_setmask()/can_rx_setfilter().  Configuration-time only; it runs in O(n^3) for n IDs.
+ */
+#ifndef CAN_WHITELIST_H
+#define CAN_WHITELIST_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/* User configuration */
+#define CAN_WHITELIST_MAX 16  // Longest ID list can_rx_whitelist() takes; costs 8 bytes of stack per ID
+
+#define CAN_WHITELIST_EXT 0x80000000UL  // OR'd into a list entry to mark it a 29-bit extended ID
+
+/* Function prototypes */
+int can_rx_whitelist(const uint32_t *, uint8_t, uint32_t *);
+int can_rx_whitelist_dev(can_dev_t *, const uint32_t *, uint8_t, uint32_t *);
+
+#endif
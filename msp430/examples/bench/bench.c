@@ -0,0 +1,456 @@
+/* bench.c
+ * Driver cost benchmark, run in LOOPBACK mode so no bus is needed:
+ *  - CPU cycles and SPI bytes per can_send(), can_recv() and can_irq_handler() call (handler servicing TX-complete + RX)
+ *  - sustained frames/sec, TX only (filters reject the looped-back frames) and TX+RX
+ *  - INT edge to application latency: PORT ISR entry until can_recv() has handed the frame over
+ *  - can_send() against the original 4-transaction send sequence (WRITE TXBnCTRL, LOAD TX BUFFER, BIT MODIFY CANINTE, RTS),
+ *    and raw SPI throughput of a 14-byte register read/write byte-by-byte through spi_transfer() vs. the inline block primitives
+ * Results are printed as name=value lines on a bit-banged UART TX pin (see BENCH_UART_*) and also left in the bench_*
+ * globals for mspdebug ("sym find bench_", "md <addr>"), followed by one row of the size/cycle table for the driver
+ * configuration built (BENCH_CONFIG; "make table" prints the sizes of them all).  The red LED comes on when done.
+ * Builds for G2xxx (USI with e.g. TARGETMCU=msp430g2452, USCI_A/USCI_B with SPI=USCI_A/USCI_B) and FR59xx (eUSCI) chips;
+ * see the Makefile.
+ */
+#include <msp430.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "msp430_spi.h"
+
+#ifndef SPI_BYTE_COUNT
+#error "bench needs SPI_BYTE_COUNT defined (see the Makefile)"
+#endif
+
+/* SMCLK = MCLK/2 (the MCP2515 tops out at 10MHz SPI) and Timer_A counts SMCLK */
+#define BENCH_CYCLES_PER_TICK 2
+#define BENCH_FRAMES 32
+#define BENCH_STREAM_FRAMES 256
+#define BENCH_MCLK_HZ 16000000UL
+#define BENCH_SPI_LEN 14  // TXB0CTRL..TXB0D7, same span as a full can_send() register write
+
+/* Report output, 8N1; defaults to P1.2, the G2 LaunchPad's TXD with the J3 jumpers in the hardware UART position.
+ * Override all three if the SPI backend in use needs that pin (USCI_A SPI on the G2xx3 does).
+ */
+#ifndef BENCH_UART_PORTBIT
+#define BENCH_UART_PORTOUT P1OUT
+#define BENCH_UART_PORTDIR P1DIR
+#define BENCH_UART_PORTBIT BIT2
+#endif
+#define BENCH_UART_BAUD 9600
+
+#ifndef BENCH_CONFIG
+#define BENCH_CONFIG "custom"
+#endif
+#ifndef BENCH_FLASH_BYTES
+#define BENCH_FLASH_BYTES 0  // The Makefile's first pass, or a build outside of it
+#endif
+
+#if defined(SPI_BACKEND_USI)
+#define BENCH_BACKEND "USI"
+#elif defined(__MSP430_HAS_EUSCI_A0__) && (defined(SPI_DRIVER_USCI_A) || defined(SPI_DRIVER_USCI_A0) || defined(SPI_DRIVER_USCI_A1))
+#define BENCH_BACKEND "eUSCI_A"
+#elif defined(__MSP430_HAS_EUSCI_B0__)
+#define BENCH_BACKEND "eUSCI_B"
+#elif defined(SPI_DRIVER_USCI_A)
+#define BENCH_BACKEND "USCI_A"
+#else
+#define BENCH_BACKEND "USCI_B"
+#endif
+
+uint32_t rid;
+uint8_t mext, buf[8];
+volatile uint16_t bench_legacy_cycles, bench_fast_cycles, bench_fast_prio_cycles;
+volatile uint32_t bench_spi_legacy_rd_bps, bench_spi_legacy_wr_bps, bench_spi_block_rd_bps, bench_spi_block_wr_bps;
+volatile uint16_t bench_send_cycles, bench_send_spi, bench_recv_cycles, bench_recv_spi, bench_irq_cycles, bench_irq_spi;
+volatile uint16_t bench_tx_fps, bench_rx_fps, bench_rx_dropped, bench_lat_avg_cycles, bench_lat_max_cycles;
+volatile uint16_t bench_isr_t;  // TA0R at the PORT ISR's first CAN edge since the main loop last caught up
+uint8_t spibuf[BENCH_SPI_LEN];
+const uint16_t bench_flash_bytes = BENCH_FLASH_BYTES;  // .text + .rodata + vectors, as msp430-size counts it
+
+// The pre-fast-path can_send() body, using only the public SPI primitives
+int legacy_send(uint32_t msg, void *data, uint8_t len, uint8_t prio)
+{
+	int txb;
+	uint8_t outbuf[13];
+
+	if ( (txb = can_tx_available()) < 0 )
+		return -1;
+	can_dev0.txb |= 1 << txb;  // Driver's TXB bitmap; the legacy path has to claim buffers itself
+
+	can_compose_msgid_ext(msg, outbuf);
+	outbuf[4] = len;
+	memcpy(outbuf+5, (uint8_t *)data, len);
+
+	can_w_reg(MCP2515_TXB0CTRL + 0x10*txb, &prio, 1);
+	can_w_txbuf(MCP2515_TXBUF_TXB0SIDH + 2*txb, outbuf, 5+len);
+	can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << txb, MCP2515_CANINTE_TX0IE << txb);
+	can_spi_command(MCP2515_SPI_RTS | (1 << txb));
+	return txb;
+}
+
+// Service IRQs until TXB0 is free again so every timed send goes through the same buffer
+void wait_txb0()
+{
+	uint8_t irq;
+
+	while (can_tx_available() != 0) {
+		if (mcp2515_irq & MCP2515_IRQ_FLAGGED) {
+			irq = can_irq_handler();
+			if (irq & MCP2515_IRQ_RX)
+				can_recv(&rid, &mext, buf);
+		}
+	}
+}
+
+// ... and until every IRQ has been dealt with
+void wait_idle()
+{
+	wait_txb0();
+	while (mcp2515_irq & MCP2515_IRQ_FLAGGED) {
+		if (can_irq_handler() & MCP2515_IRQ_RX)
+			can_recv(&rid, &mext, buf);
+	}
+}
+
+// Per-byte register I/O the way can_r_reg()/can_w_reg() used to do it
+void legacy_r_reg(uint8_t addr, uint8_t *out, uint8_t len)
+{
+	CAN_SPI_CS_PORTOUT &= ~CAN_SPI_CS_PORTBIT;
+	spi_transfer(MCP2515_SPI_READ);
+	spi_transfer(addr);
+	while (len--)
+		*out++ = spi_transfer(0xFF);
+	CAN_SPI_CS_PORTOUT |= CAN_SPI_CS_PORTBIT;
+}
+
+void legacy_w_reg(uint8_t addr, const uint8_t *in, uint8_t len)
+{
+	CAN_SPI_CS_PORTOUT &= ~CAN_SPI_CS_PORTBIT;
+	spi_transfer(MCP2515_SPI_WRITE);
+	spi_transfer(addr);
+	while (len--)
+		spi_transfer(*in++);
+	CAN_SPI_CS_PORTOUT |= CAN_SPI_CS_PORTBIT;
+}
+
+// Payload bytes/sec over BENCH_FRAMES transactions (command & address bytes not counted)
+uint32_t bench_spi(uint8_t mode)
+{
+	uint16_t i, t0;
+	uint32_t total = 0;
+
+	for (i=0; i < BENCH_FRAMES; i++) {
+		t0 = TA0R;
+		switch (mode) {
+			case 0:
+				legacy_r_reg(MCP2515_TXB0CTRL, spibuf, BENCH_SPI_LEN);
+				break;
+			case 1:
+				legacy_w_reg(MCP2515_TXB0CTRL, spibuf, BENCH_SPI_LEN);
+				break;
+			case 2:
+				can_r_reg(MCP2515_TXB0CTRL, spibuf, BENCH_SPI_LEN);
+				break;
+			case 3:
+				can_w_reg(MCP2515_TXB0CTRL, spibuf, BENCH_SPI_LEN);
+				break;
+		}
+		total += (uint16_t)(TA0R - t0);
+	}
+	total *= BENCH_CYCLES_PER_TICK;
+	return (uint32_t)BENCH_SPI_LEN * BENCH_FRAMES * (BENCH_MCLK_HZ / 1000) / (total / 1000);
+}
+
+uint16_t bench_run(uint8_t mode)
+{
+	uint16_t i, t0, total = 0;
+
+	for (i=0; i < BENCH_FRAMES; i++) {
+		wait_txb0();
+		t0 = TA0R;
+		switch (mode) {
+			case 0:
+				legacy_send(0x00000080, buf, 8, 3);
+				break;
+			case 1:
+				can_send(0x00000080, 1, buf, 8, 3);
+				break;
+			case 2:
+				can_send(0x00000080, 1, buf, 8, i & 0x03);  // Priority changes every frame
+				break;
+		}
+		total += TA0R - t0;
+	}
+	wait_txb0();
+	return total / BENCH_FRAMES * BENCH_CYCLES_PER_TICK;
+}
+
+/* Per-call cost of the three hot functions, averaged over BENCH_FRAMES looped-back frames.  can_irq_handler()
+ * runs once both the TX-complete and the RX flag are up, which is the usual case in a busy node.
+ */
+void bench_calls()
+{
+	uint16_t i, t0, b0;
+	uint32_t send_t = 0, recv_t = 0, irq_t = 0, send_b = 0, recv_b = 0, irq_b = 0;
+	uint8_t st;
+
+	for (i=0; i < BENCH_FRAMES; i++) {
+		wait_idle();
+		b0 = spi_bytes;
+		t0 = TA0R;
+		can_send(0x00000080, 0, buf, 8, 3);
+		send_t += (uint16_t)(TA0R - t0);
+		send_b += (uint16_t)(spi_bytes - b0);
+
+		do {
+			st = can_read_status();
+		} while ( !(st & MCP2515_STATUS_RXIF_MASK) || !(st & MCP2515_STATUS_TXIF_MASK) );
+
+		b0 = spi_bytes;
+		t0 = TA0R;
+		can_irq_handler();
+		irq_t += (uint16_t)(TA0R - t0);
+		irq_b += (uint16_t)(spi_bytes - b0);
+
+		b0 = spi_bytes;
+		t0 = TA0R;
+		can_recv(&rid, &mext, buf);
+		recv_t += (uint16_t)(TA0R - t0);
+		recv_b += (uint16_t)(spi_bytes - b0);
+	}
+	wait_idle();
+
+	bench_send_cycles = send_t * BENCH_CYCLES_PER_TICK / BENCH_FRAMES;
+	bench_send_spi = send_b / BENCH_FRAMES;
+	bench_irq_cycles = irq_t * BENCH_CYCLES_PER_TICK / BENCH_FRAMES;
+	bench_irq_spi = irq_b / BENCH_FRAMES;
+	bench_recv_cycles = recv_t * BENCH_CYCLES_PER_TICK / BENCH_FRAMES;
+	bench_recv_spi = recv_b / BENCH_FRAMES;
+}
+
+/* Keep all three TXBs busy for BENCH_STREAM_FRAMES frames and return frames/sec: sent (rx = 0, with RX filters set to
+ * reject everything) or received and read back out (rx = 1).  Frames lost to RX overflow land in bench_rx_dropped.
+ */
+uint16_t bench_stream(uint8_t rx)
+{
+	uint16_t sent = 0, rcvd = 0, t0, t;
+	uint32_t ticks = 0;
+
+	wait_idle();
+	t0 = TA0R;
+	while (sent < BENCH_STREAM_FRAMES || can_dev0.txb || (mcp2515_irq & MCP2515_IRQ_FLAGGED)) {
+		if (sent < BENCH_STREAM_FRAMES && can_send(0x00000080, 0, buf, 8, 3) >= 0)
+			sent++;
+		if ( (mcp2515_irq & MCP2515_IRQ_FLAGGED) && (can_irq_handler() & MCP2515_IRQ_RX) ) {
+			while (can_recv(&rid, &mext, buf) >= 0)
+				rcvd++;
+		}
+		t = TA0R;
+		ticks += (uint16_t)(t - t0);
+		t0 = t;
+	}
+	if (rx)
+		bench_rx_dropped = BENCH_STREAM_FRAMES - rcvd;
+	return (uint32_t)(rx ? rcvd : sent) * (BENCH_MCLK_HZ / BENCH_CYCLES_PER_TICK) / ticks;
+}
+
+// INT edge (PORT ISR entry) to the frame being in the application's hands, over BENCH_FRAMES single frames
+void bench_latency()
+{
+	uint16_t i, lat;
+	uint32_t total = 0;
+
+	bench_lat_max_cycles = 0;
+	for (i=0; i < BENCH_FRAMES; i++) {
+		wait_idle();
+		can_send(0x00000080, 0, buf, 8, 3);
+		while (1) {
+			if ( (mcp2515_irq & MCP2515_IRQ_FLAGGED) && (can_irq_handler() & MCP2515_IRQ_RX) ) {
+				can_recv(&rid, &mext, buf);
+				lat = (TA0R - bench_isr_t) * BENCH_CYCLES_PER_TICK;
+				break;
+			}
+		}
+		total += lat;
+		if (lat > bench_lat_max_cycles)
+			bench_lat_max_cycles = lat;
+	}
+	wait_idle();
+	bench_lat_avg_cycles = total / BENCH_FRAMES;
+}
+
+// Blocking bit-banged TX with interrupts off for each byte; only used once the measurements are done
+void bench_putc(uint8_t c)
+{
+	uint16_t sr, bits = ((uint16_t)c << 1) | 0x200;  // Start bit, 8 data bits LSB first, stop bit
+	uint8_t i;
+
+	sr = __get_SR_register() & GIE;
+	_DINT();
+	for (i=0; i < 10; i++) {
+		if (bits & 1)
+			BENCH_UART_PORTOUT |= BENCH_UART_PORTBIT;
+		else
+			BENCH_UART_PORTOUT &= ~BENCH_UART_PORTBIT;
+		bits >>= 1;
+		__delay_cycles(BENCH_MCLK_HZ / BENCH_UART_BAUD - 10);  // Less the loop's own cycles
+	}
+	__bis_SR_register(sr);
+}
+
+void bench_puts(const char *s)
+{
+	while (*s)
+		bench_putc(*s++);
+}
+
+// val in decimal, right-aligned to width
+void bench_putu(uint32_t val, uint8_t width)
+{
+	char num[11];
+	uint8_t i = sizeof(num);
+
+	num[--i] = '\0';
+	do {
+		num[--i] = '0' + val % 10;
+		val /= 10;
+		if (width)
+			width--;
+	} while (val);
+	while (width--)
+		bench_putc(' ');
+	bench_puts(num + i);
+}
+
+void bench_print(const char *name, uint32_t val)
+{
+	bench_puts(name);
+	bench_putc('=');
+	bench_putu(val, 0);
+	bench_puts("\r\n");
+}
+
+void bench_report()
+{
+	bench_puts("backend=" BENCH_BACKEND "\r\n");
+	bench_puts("config=" BENCH_CONFIG "\r\n");
+	bench_print("flash_bytes", bench_flash_bytes);
+	bench_print("send_cycles", bench_send_cycles);
+	bench_print("send_spi_bytes", bench_send_spi);
+	bench_print("recv_cycles", bench_recv_cycles);
+	bench_print("recv_spi_bytes", bench_recv_spi);
+	bench_print("irq_cycles", bench_irq_cycles);
+	bench_print("irq_spi_bytes", bench_irq_spi);
+	bench_print("tx_fps", bench_tx_fps);
+	bench_print("rx_fps", bench_rx_fps);
+	bench_print("rx_dropped", bench_rx_dropped);
+	bench_print("latency_avg_cycles", bench_lat_avg_cycles);
+	bench_print("latency_max_cycles", bench_lat_max_cycles);
+	bench_print("legacy_send_cycles", bench_legacy_cycles);
+	bench_print("fast_send_cycles", bench_fast_cycles);
+	bench_print("fast_send_prio_cycles", bench_fast_prio_cycles);
+	bench_print("spi_legacy_rd_bps", bench_spi_legacy_rd_bps);
+	bench_print("spi_legacy_wr_bps", bench_spi_legacy_wr_bps);
+	bench_print("spi_block_rd_bps", bench_spi_block_rd_bps);
+	bench_print("spi_block_wr_bps", bench_spi_block_wr_bps);
+
+	// Same columns from every configuration's run, so rows can be stacked into one table
+	bench_puts("\r\n  flash   send   recv    irq  tx_fps  rx_fps  config\r\n");
+	bench_putu(bench_flash_bytes, 7);
+	bench_putu(bench_send_cycles, 7);
+	bench_putu(bench_recv_cycles, 7);
+	bench_putu(bench_irq_cycles, 7);
+	bench_putu(bench_tx_fps, 8);
+	bench_putu(bench_rx_fps, 8);
+	bench_puts("  " BENCH_CONFIG "\r\n");
+}
+
+int main()
+{
+	uint8_t i;
+
+	WDTCTL = WDTPW | WDTHOLD;
+	#ifdef __MSP430_HAS_CS__
+	// FR59xx: 16MHz DCO needs an FRAM wait state
+	PM5CTL0 &= ~LOCKLPM5;
+	FRCTL0 = FRCTLPW | NWAITS_1;
+	CSCTL0_H = CSKEY_H;
+	CSCTL1 = DCORSEL | DCOFSEL_4;
+	CSCTL2 = SELA__VLOCLK | SELS__DCOCLK | SELM__DCOCLK;
+	CSCTL3 = DIVA__1 | DIVS__2 | DIVM__1;
+	CSCTL0_H = 0;
+	#else
+	DCOCTL = CALDCO_16MHZ;
+	BCSCTL1 = CALBC1_16MHZ;
+	BCSCTL2 = DIVS_1;
+	BCSCTL3 = LFXT1S_2;
+	while (BCSCTL3 & LFXT1OF)
+		;
+	#endif
+
+	P1DIR |= BIT0;
+	P1OUT &= ~BIT0;
+	BENCH_UART_PORTOUT |= BENCH_UART_PORTBIT;  // Idle high
+	BENCH_UART_PORTDIR |= BENCH_UART_PORTBIT;
+
+	can_init();
+	#ifdef MCP2515_NO_SPEED_CALC
+	if (CAN_SPEED_CONST(500000) < 0) {
+	#else
+	if (can_speed(500000, 1, 1) < 0) {
+	#endif
+		P1OUT |= BIT0;
+		LPM4;
+	}
+
+	can_rx_mode(0, MCP2515_RXB0CTRL_MODE_RECV_ALL);
+	can_rx_mode(1, MCP2515_RXB1CTRL_MODE_RECV_ALL);
+	can_ioctl(MCP2515_OPTION_LOOPBACK, 1);
+
+	// Free-running Timer_A from SMCLK
+	TA0CTL = TASSEL_2 | ID_0 | MC_2 | TACLR;
+
+	can_send(0x00000080, 1, buf, 8, 3);  // Warm up TXB0's priority & CANINTE state
+	wait_idle();
+
+	bench_legacy_cycles = bench_run(0);
+	bench_fast_cycles = bench_run(1);
+	bench_fast_prio_cycles = bench_run(2);
+
+	// Reads run first so the writes put TXB0's own contents (and priority) back unchanged
+	bench_spi_legacy_rd_bps = bench_spi(0);
+	bench_spi_legacy_wr_bps = bench_spi(1);
+	bench_spi_block_rd_bps = bench_spi(2);
+	bench_spi_block_wr_bps = bench_spi(3);
+
+	bench_calls();
+	bench_latency();
+	bench_rx_fps = bench_stream(1);
+
+	// Standard frames only, matched against an ID nobody sends, so nothing comes back for the TX-only run
+	can_rx_setmask(0, 0x000007FF, 0);
+	can_rx_setmask(1, 0x000007FF, 0);
+	for (i=0; i < 6; i++)
+		can_rx_setfilter(i / 2 ? 1 : 0, i / 2 ? i-2 : i, 0x7FF);
+	can_rx_mode(0, MCP2515_RXB0CTRL_MODE_RECV_STD);
+	can_rx_mode(1, MCP2515_RXB1CTRL_MODE_RECV_STD);
+	bench_tx_fps = bench_stream(0);
+
+	bench_report();
+
+	P1OUT |= BIT0;
+	LPM4;
+	return 0;
+}
+
+// ISR for PORT1
+#pragma vector=PORT1_VECTOR
+__interrupt void P1_ISR(void)
+{
+	if (P1IFG & CAN_IRQ_PORTBIT) {
+		P1IFG &= ~CAN_IRQ_PORTBIT;
+		if ( !(mcp2515_irq & MCP2515_IRQ_FLAGGED) )
+			bench_isr_t = TA0R;
+		mcp2515_irq |= MCP2515_IRQ_FLAGGED;
+		__bic_SR_register_on_exit(LPM4_bits);
+	}
+}
@@ -15,9 +15,11 @@ uint8_t irq, inbuf[19];
 volatile uint16_t sleep_counter;
 #define SLEEP_COUNTER 20
 
+static const char *health_names[] = { "BUS OK\n", "BUS WARNING\n", "BUS PASSIVE\n", "BUS OFF\n" };
+
 int main()
 {
-	uint8_t do_lpm, is_ext;
+	uint8_t is_ext, health = MCP2515_HEALTH_ACTIVE;
 	int i, j, k;
 	uint32_t msgid;
 
@@ -91,9 +93,9 @@ int main()
 	 *         |                         |                                       /|\
 	 *        \_/                       \_/                                       |
 	 *  +----------------+      +-------------------+                             |
-	 *  | Pull data      |      | Bus error, wait   |                             |
-	 *  | using can_recv |      | 100ms and recheck |->---------------------------+
-	 *  +----------------+      | IRQ.              |                             |
+	 *  | Pull data      |      | Bus error, show   |                             |
+	 *  | using can_recv |      | health; TX limits |->---------------------------+
+	 *  +----------------+      | itself, no stall  |                             |
 	 *          |               +-------------------+                             |
 	 *         \_/                                                                |
 	 *   +--------------+                                                        /|\
@@ -107,21 +109,26 @@ int main()
 	 *
 	 */
 	while(1) {
-		do_lpm = 1;
 		if (mcp2515_irq) {
 			irq = can_irq_handler();
+			// TEC/REC fall without an IRQ, so recheck on every wakeup until the bus is back to error-active
+			if (health != MCP2515_HEALTH_ACTIVE)
+				can_health_poll();
+			if (can_dev0.health != health) {
+				// Bus error state changed; the driver limits TX by itself, nothing to wait out here
+				health = can_dev0.health;
+				if (health == MCP2515_HEALTH_ACTIVE)
+					P1OUT &= ~BIT0;
+				else
+					P1OUT |= BIT0;
+				msp1202_puts(health_names[health]);
+			}
 			if (irq & MCP2515_IRQ_ERROR) {
 				if ( !(irq & MCP2515_IRQ_HANDLED) ) {
 					if (irq & MCP2515_IRQ_TX) {
 						can_tx_cancel();
-					} else {
-						// Bus error; wait 100ms, recheck
-						P1OUT |= BIT0;
-						__delay_cycles(1600000);
-						P1OUT &= ~BIT0;
-						do_lpm = 0;
 					}
-				} else {
+				} else if (irq & MCP2515_IRQ_RX) {
 					// RX overflow, most likely
 					msp1202_puts("RX OVERFLOW\n");
 				}
@@ -147,7 +154,7 @@ int main()
 			}
 		}
 
-		if ( do_lpm && !(mcp2515_irq & MCP2515_IRQ_FLAGGED) ) {
+		if ( !(mcp2515_irq & MCP2515_IRQ_FLAGGED) ) {
 			LPM4;
 		}
 	}
@@ -160,15 +167,22 @@ __interrupt void P1_ISR(void)
 {
 	if (P1IFG & CAN_IRQ_PORTBIT) {
 		P1IFG &= ~CAN_IRQ_PORTBIT;
-		mcp2515_irq |= MCP2515_IRQ_FLAGGED;
-		__bic_SR_register_on_exit(LPM4_bits);
+		// Drains RXB0/RXB1 into the driver's RX ring so frames aren't lost while the LCD is being drawn
+		if (can_isr())
+			__bic_SR_register_on_exit(LPM4_bits);
 	}
 }
 
 void lcd_chipselect(uint8_t onoff)
 {
-	if (onoff)
+	/* The LCD shares the SPI bus with the MCP2515; hold off can_isr() while the LCD is selected.
+	 * A CAN IRQ arriving in the meantime stays latched in P1IFG and runs once the LCD is released.
+	 */
+	if (onoff) {
 		P2OUT |= BIT0;
-	else
+		CAN_IRQ_PORTIE |= CAN_IRQ_PORTBIT;
+	} else {
+		CAN_IRQ_PORTIE &= ~CAN_IRQ_PORTBIT;
 		P2OUT &= ~BIT0;
+	}
 }
@@ -3,219 +3,211 @@
 #include <stdarg.h>
 #include <string.h>
 #include "mcp2515.h"
+#include "can_timer.h"
 #include "can_printf.h"
 
-/* Manage sending arbitrary-length data using 8-byte CAN buffers
- *
- * Flowchart:
- *
- *            START
- *              |------------------<---------------------<-------------------------+
- *             \_/                                                                 |
- *     --------------------                                                        |
- *   /                      \                                                      |
- *  < Is there pending data? > No-> Exit func.                                     |
- *   \                      /                                                     /|\
- *     --------------------                                                        |
- *             Yes                                                                 |
- *              |                                                                  |
- *             \_/                                                                 |
- *       -----------------                                                         |
- *     /                   \        +------------------------+                     |
- *    < Is a TXB available? > Yes-> | Send frame, ERRCOUNT=0 |->--------->---------+
- *     \                   /        +------------------------+                     |
- *       -----------------                                                         |
- *              No                                                                 |
- *              |------------<------------------------------<----------------------------------------<-------------------+
- *             \_/                    (RX IRQs always reported before TX IRQs)     |                                     |
- *     ------------------------              -------------------------             |                                    /|\
- *   /                          \          /                           \           |   +-----------------------------+   |
- *  < Is there a TX IRQ pending? > No->-- < Is there an RX IRQ pending? > Yes->--------| Run can_recv & discard data |->-+
- *   \                          /          \                           /           |   +-----------------------------+   |
- *     ------------------------              -------------------------             |                                     |
- *           Yes                                      No                          /|\                                   /|\
- *            |                                       |   +----------+             |                                     |
- *           \_/                                      +-> | Wait 1ms |------------------------>--------------------------+
- *     --------------                                     +----------+             |
- *   /                \                                         |                  |
- *  < Is it "handled"? > Yes->--------->---------------------------->--------------+
- *   \                / (this should free up a TXB)             |
- *     --------------                                           |
- *           No                                                 |
- *           |                                                  |
- *          \_/                                                 |
- *    +------------+                                           /|\
- *    | ERRCOUNT++ |                                            |
- *    +------------+                                            |
- *           |                                                  |
- *          \_/                                                 |
- *     ---------------                                          |
- *   /                 \                                        |
- *  < Is ERRCOUNT > 8 ? > No->----------------->----------------+
- *   \                 / (assumes ONESHOT=0, allow re-sending but only up to 8 times before we give up)
- *     ---------------
- *          Yes
- *           |
- *          \_/
- *   +---------------+
- *   | Cancel all TX |
- *   +---------------+
- *           |
- *          \_/
- *
- *       Exit func.
- *
- *
+/* Output goes straight into one 8-byte frame, sent the moment it fills up; the RAM cost is this struct no matter
+ * how long the output gets.  The waiting (in LPM0, woken by the CAN IRQ or the pacing timer) is done by
+ * can_tx_stream() in the core library; frames received meanwhile stay in the RX ring for the main loop.
  */
+struct can_pf {
+	uint32_t msgid, next;
+	uint8_t is_ext, len, sent, err;
+	uint8_t frame[8];
+};
 
-int can_managed_tx(uint32_t msgid, uint8_t is_ext, uint8_t *buf, uint16_t len, uint16_t pace_ms)
+// Sleep in LPM0 until the pacing alarm; the CAN ISR may wake us early, hence the caller's loop
+static void can_pf_sleep()
 {
-	uint16_t i = 0, j = 0, errcount = 0;
-	uint8_t tmp_u8, tmp_buf[8], irq;
-	uint32_t tmp_msgid;
-
-	while (i < len) {
-		if (can_tx_available() == 0) {
-			j = len - i;
-			if (j > 8)
-				j = 8;
-			can_send(msgid, is_ext, buf+i, j, 0);
-			i += j;
-			errcount = 0;
-		} else {
-			// TXB not available
-			do {
-				irq = can_irq_handler();
-				if (irq & MCP2515_IRQ_TX) {
-					// TX IRQ present
-					if (irq & MCP2515_IRQ_HANDLED) {
-						irq = 0;  // Bail out, attempt to send another frame
-						// Pace ourselves if user requests so
-						if (pace_ms) {
-							for (j=0; j < pace_ms; j++)
-								__delay_cycles(16000);
-						}
-					} else {
-						errcount++;
-						if (errcount > 8) {
-							can_tx_cancel();
-							return -1;
-						}
-						__delay_cycles(16000);
-					}
-				} else {
-					if (irq & MCP2515_IRQ_RX) {
-						can_recv(&tmp_msgid, &tmp_u8, tmp_buf);
-					}
-					// No TX IRQ, no RX IRQ, pause and re-check IRQ state
-					__delay_cycles(16000);
-				}
-			} while (irq);
+	_DINT();
+	if (!can_timer_fired)
+		__bis_SR_register(LPM0_bits | GIE);
+	else
+		_EINT();
+}
+
+static void can_pf_flush(struct can_pf *pf)
+{
+	if (!pf->len)
+		return;
+	if (pf->sent && CAN_PRINTF_PACE_MS) {
+		while (!can_timer_expired(pf->next)) {
+			can_timer_alarm(pf->next);
+			can_pf_sleep();
 		}
+		can_timer_cancel();
 	}
+	if (!pf->err && can_tx_stream(pf->msgid, pf->is_ext, pf->frame, pf->len, 0, 0) < 0)
+		pf->err = 1;  // Bus-off or a frame that kept failing; drop the rest
+	pf->next = can_timer_now() + CAN_TIMER_MS(CAN_PRINTF_PACE_MS);
+	pf->sent = 1;
+	pf->len = 0;
+}
 
-	return 0;
+static void can_pf_putc(struct can_pf *pf, uint8_t c)
+{
+	pf->frame[pf->len++] = c;
+	if (pf->len == 8)
+		can_pf_flush(pf);
 }
 
-void can_pf_putc(uint8_t *buf, uint16_t *idx, unsigned int c)
+static void can_pf_puts(struct can_pf *pf, const uint8_t *str)
 {
-	buf[*idx] = (uint8_t)c;
-	*idx += 1;
+	while (*str)
+		can_pf_putc(pf, *str++);
 }
 
-void can_pf_puts(uint8_t *buf, uint16_t *idx, uint8_t *str)
+/* Decimal conversion.  Each digit comes from subtracting 8, 4, 2 and 1 times its power of ten, so it takes at
+ * most 4 compares instead of up to 9, and only the digits above 10^3 of a 32-bit value use 32-bit math.
+ */
+static const uint32_t can_pf_dv32[] = { 1000000000, 100000000, 10000000, 1000000, 100000, 10000 };
+static const uint16_t can_pf_dv16[] = { 10000, 1000, 100, 10, 1 };
+
+// Digits of x from can_pf_dv16[i] down; lead = no digit printed yet
+static void can_pf_utoa(struct can_pf *pf, uint16_t x, uint8_t i, uint8_t lead)
 {
-	uint16_t i = 0;
+	uint8_t w, c;
+	uint16_t d;
 
-	while (str[i] != '\0') {
-		buf[*idx] = str[i++];
-		*idx += 1;
+	for (; i < 5; i++) {
+		w = i ? 8 : 4;  // 8 x 10000 doesn't fit in 16 bits; 65535 tops out at 6 anyway
+		d = can_pf_dv16[i] * w;
+		for (c = 0; w; w >>= 1, d >>= 1) {
+			if (x >= d) {
+				x -= d;
+				c += w;
+			}
+		}
+		if (c || !lead || i == 4) {
+			can_pf_putc(pf, '0' + c);
+			lead = 0;
+		}
 	}
 }
 
+static void can_pf_ultoa(struct can_pf *pf, uint32_t x)
+{
+	uint8_t i, w, c, lead = 1;
+	uint32_t d;
 
-static const unsigned long dv[] = {
-//  4294967296      // 32 bit unsigned max
-    1000000000,     // +0
-     100000000,     // +1
-      10000000,     // +2
-       1000000,     // +3
-        100000,     // +4
-//       65535      // 16 bit unsigned max     
-         10000,     // +5
-          1000,     // +6
-           100,     // +7
-            10,     // +8
-             1,     // +9
-};
+	if (x <= 0xFFFF) {
+		can_pf_utoa(pf, x, 0, 1);
+		return;
+	}
+	for (i=0; i < 6; i++) {
+		w = i ? 8 : 4;  // Same for 8 x 10^9 in 32 bits
+		d = can_pf_dv32[i] * w;
+		for (c = 0; w; w >>= 1, d >>= 1) {
+			if (x >= d) {
+				x -= d;
+				c += w;
+			}
+		}
+		if (c || !lead) {
+			can_pf_putc(pf, '0' + c);
+			lead = 0;
+		}
+	}
+	can_pf_utoa(pf, x, 1, 0);  // Under 10^4 now
+}
 
-static void can_pf_xtoa(uint8_t *buf, uint16_t *idx, unsigned long x, const unsigned long *dp)
+static void can_pf_puth(struct can_pf *pf, unsigned int n)
 {
-    uint8_t c;
-    unsigned long d;
-    if(x) {
-        while(x < *dp) ++dp;
-        do {
-            d = *dp++;
-            c = '0';
-            while(x >= d) ++c, x -= d;
-            can_pf_putc(buf, idx, c);
-        } while(!(d & 1));
-    } else
-        can_pf_putc(buf, idx, '0');
+	static const uint8_t hex[16] = { '0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F' };
+	can_pf_putc(pf, hex[n & 15]);
 }
 
-static void can_pf_puth(uint8_t *buf, uint16_t *idx, unsigned int n)
+#ifdef CAN_PRINTF_BINARY
+static void can_pf_putw(struct can_pf *pf, uint16_t w)
 {
-    static const uint8_t hex[16] = { '0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F' };
-    can_pf_putc(buf, idx, hex[n & 15]);
+	can_pf_putc(pf, w);
+	can_pf_putc(pf, w >> 8);
 }
- 
-void can_printf(uint32_t msgid, uint8_t is_ext, uint8_t *buf, char *format, ...)
+#endif
+
+/* Text mode: format into frames as above.  CAN_PRINTF_BINARY: send the format string's address (little-endian,
+ * 16 bits) and then each argument raw in the same order (%c 1 byte, %d %i %u %x 2, %l %n 4, %s up to its NUL
+ * inclusive), for can_printf_decode.py to format on the host against the firmware's ELF file.  Either way the
+ * output ends with its last, possibly short, frame, so each call starts a frame of its own.
+ * Returns 0, or -1 if it couldn't all be sent.
+ */
+int can_printf(uint32_t msgid, uint8_t is_ext, const char *format, ...)
 {
-    uint8_t c;
-    int i;
-    long n;
-    uint16_t idx = 0;
-    
-    va_list a;
-    va_start(a, format);
-    while( (c = *format++) ) {
-        if(c == '%') {
-            switch(c = *format++) {
-                case 's':                       // String
-                    can_pf_puts(buf, &idx, va_arg(a, uint8_t*));
-                    break;
-                case 'c':                       // Char
-                    can_pf_putc(buf, &idx, va_arg(a, int));   // Char gets promoted to Int in args, so it's an int we're looking for (GCC warning)
-                    break;
-                case 'i':                       // 16 bit Integer
-                case 'd':                       // 16 bit Integer
-                case 'u':                       // 16 bit Unsigned
-                    i = va_arg(a, int);
-                    if( (c == 'i' || c == 'd') && i < 0 ) i = -i, can_pf_putc(buf, &idx, '-');
-                    can_pf_xtoa(buf, &idx, (unsigned)i, dv + 5);
-                    break;
-                case 'l':                       // 32 bit Long
-                case 'n':                       // 32 bit uNsigned loNg
-                    n = va_arg(a, long);
-                    if(c == 'l' &&  n < 0) n = -n, can_pf_putc(buf, &idx, '-');
-                    can_pf_xtoa(buf, &idx, (unsigned long)n, dv);
-                    break;
-                case 'x':                       // 16 bit heXadecimal
-                    i = va_arg(a, int);
-                    can_pf_puth(buf, &idx, i >> 12);
-                    can_pf_puth(buf, &idx, i >> 8);
-                    can_pf_puth(buf, &idx, i >> 4);
-                    can_pf_puth(buf, &idx, i);
-                    break;
-                case 0: return;
-                default: goto bad_fmt;
-            }
-        } else
-bad_fmt:    can_pf_putc(buf, &idx, c);
-    }
-    va_end(a);
-
-    can_managed_tx(msgid, is_ext, buf, idx, 50);
+	struct can_pf pf;
+	uint8_t c;
+	int i;
+	long n;
+
+	pf.msgid = msgid;
+	pf.is_ext = is_ext;
+	pf.len = 0;
+	pf.sent = 0;
+	pf.err = 0;
+
+	va_list a;
+	va_start(a, format);
+	#ifdef CAN_PRINTF_BINARY
+	can_pf_putw(&pf, (uint16_t)(uintptr_t)format);
+	#endif
+	while( (c = *format++) ) {
+		if(c != '%') {
+			#ifndef CAN_PRINTF_BINARY
+			can_pf_putc(&pf, c);  // Literal text; in binary mode the host has it in the format string
+			#endif
+			continue;
+		}
+		switch(c = *format++) {
+			case 's':                       // String
+				can_pf_puts(&pf, va_arg(a, uint8_t*));
+				#ifdef CAN_PRINTF_BINARY
+				can_pf_putc(&pf, '\0');
+				#endif
+				break;
+			case 'c':                       // Char
+				can_pf_putc(&pf, va_arg(a, int));   // Char gets promoted to Int in args, so it's an int we're looking for (GCC warning)
+				break;
+			case 'i':                       // 16 bit Integer
+			case 'd':                       // 16 bit Integer
+			case 'u':                       // 16 bit Unsigned
+			case 'x':                       // 16 bit heXadecimal
+				i = va_arg(a, int);
+				#ifdef CAN_PRINTF_BINARY
+				can_pf_putw(&pf, i);
+				#else
+				if (c == 'x') {
+					can_pf_puth(&pf, i >> 12);
+					can_pf_puth(&pf, i >> 8);
+					can_pf_puth(&pf, i >> 4);
+					can_pf_puth(&pf, i);
+					break;
+				}
+				if( (c == 'i' || c == 'd') && i < 0 ) i = -i, can_pf_putc(&pf, '-');
+				can_pf_utoa(&pf, (unsigned)i, 0, 1);
+				#endif
+				break;
+			case 'l':                       // 32 bit Long
+			case 'n':                       // 32 bit uNsigned loNg
+				n = va_arg(a, long);
+				#ifdef CAN_PRINTF_BINARY
+				can_pf_putw(&pf, n);
+				can_pf_putw(&pf, n >> 16);
+				#else
+				if(c == 'l' &&  n < 0) n = -n, can_pf_putc(&pf, '-');
+				can_pf_ultoa(&pf, (unsigned long)n);
+				#endif
+				break;
+			case 0:                         // '%' ending the format
+				format--;
+				break;
+			default:                        // Anything else (e.g. "%%") is printed as-is
+				#ifndef CAN_PRINTF_BINARY
+				can_pf_putc(&pf, c);
+				#endif
+				break;
+		}
+	}
+	va_end(a);
+
+	can_pf_flush(&pf);
+	return pf.err ? -1 : 0;
 }
@@ -7,6 +7,16 @@
  */
 #include <stdint.h>
 
-void can_printf(uint32_t, uint8_t, uint8_t *, char *format, ...);
+/* User configuration */
+#ifndef CAN_PRINTF_PACE_MS
+#define CAN_PRINTF_PACE_MS 50  // Gap between the frames of one can_printf(), for slow receivers; 0 = none
+#endif
+
+/* Compact debug logging: send the format string's address and the raw arguments instead of the text, and let
+ * can_printf_decode.py format them on the host.  Needs the small code/data model (16-bit pointers).
+ */
+//#define CAN_PRINTF_BINARY 1
+
+int can_printf(uint32_t, uint8_t, const char *format, ...);
 
 #endif
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Decode can_printf() output sent with CAN_PRINTF_BINARY.
+
+Each can_printf() call starts a new frame with the 16-bit address of its format string, followed by the
+arguments in binary (%c 1 byte, %d %i %u %x 2, %l %n 4, %s NUL-terminated).  The format strings are read
+back out of the firmware's ELF file.
+
+Usage: can_printf_decode.py main.elf [candump.log]
+Reads candump output ("can0  00000080   [8]  43 68 ..." or "(...) can0 00000080#4368...") from the file
+or stdin, and prints one line per can_printf() call prefixed with its CAN ID.
+"""
+import re
+import struct
+import sys
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+
+class Elf:
+    """Just enough ELF32 little-endian reading to look up strings by their load address"""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        if self.data[:4] != b'\x7fELF' or self.data[4] != 1 or self.data[5] != 1:
+            raise ValueError('%s: not a 32-bit little-endian ELF file' % path)
+        shoff, = struct.unpack_from('<I', self.data, 0x20)
+        shentsize, shnum = struct.unpack_from('<HH', self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            _, sh_type, flags, addr, offset, size = struct.unpack_from('<IIIIII', self.data, shoff + i * shentsize)
+            if flags & SHF_ALLOC and sh_type != SHT_NOBITS and size:
+                self.sections.append((addr, offset, size))
+
+    def string(self, addr):
+        for base, offset, size in self.sections:
+            if base <= addr < base + size:
+                start = offset + addr - base
+                end = self.data.index(b'\0', start, offset + size)
+                return self.data[start:end].decode('latin-1')
+        raise KeyError('no string at 0x%04X' % addr)
+
+
+class Record:
+    """One can_printf() call being put back together from its frames"""
+
+    SIZES = {'c': 1, 'd': 2, 'i': 2, 'u': 2, 'x': 2, 'l': 4, 'n': 4}
+
+    def __init__(self, fmt):
+        self.fmt = fmt
+        self.out = ''
+        self.pos = 0
+        self.buf = b''
+
+    def feed(self, data):
+        """Add bytes; returns True once the whole format has been consumed"""
+        self.buf += data
+        while self.pos < len(self.fmt):
+            c = self.fmt[self.pos]
+            if c != '%':
+                self.out += c
+                self.pos += 1
+                continue
+            spec = self.fmt[self.pos + 1:self.pos + 2]
+            if spec == 's':
+                end = self.buf.find(b'\0')
+                if end < 0:
+                    return False
+                self.out += self.buf[:end].decode('latin-1')
+                self.buf = self.buf[end + 1:]
+            elif spec in self.SIZES:
+                n = self.SIZES[spec]
+                if len(self.buf) < n:
+                    return False
+                raw, self.buf = self.buf[:n], self.buf[n:]
+                if spec == 'c':
+                    self.out += raw.decode('latin-1')
+                elif spec == 'x':
+                    self.out += '%04X' % struct.unpack('<H', raw)
+                else:
+                    code = {'d': '<h', 'i': '<h', 'u': '<H', 'l': '<l', 'n': '<L'}[spec]
+                    self.out += str(struct.unpack(code, raw)[0])
+            else:
+                self.out += spec  # Printed as-is by the firmware's text mode too
+            self.pos += 2
+        return True
+
+
+FRAME = re.compile(r'\b([0-9A-Fa-f]{3}|[0-9A-Fa-f]{8})(?:#([0-9A-Fa-f]*)|\s+\[\d\]\s+((?:[0-9A-Fa-f]{2}\s*)*))\s*$')
+
+
+def frames(lines):
+    for line in lines:
+        m = FRAME.search(line)
+        if m:
+            hexdata = m.group(2) if m.group(2) is not None else m.group(3).replace(' ', '')
+            yield int(m.group(1), 16), bytes.fromhex(hexdata)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    elf = Elf(sys.argv[1])
+    src = open(sys.argv[2]) if len(sys.argv) > 2 else sys.stdin
+    pending = {}
+    for msgid, data in frames(src):
+        rec = pending.get(msgid)
+        if rec is None:
+            if len(data) < 2:
+                continue
+            addr, = struct.unpack_from('<H', data)
+            try:
+                rec = Record(elf.string(addr))
+            except KeyError as e:
+                print('%08X: %s' % (msgid, e))
+                continue
+            data = data[2:]
+        if rec.feed(data):
+            sys.stdout.write('%08X: %s' % (msgid, rec.out) + ('' if rec.out.endswith('\n') else '\n'))
+            pending.pop(msgid, None)
+        else:
+            pending[msgid] = rec
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1 @@
+../../can_timer.c
\ No newline at end of file
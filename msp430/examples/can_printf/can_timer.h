@@ -0,0 +1 @@
+../../can_timer.h
\ No newline at end of file
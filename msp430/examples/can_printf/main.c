@@ -6,6 +6,7 @@
 #include <msp430.h>
 #include "clockinit.h"
 #include "mcp2515.h"
+#include "can_timer.h"
 #include "can_printf.h"
 
 uint32_t rid;
@@ -40,6 +41,7 @@ int main()
 	
 	sleep_counter = SLEEP_COUNTER;
 
+	can_timer_init();
 	can_init();
 	if (can_speed(500000, 1, 3) < 0) {
 		P1OUT |= BIT0;
@@ -91,7 +93,7 @@ int main()
 
 		if (!sleep_counter) {
 			//can_send(0x00000080, 1, "hello\n", 6, 3);
-			can_printf(0x00000080, 1, buf, "Check it out: %d\n", i++);
+			can_printf(0x00000080, 1, "Check it out: %d\n", i++);
 			sleep_counter = SLEEP_COUNTER;
 		}
 
@@ -119,7 +121,7 @@ __interrupt void P1_ISR(void)
 {
 	if (P1IFG & CAN_IRQ_PORTBIT) {
 		P1IFG &= ~CAN_IRQ_PORTBIT;
-		mcp2515_irq |= MCP2515_IRQ_FLAGGED;
-		__bic_SR_register_on_exit(LPM4_bits);
+		if (can_isr())
+			__bic_SR_register_on_exit(LPM4_bits);
 	}
 }
@@ -0,0 +1 @@
+../../mcp2515_config.h
\ No newline at end of file
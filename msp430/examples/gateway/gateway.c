@@ -0,0 +1,106 @@
+/* gateway.c
+ * Two-segment gateway: the BoosterPack's MCP2515 (segment A) and a second one with CS on P2.0 and INT on P2.2
+ * (segment B), both at 500kbit/s.  Everything crosses both ways except the diagnostic requests 0x7DF and 0x7E0-0x7E7,
+ * which stay on A, and A's 0x1xx block, which shows up on B as 0x5xx.  LED1 lights if setup fails, LED2 whenever
+ * a frame is dropped from a full RX ring for want of a free TXB on the other side.
+ * Intended for MSP430 F5529 LaunchPad
+ */
+#include <msp430.h>
+#include "clockinit.h"
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_gateway.h"
+
+#define BITRATE 500000
+
+can_dev_t can_b = CAN_DEV_PINS(P2, BIT0, P2, BIT2);
+struct can_gateway gw;
+
+const struct can_gateway_rule a_to_b[] = {
+	{ 0x7DF, CAN_GATEWAY_EXT | 0x7FF, 0, 0, CAN_GATEWAY_DROP },
+	{ 0x7E0, CAN_GATEWAY_EXT | 0x7F8, 0, 0, CAN_GATEWAY_DROP },
+	{ 0x100, CAN_GATEWAY_EXT | 0x700, CAN_GATEWAY_EXT | 0x0FF, 0x500, 0 },
+};
+
+int setup(can_dev_t *dev)
+{
+	can_init_dev(dev);
+	if (CAN_SPEED_CONST_DEV(dev, BITRATE) < 0)
+		return -1;
+	can_rx_mode_dev(dev, 0, MCP2515_RXB0CTRL_MODE_RECV_ALL);
+	can_rx_mode_dev(dev, 1, MCP2515_RXB1CTRL_MODE_RECV_ALL);
+	can_ioctl_dev(dev, MCP2515_OPTION_ROLLOVER, 1);
+	return can_ioctl_dev(dev, MCP2515_OPTION_SLEEP, 0);
+}
+
+int main()
+{
+	struct can_irq_events ev;
+	int n;
+
+	WDTCTL = WDTPW | WDTHOLD;
+	P1SEL &= ~BIT0;
+	P1DIR |= BIT0;
+	P1OUT |= BIT0;
+	P4SEL &= ~BIT7;
+	P4DIR |= BIT7;
+	P4OUT &= ~BIT7;
+	P2OUT |= BIT0;  // Second CS high before the first can_init_dev() brings up the SPI bus
+	P2DIR |= BIT0;
+	if (!ucs_clockinit(16000000, 1, 1))
+		LPM4;
+	P1OUT &= ~BIT0;
+
+	can_timer_init();
+	if (setup(&can_dev0) < 0 || setup(&can_b) < 0) {
+		P1OUT |= BIT0;
+		LPM4;
+	}
+	can_gateway_init(&gw, &can_dev0, &can_b);
+	can_gateway_rules(&gw, 0, a_to_b, sizeof(a_to_b) / sizeof(a_to_b[0]), 0);
+
+	while(1) {
+		/* Errors and overflows are cleared, the rings topped up and finished TXBs retired before the gateway looks.
+		 * can_irq_batch_dev() stops flagging once INT is back high, even with frames still held in a ring.
+		 */
+		if (can_dev0.irq & MCP2515_IRQ_FLAGGED)
+			can_irq_batch_dev(&can_dev0, &ev);
+		if (can_b.irq & MCP2515_IRQ_FLAGGED)
+			can_irq_batch_dev(&can_b, &ev);
+		n = can_gateway_poll(&gw);
+
+		// Only can_gateway_poll() writes these, so no need for can_stats_get()
+		if (can_dev0.stats.fwd_drop || can_b.stats.fwd_drop)
+			P4OUT |= BIT7;
+
+		// Frames still held wait for the far side's TX-complete IRQ
+		_DINT();
+		if (!n && !((can_dev0.irq | can_b.irq) & MCP2515_IRQ_FLAGGED))
+			__bis_SR_register(LPM0_bits | GIE);
+		else
+			_EINT();
+	}
+	return 0;
+}
+
+// ISR for PORT1: segment A
+#pragma vector=PORT1_VECTOR
+__interrupt void P1_ISR(void)
+{
+	if (P1IFG & CAN_IRQ_PORTBIT) {
+		P1IFG &= ~CAN_IRQ_PORTBIT;
+		if (can_isr())
+			__bic_SR_register_on_exit(LPM4_bits);
+	}
+}
+
+// ISR for PORT2: segment B
+#pragma vector=PORT2_VECTOR
+__interrupt void P2_ISR(void)
+{
+	if (P2IFG & BIT2) {
+		P2IFG &= ~BIT2;
+		if (can_isr_dev(&can_b))
+			__bic_SR_register_on_exit(LPM4_bits);
+	}
+}
@@ -0,0 +1,94 @@
+/* isotp_echo.c
+ * ISO-TP echo server: any message received on 0x7E0 (standard ID) is sent straight back on 0x7E8,
+ * from the same buffer it was reassembled in.  Sleeps in LPM0 whenever there's nothing to do.
+ * Intended for MSP430 Value Line (G2xxx) chips
+ */
+#include <msp430.h>
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_isotp.h"
+
+#define ECHO_RX_ID 0x7E0
+#define ECHO_TX_ID 0x7E8
+
+struct can_isotp link;
+struct can_irq_events ev;
+uint8_t msgbuf[128];
+
+int main()
+{
+	int n;
+	can_frame_t *f;
+
+	WDTCTL = WDTPW | WDTHOLD;
+	DCOCTL = CALDCO_16MHZ;
+	BCSCTL1 = CALBC1_16MHZ;
+	BCSCTL2 = DIVS_1;
+	BCSCTL3 = LFXT1S_2;
+	while (BCSCTL3 & LFXT1OF)
+		;
+
+	P1DIR |= BIT0;
+	P1OUT &= ~BIT0;
+
+	can_timer_init();  // SMCLK = 8MHz / 8, matching CAN_TIMER_HZ in the Makefile
+	can_init();
+	if (can_speed(500000, 1, 3) < 0) {
+		P1OUT |= BIT0;
+		LPM4;
+	}
+
+	// Filters aren't cleared by reset; point all six at our ID so RXB1 catches what overflows RXB0
+	can_rx_setmask(0, 0x000007FF, 0);
+	can_rx_setmask(1, 0x000007FF, 0);
+	for (n=0; n < 6; n++)
+		can_rx_setfilter(n / 2 ? 1 : 0, n / 2 ? n-2 : n, ECHO_RX_ID);
+	can_rx_mode(0, MCP2515_RXB0CTRL_MODE_RECV_STD);
+	can_rx_mode(1, MCP2515_RXB1CTRL_MODE_RECV_STD);
+	can_ioctl(MCP2515_OPTION_ROLLOVER, 1);
+
+	can_ioctl(MCP2515_OPTION_LOOPBACK, 0);
+	can_ioctl(MCP2515_OPTION_ONESHOT, 0);
+
+	can_isotp_init(&link, ECHO_TX_ID, ECHO_RX_ID, 0, msgbuf, sizeof(msgbuf));
+	_EINT();
+
+	while (1) {
+		if (mcp2515_irq & MCP2515_IRQ_FLAGGED)
+			can_irq_batch(&ev);
+
+		// Frames are handed over where can_isr() left them in the RX ring
+		while ( (f = can_recv_peek()) ) {
+			can_isotp_input_frame(&link, f);
+			can_recv_drop();
+		}
+
+		n = can_isotp_recv(&link);
+		if (n > 0)
+			can_isotp_send(&link, msgbuf, n);  // The peer waits for our reply, so msgbuf won't be overwritten meanwhile
+		else if (n < 0)
+			P1OUT ^= BIT0;  // Reception failed
+
+		can_timer_fired = 0;  // can_isotp_poll() re-arms the alarm if it's waiting out an STmin
+		if (can_isotp_poll(&link) == CAN_ISOTP_ERROR)
+			P1OUT ^= BIT0;
+
+		_DINT();
+		if ( !(mcp2515_irq & MCP2515_IRQ_FLAGGED) && can_rx_pending() < 0 && !can_timer_fired )
+			__bis_SR_register(LPM0_bits | GIE);
+		else
+			_EINT();
+	}
+	return 0;
+}
+
+// ISR for PORT1
+#pragma vector=PORT1_VECTOR
+__interrupt void P1_ISR(void)
+{
+	if (P1IFG & CAN_IRQ_PORTBIT) {
+		P1IFG &= ~CAN_IRQ_PORTBIT;
+		if (can_isr())
+			__bic_SR_register_on_exit(LPM4_bits);
+	}
+}
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""Decode a can_log.c binary log (see can_log.h for the format) into candump -l or Vector ASC text.
+
+Usage: can_log_decode.py [--asc] [-t BASE] [-i IFACE] [log.bin]
+  --asc     write Vector ASC instead of candump -l lines
+  -t BASE   wall-clock time of the first frame, in seconds since the epoch (default 0)
+  -i IFACE  interface name for candump lines (default can0)
+Reads the log from the file or stdin: a UART capture, which may start mid-buffer, or a flash dump, which may end
+in erased 0xFF pages.  Frames reported lost by the logger are counted on stderr (and as ASC comments).
+"""
+import struct
+import sys
+import time
+
+START, SYNC, LOST, PAD = 0x30, 0x31, 0x32, 0xFF
+MAGIC = b'CL'
+
+
+class Decoder:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+        self.hz = 2000000  # CAN_TIMER_HZ's default, until a START record says otherwise
+        self.time = None   # Ticks of the last record, unwrapped past 32 bits
+        self.synced = False
+        self.lost = 0
+        self.skipped = 0
+
+    def resync(self):
+        """Skip to the next SYNC; a reader joining a stream late, or after a damaged record, starts over there"""
+        nxt = self.data.find(bytes([SYNC]) + MAGIC, self.pos + 1)
+        nxt = len(self.data) if nxt < 0 else nxt
+        self.skipped += nxt - self.pos
+        self.pos = nxt
+        self.synced = False
+
+    def take(self, n):
+        if self.pos + n > len(self.data):
+            raise EOFError
+        b = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return b
+
+    def records(self):
+        """Yields (ticks, id, ext, rtr, dlc, data) per frame, ticks being can_timer_now() unwrapped past 32 bits"""
+        while self.pos < len(self.data):
+            start = self.pos
+            try:
+                hdr = self.take(1)[0]
+                if hdr == PAD:
+                    continue  # Rest of a flash page
+                if hdr & 0x30 == 0x30:
+                    if hdr == START and self.take(2) == MAGIC:
+                        version, self.hz, _bufsize = struct.unpack('<BIH', self.take(7))
+                        if version != 1:
+                            sys.exit('log version %d not supported' % version)
+                    elif hdr == SYNC and self.take(2) == MAGIC:
+                        t, = struct.unpack('<I', self.take(4))
+                        self.time = t if self.time is None else self.time + ((t - self.time) & 0xFFFFFFFF)
+                        self.synced = True
+                    elif hdr == LOST and self.synced:
+                        self.lost += struct.unpack('<H', self.take(2))[0]
+                    else:
+                        self.pos = start
+                        self.resync()
+                    continue
+                if not self.synced:
+                    self.pos = start
+                    self.resync()
+                    continue
+                n = (hdr >> 4 & 3) + 1
+                delta = int.from_bytes(self.take(n), 'little')
+                ext, rtr, dlc = hdr & 0x80, hdr & 0x40, hdr & 0x0F
+                msgid = int.from_bytes(self.take(4 if ext else 2), 'little')
+                payload = b'' if rtr else self.take(min(dlc, 8))
+                self.time += delta
+                yield self.time, msgid, bool(ext), bool(rtr), dlc, payload
+            except EOFError:
+                self.skipped += len(self.data) - start
+                return
+
+
+def candump(msgid, ext, rtr, dlc, payload):
+    s = ('%08X' if ext else '%03X') % msgid + '#'
+    if rtr:
+        return s + 'R' + (str(dlc) if dlc else '')
+    return s + payload.hex().upper()
+
+
+def asc(msgid, ext, rtr, dlc, payload):
+    s = '%-15s Rx   ' % (('%Xx' if ext else '%X') % msgid)
+    if rtr:
+        return s + 'r'
+    return s + 'd %d' % dlc + ''.join(' %02X' % b for b in payload)
+
+
+def main():
+    args = sys.argv[1:]
+    fmt_asc, base, iface, path = False, '0', 'can0', None
+    while args:
+        a = args.pop(0)
+        if a == '--asc':
+            fmt_asc = True
+        elif a == '-t' and args:
+            base = args.pop(0)
+        elif a == '-i' and args:
+            iface = args.pop(0)
+        elif path is None and not a.startswith('-') or a == '-':
+            path = a
+        else:
+            sys.exit(__doc__)
+    # Integer microseconds throughout, so the output's times round-trip exactly
+    sec, _, frac = base.partition('.')
+    base_us = int(sec or 0) * 1000000 + int((frac + '000000')[:6])
+
+    if path is None or path == '-':
+        data = sys.stdin.buffer.read()
+    else:
+        with open(path, 'rb') as f:
+            data = f.read()
+    dec = Decoder(data)
+    out = sys.stdout
+    first = None
+    if fmt_asc:
+        out.write('date %s\nbase hex  timestamps absolute\nno internal events logged\nBegin Triggerblock %s\n' %
+                  ((time.strftime('%a %b %d %I:%M:%S %p %Y', time.gmtime(base_us // 1000000)),) * 2))
+    reported = 0
+    for ticks, msgid, ext, rtr, dlc, payload in dec.records():
+        if first is None:
+            first = ticks
+        us = (ticks - first) * 1000000 // dec.hz
+        if fmt_asc:
+            if dec.lost != reported:
+                out.write('// %d frames lost\n' % (dec.lost - reported))
+                reported = dec.lost
+            out.write('%11.6f 1  %s\n' % (us / 1e6, asc(msgid, ext, rtr, dlc, payload)))
+        else:
+            us += base_us
+            out.write('(%d.%06d) %s %s\n' % (us // 1000000, us % 1000000, iface, candump(msgid, ext, rtr, dlc, payload)))
+    if fmt_asc:
+        out.write('End TriggerBlock\n')
+    if dec.lost:
+        sys.stderr.write('%d frames lost by the logger\n' % dec.lost)
+    if dec.skipped:
+        sys.stderr.write('%d bytes skipped outside a buffer\n' % dec.skipped)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,153 @@
+/* logger.c
+ * Bus logger: receives everything at 500kbit/s and streams it, in can_log.h's binary format, out of UCA1
+ * (P4.4 TXD) at 1Mbaud 8N1 by DMA, which keeps up with a fully loaded bus.  Use a USB-serial adapter on P4.4;
+ * the LaunchPad's backchannel UART doesn't go that fast.  Decode the capture with can_log_decode.py.
+ * With LOG_FLASH defined it writes to a 25-series SPI NOR flash instead (CS on P2.2, sharing the MCP2515's SPI bus),
+ * from the start of the chip until it is full.  LED1 lights if the setup fails, LED2 whenever the logger drops frames.
+ * Intended for MSP430 F5529 LaunchPad
+ */
+#include <msp430.h>
+#include "clockinit.h"
+#include "mcp2515.h"
+#include "msp430_spi.h"
+#include "can_timer.h"
+#include "can_log.h"
+
+#define BITRATE 500000
+//#define LOG_FLASH
+#define FLASH_SIZE 0x400000UL  // 32Mbit
+#define FLUSH_MS 100           // Longest a frame waits in a part-filled UART buffer on a quiet bus
+
+struct can_log lg;
+#ifdef LOG_FLASH
+struct can_log_flash flash;
+#endif
+
+// UCA1 on P4.4 (TXD) / P4.5 (RXD), SMCLK = 16MHz, 1Mbaud
+void uart_init()
+{
+	P4SEL |= BIT4 | BIT5;
+	UCA1CTL1 = UCSWRST | UCSSEL_2;
+	UCA1BR0 = 16;
+	UCA1BR1 = 0;
+	UCA1MCTL = UCBRF_0 | UCBRS_0;
+	UCA1CTL1 &= ~UCSWRST;
+}
+
+/* can_log_out_t: DMA channel 2 feeds UCA1TXBUF on UCA1TXIFG (trigger 21).  TXIFG is already set while the UART
+ * is idle, so there is no edge to start on; the first byte is written by hand and the DMA sends the rest.
+ */
+void uart_out(struct can_log *l, const uint8_t *buf, uint16_t len)
+{
+	if (len > 1) {
+		DMA2CTL = 0;
+		DMACTL1 = (DMACTL1 & ~0x001F) | 21;
+		DMA2SA = (uintptr_t)(buf + 1);
+		DMA2DA = (uintptr_t)&UCA1TXBUF;
+		DMA2SZ = len - 1;
+		DMA2CTL = DMADT_0 | DMADSTINCR_0 | DMASRCINCR_3 | DMADSTBYTE | DMASRCBYTE | DMAIE | DMAEN;
+		UCA1TXBUF = buf[0];
+	} else {
+		UCA1TXBUF = buf[0];
+		can_log_done(l);
+	}
+}
+
+int main()
+{
+	#ifndef LOG_FLASH
+	uint32_t flush_at;
+	#endif
+
+	WDTCTL = WDTPW | WDTHOLD;
+	P1SEL &= ~BIT0;
+	P1DIR |= BIT0;
+	P1OUT |= BIT0;
+	P4SEL &= ~BIT7;
+	P4DIR |= BIT7;
+	P4OUT &= ~BIT7;
+	if (!ucs_clockinit(16000000, 1, 1))
+		LPM4;
+	P1OUT &= ~BIT0;
+
+	can_timer_init();
+	can_init();
+	if (can_speed(BITRATE, 1, 3) < 0) {
+		P1OUT |= BIT0;
+		LPM4;
+	}
+	can_rx_mode(0, MCP2515_RXB0CTRL_MODE_RECV_ALL);
+	can_rx_mode(1, MCP2515_RXB1CTRL_MODE_RECV_ALL);
+	can_ioctl(MCP2515_OPTION_ROLLOVER, 1);
+	can_ioctl(MCP2515_OPTION_LISTEN_ONLY, 1);
+
+	#ifdef LOG_FLASH
+	can_log_flash_init(&flash, &P2OUT, &P2DIR, BIT2, 0, FLASH_SIZE);
+	can_log_flash_erase(&flash);
+	can_log_start(&lg, &can_dev0, can_log_flash_out, &flash, CAN_LOG_BUF_SIZE);
+	#else
+	uart_init();
+	// A SYNC costs 7 bytes per buffer; waiting for a quarter buffer keeps that overhead low at a few ms latency
+	can_log_start(&lg, &can_dev0, uart_out, 0, CAN_LOG_BUF_SIZE / 4);
+	flush_at = can_timer_now() + CAN_TIMER_MS(FLUSH_MS);
+	#endif
+
+	while(1) {
+		can_log_poll(&lg);
+		#ifdef LOG_FLASH
+		can_log_flash_poll(&flash);
+		if (flash.full)
+			P1OUT |= BIT0;
+		#endif
+		if (lg.dropped)
+			P4OUT |= BIT7;
+		// Errors and overflows are just cleared; listen-only mode can't disturb the bus
+		if (mcp2515_irq & MCP2515_IRQ_FLAGGED)
+			can_irq_handler();
+
+		#ifndef LOG_FLASH
+		if (can_timer_expired(flush_at)) {
+			can_log_flush(&lg);
+			flush_at = can_timer_now() + CAN_TIMER_MS(FLUSH_MS);
+		}
+		// Sleep until a frame comes in, the DMA finishes a buffer or it's time to flush
+		can_timer_alarm(flush_at);
+		_DINT();
+		if (!can_rx_pending() && !(mcp2515_irq & MCP2515_IRQ_FLAGGED) && !can_timer_fired)
+			__bis_SR_register(LPM0_bits | GIE);
+		else
+			_EINT();
+		#endif
+	}
+	return 0;
+}
+
+// ISR for PORT1
+#pragma vector=PORT1_VECTOR
+__interrupt void P1_ISR(void)
+{
+	if (P1IFG & CAN_IRQ_PORTBIT) {
+		P1IFG &= ~CAN_IRQ_PORTBIT;
+		if (can_isr())
+			__bic_SR_register_on_exit(LPM4_bits);
+	}
+}
+
+/* ISR for DMA: an SPI block is done (only with SPI_DMA_SLEEP), or the last byte of a buffer has gone to
+ * UCA1TXBUF, so it can be refilled
+ */
+#pragma vector=DMA_VECTOR
+__interrupt void DMA_ISR(void)
+{
+	#ifdef SPI_DMA_TRIG_RX
+	if (spi_dma_isr())
+		__bic_SR_register_on_exit(LPM0_bits);
+	#endif
+	#ifndef LOG_FLASH
+	if (DMA2CTL & DMAIFG) {
+		DMA2CTL &= ~DMAIFG;
+		can_log_done(&lg);
+		__bic_SR_register_on_exit(LPM4_bits);
+	}
+	#endif
+}
@@ -0,0 +1,164 @@
+/* profile.c
+ * Bus profiler: listens (without ever ACKing or transmitting) at 500kbit/s and prints the bus load and the
+ * busiest IDs once a second over the LaunchPad's backchannel UART (115200 8N1).
+ * Intended for MSP430 F5529 LaunchPad
+ */
+#include <msp430.h>
+#include "clockinit.h"
+#include "mcp2515.h"
+#include "can_timer.h"
+#include "can_profile.h"
+
+#define BITRATE 500000
+#define WINDOW_MS 1000
+#define TOP_N 8
+
+struct can_profile prof;
+struct can_profile_id top[TOP_N];
+
+// UCA1 on P4.4 (TXD) / P4.5 (RXD), SMCLK = 16MHz
+void uart_init()
+{
+	P4SEL |= BIT4 | BIT5;
+	UCA1CTL1 = UCSWRST | UCSSEL_2;
+	UCA1BR0 = 8;
+	UCA1BR1 = 0;
+	UCA1MCTL = UCBRF_11 | UCBRS_0 | UCOS16;
+	UCA1CTL1 &= ~UCSWRST;
+}
+
+/* Printing a report takes tens of milliseconds at 115200, far longer than the RX ring lasts on a busy bus,
+ * so keep counting frames while waiting for the UART.
+ */
+void uart_putc(char c)
+{
+	while ( !(UCA1IFG & UCTXIFG) )
+		can_profile_poll(&prof);
+	UCA1TXBUF = c;
+}
+
+void uart_puts(const char *s)
+{
+	while (*s)
+		uart_putc(*s++);
+}
+
+void uart_putu(uint32_t n, uint8_t width)
+{
+	char buf[11];
+	uint8_t i = sizeof(buf);
+
+	buf[--i] = '\0';
+	do {
+		buf[--i] = '0' + n % 10;
+		n /= 10;
+		if (width)
+			width--;
+	} while (n);
+	while (width--)
+		uart_putc(' ');
+	uart_puts(buf + i);
+}
+
+void uart_puthex(uint32_t n, uint8_t digits)
+{
+	while (digits--)
+		uart_putc("0123456789ABCDEF"[(n >> (4*digits)) & 0x0F]);
+}
+
+// Load in 0.1% as "12.3%"
+void uart_putload(uint16_t l)
+{
+	uart_putu(l / 10, 3);
+	uart_putc('.');
+	uart_putc('0' + l % 10);
+	uart_putc('%');
+}
+
+void report()
+{
+	uint8_t i, n;
+	uint16_t load, load_max, peak;
+	uint32_t frames;
+
+	// Snapshot first; uart_putc() keeps the counters moving while this is printed
+	load = prof.load;
+	load_max = prof.load_max;
+	peak = prof.load_peak;
+	frames = prof.frames;
+	n = can_profile_top(&prof, top, TOP_N);
+
+	uart_puts("load");
+	uart_putload(load);
+	uart_puts(" (stuffed <=");
+	uart_putload(load_max);
+	uart_puts(", peak");
+	uart_putload(peak);
+	uart_puts(")  frames ");
+	uart_putu(frames, 0);
+	uart_puts("  IDs ");
+	uart_putu(prof.n_ids, 0);
+	if (prof.untracked) {
+		uart_puts(" (+");
+		uart_putu(prof.untracked, 0);
+		uart_puts(" frames untracked)");
+	}
+	uart_puts("\r\n");
+	for (i=0; i < n; i++) {
+		uart_puts("  ");
+		if (top[i].key & CAN_PROFILE_EXT)
+			uart_puthex(top[i].key & ~CAN_PROFILE_EXT, 8);
+		else
+			uart_puthex(top[i].key, 3);
+		uart_putu(top[i].count, 11);
+		uart_puts("\r\n");
+	}
+}
+
+int main()
+{
+	WDTCTL = WDTPW | WDTHOLD;
+	P1SEL &= ~BIT0;
+	P1DIR |= BIT0;
+	P1OUT |= BIT0;
+	if (!ucs_clockinit(16000000, 1, 1))
+		LPM4;
+	P1OUT &= ~BIT0;
+
+	uart_init();
+	can_timer_init();
+	can_init();
+	if (can_speed(BITRATE, 1, 3) < 0 || can_profile_start(&prof, &can_dev0, BITRATE, WINDOW_MS) < 0) {
+		P1OUT |= BIT0;
+		LPM4;
+	}
+	uart_puts("\r\nprofiling\r\n");
+
+	while(1) {
+		if (can_profile_poll(&prof))
+			report();
+		// Errors and overflows are just cleared; listen-only mode can't disturb the bus
+		if (mcp2515_irq & MCP2515_IRQ_FLAGGED)
+			can_irq_handler();
+
+		// Sleep until a frame comes in or the window ends, whichever is first
+		can_timer_alarm(prof.start + prof.window);
+		_DINT();
+		if (!can_rx_pending() && !(mcp2515_irq & MCP2515_IRQ_FLAGGED) && !can_timer_fired)
+			__bis_SR_register(LPM0_bits | GIE);
+		else
+			_EINT();
+	}
+	return 0;
+}
+
+// ISR for PORT1
+#pragma vector=PORT1_VECTOR
+__interrupt void P1_ISR(void)
+{
+	if (P1IFG & CAN_IRQ_PORTBIT) {
+		P1IFG &= ~CAN_IRQ_PORTBIT;
+		if (can_isr())
+			__bic_SR_register_on_exit(LPM4_bits);
+	}
+}
@@ -26,7 +26,7 @@ int main()
 	P1OUT &= ~BIT0;
 
 	can_init();
-	if (can_speed(500000, 1, 1) < 0) {
+	if (CAN_SPEED_CONST(500000) < 0) {
 		P1OUT |= BIT0;
 		LPM4;
 	}
@@ -0,0 +1,308 @@
+/* gwtest.c
+ * can_gateway.c tests: two simulated controllers on separate segments (A on can_dev0, B on P2.0/P2.2) with the
+ * gateway between them.  Frames injected on one segment should come out of the other controller's TXBs intact,
+ * in order, with RTRs kept as RTRs, rules dropping and remapping as written, frames waiting in the RX ring (not
+ * the TX queue) for a TXB, the oldest dropped once it's full, and the forward latency in the stats running from
+ * reception to TX-complete by a clock the test sets, even when the far side refills the TXB before it is seen.
+ */
+#include <msp430.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "mcp2515_sim.h"
+#include "can_timer.h"
+#include "can_gateway.h"
+
+#define BITRATE 500000
+
+static sim_mcp2515_t sim_a, sim_b;
+static can_dev_t can_b = CAN_DEV_PINS(P2, BIT0, P2, BIT2);
+static struct can_gateway gw;
+static uint32_t now;
+static int failures;
+static const char *test_name;
+
+#define CHECK(cond) do { if (!(cond)) { printf("  %s: %s:%d: %s\n", test_name, __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// Frames each side sent, in order
+static struct sim_frame sent[2][64];
+static uint8_t n_sent[2];
+
+uint32_t can_timer_now()
+{
+	return now;
+}
+
+uint32_t can_timer_stamp()
+{
+	return now;
+}
+
+static void on_tx(sim_mcp2515_t *d, const struct sim_frame *f)
+{
+	uint8_t side = d == &sim_b;
+
+	if (n_sent[side] < 64)
+		sent[side][n_sent[side]++] = *f;
+}
+
+static void port1_isr(void)
+{
+	if (P1IFG & CAN_IRQ_PORTBIT) {
+		P1IFG &= ~CAN_IRQ_PORTBIT;
+		can_isr();
+	}
+}
+
+static void port2_isr(void)
+{
+	if (P2IFG & BIT2) {
+		P2IFG &= ~BIT2;
+		can_isr_dev(&can_b);
+	}
+}
+
+static void setup_dev(sim_mcp2515_t *sim, can_dev_t *dev, uint8_t seg)
+{
+	sim_attach(sim, dev);
+	sim->seg = seg;
+	sim->on_tx = on_tx;
+	can_init_dev(dev);
+	CAN_SPEED_CONST_DEV(dev, BITRATE);
+	can_rx_mode_dev(dev, 0, MCP2515_RXB0CTRL_MODE_RECV_ALL);
+	can_rx_mode_dev(dev, 1, MCP2515_RXB1CTRL_MODE_RECV_ALL);
+	can_ioctl_dev(dev, MCP2515_OPTION_ROLLOVER, 1);
+	can_ioctl_dev(dev, MCP2515_OPTION_SLEEP, 0);
+}
+
+static void setup(const char *name)
+{
+	test_name = name;
+	setup_dev(&sim_a, &can_dev0, 0);
+	setup_dev(&sim_b, &can_b, 1);
+	can_gateway_init(&gw, &can_dev0, &can_b);
+	memset(n_sent, 0, sizeof(n_sent));
+	now = 1000;
+	sim_stats_reset();
+}
+
+// The application's main loop: errors handled, then the gateway
+static void service()
+{
+	if (can_dev0.irq & MCP2515_IRQ_FLAGGED)
+		can_irq_handler_dev(&can_dev0);
+	if (can_b.irq & MCP2515_IRQ_FLAGGED)
+		can_irq_handler_dev(&can_b);
+	can_gateway_poll(&gw);
+}
+
+static int same(const struct sim_frame *a, const struct sim_frame *b)
+{
+	return a->id == b->id && a->ext == b->ext && a->rtr == b->rtr && a->dlc == b->dlc &&
+	       (a->rtr || !memcmp(a->data, b->data, a->dlc > 8 ? 8 : a->dlc));
+}
+
+static void test_forward()
+{
+	static const uint8_t d[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	struct sim_frame f[6];
+	uint8_t i;
+
+	setup("forward");
+	sim_frame_std(&f[0], 0x123, 8, d);
+	sim_frame_ext(&f[1], 0x18DA10F1, 3, d);
+	sim_frame_std(&f[2], 0x7DF, 0, 0);
+	f[2].rtr = 1;
+	sim_frame_std(&f[3], 0x7E0, 0, 0);
+	f[3].rtr = 1;
+	f[3].dlc = 8;
+	sim_frame_ext(&f[4], 0x18DAF110, 0, 0);
+	f[4].rtr = 1;
+	f[4].dlc = 2;
+	sim_frame_std(&f[5], 0x000, 0, 0);
+
+	for (i=0; i < 6; i++) {
+		CHECK(sim_bus_inject_seg(0, &f[i]) == 1);
+		service();
+		CHECK(sim_bus_flush(10) == 1);
+	}
+	CHECK(n_sent[1] == 6 && n_sent[0] == 0);
+	for (i=0; i < n_sent[1]; i++)
+		CHECK(same(&sent[1][i], &f[i]));
+
+	// And back the other way
+	CHECK(sim_bus_inject_seg(1, &f[0]) == 1);
+	service();
+	CHECK(sim_bus_flush(10) == 1);
+	CHECK(n_sent[0] == 1 && same(&sent[0][0], &f[0]));
+
+	CHECK(can_dev0.stats.fwd == 6 && can_b.stats.fwd == 1);
+	CHECK(!can_dev0.stats.fwd_filtered && !can_dev0.stats.fwd_drop);
+	CHECK(!sim_stats.faults);
+}
+
+static void test_rules()
+{
+	static const struct can_gateway_rule rules[] = {
+		{ 0x7DF, CAN_GATEWAY_EXT | 0x7FF, 0, 0, CAN_GATEWAY_DROP },          // Not this one
+		{ 0x100, CAN_GATEWAY_EXT | 0x700, CAN_GATEWAY_EXT | 0x0FF, 0x300, 1 },  // 0x1xx -> 0x3xx
+		{ CAN_GATEWAY_EXT | 0x18DA0000, 0xFFFF0000, 0x000000FF, 0x600, 0 },  // Extended 0x18DAxxyy -> standard 0x6yy
+		{ 0x200, CAN_GATEWAY_EXT | 0x700, 0xFFFFFFFF, 0, 2 },                // 0x2xx as-is
+	};
+	struct sim_frame f, out;
+
+	setup("rules");
+	can_gateway_rules(&gw, 0, rules, sizeof(rules) / sizeof(rules[0]), CAN_GATEWAY_DROP);
+
+	sim_frame_std(&f, 0x7DF, 0, 0);
+	sim_bus_inject_seg(0, &f);
+	sim_frame_std(&f, 0x400, 1, "x");  // No rule
+	sim_bus_inject_seg(0, &f);
+	service();
+	CHECK(sim_bus_flush(10) == 0);
+	CHECK(can_dev0.stats.fwd_filtered == 2 && !can_dev0.stats.fwd);
+
+	sim_frame_std(&f, 0x1AB, 2, "hi");
+	sim_bus_inject_seg(0, &f);
+	service();
+	CHECK(sim_bus_flush(10) == 1);
+	sim_frame_std(&out, 0x3AB, 2, "hi");
+	CHECK(n_sent[1] == 1 && same(&sent[1][0], &out));
+	CHECK((sim_reg(&sim_b, MCP2515_TXB0CTRL) & 0x03) == 1 || (sim_reg(&sim_b, MCP2515_TXB0CTRL + 0x10) & 0x03) == 1 ||
+	      (sim_reg(&sim_b, MCP2515_TXB0CTRL + 0x20) & 0x03) == 1);
+
+	sim_frame_ext(&f, 0x18DA10F1, 0, 0);
+	f.rtr = 1;
+	f.dlc = 4;
+	sim_bus_inject_seg(0, &f);
+	service();
+	CHECK(sim_bus_flush(10) == 1);
+	sim_frame_std(&out, 0x6F1, 0, 0);
+	out.rtr = 1;
+	out.dlc = 4;
+	CHECK(n_sent[1] == 2 && same(&sent[1][1], &out));
+
+	sim_frame_std(&f, 0x234, 1, "y");
+	sim_bus_inject_seg(0, &f);
+	service();
+	CHECK(sim_bus_flush(10) == 1);
+	CHECK(n_sent[1] == 3 && same(&sent[1][2], &f));
+
+	// B to A still forwards everything
+	sim_frame_std(&f, 0x7DF, 0, 0);
+	sim_bus_inject_seg(1, &f);
+	service();
+	CHECK(sim_bus_flush(10) == 1);
+	CHECK(n_sent[0] == 1 && same(&sent[0][0], &f));
+	CHECK(can_dev0.stats.fwd == 3 && can_dev0.stats.fwd_filtered == 2 && can_b.stats.fwd == 1);
+	CHECK(!sim_stats.faults);
+}
+
+/* Segment B never gets a turn on the wire (nothing calls sim_bus_step()), so its 3 TXBs fill, then A's RX ring, and
+ * then the oldest frames in the ring are dropped.  None go through B's TX queue.  Once B's segment is free again,
+ * everything that was kept goes out in order.
+ */
+static void test_drop()
+{
+	struct sim_frame f;
+	uint8_t i, j;
+
+	setup("drop");
+	for (i=0; i < 24; i++) {
+		sim_frame_std(&f, 0x100, 1, &i);
+		sim_bus_inject_seg(0, &f);
+		service();
+	}
+	CHECK(can_dev0.stats.fwd == 3);
+	CHECK(can_dev0.stats.fwd_drop > 0);
+	CHECK(can_dev0.stats.ring_hwm == MCP2515_RX_RING_SIZE);
+	do {
+		service();
+	} while (sim_bus_flush(50));
+	CHECK(can_dev0.stats.fwd + can_dev0.stats.fwd_drop == 24);
+	CHECK(!can_dev0.stats.rxovr[0] && !can_dev0.stats.rxovr[1]);  // The ring kept draining the RXBs
+	CHECK(!can_b.stats.txq_hwm);
+	CHECK(n_sent[1] == can_dev0.stats.fwd);
+	for (i=1; i < n_sent[1]; i++)
+		CHECK(sent[1][i].data[0] > sent[1][i-1].data[0]);
+	for (i=0, j=0; i < n_sent[1]; i++)
+		j += sent[1][i].data[0] == i;
+	CHECK(j == 3);  // The first ones went straight into TXBs
+	CHECK(n_sent[1] && sent[1][n_sent[1]-1].data[0] == 23);  // And the newest one was kept
+	CHECK(!sim_stats.faults);
+}
+
+// Latency only counts once the frame is on the far side's segment
+static void test_latency()
+{
+	struct sim_frame f;
+
+	setup("latency");
+	sim_frame_std(&f, 0x100, 8, "abcdefgh");
+	sim_bus_inject_seg(0, &f);  // Stamped now
+	now += 500;
+	service();
+	CHECK(can_dev0.stats.fwd == 1 && !can_dev0.stats.fwd_lat_ticks);
+	sim_bus_flush(10);
+	now += 200;
+	service();
+	CHECK(can_dev0.stats.fwd_lat_ticks == 700);
+
+	sim_frame_std(&f, 0x101, 8, "abcdefgh");
+	sim_bus_inject_seg(0, &f);
+	now += 100;
+	service();
+	sim_bus_flush(10);
+	now += 50;
+	service();
+	CHECK(can_dev0.stats.fwd == 2);
+	CHECK(can_dev0.stats.fwd_lat_max == 700);
+	CHECK(can_dev0.stats.fwd_lat_ticks == 850);
+}
+
+/* A forwarded frame's TXB retired and refilled from B's own TX queue in can_isr() before the gateway looks: busy all
+ * along as far as the main loop can tell, but still sent, and only counted the once.
+ */
+static void test_latency_refill()
+{
+	static const uint8_t d[8] = { 0 };
+	struct sim_frame f;
+	uint8_t i;
+
+	setup("latency refill");
+	sim_frame_std(&f, 0x100, 8, "abcdefgh");
+	sim_bus_inject_seg(0, &f);
+	service();  // Forwarded into TXB2
+	for (i=0; i < 4; i++)
+		can_send_dev(&can_b, 0x300 + i, 0, (void *)d, 8, 0);  // TXB1, TXB0, then queued
+	CHECK(sim_bus_flush(1) == 1 && n_sent[1] == 1 && same(&sent[1][0], &f));
+	CHECK(can_b.txb == 0x07);  // Refilled already
+	now += 200;
+	service();
+	CHECK(can_dev0.stats.fwd_lat_ticks == 200);
+	sim_bus_flush(10);
+	now += 100;
+	service();
+	CHECK(n_sent[1] == 5);
+	CHECK(can_dev0.stats.fwd_lat_ticks == 200 && can_dev0.stats.fwd_lat_max == 200);
+	CHECK(!sim_stats.faults);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "-v"))
+		sim_trace = 1;
+	sim_set_isr(&P1IFG, port1_isr);
+	sim_set_isr(&P2IFG, port2_isr);
+	test_forward();
+	test_rules();
+	test_drop();
+	test_latency();
+	test_latency_refill();
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,165 @@
+/* logdump.c
+ * Plays a bus trace (candump -l format, as for replay.c) into the simulated MCP2515 and logs it with can_log.c,
+ * writing the binary log to stdout.  can_timer_now()/can_timer_stamp() follow the trace's timestamps, started
+ * just short of the 32-bit wrap and 10s before the first frame so both the wrap and a SYNC for a too-long delta
+ * get exercised.  "make check" pipes the log through examples/logger/can_log_decode.py and diffs it with the trace.
+ *
+ * Usage: logdump [-l n] trace.log > log.bin
+ *   -l n  run the main loop (and let the output finish a buffer) only every n frames, so both buffers fill up
+ * Exits nonzero on a simulator fault or a frame the logger didn't take; a summary goes to stderr.
+ */
+#include <msp430.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "mcp2515_sim.h"
+#include "can_timer.h"
+#include "can_log.h"
+
+#define BITRATE 500000
+#define START_TICKS (0xFFFFFFFFUL - 4 * CAN_TIMER_HZ)  // Wraps 4s in, 6s before the first frame
+
+static sim_mcp2515_t sim;
+static struct can_log lg;
+static uint32_t now;
+
+// The output: takes one poll's worth of time to write each buffer out, like a UART at about the bus rate
+static const uint8_t *out_buf;
+static uint16_t out_len;
+
+uint32_t can_timer_now()
+{
+	return now;
+}
+
+uint32_t can_timer_stamp()
+{
+	return now;
+}
+
+static void port1_isr(void)
+{
+	if (P1IFG & CAN_IRQ_PORTBIT) {
+		P1IFG &= ~CAN_IRQ_PORTBIT;
+		can_isr();
+	}
+}
+
+static void out(struct can_log *l, const uint8_t *buf, uint16_t len)
+{
+	(void)l;
+	out_buf = buf;
+	out_len = len;
+}
+
+static void out_finish()
+{
+	if (!out_buf)
+		return;
+	fwrite(out_buf, 1, out_len, stdout);
+	out_buf = 0;
+	can_log_done(&lg);
+}
+
+static void service()
+{
+	out_finish();
+	if (mcp2515_irq & MCP2515_IRQ_FLAGGED)
+		can_irq_handler();
+	can_log_poll(&lg);
+}
+
+// "(sec.usec) iface ID#DATA" into f and its time in microseconds; returns 0 if the line isn't a frame
+static int parse(const char *line, struct sim_frame *f, uint64_t *us)
+{
+	const char *p, *hash;
+	char *end;
+	uint32_t id;
+	uint8_t n;
+
+	if (line[0] != '(' || !(hash = strchr(line, '#')))
+		return 0;
+	*us = strtoull(line + 1, &end, 10) * 1000000;
+	if (*end == '.')
+		*us += strtoul(end + 1, 0, 10);
+	for (p = hash; p > line && p[-1] != ' '; p--)
+		;
+	id = strtoul(p, &end, 16);
+	if (end != hash)
+		return 0;
+	if (hash - p > 3)
+		sim_frame_ext(f, id, 0, 0);
+	else
+		sim_frame_std(f, id, 0, 0);
+	p = hash + 1;
+	if (*p == 'R') {
+		f->rtr = 1;
+		f->dlc = (p[1] >= '0' && p[1] <= '8') ? p[1] - '0' : 0;
+		return 1;
+	}
+	for (n=0; n < 8 && sscanf(p, "%2hhx", &f->data[n]) == 1; n++)
+		p += 2;
+	f->dlc = n;
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct sim_frame f;
+	char line[256];
+	FILE *in;
+	int i, loop = 1;
+	uint64_t us, first = 0;
+	uint32_t n_frames = 0, since = 0;
+
+	for (i=1; i < argc - 1; i++) {
+		if (!strcmp(argv[i], "-l") && i < argc - 2)
+			loop = atoi(argv[++i]);
+		else
+			break;
+	}
+	if (i != argc - 1 || loop < 1 || !(in = fopen(argv[i], "r"))) {
+		fprintf(stderr, "usage: %s [-l n] trace.log > log.bin\n", argv[0]);
+		return 2;
+	}
+
+	sim_set_isr(&P1IFG, port1_isr);
+	sim_attach(&sim, &can_dev0);
+	can_init();
+	CAN_SPEED_CONST(BITRATE);
+	can_rx_mode(0, MCP2515_RXB0CTRL_MODE_RECV_ALL);
+	can_rx_mode(1, MCP2515_RXB1CTRL_MODE_RECV_ALL);
+	can_ioctl(MCP2515_OPTION_ROLLOVER, 1);
+	can_ioctl(MCP2515_OPTION_SLEEP, 0);
+	now = START_TICKS;
+	can_log_start(&lg, &can_dev0, out, 0, 1);
+
+	while (fgets(line, sizeof(line), in)) {
+		if (!parse(line, &f, &us))
+			continue;
+		if (!n_frames++)
+			first = us;
+		now = START_TICKS + 10 * CAN_TIMER_HZ + (uint32_t)((us - first) * (CAN_TIMER_HZ / 1000000));
+		sim_bus_inject(&f);
+		if (++since >= (uint32_t)loop) {
+			service();
+			since = 0;
+		}
+	}
+	fclose(in);
+	service();
+	out_finish();
+	while (can_log_flush(&lg))
+		out_finish();
+
+	fprintf(stderr, "  %lu frames: %lu logged, %lu dropped, %lu lost in the controller; %lu bytes (%.1f per frame)\n",
+		(unsigned long)n_frames, (unsigned long)lg.frames, (unsigned long)lg.dropped, (unsigned long)sim_stats.rxovr,
+		(unsigned long)lg.bytes, n_frames ? (double)lg.bytes / n_frames : 0.0);
+	if (sim_stats.faults || lg.frames + lg.dropped + sim_stats.rxovr != n_frames) {
+		fprintf(stderr, "  FAIL: %lu faults, %lu frames unaccounted for\n", (unsigned long)sim_stats.faults,
+			(unsigned long)(n_frames - lg.frames - lg.dropped - sim_stats.rxovr));
+		return 1;
+	}
+	return 0;
+}
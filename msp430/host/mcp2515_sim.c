@@ -0,0 +1,818 @@
+/* mcp2515_sim.c
+ * Simulated MCP2515 and SPI backend for host builds; see mcp2515_sim.h
+ */
+
+#include <msp430.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "msp430_spi.h"
+#include "mcp2515_sim.h"
+
+// What <msp430.h> declares
+volatile uint8_t P1OUT, P1DIR, P1IN, P1REN, P1IES, P1IE, P1IFG;
+volatile uint8_t P2OUT, P2DIR, P2IN, P2REN, P2IES, P2IE, P2IFG;
+volatile uint16_t TA0R;
+#ifdef SPI_BYTE_COUNT
+volatile uint16_t spi_bytes;
+#endif
+
+struct sim_stats sim_stats;
+int sim_trace;
+
+static uint8_t sim_tbuf[32], sim_tlen;  // The transaction in progress, for sim_trace
+
+static sim_mcp2515_t *sim_bus;        // Every attached controller
+static uint16_t sim_sr;               // The CPU's GIE
+static uint8_t sim_in_isr;
+static void (*sim_isr_p1)(void), (*sim_isr_p2)(void);
+
+#define SIM_TA0R_PER_BYTE 8  // SMCLK/2 ticks per byte at an 8MHz SPI clock off 16MHz, for MCP2515_STATS_CLOCK
+
+// Instruction decoding, per transaction
+#define SIM_IDLE 0      // CS high
+#define SIM_CMD 1       // Instruction byte next
+#define SIM_ADDR 2      // READ, WRITE, BIT MODIFY: address byte next
+#define SIM_DATA 3      // READ, WRITE, LOAD TX BUFFER, READ RX BUFFER: data at addr
+#define SIM_MASK 4      // BIT MODIFY: mask byte next
+#define SIM_VALUE 5     // BIT MODIFY: data byte next
+#define SIM_STATUS 6    // READ STATUS, RX STATUS: the same byte over and over
+#define SIM_DONE 7      // Nothing more until CS goes high
+
+// CANSTAT.OPMOD / CANCTRL.REQOP
+#define SIM_MODE_NORMAL 0
+#define SIM_MODE_SLEEP 1
+#define SIM_MODE_LOOPBACK 2
+#define SIM_MODE_LISTEN 3
+#define SIM_MODE_CONFIG 4
+
+#define SIM_MODE(d) ((d)->regs[MCP2515_CANSTAT] >> 5)
+#define SIM_TXB(n) (MCP2515_TXB0CTRL + 0x10*(n))
+#define SIM_RXB(n) (MCP2515_RXB0CTRL + 0x10*(n))
+
+static void sim_reset(sim_mcp2515_t *d)
+{
+	memset(d->regs, 0, sizeof(d->regs));
+	d->regs[MCP2515_CANCTRL] = 0x87;  // REQOP CONFIGURATION, CLKEN, CLKPRE /8
+	d->regs[MCP2515_CANSTAT] = 0x80;
+	d->rxclear = 0;
+	d->onwire = 0;
+	d->abort = 0;
+}
+
+/* Registers */
+
+// CANSTAT.ICOD: the highest priority interrupt that's both flagged and enabled
+static uint8_t sim_icod(const sim_mcp2515_t *d)
+{
+	uint8_t f = d->regs[MCP2515_CANINTF] & d->regs[MCP2515_CANINTE];
+
+	if (f & MCP2515_CANINTF_ERRIF)
+		return 1;
+	if (f & MCP2515_CANINTF_WAKIF)
+		return 2;
+	if (f & MCP2515_CANINTF_TX0IF)
+		return 3;
+	if (f & MCP2515_CANINTF_TX1IF)
+		return 4;
+	if (f & MCP2515_CANINTF_TX2IF)
+		return 5;
+	if (f & MCP2515_CANINTF_RX0IF)
+		return 6;
+	if (f & MCP2515_CANINTF_RX1IF)
+		return 7;
+	return 0;
+}
+
+static uint8_t sim_read(const sim_mcp2515_t *d, uint8_t addr)
+{
+	addr &= 0x7F;
+	if ((addr & 0x0F) == 0x0E)  // CANSTAT shows up at the end of every row
+		return (d->regs[MCP2515_CANSTAT] & 0xE0) | (sim_icod(d) << 1);
+	if ((addr & 0x0F) == 0x0F)  // As does CANCTRL
+		return d->regs[MCP2515_CANCTRL];
+	return d->regs[addr];
+}
+
+static void sim_ctrl(sim_mcp2515_t *d, uint8_t v)
+{
+	uint8_t n, *c;
+
+	d->regs[MCP2515_CANCTRL] = v;
+	if (v & MCP2515_CANCTRL_ABAT) {
+		for (n=0; n < 3; n++) {
+			c = &d->regs[SIM_TXB(n)];
+			if (*c & MCP2515_TXBCTRL_TXREQ)
+				*c = (*c & ~MCP2515_TXBCTRL_TXREQ) | MCP2515_TXBCTRL_ABTF;
+		}
+	}
+	// Mode changes take effect at once; there's never a frame in flight to wait for
+	if ((v >> 5) <= SIM_MODE_CONFIG)
+		d->regs[MCP2515_CANSTAT] = (d->regs[MCP2515_CANSTAT] & 0x1F) | (v & 0xE0);
+}
+
+// Registers that only take writes in CONFIGURATION mode: TXRTSCTRL, filters, masks and CNF1-3
+static uint8_t sim_config_only(uint8_t addr)
+{
+	return addr < 0x0C || addr == MCP2515_TXRTSCTRL || (addr >= 0x10 && addr < 0x1C) || (addr >= 0x20 && addr <= MCP2515_CNF1);
+}
+
+// v in the mask bits, the rest left as they are; plain writes come through here with mask 0xFF
+static void sim_write(sim_mcp2515_t *d, uint8_t addr, uint8_t v, uint8_t mask)
+{
+	uint8_t cur, n;
+
+	addr &= 0x7F;
+	cur = d->regs[addr];
+	v = (cur & ~mask) | (v & mask);
+	if ((addr & 0x0F) == 0x0E)
+		return;
+	if ((addr & 0x0F) == 0x0F) {
+		sim_ctrl(d, (d->regs[MCP2515_CANCTRL] & ~mask) | (v & mask));
+		return;
+	}
+	if (sim_config_only(addr) && SIM_MODE(d) != SIM_MODE_CONFIG)
+		return;
+
+	switch (addr) {
+		case MCP2515_TEC:
+		case MCP2515_REC:
+			return;
+		case MCP2515_EFLG:  // Only the overflow flags are the MCU's to write
+			d->regs[addr] = (cur & 0x3F) | (v & 0xC0);
+			return;
+		case MCP2515_TXB0CTRL:
+		case MCP2515_TXB1CTRL:
+		case MCP2515_TXB2CTRL:
+			if ( (v & MCP2515_TXBCTRL_TXREQ) && !(cur & MCP2515_TXBCTRL_TXREQ) )
+				cur &= ~(MCP2515_TXBCTRL_ABTF | MCP2515_TXBCTRL_MLOA | MCP2515_TXBCTRL_TXERR);
+			n = (addr - MCP2515_TXB0CTRL) >> 4;
+			if ( (cur & MCP2515_TXBCTRL_TXREQ) && !(v & MCP2515_TXBCTRL_TXREQ) && (d->onwire & (1 << n)) ) {
+				d->abort |= 1 << n;  // Not until the frame on the wire is done with
+				v |= MCP2515_TXBCTRL_TXREQ;
+			}
+			d->regs[addr] = (cur & 0x70) | (v & 0x0B);
+			return;
+		case MCP2515_RXB0CTRL:  // RXM and BUKT; BUKT1 mirrors BUKT
+			d->regs[addr] = (cur & 0x09) | (v & 0x64) | ((v & 0x04) >> 1);
+			return;
+		case MCP2515_RXB1CTRL:
+			d->regs[addr] = (cur & 0x0F) | (v & 0x60);
+			return;
+	}
+	if (addr > MCP2515_TXB0CTRL && addr < 0x60 && (addr & 0x0F) <= 0x0D) {
+		n = (addr - MCP2515_TXB0CTRL) >> 4;
+		if (d->regs[SIM_TXB(n)] & MCP2515_TXBCTRL_TXREQ) {
+			sim_stats.faults++;  // Rewriting a frame that's waiting to go out
+			return;
+		}
+	}
+	if (addr > MCP2515_RXB0CTRL && (addr & 0x0F) <= 0x0D)
+		return;  // RX buffers are read-only
+	d->regs[addr] = v;
+}
+
+// BIT MODIFY works on these only; anywhere else it acts as a plain write (mask forced to 0xFF)
+static void sim_bitmod(sim_mcp2515_t *d, uint8_t addr, uint8_t mask, uint8_t v)
+{
+	addr &= 0x7F;
+	if ( !(addr == MCP2515_BFPCTRL || addr == MCP2515_TXRTSCTRL || (addr & 0x0F) == 0x0F ||
+	       (addr >= MCP2515_CNF3 && addr <= MCP2515_EFLG) || addr == MCP2515_TXB0CTRL || addr == MCP2515_TXB1CTRL ||
+	       addr == MCP2515_TXB2CTRL || addr == MCP2515_RXB0CTRL || addr == MCP2515_RXB1CTRL) )
+		mask = 0xFF;
+	sim_write(d, addr, v, mask);
+}
+
+static uint8_t sim_read_status(const sim_mcp2515_t *d)
+{
+	uint8_t f = d->regs[MCP2515_CANINTF], s;
+
+	s = f & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF);
+	if (d->regs[MCP2515_TXB0CTRL] & MCP2515_TXBCTRL_TXREQ)
+		s |= 0x04;
+	if (f & MCP2515_CANINTF_TX0IF)
+		s |= 0x08;
+	if (d->regs[MCP2515_TXB1CTRL] & MCP2515_TXBCTRL_TXREQ)
+		s |= 0x10;
+	if (f & MCP2515_CANINTF_TX1IF)
+		s |= 0x20;
+	if (d->regs[MCP2515_TXB2CTRL] & MCP2515_TXBCTRL_TXREQ)
+		s |= 0x40;
+	if (f & MCP2515_CANINTF_TX2IF)
+		s |= 0x80;
+	return s;
+}
+
+// Which RXBs are full, and the type and filter hit of the one the driver would read first
+static uint8_t sim_rx_status(const sim_mcp2515_t *d)
+{
+	uint8_t f = d->regs[MCP2515_CANINTF] & 0x03, s, n, ctrl;
+
+	s = f << 6;
+	if (!f)
+		return s;
+	n = (f & MCP2515_CANINTF_RX0IF) ? 0 : 1;
+	ctrl = d->regs[SIM_RXB(n)];
+	if (d->regs[SIM_RXB(n) + 2] & 0x08)
+		s |= 0x10;
+	if (ctrl & 0x08)
+		s |= 0x08;
+	s |= n ? (ctrl & 0x07) : (ctrl & 0x01);
+	return s;
+}
+
+/* The INT pin and the CPU's port interrupts */
+
+static void sim_pins()
+{
+	sim_mcp2515_t *d;
+	can_dev_t *dev;
+	uint8_t lvl;
+
+	for (d=sim_bus; d; d=d->next) {
+		dev = d->dev;
+		lvl = (d->regs[MCP2515_CANINTF] & d->regs[MCP2515_CANINTE]) ? 0 : 1;
+		if (lvl)
+			*dev->irq_in |= dev->irq_bit;
+		else
+			*dev->irq_in &= ~dev->irq_bit;
+		if (lvl != d->intpin && !lvl == !!(*dev->irq_ies & dev->irq_bit))
+			*dev->irq_ifg |= dev->irq_bit;  // The edge PxIES is set up for
+		d->intpin = lvl;
+	}
+}
+
+// Run port ISRs for as long as something they're enabled for is pending and GIE is on
+static void sim_dispatch()
+{
+	void (*isr)(void);
+	uint16_t sr, n;
+
+	sim_pins();
+	if ( !(sim_sr & GIE) || sim_in_isr )
+		return;
+	for (n=0; n < 1000; n++) {
+		if (sim_isr_p1 && (P1IFG & P1IE))
+			isr = sim_isr_p1;
+		else if (sim_isr_p2 && (P2IFG & P2IE))
+			isr = sim_isr_p2;
+		else
+			return;
+		sr = sim_sr;
+		sim_sr &= ~GIE;  // As on interrupt entry
+		sim_in_isr = 1;
+		sim_stats.isr_calls++;
+		isr();
+		sim_in_isr = 0;
+		sim_sr = sr;
+		sim_pins();
+	}
+	sim_stats.faults++;  // An ISR that never clears its PxIFG
+}
+
+uint16_t __get_SR_register()
+{
+	return sim_sr;
+}
+
+// Low-power bits are ignored: nothing happens in the "meantime" on a host, so sleeping is returning
+void __bis_SR_register(uint16_t bits)
+{
+	sim_sr |= bits & GIE;
+	if (bits & GIE)
+		sim_dispatch();
+}
+
+void __bic_SR_register(uint16_t bits)
+{
+	sim_sr &= ~bits;
+}
+
+void __bic_SR_register_on_exit(uint16_t bits)
+{
+	(void)bits;
+}
+
+void __delay_cycles(uint32_t n)
+{
+	(void)n;
+}
+
+/* SPI */
+
+void spi_init()
+{
+}
+
+static sim_mcp2515_t *sim_selected()
+{
+	sim_mcp2515_t *d, *sel = 0;
+
+	for (d=sim_bus; d; d=d->next) {
+		if (!d->cs) {
+			if (sel)
+				return 0;
+			sel = d;
+		}
+	}
+	return sel;
+}
+
+// One byte of the transaction in progress; returns what the controller shifts out meanwhile
+static uint8_t sim_byte(sim_mcp2515_t *d, uint8_t b)
+{
+	uint8_t r = 0xFF, n;
+
+	switch (d->state) {
+		case SIM_CMD:
+			d->cmd = b;
+			d->state = SIM_DONE;
+			if (b == MCP2515_SPI_RESET) {
+				sim_reset(d);
+				sim_stats.cmd[SIM_CMD_RESET]++;
+			} else if (b == MCP2515_SPI_READ || b == MCP2515_SPI_WRITE || b == MCP2515_SPI_BITMOD) {
+				d->state = SIM_ADDR;
+				sim_stats.cmd[b == MCP2515_SPI_READ ? SIM_CMD_READ : b == MCP2515_SPI_WRITE ? SIM_CMD_WRITE : SIM_CMD_BIT_MODIFY]++;
+			} else if (b == MCP2515_SPI_READ_STATUS || b == MCP2515_SPI_RX_STATUS) {
+				d->state = SIM_STATUS;
+				sim_stats.cmd[b == MCP2515_SPI_READ_STATUS ? SIM_CMD_READ_STATUS : SIM_CMD_RX_STATUS]++;
+			} else if ((b & 0xF8) == MCP2515_SPI_LOAD_TXBUF && (b & 0x07) <= 5) {
+				d->addr = SIM_TXB(b >> 1 & 0x03) + ((b & 1) ? 6 : 1);  // TXBnSIDH or TXBnD0
+				d->state = SIM_DATA;
+				sim_stats.cmd[SIM_CMD_LOAD_TXBUF]++;
+			} else if ((b & 0xF9) == MCP2515_SPI_READ_RXBUF) {
+				n = (b >> 2) & 1;
+				d->addr = SIM_RXB(n) + ((b & 0x02) ? 6 : 1);  // RXBnSIDH or RXBnD0
+				d->rxclear |= MCP2515_CANINTF_RX0IF << n;
+				d->state = SIM_DATA;
+				sim_stats.cmd[SIM_CMD_READ_RXBUF]++;
+			} else if ((b & 0xF8) == MCP2515_SPI_RTS) {
+				for (n=0; n < 3; n++) {
+					if (b & (1 << n))
+						sim_write(d, SIM_TXB(n), MCP2515_TXBCTRL_TXREQ, MCP2515_TXBCTRL_TXREQ);
+				}
+				sim_stats.cmd[SIM_CMD_RTS]++;
+			} else {
+				sim_stats.cmd[SIM_CMD_UNKNOWN]++;
+			}
+			break;
+
+		case SIM_ADDR:
+			d->addr = b & 0x7F;
+			d->state = (d->cmd == MCP2515_SPI_BITMOD) ? SIM_MASK : SIM_DATA;
+			break;
+
+		case SIM_DATA:
+			if (d->cmd == MCP2515_SPI_READ || (d->cmd & 0xF9) == MCP2515_SPI_READ_RXBUF)
+				r = sim_read(d, d->addr);
+			else
+				sim_write(d, d->addr, b, 0xFF);
+			d->addr = (d->addr + 1) & 0x7F;
+			break;
+
+		case SIM_MASK:
+			d->mask = b;
+			d->state = SIM_VALUE;
+			break;
+
+		case SIM_VALUE:
+			sim_bitmod(d, d->addr, d->mask, b);
+			d->state = SIM_DONE;
+			break;
+
+		case SIM_STATUS:
+			r = (d->cmd == MCP2515_SPI_READ_STATUS) ? sim_read_status(d) : sim_rx_status(d);
+			break;
+	}
+	return r;
+}
+
+uint8_t spi_transfer(uint8_t b)
+{
+	sim_mcp2515_t *d;
+	uint8_t r;
+
+	sim_stats.bytes++;
+	TA0R += SIM_TA0R_PER_BYTE;
+	#ifdef SPI_BYTE_COUNT
+	spi_bytes++;
+	#endif
+	if ( !(d = sim_selected()) ) {
+		sim_stats.faults++;  // No CS low, or more than one
+		return 0xFF;
+	}
+	r = sim_byte(d, b);
+	if (sim_tlen < sizeof(sim_tbuf)) {
+		sim_tbuf[sim_tlen++] = b;
+		sim_tbuf[sim_tlen++] = r;
+	}
+	return r;
+}
+
+uint16_t spi_transfer16(uint16_t w)
+{
+	uint16_t r;
+
+	r = (uint16_t)spi_transfer(w >> 8) << 8;
+	return r | spi_transfer(w & 0xFF);
+}
+
+uint16_t spi_transfer9(uint16_t w)
+{
+	return spi_transfer(w & 0xFF);
+}
+
+void spi_transfer_block(const uint8_t *tx, uint8_t *rx, uint16_t len)
+{
+	uint8_t r;
+
+	while (len--) {
+		r = spi_transfer(tx ? *tx++ : 0xFF);
+		if (rx)
+			*rx++ = r;
+	}
+}
+
+void spi_write_block(const uint8_t *buf, uint16_t len)
+{
+	spi_transfer_block(buf, 0, len);
+}
+
+void spi_read_block(uint8_t *buf, uint16_t len)
+{
+	spi_transfer_block(0, buf, len);
+}
+
+// "cs" and the bytes out, with what came back for the reads
+static void sim_trace_print(const sim_mcp2515_t *d)
+{
+	uint8_t i;
+
+	printf("    spi %u:", (unsigned)d->dev->cs_bit);
+	for (i=0; i < sim_tlen; i += 2)
+		printf(" %02X", sim_tbuf[i]);
+	if (d->cmd == MCP2515_SPI_READ || (d->cmd & 0xF9) == MCP2515_SPI_READ_RXBUF ||
+	    d->cmd == MCP2515_SPI_READ_STATUS || d->cmd == MCP2515_SPI_RX_STATUS) {
+		printf(" ->");
+		for (i = (d->cmd == MCP2515_SPI_READ) ? 4 : 2; i < sim_tlen; i += 2)
+			printf(" %02X", sim_tbuf[i+1]);
+	}
+	printf("\n");
+}
+
+// A transaction starts or ends on every CS edge; READ RX BUFFER's RXnIF clears as it ends
+void spi_cs_changed()
+{
+	sim_mcp2515_t *d;
+	uint8_t lvl;
+
+	for (d=sim_bus; d; d=d->next) {
+		lvl = (*d->dev->cs_out & d->dev->cs_bit) ? 1 : 0;
+		if (lvl == d->cs)
+			continue;
+		d->cs = lvl;
+		if (!lvl) {
+			d->state = SIM_CMD;
+			sim_tlen = 0;
+			sim_stats.transactions++;
+		} else {
+			if (sim_trace)
+				sim_trace_print(d);
+			d->regs[MCP2515_CANINTF] &= ~d->rxclear;
+			d->rxclear = 0;
+			d->state = SIM_IDLE;
+		}
+	}
+	sim_dispatch();
+}
+
+/* The CAN bus */
+
+static void sim_frame_regs(const struct sim_frame *f, uint8_t *r)
+{
+	uint8_t len = f->rtr ? 0 : (f->dlc > 8 ? 8 : f->dlc);
+
+	if (f->ext) {
+		r[0] = f->id >> 21;
+		r[1] = ((f->id >> 13) & 0xE0) | 0x08 | ((f->id >> 16) & 0x03);
+		r[2] = f->id >> 8;
+		r[3] = f->id;
+		r[4] = (f->dlc & 0x0F) | (f->rtr ? 0x40 : 0);
+	} else {
+		r[0] = f->id >> 3;
+		r[1] = ((f->id & 0x07) << 5) | (f->rtr ? 0x10 : 0);  // A standard RTR reads back in SRR
+		r[2] = 0;
+		r[3] = 0;
+		r[4] = f->dlc & 0x0F;
+	}
+	memcpy(r + 5, f->data, len);
+}
+
+static void sim_regs_frame(const uint8_t *r, struct sim_frame *f)
+{
+	memset(f, 0, sizeof(struct sim_frame));
+	f->ext = (r[1] & 0x08) ? 1 : 0;
+	if (f->ext)
+		f->id = ((uint32_t)r[0] << 21) | ((uint32_t)(r[1] & 0xE0) << 13) | ((uint32_t)(r[1] & 0x03) << 16) |
+			((uint32_t)r[2] << 8) | r[3];
+	else
+		f->id = ((uint32_t)r[0] << 3) | (r[1] >> 5);
+	f->rtr = (r[4] & 0x40) ? 1 : 0;  // TXBnDLC carries RTR for either kind
+	f->dlc = r[4] & 0x0F;
+	if (!f->rtr)
+		memcpy(f->data, r + 5, f->dlc > 8 ? 8 : f->dlc);
+}
+
+// Arbitration field as it goes out, MSB first: lower wins
+static uint32_t sim_arb_key(const struct sim_frame *f)
+{
+	if (f->ext)
+		return ((f->id >> 18) << 21) | 0x00180000UL | ((f->id & 0x3FFFF) << 1) | f->rtr;  // SRR and IDE recessive
+	return (f->id << 21) | ((uint32_t)f->rtr << 20);
+}
+
+// Filter (4 bytes, RXFnSIDH on) against f under mask (RXMnSIDH on)
+static uint8_t sim_match(const uint8_t *flt, const uint8_t *mask, const struct sim_frame *f)
+{
+	uint32_t fid, mid;
+
+	if ( !(flt[1] & 0x08) != !f->ext )
+		return 0;  // EXIDE picks which kind the filter applies to
+	if (f->ext) {
+		fid = ((uint32_t)flt[0] << 21) | ((uint32_t)(flt[1] & 0xE0) << 13) | ((uint32_t)(flt[1] & 0x03) << 16) |
+		      ((uint32_t)flt[2] << 8) | flt[3];
+		mid = ((uint32_t)mask[0] << 21) | ((uint32_t)(mask[1] & 0xE0) << 13) | ((uint32_t)(mask[1] & 0x03) << 16) |
+		      ((uint32_t)mask[2] << 8) | mask[3];
+		return ((fid ^ f->id) & mid) == 0;
+	}
+	fid = ((uint32_t)flt[0] << 3) | (flt[1] >> 5);
+	mid = ((uint32_t)mask[0] << 3) | (mask[1] >> 5);
+	if ((fid ^ f->id) & mid)
+		return 0;
+	// Standard frames: the EID bytes filter the first two data bytes
+	return ((flt[2] ^ f->data[0]) & mask[2]) == 0 && ((flt[3] ^ f->data[1]) & mask[3]) == 0;
+}
+
+static const uint8_t sim_rxf_addr[6] = { 0x00, 0x04, 0x08, 0x10, 0x14, 0x18 };
+
+// Filter hit for RXBn (0-5), 0xFF if the RXB doesn't accept the frame, 0xFE if it takes anything (RXM = 11)
+static uint8_t sim_accept(const sim_mcp2515_t *d, uint8_t n, const struct sim_frame *f)
+{
+	uint8_t rxm = (d->regs[SIM_RXB(n)] >> 5) & 0x03, i;
+
+	if (rxm == 3)
+		return 0xFE;
+	if ((rxm == 1 && f->ext) || (rxm == 2 && !f->ext))
+		return 0xFF;
+	for (i = n ? 2 : 0; i < (n ? 6 : 2); i++) {
+		if (sim_match(&d->regs[sim_rxf_addr[i]], &d->regs[n ? MCP2515_RXM1SIDH : MCP2515_RXM0SIDH], f))
+			return i;
+	}
+	return 0xFF;
+}
+
+static void sim_load_rxb(sim_mcp2515_t *d, uint8_t n, const struct sim_frame *f, uint8_t filhit)
+{
+	uint8_t *ctrl = &d->regs[SIM_RXB(n)];
+
+	sim_frame_regs(f, &d->regs[SIM_RXB(n) + 1]);
+	*ctrl &= n ? 0x60 : 0x66;
+	if (f->rtr)
+		*ctrl |= 0x08;
+	if (filhit < 6)
+		*ctrl |= n ? filhit : filhit & 0x01;
+	d->regs[MCP2515_CANINTF] |= MCP2515_CANINTF_RX0IF << n;
+	sim_stats.rx++;
+}
+
+static void sim_overflow(sim_mcp2515_t *d, uint8_t n)
+{
+	d->regs[MCP2515_EFLG] |= MCP2515_EFLG_RX0OVR << n;
+	d->regs[MCP2515_CANINTF] |= MCP2515_CANINTF_ERRIF;
+	sim_stats.rxovr++;
+}
+
+// A frame on the wire reaching d; 1 if it went into an RXB
+static uint8_t sim_rx(sim_mcp2515_t *d, const struct sim_frame *f)
+{
+	uint8_t hit, full = d->regs[MCP2515_CANINTF];
+
+	switch (SIM_MODE(d)) {
+		case SIM_MODE_SLEEP:
+			// Bus activity wakes it, the frame itself is lost; it comes up in LISTEN-ONLY mode
+			d->regs[MCP2515_CANINTF] |= MCP2515_CANINTF_WAKIF;
+			d->regs[MCP2515_CANSTAT] = (d->regs[MCP2515_CANSTAT] & 0x1F) | (SIM_MODE_LISTEN << 5);
+			return 0;
+		case SIM_MODE_CONFIG:
+			return 0;
+	}
+
+	if ( (hit = sim_accept(d, 0, f)) != 0xFF ) {
+		if ( !(full & MCP2515_CANINTF_RX0IF) ) {
+			sim_load_rxb(d, 0, f, hit);
+			return 1;
+		}
+		if (d->regs[MCP2515_RXB0CTRL] & 0x04) {  // BUKT: roll over, RXB1 reporting RXF0/RXF1 as FILHIT 0/1
+			if ( !(full & MCP2515_CANINTF_RX1IF) ) {
+				sim_load_rxb(d, 1, f, hit < 6 ? hit : 0xFE);
+				return 1;
+			}
+			sim_overflow(d, 1);
+			return 0;
+		}
+		sim_overflow(d, 0);
+		return 0;
+	}
+	if ( (hit = sim_accept(d, 1, f)) != 0xFF ) {
+		if ( !(full & MCP2515_CANINTF_RX1IF) ) {
+			sim_load_rxb(d, 1, f, hit);
+			return 1;
+		}
+		sim_overflow(d, 1);
+	}
+	return 0;
+}
+
+void sim_attach(sim_mcp2515_t *d, can_dev_t *dev)
+{
+	sim_mcp2515_t *p;
+
+	for (p=sim_bus; p && p != d; p=p->next)
+		;
+	if (!p) {
+		d->next = sim_bus;
+		sim_bus = d;
+		d->on_tx = 0;
+		d->seg = 0;
+	}
+	d->dev = dev;
+	sim_reset(d);
+	d->cs = 1;
+	d->state = SIM_IDLE;
+	d->intpin = 1;
+	*dev->irq_in |= dev->irq_bit;
+}
+
+void sim_set_isr(volatile uint8_t *ifg, void (*isr)(void))
+{
+	if (ifg == &P1IFG)
+		sim_isr_p1 = isr;
+	else if (ifg == &P2IFG)
+		sim_isr_p2 = isr;
+}
+
+void sim_stats_reset()
+{
+	memset(&sim_stats, 0, sizeof(struct sim_stats));
+}
+
+uint8_t sim_reg(const sim_mcp2515_t *d, uint8_t addr)
+{
+	return sim_read(d, addr);
+}
+
+int sim_bus_inject_seg(uint8_t seg, const struct sim_frame *f)
+{
+	sim_mcp2515_t *d;
+	int n = 0;
+
+	for (d=sim_bus; d; d=d->next) {
+		if (d->seg == seg && SIM_MODE(d) != SIM_MODE_LOOPBACK)
+			n += sim_rx(d, f);
+	}
+	sim_dispatch();
+	return n;
+}
+
+int sim_bus_inject(const struct sim_frame *f)
+{
+	return sim_bus_inject_seg(0, f);
+}
+
+// The TXB d would send next: highest TXP, then highest buffer number; -1 if none is pending
+static int sim_next_txb(const sim_mcp2515_t *d)
+{
+	int n, best = -1;
+	uint8_t c;
+
+	for (n=0; n < 3; n++) {
+		c = d->regs[SIM_TXB(n)];
+		if ( (c & MCP2515_TXBCTRL_TXREQ) && (best < 0 || (c & 0x03) >= (d->regs[SIM_TXB(best)] & 0x03)) )
+			best = n;
+	}
+	return best;
+}
+
+int sim_bus_step()
+{
+	sim_mcp2515_t *d, *win = 0, *r;
+	struct sim_frame f, wf;
+	int n, wn = 0;
+
+	for (d=sim_bus; d; d=d->next) {
+		if ( (SIM_MODE(d) != SIM_MODE_NORMAL && SIM_MODE(d) != SIM_MODE_LOOPBACK) || (n = sim_next_txb(d)) < 0 )
+			continue;
+		sim_regs_frame(&d->regs[SIM_TXB(n) + 1], &f);
+		if (!win || sim_arb_key(&f) < sim_arb_key(&wf)) {
+			win = d;
+			wn = n;
+			wf = f;
+		}
+	}
+	if (!win)
+		return 0;
+
+	win->regs[SIM_TXB(wn)] &= ~MCP2515_TXBCTRL_TXREQ;
+	win->regs[MCP2515_CANINTF] |= MCP2515_CANINTF_TX0IF << wn;
+	win->onwire &= ~(1 << wn);
+	win->abort &= ~(1 << wn);
+	sim_stats.tx++;
+	if (SIM_MODE(win) == SIM_MODE_LOOPBACK) {
+		sim_rx(win, &wf);
+	} else {
+		for (r=sim_bus; r; r=r->next) {
+			if (r != win && r->seg == win->seg && SIM_MODE(r) != SIM_MODE_LOOPBACK)
+				sim_rx(r, &wf);
+		}
+	}
+	if (win->on_tx)
+		win->on_tx(win, &wf);
+	sim_dispatch();
+	return 1;
+}
+
+int sim_bus_flush(uint16_t limit)
+{
+	int n = 0;
+
+	while (n < limit && sim_bus_step())
+		n++;
+	return n;
+}
+
+void sim_errors(sim_mcp2515_t *d, uint8_t tec, uint8_t rec)
+{
+	uint8_t e = 0, old = d->regs[MCP2515_EFLG];
+
+	d->regs[MCP2515_TEC] = tec;
+	d->regs[MCP2515_REC] = rec;
+	if (tec >= 96)
+		e |= MCP2515_EFLG_TXWAR | MCP2515_EFLG_EWARN;
+	if (rec >= 96)
+		e |= MCP2515_EFLG_RXWAR | MCP2515_EFLG_EWARN;
+	if (tec >= 128)
+		e |= MCP2515_EFLG_TXEP;
+	if (rec >= 128)
+		e |= MCP2515_EFLG_RXEP;
+	if (tec == 255)
+		e |= MCP2515_EFLG_TXBO;  // 256 and up on the real part; TEC is 8 bits here
+	d->regs[MCP2515_EFLG] = (old & 0xC0) | e;
+	if ((old & 0x3F) != e)
+		d->regs[MCP2515_CANINTF] |= MCP2515_CANINTF_ERRIF;
+	sim_dispatch();
+}
+
+void sim_tx_error(sim_mcp2515_t *d, uint8_t n)
+{
+	uint8_t *c = &d->regs[SIM_TXB(n)];
+	uint16_t tec;
+
+	if ( !(*c & MCP2515_TXBCTRL_TXREQ) )
+		return;
+	*c |= MCP2515_TXBCTRL_TXERR;
+	if (d->regs[MCP2515_CANCTRL] & MCP2515_CANCTRL_OSM)
+		*c &= ~MCP2515_TXBCTRL_TXREQ;  // One-shot: no retry, and no TXnIF either
+	d->regs[MCP2515_CANINTF] |= MCP2515_CANINTF_MERRF;
+	tec = d->regs[MCP2515_TEC] + 8;
+	sim_errors(d, tec > 255 ? 255 : tec, d->regs[MCP2515_REC]);
+}
+
+void sim_tx_lost(sim_mcp2515_t *d, uint8_t n)
+{
+	uint8_t *c = &d->regs[SIM_TXB(n)];
+
+	if ( !(*c & MCP2515_TXBCTRL_TXREQ) )
+		return;
+	*c |= MCP2515_TXBCTRL_MLOA;
+	if (d->abort & (1 << n))
+		*c = (*c & ~MCP2515_TXBCTRL_TXREQ) | MCP2515_TXBCTRL_ABTF;  // No interrupt for that
+	d->onwire &= ~(1 << n);
+	d->abort &= ~(1 << n);
+}
+
+void sim_frame_std(struct sim_frame *f, uint32_t id, uint8_t dlc, const void *data)
+{
+	memset(f, 0, sizeof(struct sim_frame));
+	f->id = id & 0x7FF;
+	f->dlc = dlc;
+	if (data)
+		memcpy(f->data, data, dlc > 8 ? 8 : dlc);
+}
+
+void sim_frame_ext(struct sim_frame *f, uint32_t id, uint8_t dlc, const void *data)
+{
+	sim_frame_std(f, 0, dlc, data);
+	f->id = id & 0x1FFFFFFFUL;
+	f->ext = 1;
+}
@@ -0,0 +1,77 @@
+/* mcp2515_sim.h
+ * Register-level MCP2515 model for building and running the driver on a PC.  It sits behind the spi_transfer()
+ * interface in place of msp430_spi.c (build with SPI_DRIVER_HOST and host/ first on the include path) and
+ * decodes every SPI instruction the real part has: register map with CONFIGURATION-only and read-only registers,
+ * CANSTAT/CANCTRL mirrors, BIT MODIFY's register subset, acceptance masks and filters, RXB0->RXB1 rollover,
+ * overflow, TXB priorities, CANINTF/CANINTE and the INT pin.  Every byte and CS-framed transaction is counted.
+ *
+ * Controllers attached with sim_attach() share one simulated CAN bus.  Nothing moves on it until sim_bus_step()
+ * sends the next frame a controller has pending (lowest ID wins arbitration) or sim_bus_inject() delivers one
+ * from some other node, so a test decides exactly when each TX completes or frame arrives.  Setting seg splits the
+ * bus into segments, as on either side of a gateway: frames only reach controllers on the sender's segment (and
+ * sim_bus_inject() reaches segment 0), though arbitration still picks one frame per step across all of them.  INT falling edges set
+ * PxIFG, and the ISR registered with sim_set_isr() runs whenever PxIE and GIE allow it: each time a CS line
+ * moves, when GIE comes back on, and inside the sim_bus_*() calls.
+ */
+#ifndef MCP2515_SIM_H
+#define MCP2515_SIM_H
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+// A frame as it is on the wire
+struct sim_frame {
+	uint32_t id;
+	uint8_t ext, rtr;
+	uint8_t dlc;            // 0-15; data bytes carried are min(dlc, 8), none for an RTR
+	uint8_t data[8];
+};
+
+// SPI instructions, for sim_stats.cmd[]
+enum {
+	SIM_CMD_RESET, SIM_CMD_READ, SIM_CMD_WRITE, SIM_CMD_BIT_MODIFY, SIM_CMD_READ_STATUS, SIM_CMD_RX_STATUS,
+	SIM_CMD_LOAD_TXBUF, SIM_CMD_READ_RXBUF, SIM_CMD_RTS, SIM_CMD_UNKNOWN, SIM_CMD_COUNT
+};
+
+struct sim_stats {
+	uint32_t bytes;                 // Clocked over SPI, command and address bytes included
+	uint32_t transactions;          // CS low to CS high
+	uint32_t cmd[SIM_CMD_COUNT];    // Transactions per instruction
+	uint32_t tx, rx;                // Frames sent on the bus / taken into an RXB
+	uint32_t rxovr;                 // Frames lost to a full RXB
+	uint32_t isr_calls;             // Port ISR runs
+	uint32_t faults;                // Driver misbehaviour: bytes without CS, 2 CS low at once, TXB writes while TXREQ is set
+};
+
+typedef struct sim_mcp2515 {
+	can_dev_t *dev;                 // Driver instance on this controller's CS and INT pins
+	uint8_t regs[128];
+	uint8_t cs, intpin;             // Last seen CS level and INT level driven
+	uint8_t state, cmd, addr, mask; // Instruction decoding within the current transaction
+	uint8_t rxclear;                // RXnIF bits to clear at CS high (READ RX BUFFER)
+	void (*on_tx)(struct sim_mcp2515 *, const struct sim_frame *);  // Called for every frame it sends, if set
+	uint8_t seg;                    // Bus segment it's wired to, 0 unless set after sim_attach()
+	uint8_t onwire, abort;          // TXBs a test put mid-frame, where clearing TXREQ only asks for an abort; those asked
+	struct sim_mcp2515 *next;
+} sim_mcp2515_t;
+
+extern struct sim_stats sim_stats;
+extern int sim_trace;  // Nonzero prints every SPI transaction as it ends
+
+void sim_attach(sim_mcp2515_t *, can_dev_t *);  // Power on a controller wired to dev's pins; before can_init_dev()
+void sim_set_isr(volatile uint8_t *, void (*)(void));  // ISR for the port whose PxIFG this is (P1IFG or P2IFG)
+void sim_stats_reset();
+
+int sim_bus_inject(const struct sim_frame *);  // Deliver a frame from another node; returns how many controllers took it into an RXB
+int sim_bus_inject_seg(uint8_t, const struct sim_frame *);  // ... to the controllers on one segment only
+int sim_bus_step();                             // Send one pending frame; 0 if no controller has one to send
+int sim_bus_flush(uint16_t);                    // sim_bus_step() until nothing is pending or the limit is hit; returns frames sent
+void sim_tx_error(sim_mcp2515_t *, uint8_t);   // Fail TXBn's current attempt: TXERR, MERRF and TEC += 8; it stays pending
+void sim_tx_lost(sim_mcp2515_t *, uint8_t);    // TXBn loses arbitration: MLOA, and an abort asked for while on the wire goes through
+void sim_errors(sim_mcp2515_t *, uint8_t, uint8_t);  // Set TEC and REC, updating EFLG (and ERRIF if it changed)
+
+uint8_t sim_reg(const sim_mcp2515_t *, uint8_t);  // Register as the controller holds it, no SPI counted
+void sim_frame_std(struct sim_frame *, uint32_t, uint8_t, const void *);  // Fill in a data frame: id, dlc, data
+void sim_frame_ext(struct sim_frame *, uint32_t, uint8_t, const void *);
+
+#endif
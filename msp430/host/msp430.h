@@ -0,0 +1,53 @@
+/* msp430.h (host)
+ * Stand-in for the compiler's <msp430.h> when the driver is built for a PC against the simulated MCP2515
+ * (mcp2515_sim.c), found ahead of any real one with -I.  Only what mcp2515.c, mcp2515.h and msp430_spi.h touch is
+ * here, plus the Timer0_A registers can_timer.c uses, which timertest.c models.  Port registers are plain variables the simulator reads and drives; the status register functions keep GIE
+ * and hand pending port interrupts to the simulator's ISRs the moment it goes back on.
+ */
+#ifndef HOST_MSP430_H
+#define HOST_MSP430_H
+
+#include <stdint.h>
+
+#define BIT0 0x01
+#define BIT1 0x02
+#define BIT2 0x04
+#define BIT3 0x08
+#define BIT4 0x10
+#define BIT5 0x20
+#define BIT6 0x40
+#define BIT7 0x80
+
+#define GIE 0x0008
+#define CPUOFF 0x0010
+#define LPM0_bits CPUOFF
+#define LPM3_bits 0x00D0
+#define LPM4_bits 0x00F0
+#define LPM0 __bis_SR_register(LPM0_bits | GIE)
+#define LPM4 __bis_SR_register(LPM4_bits | GIE)
+
+#define __interrupt
+
+extern volatile uint8_t P1OUT, P1DIR, P1IN, P1REN, P1IES, P1IE, P1IFG;
+extern volatile uint8_t P2OUT, P2DIR, P2IN, P2REN, P2IES, P2IE, P2IFG;
+extern volatile uint16_t TA0R;  // Free-running count for MCP2515_STATS_CLOCK; the simulator ticks it per SPI byte
+extern volatile uint16_t TA0CTL, TA0CCTL0, TA0CCTL1, TA0CCR0, TA0CCR1;
+
+#define TASSEL_2 0x0200
+#define ID_3 0x00C0
+#define MC_2 0x0020
+#define TACLR 0x0004
+#define TAIE 0x0002
+#define TAIFG 0x0001
+#define CCIE 0x0010
+#define CCIFG 0x0001
+
+uint16_t __get_SR_register();
+void __bis_SR_register(uint16_t);
+void __bic_SR_register(uint16_t);
+void __bic_SR_register_on_exit(uint16_t);
+void __delay_cycles(uint32_t);
+#define _EINT() __bis_SR_register(GIE)
+#define _DINT() __bic_SR_register(GIE)
+
+#endif
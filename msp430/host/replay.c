@@ -0,0 +1,206 @@
+/* replay.c
+ * Plays a recorded bus trace (candump -l format: "(1690000000.000123) can0 123#DEADBEEF", 8 hex digits for an
+ * extended ID, "#R" for a remote frame) into the simulated MCP2515 one frame at a time, with the examples' main loop
+ * (can_irq_handler(), can_recv()) draining it, then reports what came through and what it cost in SPI I/O.
+ *
+ * Usage: replay [-l n] [-e] [-b bytes] [-v] trace.log
+ *   -l n      run the main loop only every n frames, as if it were busy with something else meanwhile
+ *   -e        echo every frame received back onto the bus with can_send(), ID + 1
+ *   -b bytes  fail if the SPI bytes clocked per frame in the trace average more than this
+ *   -v        print every SPI transaction
+ * Exits nonzero on a simulator fault, a frame received out of order or altered, or the -b budget exceeded.
+ */
+#include <msp430.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "mcp2515_sim.h"
+
+#define BITRATE 500000
+#define PENDING 64  // Frames taken into an RXB but not yet through can_recv(); the RX ring and 2 RXBs at most
+
+static sim_mcp2515_t sim;
+
+static struct sim_frame pend[PENDING];
+static uint8_t pend_head, pend_tail;
+
+static uint32_t n_frames, n_recv, n_echo, n_echo_busy, n_bad;
+static uint8_t echo;
+
+static void port1_isr(void)
+{
+	if (P1IFG & CAN_IRQ_PORTBIT) {
+		P1IFG &= ~CAN_IRQ_PORTBIT;
+		#ifdef MCP2515_RX_RING_SIZE
+		can_isr();
+		#else
+		mcp2515_irq |= MCP2515_IRQ_FLAGGED;
+		#endif
+	}
+}
+
+// One can_recv()'d frame against the oldest one the controller took in
+static void check_recv(uint32_t id, uint8_t ext, int ret, const uint8_t *buf)
+{
+	const struct sim_frame *f;
+	uint8_t len;
+
+	if (pend_head == pend_tail) {
+		n_bad++;
+		return;
+	}
+	f = &pend[pend_tail++ % PENDING];
+	len = f->dlc > 8 ? 8 : f->dlc;
+	#ifdef MCP2515_NO_RTR
+	if (f->id != id || f->ext != ext || ret != (f->dlc & 0x0F) || (!f->rtr && memcmp(f->data, buf, len)))
+	#else
+	if (f->id != id || f->ext != ext || ret != (f->rtr ? 0x40 | f->dlc : f->dlc) || (!f->rtr && memcmp(f->data, buf, len)))
+	#endif
+		n_bad++;
+	n_recv++;
+}
+
+static void service()
+{
+	uint8_t n, ext, buf[8];
+	uint32_t id;
+	int irq, ret;
+
+	for (n=0; n < 50 && (mcp2515_irq & MCP2515_IRQ_FLAGGED); n++) {
+		irq = can_irq_handler();
+		if ( !(irq & MCP2515_IRQ_RX) )
+			continue;
+		while ( (ret = can_recv(&id, &ext, buf)) >= 0 ) {
+			check_recv(id, ext, ret, buf);
+			if (echo && !(ret & 0x40)) {
+				if (can_send((id + 1) & (ext ? 0x1FFFFFFF : 0x7FF), ext, buf, ret, 0) < 0)
+					n_echo_busy++;
+				else
+					n_echo++;
+			}
+		}
+	}
+}
+
+// "(time) iface ID#DATA"; returns 0 if the line isn't a frame
+static int parse(const char *line, struct sim_frame *f)
+{
+	const char *p, *hash;
+	char *end;
+	uint32_t id;
+	uint8_t n;
+
+	if ( !(hash = strchr(line, '#')) )
+		return 0;
+	for (p = hash; p > line && p[-1] != ' '; p--)
+		;
+	id = strtoul(p, &end, 16);
+	if (end != hash)
+		return 0;
+	if (hash - p > 3)
+		sim_frame_ext(f, id, 0, 0);
+	else
+		sim_frame_std(f, id, 0, 0);
+	p = hash + 1;
+	if (*p == 'R') {
+		f->rtr = 1;
+		f->dlc = (p[1] >= '0' && p[1] <= '8') ? p[1] - '0' : 0;
+		return 1;
+	}
+	for (n=0; n < 8 && sscanf(p, "%2hhx", &f->data[n]) == 1; n++)
+		p += 2;
+	f->dlc = n;
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *cmds[SIM_CMD_COUNT] = { "RESET", "READ", "WRITE", "BIT_MODIFY", "READ_STATUS", "RX_STATUS",
+						   "LOAD_TXBUF", "READ_RXBUF", "RTS", "unknown" };
+	struct sim_frame f;
+	char line[256];
+	FILE *in;
+	int i, loop = 1, budget = 0;
+	uint32_t n_filtered = 0, since = 0, ovr;
+
+	for (i=1; i < argc - 1; i++) {
+		if (!strcmp(argv[i], "-l") && i < argc - 2)
+			loop = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-b") && i < argc - 2)
+			budget = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-e"))
+			echo = 1;
+		else if (!strcmp(argv[i], "-v"))
+			sim_trace = 1;
+		else
+			break;
+	}
+	if (i != argc - 1 || loop < 1 || !(in = fopen(argv[i], "r"))) {
+		fprintf(stderr, "usage: %s [-l n] [-e] [-b bytes] [-v] trace.log\n", argv[0]);
+		return 2;
+	}
+
+	sim_set_isr(&P1IFG, port1_isr);
+	sim_attach(&sim, &can_dev0);
+	can_init();
+	CAN_SPEED_CONST(BITRATE);
+	#if !defined(MCP2515_STD_ONLY) && !defined(MCP2515_EXT_ONLY)
+	can_rx_mode(0, MCP2515_RXB0CTRL_MODE_RECV_ALL);
+	can_rx_mode(1, MCP2515_RXB1CTRL_MODE_RECV_ALL);
+	#endif
+	#ifndef MCP2515_NO_ROLLOVER
+	can_ioctl(MCP2515_OPTION_ROLLOVER, 1);
+	#endif
+	can_ioctl(MCP2515_OPTION_SLEEP, 0);
+	sim_stats_reset();
+
+	while (fgets(line, sizeof(line), in)) {
+		if (!parse(line, &f))
+			continue;
+		n_frames++;
+		ovr = sim_stats.rxovr;
+		if (sim_bus_inject(&f)) {
+			if ((uint8_t)(pend_head - pend_tail) < PENDING)
+				pend[pend_head++ % PENDING] = f;
+			else
+				n_bad++;  // More frames held than there's room for anywhere in the driver
+		} else if (sim_stats.rxovr == ovr) {
+			n_filtered++;  // Not lost to a full RXB, so the acceptance filters kept it out
+		}
+		sim_bus_step();  // One echoed frame, if any is pending, goes out between received ones
+		if (++since >= (uint32_t)loop) {
+			service();
+			since = 0;
+		}
+	}
+	fclose(in);
+	do {
+		service();
+	} while (sim_bus_flush(10));
+
+	printf("  %lu frames: %lu received, %lu lost, %lu filtered", (unsigned long)n_frames, (unsigned long)n_recv,
+	       (unsigned long)sim_stats.rxovr, (unsigned long)n_filtered);
+	if (echo)
+		printf(", %lu echoed (%lu with no TXB free)", (unsigned long)n_echo, (unsigned long)n_echo_busy);
+	printf("\n  SPI %lu bytes, %lu transactions", (unsigned long)sim_stats.bytes, (unsigned long)sim_stats.transactions);
+	if (n_frames)
+		printf(" (%.1f, %.1f per frame)", (double)sim_stats.bytes / n_frames, (double)sim_stats.transactions / n_frames);
+	printf("; %lu ISR runs\n ", (unsigned long)sim_stats.isr_calls);
+	for (i=0; i < SIM_CMD_COUNT; i++) {
+		if (sim_stats.cmd[i])
+			printf(" %s %lu", cmds[i], (unsigned long)sim_stats.cmd[i]);
+	}
+	printf("\n");
+
+	if (sim_stats.faults || n_bad || pend_head != pend_tail) {
+		printf("  FAIL: %lu faults, %lu frames altered or out of order, %u never received\n",
+		       (unsigned long)sim_stats.faults, (unsigned long)n_bad, (uint8_t)(pend_head - pend_tail));
+		return 1;
+	}
+	if (budget && n_frames && sim_stats.bytes > (uint32_t)budget * n_frames) {
+		printf("  FAIL: over the budget of %d SPI bytes per frame\n", budget);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,616 @@
+/* test.c
+ * Driver regression tests against the simulated MCP2515 (mcp2515_sim.c), run by "make check" for each of the
+ * Makefile's driver configurations.  Besides behaviour, the SPI cost of the hot paths is checked against a budget
+ * of bytes and CS-framed transactions, so a change that adds I/O to can_send() or the IRQ path fails here.
+ */
+#include <msp430.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "mcp2515_sim.h"
+
+#define BITRATE 500000
+
+static sim_mcp2515_t sim;
+static int failures;
+static const char *test_name;
+
+#define CHECK(cond) do { if (!(cond)) { printf("  %s: %s:%d: %s\n", test_name, __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// Frames can_recv() returned, in order
+struct rx_log {
+	uint32_t id;
+	uint8_t ext;
+	int ret;
+	uint8_t data[8];
+};
+static struct rx_log rx[64];
+static uint8_t n_rx;
+static uint8_t irqs;  // Every MCP2515_IRQ_* can_irq_handler() came back with
+
+static struct sim_frame sent[16];
+static uint8_t n_sent;
+
+static void on_tx(sim_mcp2515_t *d, const struct sim_frame *f)
+{
+	(void)d;
+	if (n_sent < 16)
+		sent[n_sent++] = *f;
+}
+
+// PORT1 ISR, as an application would write it
+static void port1_isr(void)
+{
+	if (P1IFG & CAN_IRQ_PORTBIT) {
+		P1IFG &= ~CAN_IRQ_PORTBIT;
+		#ifdef MCP2515_RX_RING_SIZE
+		can_isr();
+		#else
+		mcp2515_irq |= MCP2515_IRQ_FLAGGED;
+		#endif
+	}
+}
+
+// The examples' main loop: can_irq_handler() while an IRQ is flagged, receiving whatever it reports
+static void service()
+{
+	uint8_t n, ext, buf[8];
+	uint32_t id;
+	int irq, ret;
+
+	for (n=0; n < 50 && (mcp2515_irq & MCP2515_IRQ_FLAGGED); n++) {
+		irqs |= irq = can_irq_handler();
+		if ( !(irq & MCP2515_IRQ_RX) )
+			continue;
+		while ( (ret = can_recv(&id, &ext, buf)) >= 0 ) {
+			if (n_rx < 64) {
+				rx[n_rx].id = id;
+				rx[n_rx].ext = ext;
+				rx[n_rx].ret = ret;
+				memcpy(rx[n_rx].data, buf, 8);
+				n_rx++;
+			}
+		}
+	}
+}
+
+static void setup(const char *name)
+{
+	test_name = name;
+	sim_attach(&sim, &can_dev0);
+	sim.on_tx = on_tx;
+	can_init();
+	CAN_SPEED_CONST(BITRATE);
+	#if !defined(MCP2515_STD_ONLY) && !defined(MCP2515_EXT_ONLY)
+	can_rx_mode(0, MCP2515_RXB0CTRL_MODE_RECV_ALL);
+	can_rx_mode(1, MCP2515_RXB1CTRL_MODE_RECV_ALL);
+	#endif
+	can_ioctl(MCP2515_OPTION_SLEEP, 0);  // Out of CONFIGURATION, into NORMAL mode
+	n_rx = 0;
+	n_sent = 0;
+	irqs = 0;
+	sim_stats_reset();
+}
+
+static void frame(struct sim_frame *f, uint32_t id, uint8_t dlc, const void *data)
+{
+	#ifdef MCP2515_EXT_ONLY
+	sim_frame_ext(f, id, dlc, data);
+	#else
+	sim_frame_std(f, id, dlc, data);
+	#endif
+}
+
+#ifdef MCP2515_EXT_ONLY
+#define ID(n) (0x18DA0000UL | (n))
+#define EXT 1
+#else
+#define ID(n) (n)
+#define EXT 0
+#endif
+
+static void test_init()
+{
+	setup("init");
+	CHECK((sim_reg(&sim, MCP2515_CANSTAT) & MCP2515_CANSTAT_OPMOD_MASK) == MCP2515_CANSTAT_OPMOD_NORMAL);
+	CHECK(sim_reg(&sim, MCP2515_CNF1) == MCP2515_CNF1_FOR(BITRATE));
+	CHECK(sim_reg(&sim, MCP2515_CNF2) == MCP2515_CNF2_FOR(BITRATE));
+	CHECK(sim_reg(&sim, MCP2515_CNF3) == MCP2515_CNF3_FOR(BITRATE));
+	#ifdef MCP2515_NO_ERRORS
+	CHECK(sim_reg(&sim, MCP2515_CANINTE) == (MCP2515_CANINTE_RX0IE | MCP2515_CANINTE_RX1IE));
+	#else
+	CHECK(sim_reg(&sim, MCP2515_CANINTE) == (MCP2515_CANINTE_RX0IE | MCP2515_CANINTE_RX1IE |
+						 MCP2515_CANINTE_ERRIE | MCP2515_CANINTE_MERRE));
+	#endif
+	CHECK(can_tx_available() == 0);
+	CHECK(can_rx_pending() < 0);
+	CHECK(sim_stats.faults == 0);
+}
+
+#ifndef MCP2515_NO_CLKOUT
+// CLOCKOUT off stays off, even once can_send() rewrites CANCTRL from its shadow to leave LISTEN-ONLY
+static void test_clkout()
+{
+	uint8_t d = 0;
+
+	setup("clkout");
+	can_ioctl(MCP2515_OPTION_CLOCKOUT, 3);
+	CHECK((sim_reg(&sim, MCP2515_CANCTRL) & 0x07) == (MCP2515_CANCTRL_CLKEN | 0x02));
+	can_ioctl(MCP2515_OPTION_CLOCKOUT, 0);
+	CHECK((sim_reg(&sim, MCP2515_CANCTRL) & MCP2515_CANCTRL_CLKEN) == 0);
+	can_ioctl(MCP2515_OPTION_LISTEN_ONLY, 1);
+	CHECK(can_send(ID(0x123), EXT, &d, 1, 0) >= 0);
+	CHECK((sim_reg(&sim, MCP2515_CANSTAT) & MCP2515_CANSTAT_OPMOD_MASK) == MCP2515_CANSTAT_OPMOD_NORMAL);
+	CHECK((sim_reg(&sim, MCP2515_CANCTRL) & (MCP2515_CANCTRL_CLKEN | MCP2515_CANCTRL_ABAT)) == 0);
+	CHECK(sim_stats.faults == 0);
+}
+#endif
+
+#ifndef MCP2515_NO_SPEED_CALC
+// Bitrate and sample point (1/1000 bit) the CNF registers set up
+static uint32_t cnf_bitrate(uint16_t *sp)
+{
+	uint8_t c1 = sim_reg(&sim, MCP2515_CNF1), c2 = sim_reg(&sim, MCP2515_CNF2), c3 = sim_reg(&sim, MCP2515_CNF3);
+	uint16_t tseg1, ntq;
+
+	tseg1 = 1 + (c2 & 0x07) + 1 + ((c2 >> 3) & 0x07) + 1;  // Sync, PropSeg, PS1
+	ntq = tseg1 + (c3 & 0x07) + 1;
+	*sp = 1000UL * tseg1 / ntq;
+	return CAN_OSC_FREQUENCY / 2 / ((c1 & 0x3F) + 1) / ntq;
+}
+
+static void test_speed()
+{
+	static const uint32_t rates[] = { 1000000, 500000, 250000, 125000, 100000, 50000, 20000, 10000 };
+	uint8_t i;
+	uint16_t sp;
+
+	setup("speed");
+	for (i=0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		CHECK(can_speed(rates[i], 1, 1) == 0);
+		CHECK(cnf_bitrate(&sp) == rates[i]);
+		CHECK(sp + 125 >= MCP2515_SAMPLE_POINT && sp <= MCP2515_SAMPLE_POINT + 125);  // Within a TQ of an 8 TQ bit
+	}
+	CHECK(can_speed(2000000, 1, 1) < 0);
+	CHECK(sim_stats.faults == 0);
+}
+#endif
+
+static void test_loopback()
+{
+	uint8_t d[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+	setup("loopback");
+	can_ioctl(MCP2515_OPTION_LOOPBACK, 1);
+	CHECK(can_send(ID(0x123), EXT, d, 8, 0) >= 0);
+	CHECK(sim_bus_step() == 1);
+	service();
+	CHECK(n_rx == 1 && rx[0].id == ID(0x123) && rx[0].ext == EXT && rx[0].ret == 8 && !memcmp(rx[0].data, d, 8));
+	CHECK(irqs & MCP2515_IRQ_TX);
+	CHECK(can_tx_available() == 0);
+
+	#if !defined(MCP2515_STD_ONLY) && !defined(MCP2515_EXT_ONLY)
+	CHECK(can_send(0x1ABCDEF0, 1, d, 3, 0) >= 0);
+	sim_bus_step();
+	service();
+	CHECK(n_rx == 2 && rx[1].id == 0x1ABCDEF0 && rx[1].ext == 1 && rx[1].ret == 3 && !memcmp(rx[1].data, d, 3));
+	#endif
+
+	#ifndef MCP2515_NO_RTR
+	CHECK(can_query(ID(0x321), EXT, 0) >= 0);
+	sim_bus_step();
+	service();
+	CHECK(n_rx > 0 && rx[n_rx-1].id == ID(0x321) && rx[n_rx-1].ret == 0x40);
+	#endif
+	CHECK(sim_stats.faults == 0);
+}
+
+#ifndef MCP2515_STD_ONLY
+// Every bit of a 29-bit ID survives the trip through SIDH/SIDL/EID8/EID0, out and back in
+static void test_ext_ids()
+{
+	static const uint32_t ids[] = { 0x00010000, 0x00020000, 0x00040000, 0x00080000, 0x00100000, 0x1FFFFFFF, 0x12345678 };
+	struct sim_frame f;
+	uint8_t i;
+
+	setup("ext ids");
+	for (i=0; i < sizeof(ids)/sizeof(ids[0]); i++) {
+		CHECK(can_send(ids[i], 1, &i, 1, 0) >= 0);
+		CHECK(sim_bus_step() == 1);
+		CHECK(n_sent == i+1 && sent[i].ext && sent[i].id == ids[i]);
+		sim_frame_ext(&f, ids[i], 1, &i);
+		CHECK(sim_bus_inject(&f) == 1);
+		service();
+		CHECK(n_rx == i+1 && rx[i].ext && rx[i].id == ids[i]);
+	}
+	CHECK(sim_stats.faults == 0);
+}
+#endif
+
+// Frames from another node, serviced after each one
+static void test_rx()
+{
+	struct sim_frame f;
+	uint8_t i, d[8];
+
+	setup("rx");
+	for (i=0; i < 20; i++) {
+		memset(d, i, 8);
+		frame(&f, ID(0x100 + i), i % 9, d);
+		CHECK(sim_bus_inject(&f) == 1);
+		service();
+	}
+	CHECK(n_rx == 20);
+	for (i=0; i < 20 && i < n_rx; i++)
+		CHECK(rx[i].id == ID(0x100 + i) && rx[i].ret == i % 9 && (i % 9 == 0 || rx[i].data[0] == i));
+	CHECK(sim_stats.faults == 0);
+}
+
+#ifndef MCP2515_NO_RTR
+// RTRs from another node come back from can_recv() with 0x40 set, whichever kind of ID they have
+static void test_rtr_rx()
+{
+	struct sim_frame f;
+
+	setup("rtr rx");
+	frame(&f, ID(0x210), 3, 0);
+	f.rtr = 1;
+	CHECK(sim_bus_inject(&f) == 1);
+	service();
+	frame(&f, ID(0x211), 3, "abc");
+	CHECK(sim_bus_inject(&f) == 1);
+	service();
+	#if !defined(MCP2515_STD_ONLY) && !defined(MCP2515_EXT_ONLY)
+	sim_frame_ext(&f, 0x1000210, 5, 0);
+	f.rtr = 1;
+	CHECK(sim_bus_inject(&f) == 1);
+	service();
+	#endif
+	CHECK(n_rx >= 2 && rx[0].id == ID(0x210) && rx[0].ret == 0x43);
+	CHECK(n_rx >= 2 && rx[1].id == ID(0x211) && rx[1].ret == 3);
+	#if !defined(MCP2515_STD_ONLY) && !defined(MCP2515_EXT_ONLY)
+	CHECK(n_rx == 3 && rx[2].id == 0x1000210 && rx[2].ext && rx[2].ret == 0x45);
+	#endif
+	CHECK(sim_stats.faults == 0);
+}
+#endif
+
+/* A burst the main loop doesn't get to until it's over: RXB0 and RXB1 (with rollover) hold 2 frames, the RX ring
+ * as many as it has slots on top; the rest overflow.  Whatever gets through must be in order.
+ */
+static void test_burst()
+{
+	struct sim_frame f;
+	uint8_t i, kept;
+
+	setup("burst");
+	#ifndef MCP2515_NO_ROLLOVER
+	can_ioctl(MCP2515_OPTION_ROLLOVER, 1);
+	kept = 2;
+	#else
+	kept = 1;
+	#endif
+	#ifdef MCP2515_RX_RING_SIZE
+	kept += MCP2515_RX_RING_SIZE;
+	#endif
+	for (i=0; i < kept + 4; i++) {
+		frame(&f, ID(0x200 + i), 1, &i);
+		sim_bus_inject(&f);
+	}
+	service();
+	CHECK(n_rx == kept);
+	CHECK(sim_stats.rxovr == 4);
+	for (i=1; i < n_rx; i++)
+		CHECK(rx[i].id > rx[i-1].id);
+	#ifndef MCP2515_NO_ERRORS
+	CHECK(irqs & MCP2515_IRQ_ERROR);
+	CHECK(sim_reg(&sim, MCP2515_EFLG) == 0);
+	#endif
+	CHECK(sim_stats.faults == 0);
+}
+
+#ifdef MCP2515_RX_RING_SIZE
+/* A TX completion the main loop hasn't got round to mustn't hold INT low: can_isr() has to go on seeing edges,
+ * draining RXB0/RXB1 into the ring, with no help from the main loop.
+ */
+static void test_isr_tx()
+{
+	struct sim_frame f;
+	uint8_t i;
+
+	setup("isr tx");
+	CHECK(can_send(ID(0x100), EXT, "x", 1, 0) >= 0);
+	CHECK(sim_bus_flush(5) == 1);  // TXnIF set, nothing serviced
+	for (i=0; i < 4; i++) {
+		frame(&f, ID(0x200 + i), 1, &i);
+		CHECK(sim_bus_inject(&f) == 1);
+	}
+	CHECK(sim_stats.rxovr == 0);
+	service();
+	CHECK(n_rx == 4);
+	CHECK(irqs & MCP2515_IRQ_TX);
+	CHECK(can_tx_available() == 0);
+	CHECK(sim_stats.faults == 0);
+}
+#endif
+
+#if !defined(MCP2515_STD_ONLY) && !defined(MCP2515_EXT_ONLY)
+// can_rx_mode() sets both RXM bits whatever they were: RECV_STD after RECV_ALL turns extended frames away again
+static void test_rx_mode()
+{
+	struct sim_frame f;
+
+	setup("rx mode");
+	CHECK((sim_reg(&sim, MCP2515_RXB0CTRL) & 0x60) == MCP2515_RXB0CTRL_MODE_RECV_ALL);
+	CHECK((sim_reg(&sim, MCP2515_RXB1CTRL) & 0x60) == MCP2515_RXB1CTRL_MODE_RECV_ALL);
+	can_rx_mode(0, MCP2515_RXB0CTRL_MODE_RECV_STD);
+	can_rx_mode(1, MCP2515_RXB1CTRL_MODE_RECV_STD);
+	CHECK((sim_reg(&sim, MCP2515_RXB0CTRL) & 0x60) == MCP2515_RXB0CTRL_MODE_RECV_STD);
+	sim_frame_ext(&f, 0x1000300, 0, 0);
+	CHECK(sim_bus_inject(&f) == 0);
+	sim_frame_std(&f, 0x300, 0, 0);
+	CHECK(sim_bus_inject(&f) == 1);
+	service();
+	can_rx_mode(0, MCP2515_RXB0CTRL_MODE_RECV_ALL);
+	sim_frame_ext(&f, 0x1000301, 0, 0);
+	CHECK(sim_bus_inject(&f) == 1);
+	service();
+	CHECK(n_rx == 2 && rx[0].id == 0x300 && rx[1].id == 0x1000301 && rx[1].ext);
+	CHECK(sim_stats.faults == 0);
+}
+#endif
+
+static void test_filters()
+{
+	struct sim_frame f;
+
+	setup("filters");
+	can_rx_mode(0, 0);
+	can_rx_mode(1, 0);
+	can_rx_setmask(0, EXT ? 0x1FFFFFFF : 0x7FF, EXT);
+	can_rx_setmask(1, EXT ? 0x1FFFFFFF : 0x7F0, EXT);
+	can_rx_setfilter(0, 0, ID(0x123));
+	can_rx_setfilter(0, 1, ID(0x124));
+	can_rx_setfilter(1, 0, ID(0x450));
+	can_rx_setfilter(1, 1, ID(0x460));
+	can_rx_setfilter(1, 2, ID(0x470));
+	can_rx_setfilter(1, 3, ID(0x480));
+	can_ioctl(MCP2515_OPTION_SLEEP, 0);
+	frame(&f, ID(0x123), 0, 0);
+	CHECK(sim_bus_inject(&f) == 1);
+	frame(&f, ID(0x125), 0, 0);
+	CHECK(sim_bus_inject(&f) == 0);
+	frame(&f, ID(EXT ? 0x480 : 0x48F), 0, 0);  // Low nibble masked off on RXB1 for standard IDs
+	CHECK(sim_bus_inject(&f) == 1);
+	#if !defined(MCP2515_STD_ONLY) && !defined(MCP2515_EXT_ONLY)
+	sim_frame_ext(&f, 0x123, 0, 0);  // Standard filters don't take extended frames
+	CHECK(sim_bus_inject(&f) == 0);
+	#endif
+	service();
+	CHECK(n_rx == 2 && rx[0].id == ID(0x123) && rx[1].id == ID(EXT ? 0x480 : 0x48F));
+	CHECK(sim_stats.faults == 0);
+}
+
+static void test_tx()
+{
+	uint8_t i, d[8] = { 0 };
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	uint32_t last;
+	#endif
+	int ret;
+
+	setup("tx");
+	CHECK(can_tx_idle());
+	for (i=0; i < 3; i++)
+		CHECK(can_send(ID(0x300 - i), EXT, d, 8, 0) >= 0);
+	CHECK(!can_tx_idle());
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	// Queued behind the TXBs, then sent lowest ID first as TXBs come free
+	for (i=0; i < MCP2515_TX_QUEUE_SIZE; i++)
+		CHECK(can_send(ID(0x2F0 - 3*i + ((i & 1) ? 5 : 0)), EXT, d, 8, 0) == MCP2515_TX_QUEUED);
+	#endif
+	ret = can_send(ID(0x7F0), EXT, d, 8, 0);
+	CHECK(ret == -1);
+	sim_bus_flush(20);
+	service();
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	CHECK(n_sent == 3 + MCP2515_TX_QUEUE_SIZE);
+	for (i=0, last=0; i < n_sent; i++) {
+		if (sent[i].id < ID(0x2FE)) {  // One of the queued ones
+			CHECK(sent[i].id > last);
+			last = sent[i].id;
+		}
+	}
+	#else
+	CHECK(n_sent == 3);
+	#endif
+	CHECK(irqs & MCP2515_IRQ_TX);
+	CHECK(can_tx_available() == 0);
+	CHECK(can_tx_idle());
+	CHECK(sim_stats.faults == 0);
+}
+
+#ifdef MCP2515_TX_QUEUE_SIZE
+/* An urgent frame preempts the lowest-priority TXB while that one's frame is on the wire, so the abort only goes
+ * through once it loses arbitration.  No interrupt comes of that, yet the urgent frame must still be next out.
+ */
+static void test_preempt()
+{
+	uint8_t d[8] = { 0 };
+
+	setup("preempt");
+	CHECK(can_send(ID(0x302), EXT, d, 8, 0) == 2);
+	sim.onwire = 1 << 2;
+	CHECK(can_send(ID(0x300), EXT, d, 8, 0) >= 0);
+	CHECK(can_send(ID(0x301), EXT, d, 8, 0) >= 0);
+	CHECK(can_send(ID(0x100), EXT, d, 8, 3) == MCP2515_TX_QUEUED);
+	CHECK(sim.abort == 1 << 2);
+	sim_tx_lost(&sim, 2);
+	service();
+	CHECK(sim_bus_step() == 1);
+	CHECK(n_sent == 1 && sent[0].id == ID(0x100));
+	sim_bus_flush(10);
+	service();
+	CHECK(n_sent == 4);
+	CHECK(sent[1].id == ID(0x302) || sent[2].id == ID(0x302) || sent[3].id == ID(0x302));  // Put back, not lost
+	CHECK(can_tx_idle());
+	CHECK( !(mcp2515_irq & MCP2515_IRQ_FLAGGED) );
+	CHECK(sim_stats.faults == 0);
+}
+#endif
+
+#ifndef MCP2515_NO_ERRORS
+// A one-shot frame that fails is retired and reported as a TX error, never retried
+static void test_oneshot()
+{
+	uint8_t d = 0x55;
+	int txb;
+
+	setup("oneshot");
+	can_ioctl(MCP2515_OPTION_ONESHOT, 1);
+	txb = can_send(ID(0x42), EXT, &d, 1, 0);
+	CHECK(txb >= 0 && txb <= 2);
+	sim_tx_error(&sim, txb);
+	service();
+	CHECK((irqs & (MCP2515_IRQ_TX | MCP2515_IRQ_ERROR)) == (MCP2515_IRQ_TX | MCP2515_IRQ_ERROR));
+	CHECK(sim_bus_step() == 0);
+	CHECK(can_tx_available() == 0);
+	CHECK(sim_stats.faults == 0);
+}
+#endif
+
+#ifndef MCP2515_NO_WAKE
+static void test_wake()
+{
+	struct sim_frame f;
+
+	setup("wake");
+	can_ioctl(MCP2515_OPTION_WAKE, 1);
+	can_ioctl(MCP2515_OPTION_SLEEP, 1);
+	frame(&f, ID(0x10), 0, 0);
+	sim_bus_inject(&f);
+	service();
+	CHECK(irqs & MCP2515_IRQ_WAKEUP);
+	CHECK(sim_stats.faults == 0);
+}
+#endif
+
+/* SPI cost of the hot paths.  Budgets are exact: going over is a regression, coming in under means the table
+ * wants updating to lock the improvement in.
+ */
+struct cost {
+	const char *what;
+	uint32_t bytes, transactions;
+};
+
+#ifdef MCP2515_RX_RING_SIZE
+#define COST(poll, ring) (ring)
+#else
+#define COST(poll, ring) (poll)
+#endif
+// can_irq_handler()'s last call, the one that finds nothing left, ends on a CANINTF read unless there's nothing to look for
+#if defined(MCP2515_NO_WAKE) && defined(MCP2515_NO_ERRORS)
+#define INTF_BYTES 0
+#define INTF_TRANS 0
+#else
+#define INTF_BYTES 3
+#define INTF_TRANS 1
+#endif
+
+static const struct cost budget[] = {
+	{ "send, 8 bytes", 15, 2 },   // LOAD TX BUFFER + RTS, TXnIE already on
+	{ "send, new prio", 17, 2 },  // WRITE from TXBnCTRL + RTS
+	// READ STATUS, BIT MODIFY TXnIF, READ STATUS; ring: READ STATUS and BIT MODIFY in can_isr(), then 2 READ STATUS
+	{ "TX complete", COST(8, 10) + INTF_BYTES, COST(3, 4) + INTF_TRANS },
+	// READ STATUS, RX STATUS, READ RX BUFFER, RX STATUS, READ STATUS; ring: READ STATUS, READ RX BUFFER and READ STATUS
+	// in can_isr(), then 2 READ STATUS
+	{ "receive, 8 bytes", 22 + INTF_BYTES, 5 + INTF_TRANS },
+};
+
+static void measure(struct cost *c, const char *what)
+{
+	c->what = what;
+	c->bytes = sim_stats.bytes;
+	c->transactions = sim_stats.transactions;
+	sim_stats_reset();
+}
+
+static void test_costs()
+{
+	struct cost got[4];
+	struct sim_frame f;
+	uint8_t i, d[8] = { 0 };
+
+	setup("costs");
+	can_send(ID(0x100), EXT, d, 8, 0);  // Every TXB's TXnIE on, TXBnCTRL at prio 0
+	can_send(ID(0x100), EXT, d, 8, 0);
+	can_send(ID(0x100), EXT, d, 8, 0);
+	sim_bus_flush(3);
+	service();
+	sim_stats_reset();
+
+	can_send(ID(0x100), EXT, d, 8, 0);
+	measure(&got[0], budget[0].what);
+	sim_bus_step();
+	service();
+	sim_stats_reset();
+	can_send(ID(0x100), EXT, d, 8, 1);
+	measure(&got[1], budget[1].what);
+	sim_bus_step();
+	service();
+	measure(&got[2], budget[2].what);
+	frame(&f, ID(0x200), 8, d);
+	sim_bus_inject(&f);
+	service();
+	measure(&got[3], budget[3].what);
+
+	printf("  %-18s%7s%7s%14s\n", "", "bytes", "trans", "budget");
+	for (i=0; i < 4; i++) {
+		printf("  %-18s%7u%7u%7u%7u\n", got[i].what, (unsigned)got[i].bytes, (unsigned)got[i].transactions,
+		       (unsigned)budget[i].bytes, (unsigned)budget[i].transactions);
+		CHECK(got[i].bytes == budget[i].bytes && got[i].transactions == budget[i].transactions);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	sim_trace = argc > 1 && !strcmp(argv[1], "-v");
+	sim_set_isr(&P1IFG, port1_isr);
+	test_init();
+	#ifndef MCP2515_NO_CLKOUT
+	test_clkout();
+	#endif
+	#ifndef MCP2515_NO_SPEED_CALC
+	test_speed();
+	#endif
+	test_loopback();
+	#ifndef MCP2515_STD_ONLY
+	test_ext_ids();
+	#endif
+	test_rx();
+	#ifndef MCP2515_NO_RTR
+	test_rtr_rx();
+	#endif
+	test_burst();
+	#ifdef MCP2515_RX_RING_SIZE
+	test_isr_tx();
+	#endif
+	#if !defined(MCP2515_STD_ONLY) && !defined(MCP2515_EXT_ONLY)
+	test_rx_mode();
+	#endif
+	test_filters();
+	test_tx();
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	test_preempt();
+	#endif
+	#ifndef MCP2515_NO_ERRORS
+	test_oneshot();
+	#endif
+	#ifndef MCP2515_NO_WAKE
+	test_wake();
+	#endif
+	test_costs();
+
+	printf("%s\n", failures ? "FAIL" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+/* timertest.c
+ * can_timer.c against a modelled Timer0_A, ticked one count at a time with its ISR run whenever an enabled flag
+ * is up.  Alarms anywhere from a few ticks to several 16-bit periods out, armed at any phase of TA0R, must fire
+ * on time and not a tick early.
+ */
+#include <msp430.h>
+#include <stdio.h>
+#include "can_timer.h"
+
+// What <msp430.h> declares
+volatile uint16_t TA0R, TA0CTL, TA0CCTL0, TA0CCTL1, TA0CCR0, TA0CCR1;
+
+void can_timer_isr(void);
+
+static uint16_t sr = GIE;
+static int failures;
+static const char *test_name;
+
+#define CHECK(cond) do { if (!(cond)) { printf("  %s: %s:%d: %s\n", test_name, __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+uint16_t __get_SR_register()
+{
+	return sr;
+}
+
+void __bis_SR_register(uint16_t bits)
+{
+	sr |= bits;
+}
+
+void __bic_SR_register(uint16_t bits)
+{
+	sr &= ~bits;
+}
+
+void __bic_SR_register_on_exit(uint16_t bits)
+{
+	(void)bits;
+}
+
+// One timer count, and the ISR if it's due; returns the number of ISR runs
+static int tick()
+{
+	if (!++TA0R)
+		TA0CTL |= TAIFG;
+	if (TA0R == TA0CCR1)
+		TA0CCTL1 |= CCIFG;
+	if ( ((TA0CTL & TAIE) && (TA0CTL & TAIFG)) || ((TA0CCTL1 & CCIE) && (TA0CCTL1 & CCIFG)) ) {
+		can_timer_isr();
+		return 1;
+	}
+	return 0;
+}
+
+// Arm an alarm ticks out with TA0R at phase, and check it fires exactly then
+static void alarm(uint16_t phase, uint32_t ticks)
+{
+	uint32_t when, n;
+
+	while (TA0R != phase)
+		tick();
+	when = can_timer_now() + ticks;
+	can_timer_alarm(when);
+	for (n=0; !can_timer_fired && n < ticks + 0x20000UL; n++) {
+		tick();
+		if (!can_timer_fired && can_timer_expired(when + 1))
+			break;  // Late
+		if (can_timer_fired)
+			CHECK(can_timer_expired(when));  // Not early
+	}
+	CHECK(can_timer_fired);
+	CHECK(can_timer_now() == when);
+}
+
+static void test_alarms()
+{
+	static const uint32_t lens[] = { 1, 100, 0x7FFF, 0x8000, CAN_TIMER_MS(20), 0xFFFF, 0x10000, CAN_TIMER_MS(50),
+	                                 0x2ABCD };
+	static const uint16_t phases[] = { 0x0000, 0x1234, 0x7FFF, 0x8000, 0xC000, 0xFFFE };
+	uint8_t i, j;
+
+	test_name = "alarms";
+	for (i=0; i < sizeof(lens) / sizeof(lens[0]); i++)
+		for (j=0; j < sizeof(phases) / sizeof(phases[0]); j++)
+			alarm(phases[j], lens[i]);
+}
+
+static void test_passed()
+{
+	test_name = "passed";
+	can_timer_alarm(can_timer_now());
+	CHECK(can_timer_fired);
+	can_timer_alarm(can_timer_now() - 5);
+	CHECK(can_timer_fired);
+}
+
+static void test_cancel()
+{
+	uint32_t n;
+
+	test_name = "cancel";
+	can_timer_alarm(can_timer_now() + CAN_TIMER_MS(20));
+	can_timer_cancel();
+	for (n=0; n < CAN_TIMER_MS(40); n++)
+		tick();
+	CHECK(!can_timer_fired);
+}
+
+int main()
+{
+	can_timer_init();
+	test_alarms();
+	test_passed();
+	test_cancel();
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
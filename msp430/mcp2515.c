@@ -6,26 +6,172 @@
 #include <string.h>
 #include "mcp2515.h"
 #include "msp430_spi.h"
+#if defined(MCP2515_TX_STREAM) || defined(MCP2515_RX_TIMESTAMP)
+#include "can_timer.h"
+#endif
+#ifdef MCP2515_TX_SCHED
+#include "can_sched.h"
+#endif
+
+/* Default instance, on the CAN_SPI_CS_* / CAN_IRQ_* pins; every can_*() without a _dev suffix works on it */
+can_dev_t can_dev0 = { &CAN_SPI_CS_PORTOUT, &CAN_SPI_CS_PORTDIR, CAN_SPI_CS_PORTBIT,
+	&CAN_IRQ_PORTIN, &CAN_IRQ_PORTOUT, &CAN_IRQ_PORTDIR, &CAN_IRQ_PORTREN, &CAN_IRQ_PORTIES, &CAN_IRQ_PORTIE,
+	&CAN_IRQ_PORTIFG, CAN_IRQ_PORTBIT };
+
+// All devices share one SPI bus; whoever runs can_init_dev() first brings it up
+static uint8_t can_spi_up;
+
+#if defined(MCP2515_TX_STREAM) && !defined(MCP2515_RX_RING_SIZE)
+#error "MCP2515_TX_STREAM needs MCP2515_RX_RING_SIZE so frames received during a transfer have somewhere to go"
+#endif
+#if defined(MCP2515_RX_TIMESTAMP) && !defined(MCP2515_RX_RING_SIZE)
+#error "MCP2515_RX_TIMESTAMP needs MCP2515_RX_RING_SIZE; stamps are kept alongside the frames in the RX ring"
+#endif
+#if defined(MCP2515_RTR_RESPONDERS) && !defined(MCP2515_RX_RING_SIZE)
+#error "MCP2515_RTR_RESPONDERS needs MCP2515_RX_RING_SIZE; RTRs are answered as can_isr() reads them out"
+#endif
+#ifdef MCP2515_SW_FILTER
+#if !defined(MCP2515_RX_RING_SIZE)
+#error "MCP2515_SW_FILTER needs MCP2515_RX_RING_SIZE; frames are filtered as can_isr() reads them out"
+#endif
+#if MCP2515_SW_FILTER & (MCP2515_SW_FILTER - 1) || MCP2515_SW_FILTER > 128
+#error "MCP2515_SW_FILTER must be a power of 2 no larger than 128"
+#endif
+#endif
+#if defined(MCP2515_TX_SCHED) && !defined(MCP2515_RX_RING_SIZE)
+#error "MCP2515_TX_SCHED needs MCP2515_RX_RING_SIZE; scheduled frames are sent from can_isr()"
+#endif
+#if defined(MCP2515_STD_ONLY) && defined(MCP2515_EXT_ONLY)
+#error "MCP2515_STD_ONLY and MCP2515_EXT_ONLY can't both be defined"
+#endif
+#if defined(MCP2515_NO_RTR) && defined(MCP2515_RTR_RESPONDERS)
+#error "MCP2515_RTR_RESPONDERS answers remote frames; it can't go with MCP2515_NO_RTR"
+#endif
+#if defined(MCP2515_NO_ERRORS) && defined(MCP2515_HEALTH)
+#error "MCP2515_HEALTH runs off the error IRQ; it can't go with MCP2515_NO_ERRORS"
+#endif
+
+// is_ext as a one-kind build sees it, a constant the IDE branches fold on
+#if defined(MCP2515_STD_ONLY)
+#define CAN_IS_EXT(is_ext) 0
+#elif defined(MCP2515_EXT_ONLY)
+#define CAN_IS_EXT(is_ext) 1
+#else
+#define CAN_IS_EXT(is_ext) (is_ext)
+#endif
+
+#ifdef MCP2515_RX_RING_SIZE
+#if MCP2515_RX_RING_SIZE & (MCP2515_RX_RING_SIZE - 1) || MCP2515_RX_RING_SIZE > 128
+#error "MCP2515_RX_RING_SIZE must be a power of 2 no larger than 128"
+#endif
+
+/* Each device's ring is single-producer single-consumer: only can_isr() (or can_irq_handler() with the ISR
+ * locked out) moves rxring_head, only can_recv() moves rxring_tail.
+ */
+#define CAN_RX_RING_MASK (MCP2515_RX_RING_SIZE - 1)
+#define CAN_RX_RING_EMPTY (dev->rxring_head == dev->rxring_tail)
+#define CAN_BARRIER __asm__ __volatile__ ("" : : : "memory")
+
+// Every initialized device, so a transaction on one can keep all of their can_isr()s off the bus
+static can_dev_t *can_devs;
+#endif
+
+#ifdef MCP2515_TX_QUEUE_SIZE
+#if MCP2515_TX_QUEUE_SIZE > 255
+#error "MCP2515_TX_QUEUE_SIZE must be 255 or less"
+#endif
+
+#define CAN_TXQ_NABORT (uint8_t)((dev->txabort & 1) + ((dev->txabort >> 1) & 1) + (dev->txabort >> 2))
+#endif
+
+#ifdef MCP2515_STATS
+/* Statistics updates on the "dev" of the function they're used in */
+#define CAN_STAT(expr) (dev->stats.expr)
+#define CAN_STAT_HWM(field, n) do { if ((uint8_t)(n) > dev->stats.field) dev->stats.field = (n); } while (0)
+#else
+#define CAN_STAT(expr)
+#define CAN_STAT_HWM(field, n)
+#endif
+
+// TXnIF bits of a READ STATUS byte as a TXB bitmap
+#define CAN_STATUS_TXDONE(s) ((((s) >> 3) & 0x01) | (((s) >> 4) & 0x02) | (((s) >> 5) & 0x04))
+
+/* SPI I/O
+ * The CS and lock macros work on the "dev" of the function they're used in.
+ */
 
-/* Global variables used internally */
-uint8_t mcp2515_txb, mcp2515_ctrl, mcp2515_exmask;
+#ifdef MCP2515_RX_RING_SIZE
+/* can_isr() does SPI I/O of its own, so keep every device's from firing in the middle of a transaction;
+ * CAN_CS_HIGH lets back in those that aren't locked out with CAN_IRQ_LOCK.
+ */
+static void can_irq_mask_all()
+{
+	can_dev_t *d;
 
-/* Global variable exposed externally for IRQ handling */
-volatile uint8_t mcp2515_irq, mcp2515_buf;
+	for (d=can_devs; d; d=d->next)
+		*d->irq_ie &= ~d->irq_bit;
+}
 
-/* SPI I/O */
+static void can_irq_unmask_all()
+{
+	can_dev_t *d;
 
-#define CAN_CS_LOW CAN_SPI_CS_PORTOUT &= ~CAN_SPI_CS_PORTBIT
-#define CAN_CS_HIGH CAN_SPI_CS_PORTOUT |= CAN_SPI_CS_PORTBIT
+	for (d=can_devs; d; d=d->next)
+		*d->irq_ie |= d->irqmask;
+}
 
-void can_spi_command(uint8_t cmd)
+#define CAN_CS_LOW do { can_irq_mask_all(); *dev->cs_out &= ~dev->cs_bit; SPI_CS_CHANGED(); } while (0)
+#define CAN_CS_HIGH do { *dev->cs_out |= dev->cs_bit; can_irq_unmask_all(); SPI_CS_CHANGED(); } while (0)
+#define CAN_IRQ_LOCK do { dev->irqmask = 0; *dev->irq_ie &= ~dev->irq_bit; } while (0)
+#define CAN_IRQ_UNLOCK do { dev->irqmask = dev->irq_bit; *dev->irq_ie |= dev->irq_bit; } while (0)
+#else
+#define CAN_CS_LOW do { *dev->cs_out &= ~dev->cs_bit; SPI_CS_CHANGED(); } while (0)
+#define CAN_CS_HIGH do { *dev->cs_out |= dev->cs_bit; SPI_CS_CHANGED(); } while (0)
+#endif
+
+#ifdef MCP2515_RX_RING_SIZE
+/* can_isr() retires TXBs (refilling them from the queue) and claims them for scheduled frames, so the main loop
+ * locks it out while touching either
+ */
+#define CAN_TXQ_LOCK CAN_IRQ_LOCK
+#define CAN_TXQ_UNLOCK CAN_IRQ_UNLOCK
+#else
+#define CAN_TXQ_LOCK
+#define CAN_TXQ_UNLOCK
+#endif
+
+#ifdef MCP2515_RTR_RESPONDERS
+// TXB2 belongs to the RTR responder, its TXB2CTRL fixed at priority 3
+#define CAN_TXB_RTR 0x04
+#else
+#define CAN_TXB_RTR 0x00
+#endif
+
+/* Reserved TXBs (hot slots, the RTR responder's): their bits stay set in dev->txb so can_send() never picks them,
+ * can_txq_preempt() and can_tx_cancel() leave them alone, and their completions are cleared but never reported.
+ */
+#ifdef MCP2515_TX_HOT
+#define CAN_TXB_RES(dev) ((dev)->txres)
+#else
+#define CAN_TXB_RES(dev) CAN_TXB_RTR
+#endif
+
+#ifdef MCP2515_HEALTH
+// TXBs in use, out of a dev->txb bitmap; a new one may only be taken while this is under dev->txlimit
+#define CAN_TXB_COUNT(t) (((t) & 1) + (((t) >> 1) & 1) + ((t) >> 2))
+#define CAN_TXB_LIMITED(dev) (CAN_TXB_COUNT((dev)->txb & ~CAN_TXB_RES(dev)) >= (dev)->txlimit)
+#else
+#define CAN_TXB_LIMITED(dev) 0
+#endif
+
+void can_spi_command_dev(can_dev_t *dev, uint8_t cmd)
 {
 	CAN_CS_LOW;
 	spi_transfer(cmd);
 	CAN_CS_HIGH;
 }
 
-uint8_t can_spi_query(uint8_t cmd)
+uint8_t can_spi_query_dev(can_dev_t *dev, uint8_t cmd)
 {
 	uint8_t ret;
 
@@ -36,35 +182,25 @@ uint8_t can_spi_query(uint8_t cmd)
 	return ret;
 }
 
-void can_r_reg(uint8_t addr, void *buf, uint8_t len)
+void can_r_reg_dev(can_dev_t *dev, uint8_t addr, void *buf, uint8_t len)
 {
-	uint16_t i;
-	uint8_t *sbuf = (uint8_t *)buf;
-
 	CAN_CS_LOW;
 	spi_transfer(MCP2515_SPI_READ);
 	spi_transfer(addr);
-	for (i=0; i < len; i++) {
-		sbuf[i] = spi_transfer(0xFF);
-	}
+	spi_read_block((uint8_t *)buf, len);
 	CAN_CS_HIGH;
 }
 
-void can_w_reg(uint8_t addr, void *buf, uint8_t len)
+void can_w_reg_dev(can_dev_t *dev, uint8_t addr, void *buf, uint8_t len)
 {
-	uint16_t i;
-	uint8_t *sbuf = (uint8_t *)buf;
-
 	CAN_CS_LOW;
 	spi_transfer(MCP2515_SPI_WRITE);
 	spi_transfer(addr);
-	for (i=0; i < len; i++) {
-		spi_transfer(sbuf[i]);
-	}
+	spi_write_block((uint8_t *)buf, len);
 	CAN_CS_HIGH;
 }
 
-void can_w_bit(uint8_t addr, uint8_t mask, uint8_t val)
+void can_w_bit_dev(can_dev_t *dev, uint8_t addr, uint8_t mask, uint8_t val)
 {
 	CAN_CS_LOW;
 	spi_transfer(MCP2515_SPI_BITMOD);
@@ -74,77 +210,200 @@ void can_w_bit(uint8_t addr, uint8_t mask, uint8_t val)
 	CAN_CS_HIGH;
 }
 
-void can_w_txbuf(uint8_t bufid, void *buf, uint8_t len)
+void can_w_txbuf_dev(can_dev_t *dev, uint8_t bufid, void *buf, uint8_t len)
 {
-	uint16_t i;
-	uint8_t *sbuf = (uint8_t *)buf;
-
 	CAN_CS_LOW;
 	spi_transfer(MCP2515_SPI_LOAD_TXBUF | (bufid & 0x07));
-	for (i=0; i < len; i++) {
-		spi_transfer(sbuf[i]);
-	}
+	spi_write_block((uint8_t *)buf, len);
 	CAN_CS_HIGH;
 }
 
-void can_r_rxbuf(uint8_t bufid, void *buf, uint8_t len)
+/* BIT MODIFY on CANINTE, skipped entirely if the shadow copy says the bits are already set that way */
+static void can_w_inte(can_dev_t *dev, uint8_t mask, uint8_t val)
 {
-	uint16_t i;
-	uint8_t *sbuf = (uint8_t *)buf;
+	val &= mask;
+	if ( (dev->inte & mask) == val )
+		return;
+	dev->inte = (dev->inte & ~mask) | val;
+	can_w_bit_dev(dev, MCP2515_CANINTE, mask, val);
+}
 
+void can_r_rxbuf_dev(can_dev_t *dev, uint8_t bufid, void *buf, uint8_t len)
+{
 	CAN_CS_LOW;
 	spi_transfer(MCP2515_SPI_READ_RXBUF | (bufid & 0x06));
-	for (i=0; i < len; i++) {
-		sbuf[i] = spi_transfer(0xFF);
-	}
+	spi_read_block((uint8_t *)buf, len);
 	CAN_CS_HIGH;
 }
 
+/* 2-byte quick-poll instructions; see MCP2515_STATUS_* and MCP2515_RXSTATUS_* for the reply layout */
+uint8_t can_read_status_dev(can_dev_t *dev)
+{
+	return can_spi_query_dev(dev, MCP2515_SPI_READ_STATUS);
+}
+
+uint8_t can_rx_status_dev(can_dev_t *dev)
+{
+	return can_spi_query_dev(dev, MCP2515_SPI_RX_STATUS);
+}
+
 /* Main library - Maintenance functions */
 
-void can_init()
+#define CAN_OPMOD_POLLS 1000  // CANSTAT reads before giving up on a mode change, ~10ms worth
+
+// Wait for CANSTAT to report operating mode opmod; 0 once it does, -1 if it never gets there
+static int can_opmod_wait(can_dev_t *dev, uint8_t opmod)
 {
-	uint8_t ie;
+	uint16_t i;
+	uint8_t stat;
 
-	// CS pin - inactive HIGH, active LOW
-	CAN_SPI_CS_PORTOUT |= CAN_SPI_CS_PORTBIT;
-	CAN_SPI_CS_PORTDIR |= CAN_SPI_CS_PORTBIT;
+	for (i=0; i < CAN_OPMOD_POLLS; i++) {
+		can_r_reg_dev(dev, MCP2515_CANSTAT, &stat, 1);
+		if ( (stat & MCP2515_CANSTAT_OPMOD_MASK) == opmod )
+			return 0;
+	}
+	return -1;
+}
 
-	// IRQ pin
-	CAN_IRQ_PORTIE &= ~CAN_IRQ_PORTBIT;
-	CAN_IRQ_PORTDIR &= ~CAN_IRQ_PORTBIT;
-	CAN_IRQ_PORTREN |= CAN_IRQ_PORTBIT;
-	CAN_IRQ_PORTOUT |= CAN_IRQ_PORTBIT;
-	CAN_IRQ_PORTIES |= CAN_IRQ_PORTBIT;
-	CAN_IRQ_PORTIFG &= ~CAN_IRQ_PORTBIT;
-	CAN_IRQ_PORTIE |= CAN_IRQ_PORTBIT;
+/* Bracket writes to registers that only take them in CONFIGURATION mode.  Nothing is sent while dev->ctrl keeps
+ * the controller in CONFIGURATION mode anyway, as it does from can_init() until the firmware picks another mode.
+ */
+static int can_cfg_enter(can_dev_t *dev)
+{
+	if ( (dev->ctrl & MCP2515_CANCTRL_REQOP_MASK) == MCP2515_CANCTRL_REQOP_CONFIGURATION )
+		return 0;
+	can_w_bit_dev(dev, MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
+	return can_opmod_wait(dev, MCP2515_CANSTAT_OPMOD_CONFIGURATION);  // Not until any frame on the wire is done
+}
 
-	spi_init();
-	can_spi_command(MCP2515_SPI_RESET);
-	__delay_cycles(160000);
+static void can_cfg_leave(can_dev_t *dev)
+{
+	if ( (dev->ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
+		can_w_bit_dev(dev, MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, dev->ctrl);
+}
 
-	mcp2515_ctrl = MCP2515_CANCTRL_REQOP_CONFIGURATION;
-	can_w_reg(MCP2515_CANCTRL, &mcp2515_ctrl, 1);
+void can_init_dev(can_dev_t *dev)
+{
+	uint8_t ie;
+	#ifdef MCP2515_RX_RING_SIZE
+	can_dev_t *d;
+	#endif
 
-	ie = MCP2515_CANINTE_RX0IE | MCP2515_CANINTE_RX1IE | MCP2515_CANINTE_ERRIE | MCP2515_CANINTE_MERRE;
-	can_w_reg(MCP2515_CANINTE, &ie, 1);
+	// CS pin - inactive HIGH, active LOW
+	*dev->cs_out |= dev->cs_bit;
+	*dev->cs_dir |= dev->cs_bit;
 
-	mcp2515_irq = 0x00;
-	mcp2515_txb = 0x00;
-	mcp2515_exmask = 0x00;
+	// IRQ pin
+	*dev->irq_ie &= ~dev->irq_bit;
+	*dev->irq_dir &= ~dev->irq_bit;
+	*dev->irq_ren |= dev->irq_bit;
+	*dev->irq_out |= dev->irq_bit;
+	*dev->irq_ies |= dev->irq_bit;
+	*dev->irq_ifg &= ~dev->irq_bit;
+
+	#ifdef MCP2515_RX_RING_SIZE
+	dev->irqmask = dev->irq_bit;
+	dev->rxring_head = 0;
+	dev->rxring_tail = 0;
+	for (d=can_devs; d && d != dev; d=d->next)
+		;
+	if (!d) {
+		dev->next = can_devs;
+		can_devs = dev;
+	}
+	#endif
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	dev->txq_len = 0;
+	dev->txabort = 0;
+	#endif
+	#ifdef MCP2515_HEALTH
+	dev->health = MCP2515_HEALTH_ACTIVE;
+	dev->tec = 0;
+	dev->rec = 0;
+	dev->eflg = 0;
+	dev->txlimit = 3;
+	#endif
+	#ifdef MCP2515_SW_FILTER
+	dev->swf = NULL;
+	#endif
+	#ifdef MCP2515_RTR_RESPONDERS
+	for (ie=0; ie < MCP2515_RTR_RESPONDERS; ie++)
+		dev->rtr[ie].len = 0xFF;
+	dev->rtr_loaded = 0xFF;
+	#endif
+	#ifdef MCP2515_STATS
+	memset(&dev->stats, 0, sizeof(struct can_stats));
+	#endif
+	*dev->irq_ie |= dev->irq_bit;
+
+	if (!can_spi_up) {
+		spi_init();
+		can_spi_up = 1;
+	}
+	can_spi_command_dev(dev, MCP2515_SPI_RESET);
+	can_opmod_wait(dev, MCP2515_CANSTAT_OPMOD_CONFIGURATION);  // Comes out of reset in CONFIGURATION mode
+
+	dev->ctrl = MCP2515_CANCTRL_REQOP_CONFIGURATION;
+	can_w_reg_dev(dev, MCP2515_CANCTRL, &dev->ctrl, 1);
+
+	ie = MCP2515_CANINTE_RX0IE | MCP2515_CANINTE_RX1IE;
+	#ifndef MCP2515_NO_ERRORS
+	ie |= MCP2515_CANINTE_ERRIE | MCP2515_CANINTE_MERRE;
+	#endif
+	can_w_reg_dev(dev, MCP2515_CANINTE, &ie, 1);
+	dev->inte = ie;
+	memset(dev->txprio, 0, 3);  // TXBnCTRL resets to 0
+	memset(dev->cnf, 0, 3);     // As do CNF1-3 and RXBnCTRL
+	memset(dev->rxbctrl, 0, 2);
+	#ifdef MCP2515_EXT_ONLY
+	{
+		// Filters reset to standard ID 0; make them all extended ID 0, which with the masks at 0 takes every extended frame
+		static const uint8_t rxf_ext[12] = { 0, 0x08, 0, 0, 0, 0x08, 0, 0, 0, 0x08, 0, 0 };
+
+		can_w_reg_dev(dev, MCP2515_RXF0SIDH, (void *)rxf_ext, 12);
+		can_w_reg_dev(dev, MCP2515_RXF3SIDH, (void *)rxf_ext, 12);
+	}
+	dev->exmask = 0x03;
+	#else
+	dev->exmask = 0x00;
+	#endif
+	#ifdef MCP2515_RTR_RESPONDERS
+	dev->txprio[2] = 3;
+	can_w_reg_dev(dev, MCP2515_TXB2CTRL, &dev->txprio[2], 1);
+	#endif
+
+	dev->irq = 0x00;
+	dev->txb = CAN_TXB_RTR;
+	#ifdef MCP2515_TX_HOT
+	dev->txres = CAN_TXB_RTR;
+	#endif
+	dev->txpend = 0x00;
+	dev->txsent = 0x00;
 
 	_EINT();
 }
 
+#ifndef MCP2515_NO_SPEED_CALC
+// PS2 for n TQ per bit to put the sample point at MCP2515_SAMPLE_POINT, within the 2-8 TQ the MCP2515 allows
+static uint16_t can_bt_ps2(uint16_t n)
+{
+	uint16_t ps2 = n - (n * MCP2515_SAMPLE_POINT + 500) / 1000;
+
+	if (ps2 < 2)
+		return 2;
+	if (ps2 > 8)
+		return 8;
+	return ps2;
+}
+
 /* Bitrate in Hz
  * propseg_hint in Time Quanta, 1-8
  * syncjump in Time Quanta, 1-4
  */
-int can_speed(uint32_t bitrate, uint8_t propseg_hint, uint8_t syncjump)
+int can_speed_dev(can_dev_t *dev, uint32_t bitrate, uint8_t propseg_hint, uint8_t syncjump)
 {
-	uint32_t a;
-	uint16_t brp = 0, tq_prop, tq_ps1, tq_ps2;
-	uint8_t c;
+	uint16_t brp, i, a, n, tq_prop, tq_ps1, tq_ps2, tseg1;
+	uint32_t per;
 
 	// Sanity check
 	if (!bitrate || bitrate > 1000000)
@@ -156,45 +415,69 @@ int can_speed(uint32_t bitrate, uint8_t propseg_hint, uint8_t syncjump)
 	if (!syncjump)
 		syncjump = 1;
 
-	// Resolve appropriate bitrate prescaler
-	do {
-		brp++;
-		a = CAN_OSC_FREQUENCY / 2 / brp;  // TQ (Time Quanta) = tOSC / 2
-		a /= bitrate;
-	} while (a > 25);
-
+	// Smallest bitrate prescaler that gets a bit down to 25 TQ (TQ = 2 x tOSC), solved for directly
+	brp = CAN_OSC_FREQUENCY / 2 / 26 / bitrate + 1;
+	if (brp > 64)
+		return -1;
+	a = CAN_OSC_FREQUENCY / 2 / ((uint32_t)brp * bitrate);
 	if (a < 8)
 		return -1;  // Invalid speed
 
-	a -= 1;  // Sync Seg fixed at 1 TQ
-	if ( (a - propseg_hint) < 3 )
-		propseg_hint = a - 3;
-	if (propseg_hint > 8)
-		propseg_hint = 8;
+	// That may miss the bitrate, or the sample point; a larger prescaler with fewer TQ per bit might hit both
+	for (i = brp; i <= 64; i++) {
+		per = (uint32_t)i * bitrate;
+		n = CAN_OSC_FREQUENCY / 2 / per;
+		if (n < 8)
+			break;
+		if ( (CAN_OSC_FREQUENCY / 2) % per == 0 && n - 1 - can_bt_ps2(n) <= 16 ) {
+			brp = i;
+			a = n;
+			break;
+		}
+	}
 
-	// Propagation segment is hinted by the user (can be tweaked to account for long cable runs)
+	// PS2 is what's left after the sample point; Sync Seg + PropSeg + PS1 can't exceed 17 TQ
+	tq_ps2 = can_bt_ps2(a);
+	tseg1 = a - 1 - tq_ps2;
+	if (tseg1 > 16) {
+		tq_ps2 += tseg1 - 16;
+		tseg1 = 16;
+	}
+	if (tseg1 < tq_ps2)
+		return -1;  // Sample point too early for this many TQ
+
+	// Propagation segment is hinted by the user (can be tweaked to account for long cable runs); PS1 gets the rest
 	tq_prop = propseg_hint;
-	a -= tq_prop;
-	// Split PS1 and PS2 evenly; give bias to PS2 (it needs to be at least 2xTQ)
-	tq_ps1 = a / 2;
-	a -= tq_ps1;
-	tq_ps2 = a;
+	if (tq_prop > tseg1 - 1)
+		tq_prop = tseg1 - 1;
+	if (tq_prop > 8)
+		tq_prop = 8;
+	tq_ps1 = tseg1 - tq_prop;
+	if (tq_ps1 > 8) {
+		tq_prop += tq_ps1 - 8;
+		tq_ps1 = 8;
+	}
 
 	if (syncjump >= tq_ps2)
 		syncjump = tq_ps2 - 1;
 
-	// Configure BRP, SJW, TQ_PropSeg, TQ_PS1, TQ_PS2
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
-		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
+	return can_speed_cnf_dev(dev, ((brp - 1) & MCP2515_CNF1_BRP_MASK) | ((syncjump - 1) << 6),
+				 MCP2515_CNF2_BTLMODE | (tq_prop-1) | ((tq_ps1-1) << 3), tq_ps2-1);
+}
+#endif
 
-	c = ((brp - 1) & 0x3F) | ((syncjump - 1) << 6);
-	can_w_reg(MCP2515_CNF1, &c, 1);
-	can_w_bit(MCP2515_CNF2, MCP2515_CNF2_PRSEG_MASK | MCP2515_CNF2_PHSEG_MASK | MCP2515_CNF2_BTLMODE,
-			  MCP2515_CNF2_BTLMODE | (tq_prop-1) | ((tq_ps1-1) << 3));
-	can_w_bit(MCP2515_CNF3, MCP2515_CNF3_PHSEG_MASK, tq_ps2-1);
+/* Load CNF1-3 as worked out by can_speed() or MCP2515_CNF1_FOR() etc., all with one sequential WRITE from CNF3
+ * up.  SOF, WAKFIL and SAM belong to can_ioctl() and keep their current settings.
+ */
+int can_speed_cnf_dev(can_dev_t *dev, uint8_t cnf1, uint8_t cnf2, uint8_t cnf3)
+{
+	dev->cnf[0] = (dev->cnf[0] & (MCP2515_CNF3_SOF | MCP2515_CNF3_WAKFIL)) | (cnf3 & MCP2515_CNF3_PHSEG_MASK);
+	dev->cnf[1] = (dev->cnf[1] & MCP2515_CNF2_SAM) | (cnf2 & ~MCP2515_CNF2_SAM);
+	dev->cnf[2] = cnf1;
 
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
-		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
+	can_cfg_enter(dev);
+	can_w_reg_dev(dev, MCP2515_CNF3, dev->cnf, 3);  // CNF3, CNF2, CNF1
+	can_cfg_leave(dev);
 	return 0;
 }
 
@@ -233,17 +516,18 @@ void can_compose_msgid_std(uint32_t id, uint8_t *bytebuf)
 void can_compose_msgid_ext(uint32_t id, uint8_t *bytebuf)
 {
 	bytebuf[0] = (uint8_t) ((id & 0x1FE00000UL) >> 21);
-	bytebuf[1] = (uint8_t) ((id & 0x001C0000UL) >> 12) | (uint8_t) ((id & 0x00030000UL) >> 16) | 0x08;  // EID
+	bytebuf[1] = (uint8_t) ((id & 0x001C0000UL) >> 13) | (uint8_t) ((id & 0x00030000UL) >> 16) | 0x08;  // EID
 	bytebuf[2] = (uint8_t) ((id & 0x0000FF00UL) >> 8);
 	bytebuf[3] = (uint8_t) (id & 0x000000FFUL);
 }
 
-uint32_t can_parse_msgid(uint8_t *buf)
+// With MCP2515_STD_ONLY or MCP2515_EXT_ONLY the IDE bit isn't looked at; buf is taken to be that kind of ID
+uint32_t can_parse_msgid(const uint8_t *buf)
 {
 	uint32_t ret = 0;
 
-	if (buf[1] & 0x08) {  // Extended message ID
-		ret = ((uint32_t)(buf[0]) << 21) | ((uint32_t)(buf[1] & 0xE0) << 12) |
+	if (CAN_IS_EXT(buf[1] & 0x08)) {  // Extended message ID
+		ret = ((uint32_t)(buf[0]) << 21) | ((uint32_t)(buf[1] & 0xE0) << 13) |
 			  (((uint32_t)(buf[1]) & 0x03) << 16) |
 			  ((uint32_t)(buf[2]) << 8) |
 			  (uint32_t)(buf[3]);
@@ -253,354 +537,957 @@ uint32_t can_parse_msgid(uint8_t *buf)
 	return ret;
 }
 
+/* Frames */
+
+void can_frame_set_id(can_frame_t *f, uint32_t id, uint8_t is_ext)
+{
+	if (CAN_IS_EXT(is_ext))
+		can_compose_msgid_ext(id, &f->sidh);
+	else
+		can_compose_msgid_std(id, &f->sidh);
+}
+
+/* Fixed-block frame pool over a caller-owned array.  Free frames are chained through their data[] bytes,
+ * so the pool costs nothing per frame; alloc/free run with interrupts off and are safe from an ISR.
+ */
+void can_pool_init(struct can_frame_pool *pool, can_frame_t *frames, uint8_t count)
+{
+	pool->free = 0;
+	pool->avail = 0;
+	while (count--)
+		can_pool_free(pool, frames++);
+}
+
+can_frame_t *can_pool_alloc(struct can_frame_pool *pool)
+{
+	can_frame_t *f;
+	uint16_t sr;
+
+	sr = __get_SR_register() & GIE;
+	_DINT();
+	if ( (f = pool->free) ) {
+		memcpy(&pool->free, f->data, sizeof(can_frame_t *));  // data[] isn't aligned for a pointer
+		pool->avail--;
+	}
+	__bis_SR_register(sr);
+	return f;
+}
+
+void can_pool_free(struct can_frame_pool *pool, can_frame_t *f)
+{
+	uint16_t sr;
+
+	sr = __get_SR_register() & GIE;
+	_DINT();
+	memcpy(f->data, &pool->free, sizeof(can_frame_t *));
+	pool->free = f;
+	pool->avail++;
+	__bis_SR_register(sr);
+}
+
 /* CAN message transmission */
 
-int can_send(uint32_t msg, uint8_t is_ext, void *buf, uint8_t len, uint8_t prio)
+/* A steady-state frame (same priority as the last one sent from this TXB) costs two CS-framed
+ * transactions: LOAD TX BUFFER and RTS.  A priority change folds the TXBnCTRL write into the same
+ * transaction by running a sequential WRITE from TXBnCTRL through TXBnDm instead.
+ */
+#ifdef MCP2515_TX_QUEUE_SIZE
+/* Queue ordering, the frame's priority aside */
+static uint32_t can_txq_key(const can_frame_t *f)
 {
-	int txb;
-	uint8_t outbuf[13];
+	uint32_t key;
+
+	key = (uint32_t)((f->sidh << 3) | (f->sidl >> 5)) << 19;  // 11-bit base ID goes first in arbitration
+	if (can_frame_is_ext(f))  // Extended; IDE is recessive so it loses to a standard frame with the same base ID
+		key |= 0x00040000UL | ((uint32_t)(f->sidl & 0x03) << 16) | ((uint16_t)f->eid8 << 8) | f->eid0;
+	return key;
+}
+
+// Frame part of a queued TXBnCTRL..TXBnD7 image
+#define CAN_TXQ_FRAME(img) ((can_frame_t *)((img) + 1))
+#endif
 
-	if (len > 8 || prio > 3)
+/* Load a frame into a TXB already claimed in dev->txb and request transmission, straight from the
+ * caller's can_frame_t.  TXBnCTRL is only rewritten when the priority differs from what's already there.
+ */
+static void can_txb_load(can_dev_t *dev, uint8_t txb, uint8_t prio, const can_frame_t *f)
+{
+	uint8_t len = f->dlc & 0x0F;
+
+	if (dev->txprio[txb] == prio) {
+		can_w_txbuf_dev(dev, MCP2515_TXBUF_TXB0SIDH + 2*txb, (void *)f, 5+len);
+	} else {
+		CAN_CS_LOW;
+		spi_transfer(MCP2515_SPI_WRITE);
+		spi_transfer(MCP2515_TXB0CTRL + 0x10*txb);
+		spi_transfer(prio);
+		spi_write_block((const uint8_t *)f, 5+len);
+		CAN_CS_HIGH;
+		dev->txprio[txb] = prio;
+	}
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	dev->txkey[txb] = can_txq_key(f);
+	#endif
+	can_w_inte(dev, MCP2515_CANINTE_TX0IE << txb, MCP2515_CANINTE_TX0IE << txb);  // No SPI I/O once enabled
+	can_spi_command_dev(dev, MCP2515_SPI_RTS | (1 << txb));  // Initiate transmission
+}
+
+#ifdef MCP2515_TX_QUEUE_SIZE
+/* Sorted insert.  ahead=1 puts the image in front of others with the same prio & ID (used when requeueing
+ * an aborted TXB, which was sent to the queue before them); new frames also may not use the slots held
+ * back for TXBs with an abort in progress.
+ */
+static int can_txq_insert(can_dev_t *dev, uint8_t prio, const can_frame_t *f, uint8_t ahead)
+{
+	uint8_t i, p;
+	uint32_t key = can_txq_key(f), k;
+
+	if (dev->txq_len + (ahead ? 0 : CAN_TXQ_NABORT) >= MCP2515_TX_QUEUE_SIZE)
 		return -1;
+	for (i=dev->txq_len; i > 0; i--) {
+		p = dev->txq[i-1][0] & 0x03;
+		k = can_txq_key(CAN_TXQ_FRAME(dev->txq[i-1]));
+		if (p > prio || (p == prio && (k < key || (k == key && !ahead))))
+			break;  // Stays in front of us
+		memcpy(dev->txq[i], dev->txq[i-1], 14);
+	}
+	dev->txq[i][0] = prio;
+	memcpy(CAN_TXQ_FRAME(dev->txq[i]), f, sizeof(can_frame_t));
+	dev->txq_len++;
+	CAN_STAT_HWM(txq_hwm, dev->txq_len);
+	return 0;
+}
+
+/* Free TXB for a frame, or -1.  The MCP2515 sends equal-priority TXBs highest number first, so a frame has to go
+ * below any TXB already holding the same ID at the same priority or it would overtake it.
+ */
+static int can_txq_pick(can_dev_t *dev, uint8_t prio, uint32_t key)
+{
+	int i, txb = -1;
 
-	// Choose an available TX buffer
-	if ( (txb = can_tx_available()) < 0 )
+	if (CAN_TXB_LIMITED(dev))
 		return -1;
-	mcp2515_txb |= 1 << txb;
+	for (i=0; i < 3; i++) {
+		if ( !(dev->txb & (1 << i)) )
+			txb = i;
+		else if (dev->txprio[i] == prio && dev->txkey[i] == key)
+			break;
+	}
+	return txb;
+}
 
-	// Make sure we're in the right operational mode
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_NORMAL &&
-		 (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_LOOPBACK ) {
-		mcp2515_ctrl &= ~MCP2515_CANCTRL_REQOP_MASK;
-		can_w_reg(MCP2515_CANCTRL, &mcp2515_ctrl, 1);
+/* Collect TXBs whose abort went through (TXREQ and TXnIF both clear) and put their frames back in the queue.
+ * One that made it onto the wire anyway completes normally and is retired by the TX-complete path.
+ */
+static void can_txq_reap(can_dev_t *dev)
+{
+	uint8_t i, status, img[14];
+
+	status = can_read_status_dev(dev);
+	for (i=0; i < 3; i++) {
+		if ( !(dev->txabort & (1 << i)) )
+			continue;
+		if (status & ((MCP2515_STATUS_TX0REQ | MCP2515_STATUS_TX0IF) << 2*i)) {
+			if (status & (MCP2515_STATUS_TX0IF << 2*i))
+				dev->txabort &= ~(1 << i);  // Too late, it was sent
+			continue;
+		}
+		can_r_reg_dev(dev, MCP2515_TXB0CTRL + 0x10*i, img, 14);
+		dev->txabort &= ~(1 << i);
+		dev->txb &= ~(1 << i);
+		can_txq_insert(dev, dev->txprio[i], CAN_TXQ_FRAME(img), 1);  // Always fits; a slot was held back for it
 	}
-	
-	// Sending an Extended message?
-	if (is_ext)
-		can_compose_msgid_ext(msg, outbuf);
-	else
-		can_compose_msgid_std(msg, outbuf);
-	
-	// Load buffer & send
-	outbuf[4] = len;
-	memcpy(outbuf+5, (uint8_t *)buf, len);
+}
 
-	can_w_reg(MCP2515_TXB0CTRL + 0x10*txb, &prio, 1);
-	can_w_txbuf(MCP2515_TXBUF_TXB0SIDH + 2*txb, outbuf, 5+len);
-	can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << txb, MCP2515_CANINTE_TX0IE << txb);
-	//can_w_bit(MCP2515_TXB0CTRL + 0x10*txb, MCP2515_TXBCTRL_TXREQ, MCP2515_TXBCTRL_TXREQ);
-	can_spi_command(MCP2515_SPI_RTS | mcp2515_txb);  // Initiate transmission
+/* Priority inversion: every TXB is busy and the queue head outranks one of them.  Ask the lowest-priority
+ * one to abort; it is swapped out once can_txq_reap() sees the abort complete.  A frame already on the wire only
+ * gives up at the end of it, and an abort raises no interrupt, so until then MCP2515_IRQ_FLAGGED is kept set
+ * for can_irq_handler()/can_irq_batch() to look again.
+ */
+static void can_txq_preempt(can_dev_t *dev, uint8_t prio)
+{
+	uint8_t i, victim = 3;
 
-	return txb;
+	for (i=0; i < 3; i++) {
+		if ( ((dev->txabort | CAN_TXB_RES(dev)) & (1 << i)) || dev->txprio[i] >= prio )
+			continue;
+		if (victim == 3 || dev->txprio[i] < dev->txprio[victim] ||
+		    (dev->txprio[i] == dev->txprio[victim] && dev->txkey[i] > dev->txkey[victim]))
+			victim = i;
+	}
+	if (victim == 3 || dev->txq_len + CAN_TXQ_NABORT >= MCP2515_TX_QUEUE_SIZE)
+		return;
+	can_w_bit_dev(dev, MCP2515_TXB0CTRL + 0x10*victim, MCP2515_TXBCTRL_TXREQ, 0);
+	dev->txabort |= 1 << victim;
+	can_txq_reap(dev);
+	if (dev->txabort)
+		dev->irq |= MCP2515_IRQ_FLAGGED;
 }
 
-// SRR or RTR ... zero-byte frame requesting the specified msg be returned
-int can_query(uint32_t msg, uint8_t is_ext, uint8_t prio)
+/* Move frames from the head of the queue into whatever TXBs they may use */
+static void can_txq_refill(can_dev_t *dev)
+{
+	int txb;
+	uint8_t prio;
+	uint32_t key;
+
+	if (dev->txabort)
+		can_txq_reap(dev);
+	while (dev->txq_len) {
+		prio = dev->txq[0][0] & 0x03;
+		key = can_txq_key(CAN_TXQ_FRAME(dev->txq[0]));
+		if ( (txb = can_txq_pick(dev, prio, key)) < 0 ) {
+			if (dev->txb == 0x07)
+				can_txq_preempt(dev, prio);
+			if ( (txb = can_txq_pick(dev, prio, key)) < 0 )
+				return;
+		}
+		dev->txb |= 1 << txb;
+		can_txb_load(dev, txb, prio, CAN_TXQ_FRAME(dev->txq[0]));
+		dev->txq_len--;
+		memmove(dev->txq[0], dev->txq[1], 14 * dev->txq_len);
+	}
+}
+#endif
+
+/* Hand TXBs that completed (bitmap; TXnIF already cleared by the caller) back for reuse */
+static void can_tx_retire(can_dev_t *dev, uint8_t txdone)
+{
+	#ifdef MCP2515_STATS
+	uint8_t i;
+
+	for (i=0; i < 3; i++) {
+		if (txdone & (1 << i))
+			dev->stats.tx[i]++;
+	}
+	#endif
+	txdone &= ~CAN_TXB_RES(dev);  // Reserved TXBs stay claimed, and aren't reported
+	dev->txb &= ~txdone;
+	dev->txpend |= txdone;
+	dev->txsent |= txdone;
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	dev->txabort &= ~txdone;
+	can_txq_refill(dev);
+	#endif
+}
+
+// can_send_frame_dev() and can_send_txb_dev(); queue=0 refuses rather than copy f into the TX queue
+static int can_send_frame_q(can_dev_t *dev, const can_frame_t *f, uint8_t prio, uint8_t queue)
 {
 	int txb;
-	uint8_t outbuf[13];
 
-	if (prio > 3)
+	if ((f->dlc & 0x0F) > 8 || prio > 3)
 		return -1;
 
-	// Choose an available TX buffer
-	if ( !(mcp2515_txb & BIT0) )
-		txb = 0;
-	else if ( !(mcp2515_txb & BIT1) )
-		txb = 1;
-	else if ( !(mcp2515_txb & BIT2) )
-		txb = 2;
-	else
+	#ifndef MCP2515_TX_QUEUE_SIZE
+	// Choose an available TX buffer, claiming it before can_isr() can pick the same one for a scheduled frame
+	CAN_TXQ_LOCK;
+	if ( (txb = can_tx_available_dev(dev)) >= 0 )
+		dev->txb |= 1 << txb;
+	CAN_TXQ_UNLOCK;
+	if (txb < 0)
 		return -1;
-	mcp2515_txb |= 1 << txb;
+	#endif
 
 	// Make sure we're in the right operational mode
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_NORMAL &&
-		 (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_LOOPBACK ) {
-		mcp2515_ctrl &= ~MCP2515_CANCTRL_REQOP_MASK;
-		can_w_reg(MCP2515_CANCTRL, &mcp2515_ctrl, 1);
+	if ( (dev->ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_NORMAL &&
+		 (dev->ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_LOOPBACK ) {
+		dev->ctrl &= ~MCP2515_CANCTRL_REQOP_MASK;
+		can_w_reg_dev(dev, MCP2515_CANCTRL, &dev->ctrl, 1);
 	}
-	
-	// Sending an Extended message?
-	if (is_ext) {
-		can_compose_msgid_ext(msg, outbuf);
-		outbuf[4] = 0x40;  // RTR=1, data length = 0
+
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	CAN_TXQ_LOCK;
+	if ( !dev->txq_len && (txb = can_txq_pick(dev, prio, can_txq_key(f))) >= 0 ) {
+		dev->txb |= 1 << txb;
+		can_txb_load(dev, txb, prio, f);
+	} else if (!queue || can_txq_insert(dev, prio, f, 0) < 0) {
+		txb = -1;  // Queue full, or not to be used
 	} else {
-		can_compose_msgid_std(msg, outbuf);
-		outbuf[1] |= 0x10; // SRR=1
+		can_txq_refill(dev);
+		txb = MCP2515_TX_QUEUED;
 	}
-	
-	// Send
-	can_w_reg(MCP2515_TXB0CTRL + 0x10*txb, &prio, 1);
-	can_w_txbuf(MCP2515_TXBUF_TXB0SIDH + 2*txb, outbuf, 5);
-	can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << txb, MCP2515_CANINTE_TX0IE << txb);
-	//can_w_bit(MCP2515_TXB0CTRL + 0x10*txb, MCP2515_TXBCTRL_TXREQ, MCP2515_TXBCTRL_TXREQ);
-	can_spi_command(MCP2515_SPI_RTS);  // Initiate transmission
+	CAN_TXQ_UNLOCK;
+	#else
+	can_txb_load(dev, txb, prio, f);
+	#endif
 
 	return txb;
 }
 
+/* Send a frame as-is; returns the TXB it went into, MCP2515_TX_QUEUED or -1 like can_send().
+ * The frame isn't referenced once this returns, so the caller may reuse it right away.
+ */
+int can_send_frame_dev(can_dev_t *dev, const can_frame_t *f, uint8_t prio)
+{
+	return can_send_frame_q(dev, f, prio, 1);
+}
+
+/* can_send_frame_dev() straight into a TXB or not at all: -1 if the TX queue has frames f mustn't overtake, or
+ * no TXB may take it right now.  Nothing is copied, so f can stay where it is (an RX ring slot, say) until it goes.
+ */
+int can_send_txb_dev(can_dev_t *dev, const can_frame_t *f, uint8_t prio)
+{
+	return can_send_frame_q(dev, f, prio, 0);
+}
+
+int can_send_dev(can_dev_t *dev, uint32_t msg, uint8_t is_ext, void *buf, uint8_t len, uint8_t prio)
+{
+	can_frame_t f;
+
+	if (len > 8)
+		return -1;
+
+	// Sending an Extended message?
+	can_frame_set_id(&f, msg, is_ext);
+	f.dlc = len;
+	memcpy(f.data, (uint8_t *)buf, len);
+
+	return can_send_frame_dev(dev, &f, prio);
+}
+
+#ifndef MCP2515_NO_RTR
+// RTR ... zero-byte frame requesting the specified msg be returned; sent (or queued) like any other frame
+int can_query_dev(can_dev_t *dev, uint32_t msg, uint8_t is_ext, uint8_t prio)
+{
+	can_frame_t f;
+
+	can_frame_set_id(&f, msg, is_ext);
+	f.dlc = 0x40;  // RTR=1, data length = 0; TXBnDLC carries RTR for standard and extended frames alike
+	return can_send_frame_dev(dev, &f, prio);
+}
+#endif
+
 // Returns -1 if no TXB's were active
-int can_tx_cancel()
+int can_tx_cancel_dev(can_dev_t *dev)
 {
-	uint8_t i, work_done = -1;
+	int work_done = -1;
+	uint8_t i;
 	
+	CAN_TXQ_LOCK;
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	if (dev->txq_len)
+		work_done = 0;
+	CAN_STAT(txcancel += dev->txq_len);
+	dev->txq_len = 0;
+	dev->txabort = 0;
+	#endif
 	for (i=0; i < 3; i++) {
-		if (mcp2515_txb & (1 << i)) {
+		if (dev->txb & ~CAN_TXB_RES(dev) & (1 << i)) {
 			// Cancel TXREQ bit
-			can_w_bit(MCP2515_TXB0CTRL + 0x10*i, MCP2515_TXBCTRL_TXREQ, 0x00);
+			can_w_bit_dev(dev, MCP2515_TXB0CTRL + 0x10*i, MCP2515_TXBCTRL_TXREQ, 0x00);
 			// Disable IRQ for this TXB
-			can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_TX0IF << i, 0x00);
-			can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << i, 0x00);
+			can_w_bit_dev(dev, MCP2515_CANINTF, MCP2515_CANINTF_TX0IF << i, 0x00);
+			can_w_inte(dev, MCP2515_CANINTE_TX0IE << i, 0x00);
+			dev->txb &= ~(1 << i);
+			CAN_STAT(txcancel++);
 			work_done = 0;
 		}
 	}
+	CAN_TXQ_UNLOCK;
 	return work_done;
 }
 
 // Returns available TXB if one is available, else -1 indicating the user must wait to TX.
-int can_tx_available()
+int can_tx_available_dev(can_dev_t *dev)
 {
 	int txb = -1;
 
-	if ( !(mcp2515_txb & BIT0) )
+	if (CAN_TXB_LIMITED(dev))
+		return -1;
+	if ( !(dev->txb & BIT0) )
 		txb = 0;
-	else if ( !(mcp2515_txb & BIT1) )
+	else if ( !(dev->txb & BIT1) )
 		txb = 1;
-	else if ( !(mcp2515_txb & BIT2) )
+	else if ( !(dev->txb & BIT2) )
 		txb = 2;
 	return txb;
 }
 
-/* CAN message receive */
-
-// Returns length of packet or -1 if nothing to read
-int can_recv(uint32_t *msgid, uint8_t *is_ext, void *buf)
+/* Nonzero if no TXB is busy with a frame from can_send() (reserved ones don't count) and one can be taken now, so
+ * the next frame can't be reordered against anything of ours.  Without a TX queue, a run of same-ID frames waits
+ * for this between frames, whichever TXB can_send() then picks.
+ */
+int can_tx_idle_dev(can_dev_t *dev)
 {
-	uint8_t msginbuf[13];
-	int rxb = -1;
-
-	// Any of them have unread data?
-	rxb = can_rx_pending();
-	if (rxb < 0)
-		return -1;
-
-	// Pull down the message
-	can_r_rxbuf(MCP2515_RXBUF_RXB0SIDH + 0x04*rxb, msginbuf, 13);
-	// To reduce risk of RXB overflow, acknowledge IRQ right away.
-	can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_RX0IF + rxb, 0x00);
-
-	*msgid = can_parse_msgid(msginbuf);
-	if (msginbuf[1] & 0x08)
-		*is_ext = 1;
-	else
-		*is_ext = 0;
-	memcpy((uint8_t *)buf, msginbuf+5, msginbuf[4] & 0x0F);
-
-	// Present RTR or SRR bit as 0x40
-	if (is_ext)
-		return msginbuf[4] & 0x4F;
-	else
-		return (msginbuf[4] & 0x0F) | ((msginbuf[1] & 0x10) << 2);
+	return !(dev->txb & ~CAN_TXB_RES(dev)) && can_tx_available_dev(dev) >= 0;
 }
 
-// Returns RXBID of first full buffer or -1 if nothing is waiting.
-int can_rx_pending()
+/* TXBs whose frames have gone out since the last call, and cleared by it.  Unlike a busy TXB going idle, this sees
+ * every completion, even one that can_isr() refilled from the TX queue straight away.  Meant for one user per device.
+ */
+uint8_t can_tx_sent_dev(can_dev_t *dev)
 {
-	uint8_t canintf;
+	uint8_t sent;
 
-	can_r_reg(MCP2515_CANINTF, &canintf, 1);
-	if (canintf & MCP2515_CANINTF_RX0IF)
-		return 0;
-	if (canintf & MCP2515_CANINTF_RX1IF)
-		return 1;
-	return -1;
+	CAN_TXQ_LOCK;
+	sent = dev->txsent;
+	dev->txsent = 0;
+	CAN_TXQ_UNLOCK;
+	return sent;
 }
 
-// Set one of the 2 RX masks.  maskid=0 is for RXB0, maskid=1 is for RXB1.
-int can_rx_setmask(uint8_t maskid, uint32_t msgmask, uint8_t is_ext)
+#ifdef MCP2515_TX_HOT
+/* Dedicate TXB txb (0-2) to frame f at priority prio, loading TXBnCTRL through the data in one sequential WRITE.
+ * With pin set, a falling edge on the TXnRTS pin sends it too; that bit of TXRTSCTRL only takes writes in
+ * CONFIGURATION mode, so the controller passes through it briefly.
+ * Returns txb, or -1 if it's in use, already reserved, or the controller wouldn't enter CONFIGURATION mode.
+ */
+int can_hot_reserve_dev(can_dev_t *dev, uint8_t txb, const can_frame_t *f, uint8_t prio, uint8_t pin)
 {
-	uint8_t maskbuf[4];
+	uint8_t bit;
 
-	if (maskid > 1)
+	if (txb > 2 || prio > 3 || (f->dlc & 0x0F) > 8)
+		return -1;
+	bit = 1 << txb;
+	CAN_TXQ_LOCK;
+	if ( (dev->txb | dev->txres) & bit ) {
+		CAN_TXQ_UNLOCK;
 		return -1;
-	
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
-		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
-
-	if (is_ext) {
-		can_compose_msgid_ext(msgmask, maskbuf);
-		maskbuf[1] &= ~0x08;  // EXIDE is unimplemented in the MASK registers
-		mcp2515_exmask |= 1 << maskid;
-	} else {
-		can_compose_msgid_std(msgmask, maskbuf);
-		mcp2515_exmask &= ~(1 << maskid);
 	}
-	
-	can_w_reg(MCP2515_RXM0SIDH + maskid * 0x04, maskbuf, 4);
+	dev->txb |= bit;
+	dev->txres |= bit;
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	dev->txkey[txb] = can_txq_key(f);
+	#endif
+	CAN_TXQ_UNLOCK;
 
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
-		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
+	CAN_CS_LOW;
+	spi_transfer(MCP2515_SPI_WRITE);
+	spi_transfer(MCP2515_TXB0CTRL + 0x10*txb);
+	spi_transfer(prio);
+	spi_write_block((const uint8_t *)f, 5 + (f->dlc & 0x0F));
+	CAN_CS_HIGH;
+	dev->txprio[txb] = prio;
 
-	return maskid;
+	if (pin) {
+		if (can_cfg_enter(dev) < 0) {
+			can_cfg_leave(dev);
+			can_hot_release_dev(dev, txb);
+			return -1;
+		}
+		can_w_bit_dev(dev, MCP2515_TXRTSCTRL, MCP2515_TXRTSCTRL_B0RTSM << txb, MCP2515_TXRTSCTRL_B0RTSM << txb);
+		can_cfg_leave(dev);
+	}
+	return txb;
 }
 
-/* Configure filter.  filtid is from 0-3 (0-1 when rxb=0, 0-3 when rxb=1)
- * Standard vs. Extended ID is determined by mcp2515_exmask (whether a mask was specified
- * for std or ext operation)
+/* Rewrite the first n data bytes of hot slot txb, and nothing else: one LOAD TX BUFFER from TXBnD0.
+ * Returns 0, or -1 if txb isn't a hot slot or its last frame is still waiting to go out.
  */
-int can_rx_setfilter(uint8_t rxb, uint8_t filtid, uint32_t msgid)
+int can_hot_load_dev(can_dev_t *dev, uint8_t txb, const void *data, uint8_t n)
 {
-	uint8_t idbuf[4];
-
-	if (rxb > 1)
-		return -1;
-	if (filtid > 5 || (filtid > 1 && rxb == 0))
+	if (txb > 2 || n > 8 || !(dev->txres & ~CAN_TXB_RTR & (1 << txb)))
 		return -1;
-	
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
-		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
-
-	if (mcp2515_exmask & (1 << rxb)) // Extended ID
-		can_compose_msgid_ext(msgid, idbuf);
-	else
-		can_compose_msgid_std(msgid, idbuf);
-	
-	filtid += 2*rxb;
-	if (filtid < 3)
-		can_w_reg(MCP2515_RXF0SIDH + filtid * 0x04, idbuf, 4);
-	else
-		can_w_reg(MCP2515_RXF3SIDH + (filtid-3) * 0x04, idbuf, 4);
-	
-	if ( (mcp2515_ctrl & MCP2515_CANCTRL_REQOP_MASK) != MCP2515_CANCTRL_REQOP_CONFIGURATION )
-		can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
-
-	return filtid;
+	if (can_read_status_dev(dev) & (MCP2515_STATUS_TX0REQ << 2*txb))
+		return -1;  // The MCP2515 ignores writes to a TXB with TXREQ set
+	if (n)
+		can_w_txbuf_dev(dev, MCP2515_TXBUF_TXB0D0 + 2*txb, (void *)data, n);
+	return 0;
 }
 
-// RX mode for the specified RXB.  See MCP2515_RXB0CTRL_MODE_* for details.
-int can_rx_mode(uint8_t rxb, uint8_t mode)
+// can_hot_load() then RTS; n = 0 resends the frame as it stands
+int can_hot_send_dev(can_dev_t *dev, uint8_t txb, const void *data, uint8_t n)
 {
-	if (rxb > 1)
+	if (can_hot_load_dev(dev, txb, data, n) < 0)
 		return -1;
+	can_spi_command_dev(dev, MCP2515_SPI_RTS | (1 << txb));
+	return 0;
+}
 
-	can_w_bit(MCP2515_RXB0CTRL + rxb*0x10, MCP2515_RXB0CTRL_RXM0 | MCP2515_RXB0CTRL_RXM0, mode);
+// Abort anything pending in hot slot txb, unhook its TXnRTS pin and give it back to can_send()
+int can_hot_release_dev(can_dev_t *dev, uint8_t txb)
+{
+	uint8_t rts;
 
+	if (txb > 2 || !(dev->txres & ~CAN_TXB_RTR & (1 << txb)))
+		return -1;
+	can_r_reg_dev(dev, MCP2515_TXRTSCTRL, &rts, 1);
+	if (rts & (MCP2515_TXRTSCTRL_B0RTSM << txb)) {
+		can_cfg_enter(dev);
+		can_w_bit_dev(dev, MCP2515_TXRTSCTRL, MCP2515_TXRTSCTRL_B0RTSM << txb, 0);
+		can_cfg_leave(dev);
+	}
+	can_w_bit_dev(dev, MCP2515_TXB0CTRL + 0x10*txb, MCP2515_TXBCTRL_TXREQ, 0);
+	can_w_bit_dev(dev, MCP2515_CANINTF, MCP2515_CANINTF_TX0IF << txb, 0);
+
+	CAN_TXQ_LOCK;
+	dev->txres &= ~(1 << txb);
+	dev->txb &= ~(1 << txb);
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	can_txq_refill(dev);
+	#endif
+	CAN_TXQ_UNLOCK;
 	return 0;
 }
+#endif
 
-// Miscellaneous option-setting goes here.
-int can_ioctl(uint8_t option, uint8_t val)
+/* CAN message receive */
+
+/* READ RX BUFFER straight into a frame, the payload only as far as the DLC says.  The RXnIF flag clears
+ * itself once CS goes high.
+ */
+static void can_r_rxframe(can_dev_t *dev, uint8_t bufid, can_frame_t *f)
 {
-	switch (option) {
-		// Allows RXB0 to shove its contents over to RXB1 if a new RXB0 frame comes in.
-		case MCP2515_OPTION_ROLLOVER:
-			if (val)
-				can_w_bit(MCP2515_RXB0CTRL, MCP2515_RXB0CTRL_BUKT, MCP2515_RXB0CTRL_BUKT);
-			else
-				can_w_bit(MCP2515_RXB0CTRL, MCP2515_RXB0CTRL_BUKT, 0);
-			break;
+	uint8_t len;
+
+	CAN_CS_LOW;
+	spi_transfer(MCP2515_SPI_READ_RXBUF | (bufid & 0x06));
+	spi_read_block(&f->sidh, 5);
+	len = f->dlc & 0x0F;
+	spi_read_block(f->data, len > 8 ? 8 : len);
+	CAN_CS_HIGH;
+}
+
+#ifdef MCP2515_RX_DISPATCH
+/* Filter (0-5) that let the frame in RXBn through, or MCP2515_RX_ROUTE_OTHER if that RXB ignores the filters */
+static uint8_t can_rx_filhit(can_dev_t *dev, uint8_t rxb)
+{
+	uint8_t ctrl;
+
+	can_r_reg_dev(dev, MCP2515_RXB0CTRL + 0x10*rxb, &ctrl, 1);
+	if ( (ctrl & MCP2515_RXB0CTRL_MODE_RECV_ALL) == MCP2515_RXB0CTRL_MODE_RECV_ALL )
+		return MCP2515_RX_ROUTE_OTHER;
+	if (rxb)
+		return ctrl & (MCP2515_RXB1CTRL_FILHIT2 | MCP2515_RXB1CTRL_FILHIT1 | MCP2515_RXB1CTRL_FILHIT0);
+	return ctrl & MCP2515_RXB0CTRL_FILHIT0;
+}
+#endif
+
+// can_recv()'s return value: length, RTR presented as 0x40
+static int can_frame_ret(const can_frame_t *f)
+{
+	#ifdef MCP2515_NO_RTR
+	return f->dlc & 0x0F;
+	#else
+	if (can_frame_is_ext(f))
+		return f->dlc & 0x4F;
+	return (f->dlc & 0x0F) | ((f->sidl & 0x10) << 2);
+	#endif
+}
+
+#ifdef MCP2515_RX_RING_SIZE
+/* Zero-copy receive: the oldest frame in the ring, left in place until can_recv_drop(); NULL if none */
+can_frame_t *can_recv_peek_dev(can_dev_t *dev)
+{
+	if (CAN_RX_RING_EMPTY)
+		return 0;
+	return &dev->rxring[dev->rxring_tail & CAN_RX_RING_MASK];
+}
+
+void can_recv_drop_dev(can_dev_t *dev)
+{
+	CAN_BARRIER;  // Slot must be fully consumed before can_isr() may reuse it
+	if (!CAN_RX_RING_EMPTY)
+		dev->rxring_tail++;
+}
+
+#ifdef MCP2515_RX_TIMESTAMP
+/* Timestamp of the frame can_recv_peek() returns, i.e. the one the next can_recv()/can_recv_frame() will return */
+uint32_t can_recv_stamp_dev(can_dev_t *dev)
+{
+	return dev->rxstamp[dev->rxring_tail & CAN_RX_RING_MASK];
+}
+#endif
+#endif
+
+// Returns can_recv()'s length/RTR value or -1 if nothing to read; the ID is left for can_frame_id()
+int can_recv_frame_dev(can_dev_t *dev, can_frame_t *f)
+{
+	#ifdef MCP2515_RX_RING_SIZE
+	can_frame_t *r;
+
+	// Frames were already pulled off the controller by can_isr()
+	if ( !(r = can_recv_peek_dev(dev)) )
+		return -1;
+	memcpy(f, r, sizeof(can_frame_t));
+	can_recv_drop_dev(dev);
+	#else
+	int rxb;
+
+	// Any of them have unread data?
+	if ( (rxb = can_rx_pending_dev(dev)) < 0 )
+		return -1;
+	can_r_rxframe(dev, MCP2515_RXBUF_RXB0SIDH + 0x04*rxb, f);
+	CAN_STAT(rx[rxb]++);
+	#endif
+	return can_frame_ret(f);
+}
+
+// Returns length of packet or -1 if nothing to read
+int can_recv_dev(can_dev_t *dev, uint32_t *msgid, uint8_t *is_ext, void *buf)
+{
+	int ret;
+	can_frame_t *f;
+	#ifdef MCP2515_RX_RING_SIZE
+	// Parse straight out of the ring slot
+	if ( !(f = can_recv_peek_dev(dev)) )
+		return -1;
+	#else
+	can_frame_t fr;
+
+	f = &fr;
+	if (can_recv_frame_dev(dev, f) < 0)
+		return -1;
+	#endif
+
+	*msgid = can_frame_id(f);
+	*is_ext = can_frame_is_ext(f) ? 1 : 0;
+	memcpy((uint8_t *)buf, f->data, can_frame_len(f));
+	ret = can_frame_ret(f);
+
+	#ifdef MCP2515_RX_RING_SIZE
+	can_recv_drop_dev(dev);
+	#endif
+	return ret;
+}
+
+// Returns RXBID of first full buffer or -1 if nothing is waiting.
+int can_rx_pending_dev(can_dev_t *dev)
+{
+	#ifdef MCP2515_RX_RING_SIZE
+	// Frames sitting in the ring are reported as RXB0
+	if (!CAN_RX_RING_EMPTY)
+		return 0;
+	return -1;
+	#else
+	uint8_t rxstat;
+
+	rxstat = can_rx_status_dev(dev);
+	if (rxstat & MCP2515_RXSTATUS_RXB0)
+		return 0;
+	if (rxstat & MCP2515_RXSTATUS_RXB1)
+		return 1;
+	return -1;
+	#endif
+}
+
+// Set one of the 2 RX masks.  maskid=0 is for RXB0, maskid=1 is for RXB1.
+int can_rx_setmask_dev(can_dev_t *dev, uint8_t maskid, uint32_t msgmask, uint8_t is_ext)
+{
+	uint8_t maskbuf[4];
+
+	if (maskid > 1)
+		return -1;
+	
+	can_cfg_enter(dev);
+
+	if (CAN_IS_EXT(is_ext)) {
+		can_compose_msgid_ext(msgmask, maskbuf);
+		maskbuf[1] &= ~0x08;  // EXIDE is unimplemented in the MASK registers
+		dev->exmask |= 1 << maskid;
+	} else {
+		can_compose_msgid_std(msgmask, maskbuf);
+		dev->exmask &= ~(1 << maskid);
+	}
+	
+	can_w_reg_dev(dev, MCP2515_RXM0SIDH + maskid * 0x04, maskbuf, 4);
+
+	can_cfg_leave(dev);
+
+	return maskid;
+}
+
+/* Configure filter.  filtid is from 0-3 (0-1 when rxb=0, 0-3 when rxb=1)
+ * Standard vs. Extended ID is determined by dev->exmask (whether a mask was specified
+ * for std or ext operation)
+ */
+int can_rx_setfilter_dev(can_dev_t *dev, uint8_t rxb, uint8_t filtid, uint32_t msgid)
+{
+	uint8_t idbuf[4];
+
+	if (rxb > 1)
+		return -1;
+	if (filtid > 5 || (filtid > 1 && rxb == 0))
+		return -1;
+	
+	can_cfg_enter(dev);
+
+	if (CAN_IS_EXT(dev->exmask & (1 << rxb))) // Extended ID
+		can_compose_msgid_ext(msgid, idbuf);
+	else
+		can_compose_msgid_std(msgid, idbuf);
+	
+	filtid += 2*rxb;
+	if (filtid < 3)
+		can_w_reg_dev(dev, MCP2515_RXF0SIDH + filtid * 0x04, idbuf, 4);
+	else
+		can_w_reg_dev(dev, MCP2515_RXF3SIDH + (filtid-3) * 0x04, idbuf, 4);
+	
+	can_cfg_leave(dev);
+
+	return filtid;
+}
+
+// RX mode for the specified RXB.  See MCP2515_RXB0CTRL_MODE_* for details.
+int can_rx_mode_dev(can_dev_t *dev, uint8_t rxb, uint8_t mode)
+{
+	if (rxb > 1)
+		return -1;
+
+	dev->rxbctrl[rxb] = (dev->rxbctrl[rxb] & ~(MCP2515_RXB0CTRL_RXM1 | MCP2515_RXB0CTRL_RXM0)) |
+			    (mode & (MCP2515_RXB0CTRL_RXM1 | MCP2515_RXB0CTRL_RXM0));
+	can_w_reg_dev(dev, MCP2515_RXB0CTRL + rxb*0x10, &dev->rxbctrl[rxb], 1);
+
+	return 0;
+}
+
+#ifdef MCP2515_SW_FILTER
+/* Home slot of an extended ID in the hash set: both halves folded, using only 16-bit shifts */
+static uint8_t can_swf_hash(uint32_t id)
+{
+	uint16_t h = (uint16_t)id ^ (uint16_t)(id >> 16);
+
+	return (h ^ (h >> 7)) & (MCP2515_SW_FILTER - 1);
+}
+
+// Whether f's ID is in the filter; linear probing stops at the first empty slot, or after a full lap
+static uint8_t can_swf_match(const struct can_swfilter *sf, const can_frame_t *f)
+{
+	uint16_t std;
+	uint32_t key;
+	uint8_t h, n;
+
+	if (!can_frame_is_ext(f)) {
+		std = ((uint16_t)f->sidh << 3) | (f->sidl >> 5);
+		return sf->std[std >> 3] & (1 << (std & 7));
+	}
+	key = can_parse_msgid(&f->sidh) | 0x80000000UL;
+	for (h=can_swf_hash(key), n=MCP2515_SW_FILTER; n; n--, h=(h+1) & (MCP2515_SW_FILTER - 1)) {
+		if (sf->ext[h] == key)
+			return 1;
+		if (!sf->ext[h])
+			return 0;
+	}
+	return 0;
+}
+
+void can_swfilter_init(struct can_swfilter *sf)
+{
+	memset(sf, 0, sizeof(struct can_swfilter));
+}
+
+// Add an ID; returns 0, or -1 if the extended ID set is full
+int can_swfilter_add(struct can_swfilter *sf, uint32_t msgid, uint8_t is_ext)
+{
+	uint8_t h, n;
+	uint32_t key;
+
+	if (!CAN_IS_EXT(is_ext)) {
+		msgid &= 0x7FF;
+		sf->std[msgid >> 3] |= 1 << (msgid & 7);
+		return 0;
+	}
+	key = (msgid & 0x1FFFFFFFUL) | 0x80000000UL;
+	for (h=can_swf_hash(key), n=MCP2515_SW_FILTER; n; n--, h=(h+1) & (MCP2515_SW_FILTER - 1)) {
+		if (sf->ext[h] == key)
+			return 0;
+		if (!sf->ext[h]) {
+			sf->ext[h] = key;
+			sf->ext_n++;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Check every frame can_isr() reads out against sf from now on (NULL: stop filtering).  sf is used in place, so it
+ * must stay put and not be changed while installed.
+ */
+int can_rx_swfilter_dev(can_dev_t *dev, const struct can_swfilter *sf)
+{
+	CAN_IRQ_LOCK;
+	dev->swf = sf;
+	CAN_IRQ_UNLOCK;
+	return 0;
+}
+#endif
+
+#ifdef MCP2515_RX_DISPATCH
+/* Program filter filt (0-5 = RXF0-RXF5; 0-1 belong to RXB0, 2-5 to RXB1) with msgid and have can_rx_dispatch()
+ * hand its frames to fn.  Std. vs ext. comes from the RXB's mask, so set that first.  filt = MCP2515_RX_ROUTE_OTHER
+ * programs nothing and takes frames for filters without a handler.
+ */
+int can_rx_route_dev(can_dev_t *dev, uint8_t filt, uint32_t msgid, can_rx_handler_t fn)
+{
+	if (filt > MCP2515_RX_ROUTE_OTHER)
+		return -1;
+	if (filt < 2)
+		can_rx_setfilter_dev(dev, 0, filt, msgid);
+	else if (filt < MCP2515_RX_ROUTE_OTHER)
+		can_rx_setfilter_dev(dev, 1, filt-2, msgid);
+	dev->rxroute[filt] = fn;
+	return filt;
+}
+
+/* Pass every frame waiting (in the ring, or in RXB0/RXB1) to its filter's handler; frames nobody handles are
+ * dropped.  Returns the number of frames consumed.
+ */
+int can_rx_dispatch_dev(can_dev_t *dev)
+{
+	int n = 0;
+	uint8_t hit;
+	can_rx_handler_t fn;
+	#ifdef MCP2515_RX_RING_SIZE
+	can_frame_t *f;
+
+	while ( (f = can_recv_peek_dev(dev)) ) {
+		hit = dev->rxhit[dev->rxring_tail & CAN_RX_RING_MASK];
+		if ( (fn = dev->rxroute[hit]) || (fn = dev->rxroute[MCP2515_RX_ROUTE_OTHER]) )
+			fn(dev, f);
+		can_recv_drop_dev(dev);
+		n++;
+	}
+	#else
+	can_frame_t f;
+	int rxb;
+
+	while ( (rxb = can_rx_pending_dev(dev)) >= 0 ) {
+		hit = can_rx_filhit(dev, rxb);
+		can_r_rxframe(dev, MCP2515_RXBUF_RXB0SIDH + 0x04*rxb, &f);
+		CAN_STAT(rx[rxb]++);
+		if ( (fn = dev->rxroute[hit]) || (fn = dev->rxroute[MCP2515_RX_ROUTE_OTHER]) )
+			fn(dev, &f);
+		n++;
+	}
+	#endif
+	return n;
+}
+#endif
+
+#ifdef MCP2515_RTR_RESPONDERS
+/* Have can_isr() answer RTRs for msgid itself: with len bytes from data (read at the time of each request, so
+ * the app may update it in place), or, with data NULL, with whatever fn fills in.  Registering an ID again
+ * replaces its entry; data and fn both NULL removes it.  The RTRs still have to get past the RX masks & filters.
+ * Returns the entry used, or -1 if the table is full.
+ */
+int can_rtr_respond_dev(can_dev_t *dev, uint32_t msgid, uint8_t is_ext, const void *data, uint8_t len, can_rtr_handler_t fn)
+{
+	int i, slot = -1;
+	can_frame_t f;
+
+	if (len > 8)
+		return -1;
+	can_frame_set_id(&f, msgid, is_ext);
+	if (!CAN_IS_EXT(is_ext))
+		f.eid8 = f.eid0 = 0;
+
+	CAN_IRQ_LOCK;
+	for (i=0; i < MCP2515_RTR_RESPONDERS; i++) {
+		if (dev->rtr[i].len == 0xFF) {
+			if (slot < 0)
+				slot = i;
+		} else if (!memcmp(dev->rtr[i].hdr, &f.sidh, 4)) {
+			slot = i;
+			break;
+		}
+	}
+	if (slot >= 0) {
+		if (!data && !fn) {
+			dev->rtr[slot].len = 0xFF;
+		} else {
+			memcpy(dev->rtr[slot].hdr, &f.sidh, 4);
+			dev->rtr[slot].data = data;
+			dev->rtr[slot].len = data ? len : 0;
+			dev->rtr[slot].fn = data ? NULL : fn;
+		}
+		dev->rtr_loaded = 0xFF;  // TXB2 may hold an old response for this slot
+	}
+	CAN_IRQ_UNLOCK;
+	return slot;
+}
+#endif
+
+// BIT MODIFY on CANCTRL, keeping dev->ctrl in step
+static void can_w_ctrl(can_dev_t *dev, uint8_t mask, uint8_t val)
+{
+	val &= mask;
+	can_w_bit_dev(dev, MCP2515_CANCTRL, mask, val);
+	dev->ctrl = (dev->ctrl & ~mask) | val;
+}
+
+// Set or clear bits of one of CNF3-CNF1 (i = 0-2, as in dev->cnf[]), which only take writes in CONFIGURATION mode
+static void can_w_cnf(can_dev_t *dev, uint8_t i, uint8_t bits, uint8_t val)
+{
+	if (val)
+		dev->cnf[i] |= bits;
+	else
+		dev->cnf[i] &= ~bits;
+	can_cfg_enter(dev);
+	can_w_reg_dev(dev, MCP2515_CNF3 + i, &dev->cnf[i], 1);
+	can_cfg_leave(dev);
+}
+
+/* Miscellaneous option-setting goes here.  Options pruned from the build (see mcp2515_config.h) return -1
+ * like unknown ones.
+ */
+int can_ioctl_dev(can_dev_t *dev, uint8_t option, uint8_t val)
+{
+	switch (option) {
+		#ifndef MCP2515_NO_ROLLOVER
+		// Allows RXB0 to shove its contents over to RXB1 if a new RXB0 frame comes in.
+		case MCP2515_OPTION_ROLLOVER:
+			if (val)
+				dev->rxbctrl[0] |= MCP2515_RXB0CTRL_BUKT;
+			else
+				dev->rxbctrl[0] &= ~MCP2515_RXB0CTRL_BUKT;
+			can_w_reg_dev(dev, MCP2515_RXB0CTRL, &dev->rxbctrl[0], 1);
+			break;
+		#endif
 
 		case MCP2515_OPTION_ONESHOT:
-			if (val) {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_OSM, MCP2515_CANCTRL_OSM);
-				mcp2515_ctrl |= MCP2515_CANCTRL_OSM;
-			} else {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_OSM, 0);
-				mcp2515_ctrl &= ~MCP2515_CANCTRL_OSM;
-			}
+			can_w_ctrl(dev, MCP2515_CANCTRL_OSM, val ? MCP2515_CANCTRL_OSM : 0);
 			break;
 
 		// Abort all pending transmissions.
 		case MCP2515_OPTION_ABORT:
-			if (val) {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_ABAT, MCP2515_CANCTRL_ABAT);
-				mcp2515_ctrl |= MCP2515_CANCTRL_ABAT;
-			} else {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_ABAT, 0);
-				mcp2515_ctrl &= ~MCP2515_CANCTRL_ABAT;
-			}
+			can_w_ctrl(dev, MCP2515_CANCTRL_ABAT, val ? MCP2515_CANCTRL_ABAT : 0);
 			break;
 
+		#ifndef MCP2515_NO_CLKOUT
 		// CLKOUT pin shows the clock signal divided by 2^(val-1) (1=/1, 2=/2, 3=/4, 4=/8)
 		case MCP2515_OPTION_CLOCKOUT:
-			if (val) {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_CLKEN | MCP2515_CANCTRL_CLKPRE_MASK, MCP2515_CANCTRL_CLKEN | ((val-1) & 0x03));
-				mcp2515_ctrl |= MCP2515_CANCTRL_CLKEN | ((val-1) & 0x03);
-			} else {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_CLKEN, 0);
-				mcp2515_ctrl &= ~(MCP2515_CANCTRL_ABAT | MCP2515_CANCTRL_CLKPRE_MASK);
-			}
+			can_w_ctrl(dev, MCP2515_CANCTRL_CLKEN | MCP2515_CANCTRL_CLKPRE_MASK,
+				   val ? MCP2515_CANCTRL_CLKEN | ((val-1) & 0x03) : 0);
 			break;
+		#endif
 
 		case MCP2515_OPTION_LOOPBACK:
-			if (val) {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_LOOPBACK);
-				mcp2515_ctrl &= ~MCP2515_CANCTRL_REQOP_MASK; mcp2515_ctrl |= MCP2515_CANCTRL_REQOP_LOOPBACK;
-			} else {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_NORMAL);
-				mcp2515_ctrl &= ~MCP2515_CANCTRL_REQOP_MASK; mcp2515_ctrl |= MCP2515_CANCTRL_REQOP_NORMAL;
-			}
+			can_w_ctrl(dev, MCP2515_CANCTRL_REQOP_MASK, val ? MCP2515_CANCTRL_REQOP_LOOPBACK : MCP2515_CANCTRL_REQOP_NORMAL);
 			break;
 
 		case MCP2515_OPTION_LISTEN_ONLY:
-			if (val) {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_LISTEN_ONLY);
-				mcp2515_ctrl &= ~MCP2515_CANCTRL_REQOP_MASK; mcp2515_ctrl |= MCP2515_CANCTRL_REQOP_LISTEN_ONLY;
-			} else {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_NORMAL);
-				mcp2515_ctrl &= ~MCP2515_CANCTRL_REQOP_MASK; mcp2515_ctrl |= MCP2515_CANCTRL_REQOP_NORMAL;
-			}
+			can_w_ctrl(dev, MCP2515_CANCTRL_REQOP_MASK, val ? MCP2515_CANCTRL_REQOP_LISTEN_ONLY : MCP2515_CANCTRL_REQOP_NORMAL);
 			break;
 
 		// See MCP2515_OPTION_WAKE* for ways to come out of this.
 		case MCP2515_OPTION_SLEEP:
-			if (val) {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_SLEEP);
-				mcp2515_ctrl &= ~MCP2515_CANCTRL_REQOP_MASK; mcp2515_ctrl |= MCP2515_CANCTRL_REQOP_SLEEP;
-			} else {
-				can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_NORMAL);
-				mcp2515_ctrl &= ~MCP2515_CANCTRL_REQOP_MASK; mcp2515_ctrl |= MCP2515_CANCTRL_REQOP_NORMAL;
-			}
+			can_w_ctrl(dev, MCP2515_CANCTRL_REQOP_MASK, val ? MCP2515_CANCTRL_REQOP_SLEEP : MCP2515_CANCTRL_REQOP_NORMAL);
 			break;
 
 		// Sample 3 times around the sample point instead of 1.
 		case MCP2515_OPTION_MULTISAMPLE:
-			can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
-			if (val)
-				can_w_bit(MCP2515_CNF2, MCP2515_CNF2_SAM, MCP2515_CNF2_SAM);
-			else
-				can_w_bit(MCP2515_CNF2, MCP2515_CNF2_SAM, 0);
-			can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
+			can_w_cnf(dev, 1, MCP2515_CNF2_SAM, val);
 			break;
 
+		#ifndef MCP2515_NO_CLKOUT
 		// CLKOUT pin produces Start of Frame edge signal instead of CLKOUT.
 		case MCP2515_OPTION_SOFOUT:
-			can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
-			if (val)
-				can_w_bit(MCP2515_CNF3, MCP2515_CNF3_SOF, MCP2515_CNF3_SOF);
-			else
-				can_w_bit(MCP2515_CNF3, MCP2515_CNF3_SOF, 0);
-			can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
+			can_w_cnf(dev, 0, MCP2515_CNF3_SOF, val);
 			break;
+		#endif
 
+		#ifndef MCP2515_NO_WAKE
 		// Enable low-pass filter on CAN_RX to reduce the likelihood of waking due to random noise.
 		case MCP2515_OPTION_WAKE_GLITCH_FILTER:
-			can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, MCP2515_CANCTRL_REQOP_CONFIGURATION);
-			if (val)
-				can_w_bit(MCP2515_CNF3, MCP2515_CNF3_WAKFIL, MCP2515_CNF3_WAKFIL);
-			else
-				can_w_bit(MCP2515_CNF3, MCP2515_CNF3_WAKFIL, 0);
-			can_w_bit(MCP2515_CANCTRL, MCP2515_CANCTRL_REQOP_MASK, mcp2515_ctrl);
+			can_w_cnf(dev, 0, MCP2515_CNF3_WAKFIL, val);
 			break;
 
 		// Enable WAKIE to activate IRQ line in the event of received data.
 		case MCP2515_OPTION_WAKE:
-			if (val)
-				can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_WAKIE, MCP2515_CANINTE_WAKIE);
-			else
-				can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_WAKIE, 0);
+			can_w_inte(dev, MCP2515_CANINTE_WAKIE, val ? MCP2515_CANINTE_WAKIE : 0);
 			break;
+		#endif
 
 		default:
 			return -1;
@@ -608,17 +1495,134 @@ int can_ioctl(uint8_t option, uint8_t val)
 	return 0;
 }
 
+/* Capture the configuration set up so far (can_speed(), can_rx_setmask()/setfilter()/mode(), can_ioctl()) into an
+ * image for can_config_load().  Masks and filters only read back in CONFIGURATION mode, so outside of it this visits
+ * CONFIGURATION mode for 3 12-byte READs.  Returns 0, or -1 if the controller wouldn't enter CONFIGURATION mode.
+ */
+int can_config_save_dev(can_dev_t *dev, struct can_config *cfg)
+{
+	if (can_cfg_enter(dev) < 0) {
+		can_cfg_leave(dev);
+		return -1;
+	}
+	can_r_reg_dev(dev, MCP2515_RXF0SIDH, cfg->rxf, 12);
+	can_r_reg_dev(dev, MCP2515_RXF3SIDH, cfg->rxf_hi, 12);
+	can_r_reg_dev(dev, MCP2515_RXM0SIDH, cfg->rxm, 12);  // RXM0-1, CNF3-1, CANINTE
+	can_cfg_leave(dev);
+
+	memcpy(cfg->rxbctrl, dev->rxbctrl, 2);
+	cfg->ctrl = dev->ctrl;
+	cfg->exmask = dev->exmask;
+	return 0;
+}
+
+/* Apply a whole image from can_config_save() (or built ahead of time) with one trip through CONFIGURATION mode:
+ * 3 12-byte WRITEs cover the filters, masks, CNF1-3 and CANINTE, then RXB0CTRL, RXB1CTRL and finally CANCTRL,
+ * which puts the controller in the image's mode.  Meant to follow can_init() in place of the individual setters.
+ * Returns 0, or -1 if the controller wouldn't enter CONFIGURATION mode (nothing is written then).
+ */
+int can_config_load_dev(can_dev_t *dev, const struct can_config *cfg)
+{
+	if (can_cfg_enter(dev) < 0) {
+		can_cfg_leave(dev);
+		return -1;
+	}
+	can_w_reg_dev(dev, MCP2515_RXF0SIDH, (void *)cfg->rxf, 12);
+	can_w_reg_dev(dev, MCP2515_RXF3SIDH, (void *)cfg->rxf_hi, 12);
+	can_w_reg_dev(dev, MCP2515_RXM0SIDH, (void *)cfg->rxm, 12);  // RXM0-1, CNF3-1, CANINTE
+	memcpy(dev->cnf, cfg->cnf, 3);
+	dev->inte = cfg->inte;
+	dev->exmask = cfg->exmask;
+
+	dev->rxbctrl[0] = cfg->rxbctrl[0] & (MCP2515_RXB0CTRL_RXM1 | MCP2515_RXB0CTRL_RXM0 | MCP2515_RXB0CTRL_BUKT);
+	dev->rxbctrl[1] = cfg->rxbctrl[1] & (MCP2515_RXB1CTRL_RXM1 | MCP2515_RXB1CTRL_RXM0);
+	can_w_reg_dev(dev, MCP2515_RXB0CTRL, &dev->rxbctrl[0], 1);
+	can_w_reg_dev(dev, MCP2515_RXB1CTRL, &dev->rxbctrl[1], 1);
+
+	dev->ctrl = cfg->ctrl & ~MCP2515_CANCTRL_ABAT;
+	can_w_reg_dev(dev, MCP2515_CANCTRL, &dev->ctrl, 1);
+	return 0;
+}
+
 // Report error counters; valid registers include MCP2515_TEC (TX error count) and MCP2515_REC (RX error count)
-int can_read_error(uint8_t reg)
+int can_read_error_dev(can_dev_t *dev, uint8_t reg)
 {
 	uint8_t e;
 
 	if (reg != MCP2515_TEC && reg != MCP2515_REC && reg != MCP2515_EFLG)
 		return -1;
-	can_r_reg(reg, &e, 1);
+	can_r_reg_dev(dev, reg, &e, 1);
 	return e;
 }
 
+#ifdef MCP2515_HEALTH
+/* Work out the bus health state from EFLG and TEC/REC (one 2-byte READ, they sit side by side at 0x1C) and set
+ * the TXB limit to match.  On the way back down a counter has to fall MCP2515_HEALTH_HYST below the threshold
+ * before the state follows, so a node hovering around 96 or 128 doesn't flap.  Caller holds CAN_TXQ_LOCK.
+ * Returns the state, OR'd with MCP2515_HEALTH_CHANGED if it differs from the last one.
+ */
+static uint8_t can_health_update(can_dev_t *dev, uint8_t eflg)
+{
+	uint8_t cnt[2], worst, state;
+
+	can_r_reg_dev(dev, MCP2515_TEC, cnt, 2);  // TEC, REC
+	dev->tec = cnt[0];
+	dev->rec = cnt[1];
+	dev->eflg = eflg;
+	worst = (cnt[0] > cnt[1]) ? cnt[0] : cnt[1];
+
+	if (eflg & MCP2515_EFLG_TXBO)
+		state = MCP2515_HEALTH_BUSOFF;
+	else if (eflg & (MCP2515_EFLG_TXEP | MCP2515_EFLG_RXEP))
+		state = MCP2515_HEALTH_PASSIVE;
+	else if (eflg & MCP2515_EFLG_EWARN)
+		state = MCP2515_HEALTH_WARNING;
+	else
+		state = MCP2515_HEALTH_ACTIVE;
+
+	// Leaving bus-off resets both counters, so there's nothing to hold back there
+	if (state < dev->health && dev->health != MCP2515_HEALTH_BUSOFF) {
+		if (worst >= 128 - MCP2515_HEALTH_HYST)
+			state = MCP2515_HEALTH_PASSIVE;
+		else if (worst >= 96 - MCP2515_HEALTH_HYST && state == MCP2515_HEALTH_ACTIVE)
+			state = MCP2515_HEALTH_WARNING;
+	}
+	if (state == dev->health)
+		return state;
+
+	if (state == MCP2515_HEALTH_BUSOFF)
+		CAN_STAT(busoff++);
+	else if (state == MCP2515_HEALTH_PASSIVE && dev->health < state)
+		CAN_STAT(passive++);
+	dev->health = state;
+	if (state == MCP2515_HEALTH_BUSOFF)
+		dev->txlimit = 0;
+	else if (state == MCP2515_HEALTH_PASSIVE)
+		dev->txlimit = MCP2515_HEALTH_PASSIVE_TXBS;
+	else
+		dev->txlimit = 3;
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	can_txq_refill(dev);  // Frames held back by a tighter limit may go now
+	#endif
+	return state | MCP2515_HEALTH_CHANGED;
+}
+
+/* Re-read the error state without waiting for an error IRQ; TEC and REC fall without raising one, so call this
+ * now and then (e.g. every 100ms) while dev->health isn't MCP2515_HEALTH_ACTIVE.  Costs a 1-byte and a 2-byte READ.
+ * Returns the state, OR'd with MCP2515_HEALTH_CHANGED on a transition.
+ */
+int can_health_poll_dev(can_dev_t *dev)
+{
+	uint8_t eflg, ret;
+
+	CAN_TXQ_LOCK;
+	can_r_reg_dev(dev, MCP2515_EFLG, &eflg, 1);
+	ret = can_health_update(dev, eflg);
+	CAN_TXQ_UNLOCK;
+	return ret;
+}
+#endif
+
 /* IRQ handling
  *
  * Handler architecture:
@@ -633,118 +1637,888 @@ int can_read_error(uint8_t reg)
  * be cleared by the user's firmware.
  */
 
-int can_irq_handler()
+#ifdef MCP2515_RTR_RESPONDERS
+/* Answer an RTR just read out of an RXB if its ID is in dev->rtr[]: fill in TXB2 and RTS it, all before the
+ * frame would have gone into the ring.  A response still waiting in TXB2 (TX2REQ set in status, the READ STATUS
+ * the frame was found with) answers a repeat of the same request; any other request then goes to the ring.
+ * TXB2 is rewritten from SIDH only when it was last loaded for a different entry or length, else from D0.
+ * Returns 1 if the RTR was dealt with, 0 to queue it as usual.
+ */
+static uint8_t can_rtr_answer(can_dev_t *dev, const can_frame_t *f, uint8_t status)
 {
-	int i;
-	uint8_t ifg, eflg, ie, txbctrl;
+	uint8_t i, idmask, buf[8];
+	const uint8_t *data;
+	int len;
+	struct can_rtr_entry *e;
+
+	if ( !(can_frame_ret(f) & 0x40) )
+		return 0;
+	idmask = can_frame_is_ext(f) ? 0xEB : 0xE8;  // SID2-0, IDE and for extended IDs EID17-16; not SRR
+	for (i=0; i < MCP2515_RTR_RESPONDERS; i++) {
+		e = &dev->rtr[i];
+		if (e->len != 0xFF && e->hdr[0] == f->sidh && e->hdr[1] == (f->sidl & idmask) &&
+		    (!can_frame_is_ext(f) || (e->hdr[2] == f->eid8 && e->hdr[3] == f->eid0)))
+			break;
+	}
+	if (i == MCP2515_RTR_RESPONDERS)
+		return 0;
+	if (status & MCP2515_STATUS_TX2REQ)
+		return dev->rtr_loaded == i;
+
+	if (e->fn) {
+		if ( (len = e->fn(dev, f, buf)) < 0 )
+			return 0;
+		if (len > 8)
+			len = 8;
+		data = buf;
+	} else {
+		len = e->len;
+		data = e->data;
+	}
 
-	mcp2515_irq &= MCP2515_IRQ_FLAGGED;  // Clear everything but the flagged bit.
-	// Read CANINTF to get started
-	can_r_reg(MCP2515_CANINTF, &ifg, 1);
+	CAN_CS_LOW;
+	if (dev->rtr_loaded == i && dev->rtr_len == len) {
+		spi_transfer(MCP2515_SPI_LOAD_TXBUF | MCP2515_TXBUF_TXB2D0);
+	} else {
+		spi_transfer(MCP2515_SPI_LOAD_TXBUF | MCP2515_TXBUF_TXB2SIDH);
+		spi_write_block(e->hdr, 4);
+		spi_transfer(len);
+		dev->rtr_loaded = i;
+		dev->rtr_len = len;
+	}
+	spi_write_block(data, len);
+	CAN_CS_HIGH;
+	can_spi_command_dev(dev, MCP2515_SPI_RTS | CAN_TXB_RTR);
+	CAN_STAT(rtr++);
+	return 1;
+}
+#endif
 
+#ifdef MCP2515_RX_RING_SIZE
+/* Copy RXB0/RXB1 into the ring until both are empty or the ring is full.
+ * Caller must either be can_isr() or have the ISR locked out with CAN_IRQ_LOCK.
+ * Returns the last READ STATUS value; RXnIF bits left set there mean the ring filled up.
+ */
+static uint8_t can_rx_drain(can_dev_t *dev)
+{
+	uint8_t status, head, rxb;
+
+	while (1) {
+		status = can_read_status_dev(dev);
+		if ( !(status & MCP2515_STATUS_RXIF_MASK) )
+			return status;
+		head = dev->rxring_head;
+		if ( (uint8_t)(head - dev->rxring_tail) >= MCP2515_RX_RING_SIZE )
+			return status;  // Full; leave the frame in its RXB until can_recv() makes room
+
+		rxb = (status & MCP2515_STATUS_RX0IF) ? 0 : 1;
+		#ifdef MCP2515_RX_DISPATCH
+		dev->rxhit[head & CAN_RX_RING_MASK] = can_rx_filhit(dev, rxb);
+		#endif
+		#ifdef MCP2515_RX_TIMESTAMP
+		dev->rxstamp[head & CAN_RX_RING_MASK] = can_timer_stamp();  // A frame sharing an INT edge with the last one gets the time it's read
+		#endif
+		can_r_rxframe(dev, MCP2515_RXBUF_RXB0SIDH + 0x04*rxb, &dev->rxring[head & CAN_RX_RING_MASK]);
+		CAN_STAT(rx[rxb]++);
+		#ifdef MCP2515_RTR_RESPONDERS
+		if (can_rtr_answer(dev, &dev->rxring[head & CAN_RX_RING_MASK], status))
+			continue;  // Answered; the slot gets reused
+		#endif
+		#ifdef MCP2515_SW_FILTER
+		if (dev->swf && !can_swf_match(dev->swf, &dev->rxring[head & CAN_RX_RING_MASK])) {
+			CAN_STAT(swdrop++);
+			continue;
+		}
+		#endif
+		CAN_BARRIER;
+		dev->rxring_head = head + 1;
+		CAN_STAT_HWM(ring_hwm, head + 1 - dev->rxring_tail);
+	}
+}
+#endif
+
+#ifdef MCP2515_STATS
+// Account for one IRQ service call that started at MCP2515_STATS_CLOCK == t0
+static void can_stats_irq(can_dev_t *dev, uint16_t t0)
+{
+	uint16_t dt = MCP2515_STATS_CLOCK - t0;
+
+	if (dt > dev->stats.irq_max)
+		dev->stats.irq_max = dt;
+	dev->stats.irq_ticks += dt;
+	dev->stats.irq_calls++;
+}
+#endif
+
+static int can_irq_service(can_dev_t *dev)
+{
+	int i;
+	uint8_t status, txdone;
+	#if !defined(MCP2515_NO_WAKE) || !defined(MCP2515_NO_ERRORS)
+	uint8_t ifg;
+	#endif
+	#ifndef MCP2515_NO_ERRORS
+	uint8_t eflg, txbctrl;
+	#endif
+
+	dev->irq &= MCP2515_IRQ_FLAGGED;  // Clear everything but the flagged bit.
+
+	/* READ STATUS covers RXnIF and TXnIF in 2 bytes, which is all the common cases need; the full
+	 * CANINTF register is only read further down to look for the rarer wakeup and error causes.
+	 */
+	#ifdef MCP2515_RX_RING_SIZE
+	// Top up the ring in case can_isr() found it full, then keep reporting RX as long as frames are queued.
+	CAN_IRQ_LOCK;
+	status = can_rx_drain(dev);
+	#else
+	status = can_read_status_dev(dev);
+	#endif
+
+	// Completed TXBs are retired right away, all at once with a single BIT MODIFY, even if RX gets reported first
+	if ( (txdone = CAN_STATUS_TXDONE(status)) ) {
+		CAN_TXQ_LOCK;
+		can_w_bit_dev(dev, MCP2515_CANINTF, txdone << 2, 0);  // TXnIF are CANINTF bits 2-4; TXnIE stays enabled for the next can_send()
+		can_tx_retire(dev, txdone);
+		CAN_TXQ_UNLOCK;
+	}
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	else if (dev->txabort) {
+		// Nothing completed, but a preempted TXB's abort may have; see can_txq_preempt()
+		CAN_TXQ_LOCK;
+		can_txq_refill(dev);
+		CAN_TXQ_UNLOCK;
+	}
+	#endif
+
+	#ifdef MCP2515_RX_RING_SIZE
+	CAN_IRQ_UNLOCK;
+	if (!CAN_RX_RING_EMPTY) {
+		dev->buf = 0;
+		dev->irq |= MCP2515_IRQ_RX;
+		return MCP2515_IRQ_RX;
+	}
+	#else
 	// RX success IRQ?
-	if (ifg & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF)) {
-		if (ifg & MCP2515_CANINTF_RX0IF)
-			mcp2515_buf = 0;
+	if (status & MCP2515_STATUS_RXIF_MASK) {
+		if (status & MCP2515_STATUS_RX0IF)
+			dev->buf = 0;
 		else
-			mcp2515_buf = 1;
-		mcp2515_irq |= MCP2515_IRQ_RX;
+			dev->buf = 1;
+		dev->irq |= MCP2515_IRQ_RX;
 		return MCP2515_IRQ_RX;
 	}
-
-	// TX success IRQ?
-	if (ifg & (MCP2515_CANINTF_TX0IF | MCP2515_CANINTF_TX1IF | MCP2515_CANINTF_TX2IF)) {
-		for (i=0; i < 2; i++) {
-			if (ifg & (MCP2515_CANINTF_TX0IF << i)) {
-				can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_TX0IF << i, 0);  // Clear IFG
-				can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << i, 0);  // Disable interrupt (will be re-enabled on next TX)
-				mcp2515_txb &= ~(1 << i);
-				mcp2515_buf = i;
-				mcp2515_irq |= MCP2515_IRQ_TX | MCP2515_IRQ_HANDLED;
-				return MCP2515_IRQ_TX | MCP2515_IRQ_HANDLED;
-			}
+	#endif
+
+	// TX success IRQ?  Report everything retired since the last report (here or by can_isr()).
+	if (dev->txpend) {
+		CAN_TXQ_LOCK;
+		txdone = dev->txpend;
+		dev->txpend = 0;
+		CAN_TXQ_UNLOCK;
+		for (i=2; i >= 0; i--) {
+			if (txdone & (1 << i))
+				dev->buf = i;  // Lowest completed TXB, for apps that only look at one
 		}
+		dev->txdone = txdone;
+		dev->irq |= MCP2515_IRQ_TX | MCP2515_IRQ_HANDLED;
+		return MCP2515_IRQ_TX | MCP2515_IRQ_HANDLED;
 	}
 
+	#if !defined(MCP2515_NO_WAKE) || !defined(MCP2515_NO_ERRORS)
+	// Nothing RX/TX related; pull CANINTF for the remaining causes
+	can_r_reg_dev(dev, MCP2515_CANINTF, &ifg, 1);
+	#endif
+
+	#ifndef MCP2515_NO_WAKE
 	// Wake up?
 	if (ifg & MCP2515_CANINTF_WAKIF) {
-		can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_WAKIF, 0);
-		mcp2515_irq |= MCP2515_IRQ_WAKEUP | MCP2515_IRQ_HANDLED;
+		can_w_bit_dev(dev, MCP2515_CANINTF, MCP2515_CANINTF_WAKIF, 0);
+		dev->irq |= MCP2515_IRQ_WAKEUP | MCP2515_IRQ_HANDLED;
 		return MCP2515_IRQ_WAKEUP | MCP2515_IRQ_HANDLED;
 	}
+	#endif
 
+	#ifndef MCP2515_NO_ERRORS
 	// Message error?
 	if (ifg & MCP2515_CANINTF_MERRF) {
-		can_r_reg(MCP2515_CANINTE, &ie, 1);
-		// See if it's a TX error
-		for (i=0; i < 2; i++) {
-			if (ie & (MCP2515_CANINTE_TX0IE << i)) {
-				can_r_reg(MCP2515_TXB0CTRL + 0x10*i, &txbctrl, 1);
+		CAN_STAT(merr++);
+		/* See if it's a TX error; only TXBs we loaded that haven't completed (those were retired above) can be at
+		 * fault.  TXREQ is no guide: in ONESHOT mode the failed attempt has already cleared it.
+		 */
+		for (i=0; i < 3; i++) {
+			if (dev->txb & ~CAN_TXB_RES(dev) & (1 << i)) {
+				can_r_reg_dev(dev, MCP2515_TXB0CTRL + 0x10*i, &txbctrl, 1);
 				if (txbctrl & MCP2515_TXBCTRL_TXERR) {
-					mcp2515_buf = i;
-					can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_MERRF, 0);  // Clear MERRF
+					CAN_STAT(txerr++);
+					dev->buf = i;
+					can_w_bit_dev(dev, MCP2515_CANINTF, MCP2515_CANINTF_MERRF, 0);  // Clear MERRF
 					// Are we in OneShot mode?
-					if (mcp2515_ctrl & MCP2515_CANCTRL_OSM) {
-						can_w_bit(MCP2515_CANINTE, MCP2515_CANINTE_TX0IE << i, 0);  // Disable interrupt (will be re-enabled on next TX)
-						mcp2515_txb &= ~(1 << i);
-						mcp2515_irq |= MCP2515_IRQ_TX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
+					if (dev->ctrl & MCP2515_CANCTRL_OSM) {
+						CAN_TXQ_LOCK;
+						dev->txb &= ~(1 << i);
+						#ifdef MCP2515_TX_QUEUE_SIZE
+						can_txq_refill(dev);
+						#endif
+						CAN_TXQ_UNLOCK;
+						dev->txdone = 1 << i;
+						dev->irq |= MCP2515_IRQ_TX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
 						return MCP2515_IRQ_TX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
 					} else {
+						CAN_STAT(txretry++);
 					// If not, notify that TX error occurred but it "hasn't" been handled.  MCU intervention may be required
 					// in order to monitor and validate the # of retries that have occurred & failed and whether the request should
 					// be cancelled.
-						mcp2515_irq |= MCP2515_IRQ_TX | MCP2515_IRQ_ERROR;
+						dev->irq |= MCP2515_IRQ_TX | MCP2515_IRQ_ERROR;
 						return MCP2515_IRQ_TX | MCP2515_IRQ_ERROR;
 					}
 				}
 			}
 		}
 		// Not TX?  Must be an RX error.
-		can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_MERRF, 0);
-		mcp2515_irq |= MCP2515_IRQ_RX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
+		can_w_bit_dev(dev, MCP2515_CANINTF, MCP2515_CANINTF_MERRF, 0);
+		dev->irq |= MCP2515_IRQ_RX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
 		return MCP2515_IRQ_RX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
 	}
 
 	// All other errors are expressed in EFLG.
 	if (ifg & MCP2515_CANINTF_ERRIF) {
 		// ERRIF ... Read EFLG.
-		can_r_reg(MCP2515_EFLG, &eflg, 1);
+		can_r_reg_dev(dev, MCP2515_EFLG, &eflg, 1);
 
 		if (eflg & (MCP2515_EFLG_RX0OVR | MCP2515_EFLG_RX1OVR)) {
 			// RX overflow
-			can_w_bit(MCP2515_EFLG, MCP2515_EFLG_RX0OVR | MCP2515_EFLG_RX1OVR, 0);
+			CAN_STAT(rxovr[0] += (eflg & MCP2515_EFLG_RX0OVR) ? 1 : 0);
+			CAN_STAT(rxovr[1] += (eflg & MCP2515_EFLG_RX1OVR) ? 1 : 0);
+			can_w_bit_dev(dev, MCP2515_EFLG, MCP2515_EFLG_RX0OVR | MCP2515_EFLG_RX1OVR, 0);
 			eflg &= ~(MCP2515_EFLG_RX0OVR | MCP2515_EFLG_RX1OVR);
 			if (!eflg)
-				can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_ERRIF, 0);
-			mcp2515_irq |= MCP2515_IRQ_RX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
+				can_w_bit_dev(dev, MCP2515_CANINTF, MCP2515_CANINTF_ERRIF, 0);
+			dev->irq |= MCP2515_IRQ_RX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
 			return MCP2515_IRQ_RX | MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
 		}
 
+		#ifdef MCP2515_HEALTH
+		/* Warning, error-passive, bus-off or a way back out of one.  ERRIF only comes back on the next change,
+		 * so it's cleared and the health state tracks the rest.
+		 */
+		can_w_bit_dev(dev, MCP2515_CANINTF, MCP2515_CANINTF_ERRIF, 0);
+		CAN_TXQ_LOCK;
+		can_health_update(dev, eflg);
+		CAN_TXQ_UNLOCK;
+		dev->irq |= MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
+		return MCP2515_IRQ_ERROR | MCP2515_IRQ_HANDLED;
+		#else
 		if (eflg & ~(MCP2515_EFLG_RX0OVR | MCP2515_EFLG_RX1OVR)) {
 			// Warning; TEC or REC too high
-			mcp2515_irq |= MCP2515_IRQ_ERROR;
+			dev->irq |= MCP2515_IRQ_ERROR;
 			return MCP2515_IRQ_ERROR;
 		}
+		#endif
 	}
+	#endif
 
 	/* If we reach this far, it means the user ran this function when no IRQ existed.
-	 * At this point we can clear the MCP2515_IRQ_FLAGGED bit.
+	 * At this point we can clear the MCP2515_IRQ_FLAGGED bit, unless an abort is still outstanding.
 	 */
-	mcp2515_irq &= ~MCP2515_IRQ_FLAGGED;
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	if (dev->txabort)
+		return 0;
+	#endif
+	dev->irq &= ~MCP2515_IRQ_FLAGGED;
 	return 0;
 }
 
-int can_clear_buserror()
+int can_irq_handler_dev(can_dev_t *dev)
+{
+	#ifdef MCP2515_STATS
+	uint16_t t0 = MCP2515_STATS_CLOCK;
+	int irq;
+
+	irq = can_irq_service(dev);
+	can_stats_irq(dev, t0);
+	return irq;
+	#else
+	return can_irq_service(dev);
+	#endif
+}
+
+/* Batched alternative to can_irq_handler(): CANINTF & EFLG come in with one 2-byte READ, every cause found is
+ * handled, and all the CANINTF flags it dealt with are cleared with one BIT MODIFY.  RXnIF is left for
+ * can_recv() to clear by reading the buffer.  MCP2515_IRQ_FLAGGED is only dropped once the INT line has gone
+ * back high, so the caller doesn't have to come back just to find out there's nothing left.
+ */
+int can_irq_batch_dev(can_dev_t *dev, struct can_irq_events *ev)
+{
+	uint8_t regs[2], clr, txdone, irq = MCP2515_IRQ_HANDLED;
+	uint16_t sr;
+	#ifndef MCP2515_NO_ERRORS
+	int i;
+	uint8_t txbctrl;
+	#endif
+	#ifdef MCP2515_STATS
+	uint16_t t0 = MCP2515_STATS_CLOCK;
+	#endif
+
+	#ifdef MCP2515_RX_RING_SIZE
+	CAN_IRQ_LOCK;  // Held throughout so can_isr() can't retire or refill TXBs under us
+	can_rx_drain(dev);
+	#endif
+	can_r_reg_dev(dev, MCP2515_CANINTF, regs, 2);  // CANINTF, EFLG
+	ev->intf = regs[0];
+	ev->eflg = regs[1];
+	ev->txerr = 0;
+	clr = 0;
+
+	// RX; frames are picked up with can_recv() as usual
+	#ifdef MCP2515_RX_RING_SIZE
+	ev->rx = CAN_RX_RING_EMPTY ? 0 : 1;
+	#else
+	ev->rx = regs[0] & (MCP2515_CANINTF_RX0IF | MCP2515_CANINTF_RX1IF);
+	#endif
+	if (ev->rx) {
+		dev->buf = (ev->rx & MCP2515_CANINTF_RX0IF) ? 0 : 1;
+		irq = MCP2515_IRQ_RX;  // Not "handled" until the app reads it
+	}
+
+	// TX complete; released after the flags are cleared below, so a refilled TXB can't lose its new TXnIF
+	txdone = (regs[0] >> 2) & 0x07;
+	clr |= txdone << 2;
+
+	#ifndef MCP2515_NO_WAKE
+	// Wake up
+	if (regs[0] & MCP2515_CANINTF_WAKIF) {
+		clr |= MCP2515_CANINTF_WAKIF;
+		irq |= MCP2515_IRQ_WAKEUP;
+	}
+	#endif
+
+	#ifndef MCP2515_NO_ERRORS
+	// Message error; only TXBs we loaded that haven't completed can be at fault
+	if (regs[0] & MCP2515_CANINTF_MERRF) {
+		clr |= MCP2515_CANINTF_MERRF;
+		CAN_STAT(merr++);
+		for (i=0; i < 3; i++) {
+			if ( (dev->txb & ~CAN_TXB_RES(dev) & ~txdone & (1 << i)) ) {
+				can_r_reg_dev(dev, MCP2515_TXB0CTRL + 0x10*i, &txbctrl, 1);
+				if (txbctrl & MCP2515_TXBCTRL_TXERR)
+					ev->txerr |= 1 << i;
+			}
+		}
+		if (ev->txerr) {
+			CAN_STAT(txerr++);
+			irq |= MCP2515_IRQ_TX | MCP2515_IRQ_ERROR;
+			if (dev->ctrl & MCP2515_CANCTRL_OSM) {
+				dev->txb &= ~ev->txerr;
+			} else {
+				CAN_STAT(txretry++);
+				irq &= ~MCP2515_IRQ_HANDLED;  // App has to decide whether to keep retrying
+			}
+		} else {
+			irq |= MCP2515_IRQ_RX | MCP2515_IRQ_ERROR;
+		}
+	}
+
+	// Everything else is in EFLG
+	if (regs[0] & MCP2515_CANINTF_ERRIF) {
+		if (regs[1] & (MCP2515_EFLG_RX0OVR | MCP2515_EFLG_RX1OVR)) {
+			can_w_bit_dev(dev, MCP2515_EFLG, MCP2515_EFLG_RX0OVR | MCP2515_EFLG_RX1OVR, 0);
+			CAN_STAT(rxovr[0] += (regs[1] & MCP2515_EFLG_RX0OVR) ? 1 : 0);
+			CAN_STAT(rxovr[1] += (regs[1] & MCP2515_EFLG_RX1OVR) ? 1 : 0);
+			irq |= MCP2515_IRQ_RX | MCP2515_IRQ_ERROR;
+		}
+		#ifdef MCP2515_HEALTH
+		// Error state change; handled by the health state, as with can_irq_handler()
+		if (can_health_update(dev, regs[1]) & MCP2515_HEALTH_CHANGED)
+			irq |= MCP2515_IRQ_ERROR;
+		clr |= MCP2515_CANINTF_ERRIF;
+		#else
+		if (regs[1] & ~(MCP2515_EFLG_RX0OVR | MCP2515_EFLG_RX1OVR)) {
+			// Warning; TEC or REC too high.  ERRIF stays set while it lasts, as with can_irq_handler().
+			irq |= MCP2515_IRQ_ERROR;
+			irq &= ~MCP2515_IRQ_HANDLED;
+		} else {
+			clr |= MCP2515_CANINTF_ERRIF;
+		}
+		#endif
+	}
+	#endif
+
+	if (clr)
+		can_w_bit_dev(dev, MCP2515_CANINTF, clr, 0);
+
+	can_tx_retire(dev, txdone);  // Also refills from the TX queue
+	ev->txdone = dev->txpend;  // Includes anything can_isr() retired
+	dev->txpend = 0;
+	#ifdef MCP2515_RX_RING_SIZE
+	CAN_IRQ_UNLOCK;
+	#endif
+	if (ev->txdone) {
+		dev->txdone = ev->txdone;
+		irq |= MCP2515_IRQ_TX;
+	}
+
+	if (!regs[0] && !ev->rx && !ev->txdone)
+		irq = 0;  // Nothing was pending
+	dev->irq = (dev->irq & MCP2515_IRQ_FLAGGED) | irq;
+	ev->irq = irq;
+
+	/* INT only has a falling edge while no flag is set, so if it's still low we must come back.  With
+	 * interrupts off, an edge after the pin test still gets MCP2515_IRQ_FLAGGED set again by the ISR.
+	 * An abort still outstanding (see can_txq_preempt()) has no edge to come, so that needs another look too.
+	 */
+	sr = __get_SR_register() & GIE;
+	_DINT();
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	if ((*dev->irq_in & dev->irq_bit) && !dev->txabort)
+	#else
+	if (*dev->irq_in & dev->irq_bit)
+	#endif
+		dev->irq &= ~MCP2515_IRQ_FLAGGED;
+	__bis_SR_register(sr);
+
+	#ifdef MCP2515_STATS
+	can_stats_irq(dev, t0);
+	#endif
+	return irq;
+}
+
+/* Meant to be run from the user's PORT ISR in place of setting MCP2515_IRQ_FLAGGED by hand.
+ * With MCP2515_RX_RING_SIZE defined, received frames are moved straight into the RX ring here so RXB0/RXB1
+ * never sit full while the main loop is busy, and with MCP2515_TX_SCHED, periodic frames that are due go out.
+ * Completed TXBs are retired here too, though reported by can_irq_handler() like everything else (errors, wakeup).
+ * Returns nonzero if the main loop has work to do and should be woken up.
+ */
+static int can_isr_service(can_dev_t *dev)
+{
+	#ifdef MCP2515_RX_RING_SIZE
+	uint8_t status, ifg, txdone;
+
+	status = can_rx_drain(dev);
+	/* Completed TXBs are retired here, so TXnIF can't hold INT low (and the next RX edge off) until the main loop
+	 * comes round; dev->txpend carries them to can_irq_handler() to report.  With a TX queue that also keeps the
+	 * bus busy, the next queued frames going out without waiting for the main loop.
+	 */
+	txdone = CAN_STATUS_TXDONE(status);
+	if (txdone) {
+		can_w_bit_dev(dev, MCP2515_CANINTF, txdone << 2, 0);
+		can_tx_retire(dev, txdone);
+	}
+	#ifdef MCP2515_TX_SCHED
+	can_sched_run(dev);
+	#endif
+	if (CAN_RX_RING_EMPTY && !dev->txpend) {
+		// Only the rarer causes live outside of READ STATUS; flags whose IRQ is off (pruned error or wake handling) don't count
+		can_r_reg_dev(dev, MCP2515_CANINTF, &ifg, 1);
+		if ( !(ifg & dev->inte) )
+			return 0;
+	}
+	#endif
+
+	dev->irq |= MCP2515_IRQ_FLAGGED;
+	return 1;
+}
+
+int can_isr_dev(can_dev_t *dev)
+{
+	#ifdef MCP2515_STATS
+	uint16_t t0 = MCP2515_STATS_CLOCK;
+	int wake;
+
+	wake = can_isr_service(dev);
+	can_stats_irq(dev, t0);
+	return wake;
+	#else
+	return can_isr_service(dev);
+	#endif
+}
+
+/* Keep every controller's can_isr() off the SPI bus while another device on it is selected, the same way the
+ * driver does around its own transactions: by their port interrupts, so global interrupts can stay on.
+ */
+void can_isr_hold()
+{
+	#ifdef MCP2515_RX_RING_SIZE
+	can_irq_mask_all();
+	#endif
+}
+
+void can_isr_release()
+{
+	#ifdef MCP2515_RX_RING_SIZE
+	can_irq_unmask_all();
+	#endif
+}
+
+int can_clear_buserror_dev(can_dev_t *dev)
 {
 	uint8_t intf, eflg;
 
-	can_r_reg(MCP2515_CANINTF, &intf, 1);
+	can_r_reg_dev(dev, MCP2515_CANINTF, &intf, 1);
 	if (intf & MCP2515_CANINTF_ERRIF) {
-		can_r_reg(MCP2515_EFLG, &eflg, 1);
-		can_w_bit(MCP2515_EFLG, MCP2515_EFLG_RX0OVR | MCP2515_EFLG_RX1OVR, 0);  // The only bits that can be written
-		can_w_bit(MCP2515_CANINTF, MCP2515_CANINTF_ERRIF, 0);
+		can_r_reg_dev(dev, MCP2515_EFLG, &eflg, 1);
+		can_w_bit_dev(dev, MCP2515_EFLG, MCP2515_EFLG_RX0OVR | MCP2515_EFLG_RX1OVR, 0);  // The only bits that can be written
+		can_w_bit_dev(dev, MCP2515_CANINTF, MCP2515_CANINTF_ERRIF, 0);
 		return eflg;
 	}
 
 	return -1;  // No bus error found
 }
+
+#ifdef MCP2515_STATS
+// Consistent copy of the counters, taken with interrupts off since can_isr() updates them too
+void can_stats_get_dev(can_dev_t *dev, struct can_stats *out)
+{
+	uint16_t sr;
+
+	sr = __get_SR_register() & GIE;
+	_DINT();
+	memcpy(out, &dev->stats, sizeof(struct can_stats));
+	__bis_SR_register(sr);
+}
+
+void can_stats_reset_dev(can_dev_t *dev)
+{
+	uint16_t sr;
+
+	sr = __get_SR_register() & GIE;
+	_DINT();
+	memset(&dev->stats, 0, sizeof(struct can_stats));
+	__bis_SR_register(sr);
+}
+#endif
+
+#ifdef MCP2515_TX_STREAM
+/* Sleep in LPM0 until the CAN ISR or the pacing alarm wakes us, unless either already has.  GIE is set by
+ * the same instruction that enters LPM0, so a wakeup can't slip in between the test and the sleep.
+ */
+static void can_tx_stream_sleep(can_dev_t *dev)
+{
+	_DINT();
+	if ( !(dev->irq & MCP2515_IRQ_FLAGGED) && !can_timer_fired )
+		__bis_SR_register(LPM0_bits | GIE);
+	else
+		_EINT();
+}
+
+/* Send len bytes as a run of up-to-8-byte frames, all with the same msgid, at most one every pace_ms
+ * milliseconds (0 = as fast as the bus allows).  Returns once the last frame has been handed to a TXB
+ * (or the TX queue); -1 if the controller went bus-off or one frame failed more than 8 times.
+ */
+int can_tx_stream_dev(can_dev_t *dev, uint32_t msgid, uint8_t is_ext, const uint8_t *buf, uint16_t len, uint8_t prio, uint16_t pace_ms)
+{
+	uint16_t i = 0, j;
+	uint8_t errcount = 0, ready;
+	uint32_t next;
+	struct can_irq_events ev;
+
+	can_timer_cancel();
+	next = can_timer_now();
+	while (i < len) {
+		if (pace_ms && !can_timer_expired(next)) {
+			can_timer_alarm(next);
+		} else {
+			#ifdef MCP2515_TX_QUEUE_SIZE
+			ready = 1;  // can_send() keeps same-ID frames in order and says so when the queue is full
+			#else
+			ready = can_tx_idle_dev(dev);  // One TXB at a time, or the MCP2515 could reorder our frames
+			#endif
+			if (ready) {
+				j = len - i;
+				if (j > 8)
+					j = 8;
+				if (can_send_dev(dev, msgid, is_ext, (void *)(buf+i), j, prio) >= 0) {
+					i += j;
+					errcount = 0;
+					next = can_timer_now() + CAN_TIMER_MS(pace_ms);
+					continue;
+				}
+			}
+		}
+
+		// Wait for a TXB (or the pacing alarm); RX frames stay in the ring for the app's own can_recv()
+		can_tx_stream_sleep(dev);
+		if (dev->irq & MCP2515_IRQ_FLAGGED) {
+			can_irq_batch_dev(dev, &ev);
+			if ( (ev.eflg & MCP2515_EFLG_TXBO) ||
+			     (ev.txerr && !(ev.irq & MCP2515_IRQ_HANDLED) && ++errcount > 8) ) {
+				can_timer_cancel();
+				can_tx_cancel_dev(dev);
+				return -1;
+			}
+		}
+	}
+	can_timer_cancel();
+	return 0;
+}
+#endif
+
+/* Default instance wrappers */
+
+void can_spi_command(uint8_t cmd)
+{
+	can_spi_command_dev(&can_dev0, cmd);
+}
+
+uint8_t can_spi_query(uint8_t cmd)
+{
+	return can_spi_query_dev(&can_dev0, cmd);
+}
+
+void can_r_reg(uint8_t addr, void *buf, uint8_t len)
+{
+	can_r_reg_dev(&can_dev0, addr, buf, len);
+}
+
+void can_w_reg(uint8_t addr, void *buf, uint8_t len)
+{
+	can_w_reg_dev(&can_dev0, addr, buf, len);
+}
+
+void can_w_bit(uint8_t addr, uint8_t mask, uint8_t val)
+{
+	can_w_bit_dev(&can_dev0, addr, mask, val);
+}
+
+void can_w_txbuf(uint8_t bufid, void *buf, uint8_t len)
+{
+	can_w_txbuf_dev(&can_dev0, bufid, buf, len);
+}
+
+void can_r_rxbuf(uint8_t bufid, void *buf, uint8_t len)
+{
+	can_r_rxbuf_dev(&can_dev0, bufid, buf, len);
+}
+
+uint8_t can_read_status()
+{
+	return can_read_status_dev(&can_dev0);
+}
+
+uint8_t can_rx_status()
+{
+	return can_rx_status_dev(&can_dev0);
+}
+
+
+void can_init()
+{
+	can_init_dev(&can_dev0);
+}
+
+#ifndef MCP2515_NO_SPEED_CALC
+int can_speed(uint32_t bitrate, uint8_t propseg_hint, uint8_t syncjump)
+{
+	return can_speed_dev(&can_dev0, bitrate, propseg_hint, syncjump);
+}
+#endif
+
+int can_speed_cnf(uint8_t cnf1, uint8_t cnf2, uint8_t cnf3)
+{
+	return can_speed_cnf_dev(&can_dev0, cnf1, cnf2, cnf3);
+}
+
+
+int can_send(uint32_t msg, uint8_t is_ext, void *buf, uint8_t len, uint8_t prio)
+{
+	return can_send_dev(&can_dev0, msg, is_ext, buf, len, prio);
+}
+
+#ifndef MCP2515_NO_RTR
+int can_query(uint32_t msg, uint8_t is_ext, uint8_t prio)
+{
+	return can_query_dev(&can_dev0, msg, is_ext, prio);
+}
+#endif
+
+int can_tx_cancel()
+{
+	return can_tx_cancel_dev(&can_dev0);
+}
+
+int can_tx_available()
+{
+	return can_tx_available_dev(&can_dev0);
+}
+
+int can_tx_idle()
+{
+	return can_tx_idle_dev(&can_dev0);
+}
+
+uint8_t can_tx_sent()
+{
+	return can_tx_sent_dev(&can_dev0);
+}
+
+int can_recv(uint32_t *msgid, uint8_t *is_ext, void *buf)
+{
+	return can_recv_dev(&can_dev0, msgid, is_ext, buf);
+}
+
+int can_send_frame(const can_frame_t *f, uint8_t prio)
+{
+	return can_send_frame_dev(&can_dev0, f, prio);
+}
+
+int can_send_txb(const can_frame_t *f, uint8_t prio)
+{
+	return can_send_txb_dev(&can_dev0, f, prio);
+}
+
+int can_recv_frame(can_frame_t *f)
+{
+	return can_recv_frame_dev(&can_dev0, f);
+}
+
+#ifdef MCP2515_RX_RING_SIZE
+can_frame_t *can_recv_peek()
+{
+	return can_recv_peek_dev(&can_dev0);
+}
+
+void can_recv_drop()
+{
+	can_recv_drop_dev(&can_dev0);
+}
+
+#ifdef MCP2515_RX_TIMESTAMP
+uint32_t can_recv_stamp()
+{
+	return can_recv_stamp_dev(&can_dev0);
+}
+#endif
+#endif
+
+int can_rx_pending()
+{
+	return can_rx_pending_dev(&can_dev0);
+}
+
+int can_rx_setmask(uint8_t maskid, uint32_t msgmask, uint8_t is_ext)
+{
+	return can_rx_setmask_dev(&can_dev0, maskid, msgmask, is_ext);
+}
+
+int can_rx_setfilter(uint8_t rxb, uint8_t filtid, uint32_t msgid)
+{
+	return can_rx_setfilter_dev(&can_dev0, rxb, filtid, msgid);
+}
+
+int can_rx_mode(uint8_t rxb, uint8_t mode)
+{
+	return can_rx_mode_dev(&can_dev0, rxb, mode);
+}
+
+#ifdef MCP2515_SW_FILTER
+int can_rx_swfilter(const struct can_swfilter *sf)
+{
+	return can_rx_swfilter_dev(&can_dev0, sf);
+}
+#endif
+
+#ifdef MCP2515_RX_DISPATCH
+int can_rx_route(uint8_t filt, uint32_t msgid, can_rx_handler_t fn)
+{
+	return can_rx_route_dev(&can_dev0, filt, msgid, fn);
+}
+
+int can_rx_dispatch()
+{
+	return can_rx_dispatch_dev(&can_dev0);
+}
+#endif
+
+int can_ioctl(uint8_t option, uint8_t val)
+{
+	return can_ioctl_dev(&can_dev0, option, val);
+}
+
+int can_config_save(struct can_config *cfg)
+{
+	return can_config_save_dev(&can_dev0, cfg);
+}
+
+int can_config_load(const struct can_config *cfg)
+{
+	return can_config_load_dev(&can_dev0, cfg);
+}
+
+int can_read_error(uint8_t reg)
+{
+	return can_read_error_dev(&can_dev0, reg);
+}
+
+int can_irq_handler()
+{
+	return can_irq_handler_dev(&can_dev0);
+}
+
+int can_irq_batch(struct can_irq_events *ev)
+{
+	return can_irq_batch_dev(&can_dev0, ev);
+}
+
+int can_isr()
+{
+	return can_isr_dev(&can_dev0);
+}
+
+int can_clear_buserror()
+{
+	return can_clear_buserror_dev(&can_dev0);
+}
+
+#ifdef MCP2515_TX_STREAM
+int can_tx_stream(uint32_t msgid, uint8_t is_ext, const uint8_t *buf, uint16_t len, uint8_t prio, uint16_t pace_ms)
+{
+	return can_tx_stream_dev(&can_dev0, msgid, is_ext, buf, len, prio, pace_ms);
+}
+#endif
+
+#ifdef MCP2515_HEALTH
+int can_health_poll()
+{
+	return can_health_poll_dev(&can_dev0);
+}
+#endif
+
+#ifdef MCP2515_RTR_RESPONDERS
+int can_rtr_respond(uint32_t msgid, uint8_t is_ext, const void *data, uint8_t len, can_rtr_handler_t fn)
+{
+	return can_rtr_respond_dev(&can_dev0, msgid, is_ext, data, len, fn);
+}
+#endif
+
+#ifdef MCP2515_TX_HOT
+int can_hot_reserve(uint8_t txb, const can_frame_t *f, uint8_t prio, uint8_t pin)
+{
+	return can_hot_reserve_dev(&can_dev0, txb, f, prio, pin);
+}
+
+int can_hot_load(uint8_t txb, const void *data, uint8_t n)
+{
+	return can_hot_load_dev(&can_dev0, txb, data, n);
+}
+
+int can_hot_send(uint8_t txb, const void *data, uint8_t n)
+{
+	return can_hot_send_dev(&can_dev0, txb, data, n);
+}
+
+int can_hot_release(uint8_t txb)
+{
+	return can_hot_release_dev(&can_dev0, txb);
+}
+#endif
+
+#ifdef MCP2515_STATS
+void can_stats_get(struct can_stats *out)
+{
+	can_stats_get_dev(&can_dev0, out);
+}
+
+void can_stats_reset()
+{
+	can_stats_reset_dev(&can_dev0);
+}
+#endif
@@ -4,21 +4,8 @@
 
 #include <stdint.h>
 
-/* User configuration */
-#define CAN_SPI_CS_PORTBIT BIT4
-#define CAN_SPI_CS_PORTOUT P2OUT
-#define CAN_SPI_CS_PORTDIR P2DIR
-
-#define CAN_IRQ_PORTBIT BIT3
-#define CAN_IRQ_PORTOUT P1OUT
-#define CAN_IRQ_PORTDIR P1DIR
-#define CAN_IRQ_PORTREN P1REN
-#define CAN_IRQ_PORTIES P1IES
-#define CAN_IRQ_PORTIE P1IE
-#define CAN_IRQ_PORTIFG P1IFG
-
-// BoosterPack contains 16MHz crystal w/ 22pF load caps
-#define CAN_OSC_FREQUENCY 16000000
+/* User configuration; see mcp2515_config.h */
+#include "mcp2515_config.h"
 
 /* Register Memory Map */
 #define MCP2515_RXF0SIDH 0x00
@@ -232,6 +219,51 @@
 #define MCP2515_CNF1_BRP_MASK   0x3F
 #define MCP2515_CNF1_SJW_MASK   0xC0
 
+/* Compile-time bit timing: CNF1-3 for a constant bitrate, worked out by the preprocessor from CAN_OSC_FREQUENCY and
+ * MCP2515_SAMPLE_POINT so nothing is divided at run time.  The most TQ per bit (8-25) that divides the oscillator
+ * exactly, keeps PS2 within 8 TQ and PropSeg + PS1 within 16 is used; MCP2515_BT_NTQ() is 0 if none does, which
+ * CAN_SPEED_CONST() turns into a compile error.
+ */
+#define MCP2515_BT_PS2_(n) ((n) - ((n) * MCP2515_SAMPLE_POINT + 500) / 1000)
+#define MCP2515_BT_PS2(n) (MCP2515_BT_PS2_(n) < 2 ? 2 : MCP2515_BT_PS2_(n))  // As close to the target as PS2 >= 2 allows
+#define MCP2515_BT_TSEG1(n) ((n) - 1 - MCP2515_BT_PS2(n))  // PropSeg + PS1
+#define MCP2515_BT_FITS(br, n) ((CAN_OSC_FREQUENCY / 2) % ((uint32_t)(n) * (br)) == 0 && \
+	(CAN_OSC_FREQUENCY / 2) / ((uint32_t)(n) * (br)) <= 64 && \
+	MCP2515_BT_PS2(n) <= 8 && MCP2515_BT_TSEG1(n) <= 16)
+#define MCP2515_BT_NTQ(br) (MCP2515_BT_FITS(br, 25) ? 25 : \
+	MCP2515_BT_FITS(br, 24) ? 24 : \
+	MCP2515_BT_FITS(br, 23) ? 23 : \
+	MCP2515_BT_FITS(br, 22) ? 22 : \
+	MCP2515_BT_FITS(br, 21) ? 21 : \
+	MCP2515_BT_FITS(br, 20) ? 20 : \
+	MCP2515_BT_FITS(br, 19) ? 19 : \
+	MCP2515_BT_FITS(br, 18) ? 18 : \
+	MCP2515_BT_FITS(br, 17) ? 17 : \
+	MCP2515_BT_FITS(br, 16) ? 16 : \
+	MCP2515_BT_FITS(br, 15) ? 15 : \
+	MCP2515_BT_FITS(br, 14) ? 14 : \
+	MCP2515_BT_FITS(br, 13) ? 13 : \
+	MCP2515_BT_FITS(br, 12) ? 12 : \
+	MCP2515_BT_FITS(br, 11) ? 11 : \
+	MCP2515_BT_FITS(br, 10) ? 10 : \
+	MCP2515_BT_FITS(br, 9) ? 9 : \
+	MCP2515_BT_FITS(br, 8) ? 8 : 0)
+#define MCP2515_BT_BRP(br) ((CAN_OSC_FREQUENCY / 2) / ((uint32_t)(MCP2515_BT_NTQ(br) ? MCP2515_BT_NTQ(br) : 1) * (br)))
+#define MCP2515_BT_SJW(br) (MCP2515_SJW < MCP2515_BT_PS2(MCP2515_BT_NTQ(br)) ? MCP2515_SJW : MCP2515_BT_PS2(MCP2515_BT_NTQ(br)) - 1)
+
+#define MCP2515_CNF1_FOR(br) ((uint8_t)(((MCP2515_BT_BRP(br) - 1) & MCP2515_CNF1_BRP_MASK) | ((MCP2515_BT_SJW(br) - 1) << 6)))
+#define MCP2515_CNF2_FOR(br) ((uint8_t)(MCP2515_CNF2_BTLMODE | \
+	(((MCP2515_BT_TSEG1(MCP2515_BT_NTQ(br)) + 1) / 2 - 1) << 3) | (MCP2515_BT_TSEG1(MCP2515_BT_NTQ(br)) / 2 - 1)))
+#define MCP2515_CNF3_FOR(br) ((uint8_t)(MCP2515_BT_PS2(MCP2515_BT_NTQ(br)) - 1))
+
+/* can_speed() for a constant bitrate; fails to compile (negative bit-field width) if the bitrate can't be hit
+ * exactly from CAN_OSC_FREQUENCY, and returns what can_speed_cnf() does.
+ */
+#define CAN_SPEED_CONST(br) ((void)sizeof(struct { int bitrate_unreachable : MCP2515_BT_NTQ(br) ? 1 : -1; }), \
+	can_speed_cnf(MCP2515_CNF1_FOR(br), MCP2515_CNF2_FOR(br), MCP2515_CNF3_FOR(br)))
+#define CAN_SPEED_CONST_DEV(dev, br) ((void)sizeof(struct { int bitrate_unreachable : MCP2515_BT_NTQ(br) ? 1 : -1; }), \
+	can_speed_cnf_dev(dev, MCP2515_CNF1_FOR(br), MCP2515_CNF2_FOR(br), MCP2515_CNF3_FOR(br)))
+
 #define MCP2515_CANINTE_RX0IE   0x01
 #define MCP2515_CANINTE_RX1IE   0x02
 #define MCP2515_CANINTE_TX0IE   0x04
@@ -299,6 +331,26 @@
 #define MCP2515_SPI_RX_STATUS   0xB0
 #define MCP2515_SPI_BITMOD      0x05
 
+/* READ STATUS (can_read_status()) reply bits */
+#define MCP2515_STATUS_RX0IF    0x01
+#define MCP2515_STATUS_RX1IF    0x02
+#define MCP2515_STATUS_TX0REQ   0x04
+#define MCP2515_STATUS_TX0IF    0x08
+#define MCP2515_STATUS_TX1REQ   0x10
+#define MCP2515_STATUS_TX1IF    0x20
+#define MCP2515_STATUS_TX2REQ   0x40
+#define MCP2515_STATUS_TX2IF    0x80
+
+#define MCP2515_STATUS_RXIF_MASK (MCP2515_STATUS_RX0IF | MCP2515_STATUS_RX1IF)
+#define MCP2515_STATUS_TXIF_MASK (MCP2515_STATUS_TX0IF | MCP2515_STATUS_TX1IF | MCP2515_STATUS_TX2IF)
+
+/* RX STATUS (can_rx_status()) reply bits */
+#define MCP2515_RXSTATUS_FILHIT_MASK 0x07  // 0-5 = RXF0-RXF5, 6 = RXF0 rolled over into RXB1, 7 = RXF1 rolled over into RXB1
+#define MCP2515_RXSTATUS_RTR    0x08
+#define MCP2515_RXSTATUS_EXT    0x10
+#define MCP2515_RXSTATUS_RXB0   0x40
+#define MCP2515_RXSTATUS_RXB1   0x80
+
 /* bufid's for can_r_rxbuf() / can_w_txbuf() */
 #define MCP2515_RXBUF_RXB0SIDH 0x00
 #define MCP2515_RXBUF_RXB0D0 0x02
@@ -312,6 +364,9 @@
 #define MCP2515_TXBUF_TXB2SIDH 0x04
 #define MCP2515_TXBUF_TXB2D0 0x05
 
+/* can_send() return value when the frame went into the software TX queue */
+#define MCP2515_TX_QUEUED 3
+
 /* Option IDs for can_ioctl() */
 #define MCP2515_OPTION_ROLLOVER 1
 #define MCP2515_OPTION_ONESHOT 2
@@ -333,8 +388,186 @@
 #define MCP2515_IRQ_ERROR 0x04
 #define MCP2515_IRQ_WAKEUP 0x08
 
-/* Global variable used for IRQ handling */
-extern volatile uint8_t mcp2515_irq, mcp2515_buf;
+/* Everything can_irq_batch() found and did in one pass; per-buffer fields are bitmaps (BIT0 = RXB0/TXB0 etc.) */
+struct can_irq_events {
+	uint8_t irq;     // Same MCP2515_IRQ_* bits as the return value
+	uint8_t intf;    // CANINTF as read
+	uint8_t eflg;    // EFLG as read
+	uint8_t rx;      // RXBs holding a frame for can_recv() (ring mode: nonzero when the ring has frames)
+	uint8_t txdone;  // TXBs that completed and were released
+	uint8_t txerr;   // TXBs with TXERR set; released too in ONESHOT mode
+};
+
+/* Bus health states, see MCP2515_HEALTH; can_health_poll() ORs in MCP2515_HEALTH_CHANGED on a transition */
+#define MCP2515_HEALTH_ACTIVE 0
+#define MCP2515_HEALTH_WARNING 1  // TEC or REC >= 96
+#define MCP2515_HEALTH_PASSIVE 2  // TEC or REC >= 128
+#define MCP2515_HEALTH_BUSOFF 3   // TEC went past 255; the controller rejoins by itself after 128 x 11 recessive bits
+#define MCP2515_HEALTH_CHANGED 0x80
+
+/* One CAN frame, laid out like the MCP2515's RXBn/TXBn SIDH..D7 registers so it can be read or written over
+ * SPI as-is; see can_frame_id()/can_frame_set_id() for the ID bytes.
+ */
+typedef struct can_frame {
+	uint8_t sidh, sidl, eid8, eid0;
+	uint8_t dlc;  // Length in bits 0-3, RTR in bit 6 (received standard frames have it in sidl bit 4, SRR, instead)
+	uint8_t data[8];
+} can_frame_t;
+
+/* Whole-controller configuration image for can_config_load(): filters, masks, bit timing, interrupt enables and
+ * RX modes, laid out like the register blocks they come from so each block goes out in one sequential WRITE.
+ */
+struct can_config {
+	uint8_t rxf[3][4];          // RXF0-RXF2 SIDH, SIDL, EID8, EID0 (0x00-0x0B)
+	uint8_t rxf_hi[3][4];       // RXF3-RXF5 (0x10-0x1B)
+	uint8_t rxm[2][4];          // RXM0, RXM1 (0x20-0x27), then in the same run
+	uint8_t cnf[3];             // CNF3, CNF2, CNF1 (0x28-0x2A) and
+	uint8_t inte;               // CANINTE (0x2B)
+	uint8_t rxbctrl[2];         // RXB0CTRL, RXB1CTRL
+	uint8_t ctrl;               // CANCTRL to finish in: mode, OSM, CLKOUT
+	uint8_t exmask;             // Masks set up for extended IDs, for can_rx_setfilter() calls after loading
+};
+
+#ifdef MCP2515_SW_FILTER
+/* Wanted IDs, built with can_swfilter_add() at configuration time; a frame passes if its ID is in here */
+struct can_swfilter {
+	uint8_t std[256];                    // Bit (id & 7) of std[id >> 3] for each 11-bit ID
+	uint32_t ext[MCP2515_SW_FILTER];     // 29-bit IDs | 0x80000000, 0 for an empty slot
+	uint8_t ext_n;
+};
+#endif
+
+#define can_frame_id(f) can_parse_msgid(&(f)->sidh)
+#if defined(MCP2515_STD_ONLY)
+#define can_frame_is_ext(f) ((void)(f), 0)
+#elif defined(MCP2515_EXT_ONLY)
+#define can_frame_is_ext(f) ((void)(f), 0x08)
+#else
+#define can_frame_is_ext(f) ((f)->sidl & 0x08)
+#endif
+#define can_frame_len(f) ((f)->dlc & 0x0F)
+
+// Fixed-block allocator over a caller-owned can_frame_t array
+struct can_frame_pool {
+	can_frame_t *free;
+	uint8_t avail;  // Frames left
+};
+
+#ifdef MCP2515_RX_DISPATCH
+struct can_dev;
+typedef void (*can_rx_handler_t)(struct can_dev *, const can_frame_t *);
+
+#define MCP2515_RX_ROUTE_OTHER 6  // can_rx_route() slot for frames whose filter has no handler, or RECV_ALL mode
+#endif
+
+#ifdef MCP2515_RTR_RESPONDERS
+struct can_dev;
+/* Producer for an RTR response, called from can_isr(): fill in up to 8 bytes of data and return the length, or
+ * return -1 to leave the RTR in the RX ring for the main loop instead.
+ */
+typedef int (*can_rtr_handler_t)(struct can_dev *, const can_frame_t *, uint8_t *);
+
+struct can_rtr_entry {
+	uint8_t hdr[4];             // SIDH, SIDL, EID8, EID0 of the ID answered
+	uint8_t len;                // Static response length, 0xFF for an unused entry
+	const uint8_t *data;        // Static response, or NULL to call fn
+	can_rtr_handler_t fn;
+};
+#endif
+
+/* Driver context, one per MCP2515.  They all share the one SPI bus (brought up once, by whichever
+ * can_init_dev() runs first), each on its own CS and INT pins; define extra ones with CAN_DEV_PINS().
+ */
+#ifdef MCP2515_STATS
+struct can_stats {
+	uint32_t tx[3];             // Frames sent, per TXB
+	uint32_t rx[2];             // Frames read out, per RXB
+	uint16_t rxovr[2];          // RX0OVR/RX1OVR events; each lost at least one frame
+	uint16_t merr;              // MERRF interrupts, RX or TX
+	uint16_t txerr;             // ... of those, with TXERR set in one of our TXBs
+	uint16_t txretry;           // ... and of those, outside one-shot mode, so the controller sends again
+	uint16_t txcancel;          // Frames dropped from TXBs or the TX queue by can_tx_cancel()
+	uint16_t passive, busoff;   // Times the controller went error-passive / bus-off (MCP2515_HEALTH only)
+	uint16_t rtr;               // RTRs answered by can_isr() (MCP2515_RTR_RESPONDERS only)
+	uint16_t sched_miss;        // Periodic frames late or not sent at all (MCP2515_TX_SCHED only)
+	uint16_t swdrop;            // Frames dropped by the software filter (MCP2515_SW_FILTER only)
+	uint32_t fwd;               // Frames from here forwarded to the other side by can_gateway.c
+	uint16_t fwd_filtered;      // ... not forwarded, by its rules
+	uint16_t fwd_drop;          // ... dropped from a full RX ring, still waiting for a TXB on the other side
+	uint32_t fwd_lat_max, fwd_lat_ticks;  // Longest and total time from reception to sent on the other side (with MCP2515_RX_TIMESTAMP)
+	uint8_t ring_hwm, txq_hwm;  // Most frames ever waiting in the RX ring / TX queue
+	uint16_t irq_max;           // Longest can_irq_handler()/can_irq_batch()/can_isr() call, in MCP2515_STATS_CLOCK ticks
+	uint32_t irq_ticks, irq_calls;  // Totals of the same, for the average
+};
+#endif
+
+typedef struct can_dev {
+	volatile uint8_t *cs_out, *cs_dir;
+	uint8_t cs_bit;
+	volatile uint8_t *irq_in, *irq_out, *irq_dir, *irq_ren, *irq_ies, *irq_ie, *irq_ifg;
+	uint8_t irq_bit;
+
+	volatile uint8_t irq, buf;  // See mcp2515_irq, mcp2515_buf
+	uint8_t txdone;             // See mcp2515_txdone
+	volatile uint8_t txpend;    // TXBs retired but not yet reported as MCP2515_IRQ_TX
+	volatile uint8_t txsent;    // TXBs retired since can_tx_sent() last took them
+	uint8_t txb, ctrl, exmask;
+	uint8_t inte, txprio[3];    // Shadows so can_send() can skip register writes that wouldn't change anything
+	uint8_t cnf[3], rxbctrl[2]; // CNF3-CNF1 and RXB0CTRL/RXB1CTRL shadows, so their setters never read them back
+	#ifdef MCP2515_RX_RING_SIZE
+	can_frame_t rxring[MCP2515_RX_RING_SIZE];
+	volatile uint8_t rxring_head, rxring_tail;
+	uint8_t irqmask;            // irq_bit while can_isr() is allowed to run, 0 while the main loop has locked it out
+	struct can_dev *next;
+	#ifdef MCP2515_RX_DISPATCH
+	uint8_t rxhit[MCP2515_RX_RING_SIZE];  // Filter each ring slot's frame matched
+	#endif
+	#ifdef MCP2515_RX_TIMESTAMP
+	uint32_t rxstamp[MCP2515_RX_RING_SIZE];  // can_timer_stamp() of each ring slot's frame
+	#endif
+	#endif
+	#ifdef MCP2515_RX_DISPATCH
+	can_rx_handler_t rxroute[7];  // By filter hit, RXF0-5 then MCP2515_RX_ROUTE_OTHER
+	#endif
+	#ifdef MCP2515_TX_QUEUE_SIZE
+	uint8_t txq[MCP2515_TX_QUEUE_SIZE][14];  // TXBnCTRL..TXBnD7 images, sorted so [0] is sent next
+	uint8_t txq_len;
+	uint32_t txkey[3];          // Queue ordering key of the frame loaded in each TXB
+	uint8_t txabort;            // TXBs we've asked to abort so a higher-priority frame can have them
+	#endif
+	#ifdef MCP2515_HEALTH
+	uint8_t health;             // MCP2515_HEALTH_* state
+	uint8_t tec, rec, eflg;     // As last read by the IRQ path or can_health_poll()
+	uint8_t txlimit;            // TXBs that may be in use at once in this state
+	#endif
+	#ifdef MCP2515_TX_HOT
+	uint8_t txres;              // TXBs kept back from can_send(): hot slots, and TXB2 for the RTR responder
+	#endif
+	#ifdef MCP2515_SW_FILTER
+	const struct can_swfilter *swf;  // NULL lets everything through
+	#endif
+	#ifdef MCP2515_RTR_RESPONDERS
+	struct can_rtr_entry rtr[MCP2515_RTR_RESPONDERS];
+	uint8_t rtr_loaded;         // Entry whose response TXB2 holds, 0xFF if none or it may be stale
+	uint8_t rtr_len;            // ... and that response's length
+	#endif
+	#ifdef MCP2515_STATS
+	struct can_stats stats;
+	#endif
+} can_dev_t;
+
+/* Initializer for a can_dev_t from port name and bit, e.g. can_dev_t can_tlm = CAN_DEV_PINS(P2, BIT0, P2, BIT2);
+ * The INT pin's port needs an interrupt vector that runs can_isr_dev() (or sets MCP2515_IRQ_FLAGGED in dev->irq).
+ */
+#define CAN_DEV_PINS(csport, csbit, irqport, irqbit) { &csport##OUT, &csport##DIR, csbit, \
+	&irqport##IN, &irqport##OUT, &irqport##DIR, &irqport##REN, &irqport##IES, &irqport##IE, &irqport##IFG, irqbit }
+
+extern can_dev_t can_dev0;
+
+/* Global variable used for IRQ handling (can_dev0's) */
+#define mcp2515_irq (can_dev0.irq)
+#define mcp2515_buf (can_dev0.buf)
+#define mcp2515_txdone (can_dev0.txdone)
 
 /* Function prototypes */
 void can_spi_command(uint8_t);
@@ -344,26 +577,154 @@ void can_w_reg(uint8_t, void *, uint8_t);
 void can_w_bit(uint8_t, uint8_t, uint8_t);
 void can_w_txbuf(uint8_t, void *, uint8_t);
 void can_r_rxbuf(uint8_t, void *, uint8_t);
+uint8_t can_read_status();
+uint8_t can_rx_status();
 
 void can_init();
+#ifndef MCP2515_NO_SPEED_CALC
 int can_speed(uint32_t, uint8_t, uint8_t);
+#endif
+int can_speed_cnf(uint8_t, uint8_t, uint8_t);
 void can_compose_msgid_std(uint32_t, uint8_t *);
 void can_compose_msgid_ext(uint32_t, uint8_t *);
-uint32_t can_parse_msgid(uint8_t *);
+uint32_t can_parse_msgid(const uint8_t *);
+void can_frame_set_id(can_frame_t *, uint32_t, uint8_t);
+void can_pool_init(struct can_frame_pool *, can_frame_t *, uint8_t);
+can_frame_t *can_pool_alloc(struct can_frame_pool *);
+void can_pool_free(struct can_frame_pool *, can_frame_t *);
 
 int can_send(uint32_t, uint8_t, void *, uint8_t, uint8_t);
+#ifndef MCP2515_NO_RTR
 int can_query(uint32_t, uint8_t, uint8_t);
+#endif
 int can_tx_cancel();
 int can_tx_available();
+int can_tx_idle();
+uint8_t can_tx_sent();
 int can_recv(uint32_t *, uint8_t *, void *);
+int can_send_frame(const can_frame_t *, uint8_t);
+int can_send_txb(const can_frame_t *, uint8_t);
+int can_recv_frame(can_frame_t *);
+can_frame_t *can_recv_peek();
+void can_recv_drop();
+#ifdef MCP2515_RX_TIMESTAMP
+uint32_t can_recv_stamp();
+#endif
 int can_rx_pending();
 int can_rx_setmask(uint8_t, uint32_t, uint8_t);
 int can_rx_setfilter(uint8_t, uint8_t, uint32_t);
 int can_rx_mode(uint8_t, uint8_t);
+#ifdef MCP2515_SW_FILTER
+void can_swfilter_init(struct can_swfilter *);
+int can_swfilter_add(struct can_swfilter *, uint32_t, uint8_t);
+int can_rx_swfilter(const struct can_swfilter *);
+#endif
+#ifdef MCP2515_RX_DISPATCH
+int can_rx_route(uint8_t, uint32_t, can_rx_handler_t);
+int can_rx_dispatch();
+#endif
 int can_ioctl(uint8_t, uint8_t);
+int can_config_save(struct can_config *);
+int can_config_load(const struct can_config *);
 int can_read_error(uint8_t);
 int can_irq_handler();
+int can_irq_batch(struct can_irq_events *);
+int can_isr();
+void can_isr_hold();
+void can_isr_release();
 int can_clear_buserror();
+#ifdef MCP2515_TX_STREAM
+int can_tx_stream(uint32_t, uint8_t, const uint8_t *, uint16_t, uint8_t, uint16_t);
+#endif
+#ifdef MCP2515_HEALTH
+int can_health_poll();
+#endif
+#ifdef MCP2515_RTR_RESPONDERS
+int can_rtr_respond(uint32_t, uint8_t, const void *, uint8_t, can_rtr_handler_t);
+#endif
+#ifdef MCP2515_TX_HOT
+int can_hot_reserve(uint8_t, const can_frame_t *, uint8_t, uint8_t);
+int can_hot_load(uint8_t, const void *, uint8_t);
+int can_hot_send(uint8_t, const void *, uint8_t);
+int can_hot_release(uint8_t);
+#endif
+#ifdef MCP2515_STATS
+void can_stats_get(struct can_stats *);
+void can_stats_reset();
+#endif
+
+/* Same as above, on a given controller */
+void can_spi_command_dev(can_dev_t *, uint8_t);
+uint8_t can_spi_query_dev(can_dev_t *, uint8_t);
+void can_r_reg_dev(can_dev_t *, uint8_t, void *, uint8_t);
+void can_w_reg_dev(can_dev_t *, uint8_t, void *, uint8_t);
+void can_w_bit_dev(can_dev_t *, uint8_t, uint8_t, uint8_t);
+void can_w_txbuf_dev(can_dev_t *, uint8_t, void *, uint8_t);
+void can_r_rxbuf_dev(can_dev_t *, uint8_t, void *, uint8_t);
+uint8_t can_read_status_dev(can_dev_t *);
+uint8_t can_rx_status_dev(can_dev_t *);
+
+void can_init_dev(can_dev_t *);
+#ifndef MCP2515_NO_SPEED_CALC
+int can_speed_dev(can_dev_t *, uint32_t, uint8_t, uint8_t);
+#endif
+int can_speed_cnf_dev(can_dev_t *, uint8_t, uint8_t, uint8_t);
+
+int can_send_dev(can_dev_t *, uint32_t, uint8_t, void *, uint8_t, uint8_t);
+#ifndef MCP2515_NO_RTR
+int can_query_dev(can_dev_t *, uint32_t, uint8_t, uint8_t);
+#endif
+int can_tx_cancel_dev(can_dev_t *);
+int can_tx_available_dev(can_dev_t *);
+int can_tx_idle_dev(can_dev_t *);
+uint8_t can_tx_sent_dev(can_dev_t *);
+int can_recv_dev(can_dev_t *, uint32_t *, uint8_t *, void *);
+int can_send_frame_dev(can_dev_t *, const can_frame_t *, uint8_t);
+int can_send_txb_dev(can_dev_t *, const can_frame_t *, uint8_t);
+int can_recv_frame_dev(can_dev_t *, can_frame_t *);
+can_frame_t *can_recv_peek_dev(can_dev_t *);
+void can_recv_drop_dev(can_dev_t *);
+#ifdef MCP2515_RX_TIMESTAMP
+uint32_t can_recv_stamp_dev(can_dev_t *);
+#endif
+int can_rx_pending_dev(can_dev_t *);
+int can_rx_setmask_dev(can_dev_t *, uint8_t, uint32_t, uint8_t);
+int can_rx_setfilter_dev(can_dev_t *, uint8_t, uint8_t, uint32_t);
+int can_rx_mode_dev(can_dev_t *, uint8_t, uint8_t);
+#ifdef MCP2515_SW_FILTER
+int can_rx_swfilter_dev(can_dev_t *, const struct can_swfilter *);
+#endif
+#ifdef MCP2515_RX_DISPATCH
+int can_rx_route_dev(can_dev_t *, uint8_t, uint32_t, can_rx_handler_t);
+int can_rx_dispatch_dev(can_dev_t *);
+#endif
+int can_ioctl_dev(can_dev_t *, uint8_t, uint8_t);
+int can_config_save_dev(can_dev_t *, struct can_config *);
+int can_config_load_dev(can_dev_t *, const struct can_config *);
+int can_read_error_dev(can_dev_t *, uint8_t);
+int can_irq_handler_dev(can_dev_t *);
+int can_irq_batch_dev(can_dev_t *, struct can_irq_events *);
+int can_isr_dev(can_dev_t *);
+int can_clear_buserror_dev(can_dev_t *);
+#ifdef MCP2515_TX_STREAM
+int can_tx_stream_dev(can_dev_t *, uint32_t, uint8_t, const uint8_t *, uint16_t, uint8_t, uint16_t);
+#endif
+#ifdef MCP2515_HEALTH
+int can_health_poll_dev(can_dev_t *);
+#endif
+#ifdef MCP2515_RTR_RESPONDERS
+int can_rtr_respond_dev(can_dev_t *, uint32_t, uint8_t, const void *, uint8_t, can_rtr_handler_t);
+#endif
+#ifdef MCP2515_TX_HOT
+int can_hot_reserve_dev(can_dev_t *, uint8_t, const can_frame_t *, uint8_t, uint8_t);
+int can_hot_load_dev(can_dev_t *, uint8_t, const void *, uint8_t);
+int can_hot_send_dev(can_dev_t *, uint8_t, const void *, uint8_t);
+int can_hot_release_dev(can_dev_t *, uint8_t);
+#endif
+#ifdef MCP2515_STATS
+void can_stats_get_dev(can_dev_t *, struct can_stats *);
+void can_stats_reset_dev(can_dev_t *);
+#endif
 
 
 #endif
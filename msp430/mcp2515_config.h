@@ -0,0 +1,141 @@
+/* mcp2515_config.h
+ * Compile-time configuration for mcp2515.c, included by mcp2515.h: pin assignments, oscillator, optional features
+ * and, at the bottom, feature pruning for small-flash parts.  Everything here can also be given with -D on the
+ * command line, as the examples' Makefiles do.
+ */
+#ifndef MCP2515_CONFIG_H
+#define MCP2515_CONFIG_H
+
+#define CAN_SPI_CS_PORTBIT BIT4
+#define CAN_SPI_CS_PORTOUT P2OUT
+#define CAN_SPI_CS_PORTDIR P2DIR
+
+#define CAN_IRQ_PORTBIT BIT3
+#define CAN_IRQ_PORTOUT P1OUT
+#define CAN_IRQ_PORTDIR P1DIR
+#define CAN_IRQ_PORTREN P1REN
+#define CAN_IRQ_PORTIES P1IES
+#define CAN_IRQ_PORTIE P1IE
+#define CAN_IRQ_PORTIFG P1IFG
+#define CAN_IRQ_PORTIN P1IN
+
+// BoosterPack contains 16MHz crystal w/ 22pF load caps
+#ifndef CAN_OSC_FREQUENCY
+#define CAN_OSC_FREQUENCY 16000000
+#endif
+
+/* Where in the bit can_speed() and CAN_SPEED_CONST() put the sample point, in 1/1000 of a bit time (87.5% is what
+ * CANopen and DeviceNet ask for).  MCP2515_SJW is the synchronization jump width CAN_SPEED_CONST() uses, 1-4 TQ.
+ */
+#ifndef MCP2515_SAMPLE_POINT
+#define MCP2515_SAMPLE_POINT 875
+#endif
+#ifndef MCP2515_SJW
+#define MCP2515_SJW 1
+#endif
+
+/* ISR-side receive: when defined, can_isr() (run from the user's PORT ISR) pulls frames out of RXB0/RXB1
+ * into a ring of this many frames (power of 2, 13 bytes each) and can_recv() pops from it without any SPI I/O.
+ */
+//#define MCP2515_RX_RING_SIZE 8
+
+/* Software TX queue: when defined, can_send() queues frames (14 bytes each) while all TXBs are busy instead of
+ * failing, ordered by prio then CAN ID, and TXB0-2 are refilled from the TX-complete IRQ.  With MCP2515_RX_RING_SIZE
+ * also defined the refill happens right in can_isr(), otherwise in can_irq_handler()/can_irq_batch().
+ */
+//#define MCP2515_TX_QUEUE_SIZE 8
+
+/* Multi-frame transmit, can_tx_stream(): waits in LPM0 for TX-complete instead of spinning and paces frames
+ * with Timer0_A.  Needs MCP2515_RX_RING_SIZE, can_timer.c linked in and the CAN IRQ ISR calling can_isr().
+ */
+//#define MCP2515_TX_STREAM 1
+
+/* Filter-hit dispatch: can_rx_route() ties each of RXF0-5 to a callback and can_rx_dispatch() hands every received
+ * frame to the one its FILHIT bits name, with no ID comparisons.  Costs one extra register read per frame received.
+ */
+//#define MCP2515_RX_DISPATCH 1
+
+/* Receive timestamps: can_isr() stamps each frame it puts in the RX ring with can_timer_stamp(), a 32-bit Timer0_A
+ * count (CAN_TIMER_HZ), read back with can_recv_stamp().  With CAN_TIMER_CAPTURE defined the stamp is the captured
+ * INT (or SOF) edge, free of ISR latency; otherwise it is taken as the frame is read out.  Needs MCP2515_RX_RING_SIZE
+ * and can_timer.c linked in; costs 4 bytes per ring slot.
+ */
+//#define MCP2515_RX_TIMESTAMP 1
+
+/* Statistics: per-device counters (struct can_stats) of frames, overflows, errors, cancellations, ring/queue
+ * high-water marks and IRQ service time, read with can_stats_get().  Compiled out entirely when not defined.
+ * Service times are taken from MCP2515_STATS_CLOCK, a free-running 16-bit counter (Timer0_A runs continuously under
+ * can_timer_init()).
+ */
+//#define MCP2515_STATS 1
+#ifndef MCP2515_STATS_CLOCK
+#define MCP2515_STATS_CLOCK TA0R
+#endif
+
+/* Bus health monitor: the error IRQ and can_health_poll() track error-active/warning/passive/bus-off from EFLG, TEC
+ * and REC, with MCP2515_HEALTH_HYST counts of hysteresis on the way back down, and limit how many TXBs may be in use
+ * per state so a struggling node eases off the bus.  Error warnings are then handled (ERRIF cleared) in the IRQ path.
+ */
+//#define MCP2515_HEALTH 1
+#ifndef MCP2515_HEALTH_HYST
+#define MCP2515_HEALTH_HYST 16
+#endif
+#ifndef MCP2515_HEALTH_PASSIVE_TXBS
+#define MCP2515_HEALTH_PASSIVE_TXBS 1  // TXBs in use at once while error-passive; none while bus-off
+#endif
+
+/* Remote-request responder: can_rtr_respond() registers up to this many IDs, each with a response buffer or a
+ * producer callback, and can_isr() answers a matching RTR itself out of TXB2, which is kept back from can_send()
+ * for it; the RTR never reaches the RX ring.  Needs MCP2515_RX_RING_SIZE.
+ */
+//#define MCP2515_RTR_RESPONDERS 4
+
+/* TX hot slots: can_hot_reserve() dedicates one of TXB0-2 to a single frame whose ID, DLC and priority stay
+ * loaded, so can_hot_send() only rewrites the data bytes (LOAD TX BUFFER at TXBnD0) and issues RTS; optionally
+ * the TXnRTS pin fires it with no SPI at all.  Reserved TXBs are kept back from can_send().
+ */
+//#define MCP2515_TX_HOT 1
+
+/* Periodic TX scheduler: can_isr() sends the frames can_sched.c's timer interrupt has marked due; see can_sched.h.
+ * Needs MCP2515_RX_RING_SIZE, with can_timer.c and can_sched.c linked in.
+ */
+//#define MCP2515_TX_SCHED 1
+
+/* Software acceptance filter, for when the wanted IDs don't fit RXF0-5: can_isr() checks every frame against a
+ * struct can_swfilter installed with can_rx_swfilter() and drops unwanted ones before they reach the RX ring.
+ * Standard IDs are looked up in a 2048-bit bitmap, extended ones in an open-addressing hash set of this many slots
+ * (a power of 2, up to 128).  Needs MCP2515_RX_RING_SIZE.
+ */
+//#define MCP2515_SW_FILTER 16
+
+/* Feature pruning.  Each of these compiles a piece of the driver out entirely, for parts where flash is tight
+ * (a 16KB G2553 with a font table, say); unused functions are already dropped by -ffunction-sections and
+ * --gc-sections, so these are about the branches inside the ones every build links.  The RX ring, TX queue, stats
+ * and the rest above are already opt-in.
+ */
+
+/* One kind of ID only: can_send(), can_recv(), the TX queue's ordering and the filter setters take every ID as
+ * standard (or extended) and skip the IDE tests; is_ext arguments are ignored and can_frame_is_ext() is a
+ * constant.  RXBs left in their default mode then only take frames of that kind (EXT_ONLY has can_init() flag
+ * every filter extended); RECV_ALL mode would let the other kind in, misread.
+ */
+//#define MCP2515_STD_ONLY 1
+//#define MCP2515_EXT_ONLY 1
+
+// No remote frames: can_query() is left out and can_recv() returns the bare length, never 0x40
+//#define MCP2515_NO_RTR 1
+
+// can_ioctl() options left out (returning -1 like any unknown option): ROLLOVER; CLOCKOUT and SOFOUT; WAKE and WAKE_GLITCH_FILTER
+//#define MCP2515_NO_ROLLOVER 1
+//#define MCP2515_NO_CLKOUT 1
+//#define MCP2515_NO_WAKE 1  // Also drops wakeup handling from the IRQ handlers; MCP2515_IRQ_WAKEUP never comes back
+
+/* No error handling: ERRIE and MERRE stay disabled and the IRQ handlers leave out message error, RX overflow and
+ * EFLG processing, so MCP2515_IRQ_ERROR is never returned.  can_read_error() still works for polling.
+ */
+//#define MCP2515_NO_ERRORS 1
+
+// Leave out can_speed() and its run-time bit timing search; set the bitrate with CAN_SPEED_CONST() or can_speed_cnf()
+//#define MCP2515_NO_SPEED_CALC 1
+
+#endif
@@ -7,6 +7,10 @@
  * 3. USCI_B - developed on MSP430G2553
  * 4. USCI_A F5xxx - developed on MSP430F5172, added F5529
  * 5. USCI_B F5xxx - developed on MSP430F5172, added F5529
+ * 6. eUSCI_A/eUSCI_B FRxxxx - developed on MSP430FR5969
+ *
+ * spi_transfer_block() uses DMA channels 0 (RX) and 1 (TX) on the F5xxx USCI and FR5969 eUSCI
+ * backends when SPI_DRIVER_DMA is defined; every other backend gets a polled loop.
  *
  * Copyright (c) 2013, Eric Brundick <spirilis@linux.com>
  *
@@ -25,6 +29,9 @@
 #include <msp430.h>
 #include "msp430_spi.h"
 
+#ifdef SPI_BYTE_COUNT
+volatile uint16_t spi_bytes;
+#endif
 
 #ifdef __MSP430_HAS_USI__
 void spi_init()
@@ -39,6 +46,7 @@ void spi_init()
 
 uint8_t spi_transfer(uint8_t inb)
 {
+	SPI_COUNT(1);
 	USISRL = inb;
 	USICNT = 8;            // Start SPI transfer
 	while ( !(USICTL1 & USIIFG) )
@@ -49,6 +57,7 @@ uint8_t spi_transfer(uint8_t inb)
 /* What wonderful toys TI gives us!  A 16-bit SPI function. */
 uint16_t spi_transfer16(uint16_t inw)
 {
+	SPI_COUNT(2);
 	USISR = inw;
 	USICNT = 16 | USI16B;  // Start 16-bit SPI transfer
 	while ( !(USICTL1 & USIIFG) )
@@ -91,6 +100,7 @@ void spi_init()
 
 uint8_t spi_transfer(uint8_t inb)
 {
+	SPI_COUNT(1);
 	UCA0TXBUF = inb;
 	while ( !(IFG2 & UCA0RXIFG) )  // Wait for RXIFG indicating remote byte received via SOMI
 		;
@@ -102,6 +112,7 @@ uint16_t spi_transfer16(uint16_t inw)
 	uint16_t retw;
 	uint8_t *retw8 = (uint8_t *)&retw, *inw8 = (uint8_t *)&inw;
 
+	SPI_COUNT(2);
 	UCA0TXBUF = inw8[1];
 	while ( !(IFG2 & UCA0RXIFG) )
 		;
@@ -163,6 +174,7 @@ void spi_init()
 
 uint8_t spi_transfer(uint8_t inb)
 {
+	SPI_COUNT(1);
 	UCB0TXBUF = inb;
 	while ( !(IFG2 & UCB0RXIFG) )  // Wait for RXIFG indicating remote byte received via SOMI
 		;
@@ -174,6 +186,7 @@ uint16_t spi_transfer16(uint16_t inw)
 	uint16_t retw;
 	uint8_t *retw8 = (uint8_t *)&retw, *inw8 = (uint8_t *)&inw;
 
+	SPI_COUNT(2);
 	UCB0TXBUF = inw8[1];
 	while ( !(IFG2 & UCB0RXIFG) )
 		;
@@ -237,6 +250,7 @@ void spi_init()
 
 uint8_t spi_transfer(uint8_t inb)
 {
+	SPI_COUNT(1);
 	UCA0TXBUF = inb;
 	while ( !(IFG2 & UCA0RXIFG) )  // Wait for RXIFG indicating remote byte received via SOMI
 		;
@@ -248,6 +262,7 @@ uint16_t spi_transfer16(uint16_t inw)
 	uint16_t retw;
 	uint8_t *retw8 = (uint8_t *)&retw, *inw8 = (uint8_t *)&inw;
 
+	SPI_COUNT(2);
 	UCA0TXBUF = inw8[1];
 	while ( !(IFG2 & UCA0RXIFG) )
 		;
@@ -308,6 +323,7 @@ void spi_init()
 
 uint8_t spi_transfer(uint8_t inb)
 {
+	SPI_COUNT(1);
 	UCB0TXBUF = inb;
 	while ( !(IFG2 & UCB0RXIFG) )  // Wait for RXIFG indicating remote byte received via SOMI
 		;
@@ -319,6 +335,7 @@ uint16_t spi_transfer16(uint16_t inw)
 	uint16_t retw;
 	uint8_t *retw8 = (uint8_t *)&retw, *inw8 = (uint8_t *)&inw;
 
+	SPI_COUNT(2);
 	UCB0TXBUF = inw8[1];
 	while ( !(IFG2 & UCB0RXIFG) )
 		;
@@ -386,6 +403,7 @@ void spi_init()
 
 uint8_t spi_transfer(uint8_t inb)
 {
+	SPI_COUNT(1);
 	UCA0TXBUF = inb;
 	while ( !(UCA0IFG & UCRXIFG) )  // Wait for RXIFG indicating remote byte received via SOMI
 		;
@@ -397,6 +415,7 @@ uint16_t spi_transfer16(uint16_t inw)
 	uint16_t retw;
 	uint8_t *retw8 = (uint8_t *)&retw, *inw8 = (uint8_t *)&inw;
 
+	SPI_COUNT(2);
 	UCA0TXBUF = inw8[1];
 	while ( !(UCA0IFG & UCRXIFG) )
 		;
@@ -497,6 +516,7 @@ void spi_init()
 
 uint8_t spi_transfer(uint8_t inb)
 {
+	SPI_COUNT(1);
 	UCB0TXBUF = inb;
 	while ( !(UCB0IFG & UCRXIFG) )  // Wait for RXIFG indicating remote byte received via SOMI
 		;
@@ -508,6 +528,7 @@ uint16_t spi_transfer16(uint16_t inw)
 	uint16_t retw;
 	uint8_t *retw8 = (uint8_t *)&retw, *inw8 = (uint8_t *)&inw;
 
+	SPI_COUNT(2);
 	UCB0TXBUF = inw8[1];
 	while ( !(UCB0IFG & UCRXIFG) )
 		;
@@ -609,6 +630,7 @@ void spi_init()
 
 uint8_t spi_transfer(uint8_t inb)
 {
+	SPI_COUNT(1);
 	UCA0TXBUF = inb;
 	while ( !(UCA0IFG & UCRXIFG) )  // Wait for RXIFG indicating remote byte received via SOMI
 		;
@@ -620,6 +642,7 @@ uint16_t spi_transfer16(uint16_t inw)
 	uint16_t retw;
 	uint8_t *retw8 = (uint8_t *)&retw, *inw8 = (uint8_t *)&inw;
 
+	SPI_COUNT(2);
 	UCA0TXBUF = inw8[1];
 	while ( !(UCA0IFG & UCRXIFG) )
 		;
@@ -699,6 +722,7 @@ void spi_init()
 
 uint8_t spi_transfer(uint8_t inb)
 {
+	SPI_COUNT(1);
 	UCA1TXBUF = inb;
 	while ( !(UCA1IFG & UCRXIFG) )  // Wait for RXIFG indicating remote byte received via SOMI
 		;
@@ -710,6 +734,7 @@ uint16_t spi_transfer16(uint16_t inw)
 	uint16_t retw;
 	uint8_t *retw8 = (uint8_t *)&retw, *inw8 = (uint8_t *)&inw;
 
+	SPI_COUNT(2);
 	UCA1TXBUF = inw8[1];
 	while ( !(UCA1IFG & UCRXIFG) )
 		;
@@ -780,6 +805,7 @@ void spi_init()
 
 uint8_t spi_transfer(uint8_t inb)
 {
+	SPI_COUNT(1);
 	UCB0TXBUF = inb;
 	while ( !(UCB0IFG & UCRXIFG) )  // Wait for RXIFG indicating remote byte received via SOMI
 		;
@@ -791,6 +817,7 @@ uint16_t spi_transfer16(uint16_t inw)
 	uint16_t retw;
 	uint8_t *retw8 = (uint8_t *)&retw, *inw8 = (uint8_t *)&inw;
 
+	SPI_COUNT(2);
 	UCB0TXBUF = inw8[1];
 	while ( !(UCB0IFG & UCRXIFG) )
 		;
@@ -848,3 +875,113 @@ uint16_t spi_transfer9(uint16_t inw)
 #endif
 
 #endif
+
+/* Block transfers
+ * tx == NULL clocks out 0xFF, rx == NULL discards what comes back.
+ */
+#ifdef SPI_DMA_TRIG_RX
+/* Start a block transfer and return while the DMA runs it; the buffers must stay put until
+ * spi_transfer_block_wait() (or spi_transfer_block_busy() going to 0).
+ */
+void spi_transfer_block_start(const uint8_t *tx, uint8_t *rx, uint16_t len)
+{
+	static const uint8_t ff = 0xFF;
+	static uint8_t sink;
+	uint8_t c;
+	uint16_t i;
+
+	if (len < SPI_DMA_MIN_LEN) {
+		// Not worth setting up the DMA for a byte or two
+		for (i=0; i < len; i++) {
+			c = spi_transfer(tx ? tx[i] : 0xFF);
+			if (rx)
+				rx[i] = c;
+		}
+		return;
+	}
+
+	SPI_COUNT(len);
+	DMA0CTL = 0;
+	DMA1CTL = 0;
+	DMACTL0 = SPI_DMA_TRIG_RX | (SPI_DMA_TRIG_TX << 8);
+	c = SPI_REG_RXBUF;  // Clear a stale RXIFG; the DMA triggers on its rising edge
+
+	// RX on channel 0, which has the highest priority so each byte is collected before the next one lands
+	DMA0SA = (uintptr_t)&SPI_REG_RXBUF;
+	DMA0DA = (uintptr_t)(rx ? rx : &sink);
+	DMA0SZ = len;
+	DMA0CTL = DMADT_0 | (rx ? DMADSTINCR_3 : DMADSTINCR_0) | DMASRCINCR_0 | DMADSTBYTE | DMASRCBYTE | SPI_DMA_IE | DMAEN;
+
+	/* TX on channel 1 for bytes 1..len-1.  TXIFG is already high when idle, so the first byte is
+	 * written by hand; its move into the shift register produces the edge that starts the DMA.
+	 */
+	DMA1SA = (uintptr_t)(tx ? tx+1 : &ff);
+	DMA1DA = (uintptr_t)&SPI_REG_TXBUF;
+	DMA1SZ = len - 1;
+	DMA1CTL = DMADT_0 | DMADSTINCR_0 | (tx ? DMASRCINCR_3 : DMASRCINCR_0) | DMADSTBYTE | DMASRCBYTE | DMAEN;
+
+	SPI_REG_TXBUF = tx ? tx[0] : 0xFF;
+}
+
+// Nonzero while a block started by spi_transfer_block_start() is still on the bus
+int spi_transfer_block_busy()
+{
+	return !!(DMA0CTL & DMAEN);  // Cleared by hardware once the last byte has been received
+}
+
+/* Wait for the block in progress.  With SPI_DMA_SLEEP, and interrupts enabled by the caller, that's
+ * in LPM0 until spi_dma_isr() wakes us; inside an ISR or with interrupts off it can only spin.
+ */
+void spi_transfer_block_wait()
+{
+	#ifdef SPI_DMA_SLEEP
+	uint16_t sr = __get_SR_register() & GIE;
+
+	if (sr) {
+		_DINT();  // So the DMA can't finish between the test and the sleep
+		while (DMA0CTL & DMAEN) {
+			__bis_SR_register(LPM0_bits | GIE);
+			_DINT();
+		}
+		__bis_SR_register(sr);
+		return;
+	}
+	#endif
+	while (DMA0CTL & DMAEN)
+		;
+}
+
+void spi_transfer_block(const uint8_t *tx, uint8_t *rx, uint16_t len)
+{
+	spi_transfer_block_start(tx, rx, len);
+	spi_transfer_block_wait();
+}
+
+/* Call from the DMA_VECTOR ISR, which belongs to the application as other channels may need it too.
+ * Returns 1 if an SPI block has just finished, in which case the ISR should exit LPM0.
+ */
+int spi_dma_isr()
+{
+	if ((DMA0CTL & (DMAIE | DMAIFG)) != (DMAIE | DMAIFG))
+		return 0;
+	DMA0CTL &= ~DMAIFG;
+	return 1;
+}
+#else
+void spi_transfer_block(const uint8_t *tx, uint8_t *rx, uint16_t len)
+{
+	uint8_t c;
+
+	if (!tx && rx) {
+		spi_read_block(rx, len);
+	} else if (tx && !rx) {
+		spi_write_block(tx, len);
+	} else {
+		while (len--) {
+			c = spi_transfer(tx ? *tx++ : 0xFF);
+			if (rx)
+				*rx++ = c;
+		}
+	}
+}
+#endif
@@ -20,13 +20,220 @@
 
 /* User configuration */
 //#define SPI_DRIVER_USCI_A 1
-#define SPI_DRIVER_USCI_B 1
+#if !defined(SPI_DRIVER_USCI_A) && !defined(SPI_DRIVER_USCI_A0) && !defined(SPI_DRIVER_USCI_A1)
+#define SPI_DRIVER_USCI_B 1  // Default; build with -DSPI_DRIVER_USCI_A (or _A0, _A1 on eUSCI) to use USCI_A instead
+#endif
+#define SPI_DRIVER_DMA 1     // spi_transfer_block() uses DMA channels 0 & 1 where available (F5xxx, FR5969)
+#define SPI_DMA_MIN_LEN 4    // Shorter blocks are sent polled
+/* SPI_DMA_SLEEP has spi_transfer_block() wait for the DMA in LPM0, if interrupts are enabled, rather than spinning.
+ * The application's DMA_VECTOR ISR must then call spi_dma_isr() and exit LPM0 when it returns nonzero.
+ */
+//#define SPI_DMA_SLEEP 1
 
+#include <msp430.h>
 #include <stdint.h>
 
+/* SPI_BYTE_COUNT keeps a running (wrapping) count of bytes clocked over the bus in spi_bytes, for benchmarking */
+//#define SPI_BYTE_COUNT 1
+#ifdef SPI_BYTE_COUNT
+extern volatile uint16_t spi_bytes;
+#define SPI_COUNT(n) (spi_bytes += (n))
+#else
+#define SPI_COUNT(n)
+#endif
+
+/* SPI_BLOCK_READ_PIPELINE keeps a second dummy byte queued in TXBUF during spi_read_block() so the
+ * bus runs back-to-back.  The byte in RXBUF must then be collected within one SPI byte time, so only
+ * enable this when the SPI clock is at most MCLK/2 (e.g. the G2xxx examples' SMCLK = MCLK/2).
+ */
+//#define SPI_BLOCK_READ_PIPELINE 1
+
+/* Register selection for the inline block primitives & DMA, per backend (mirrors msp430_spi.c).
+ * SPI_DRIVER_HOST builds for a PC against the simulated MCP2515 in host/mcp2515_sim.c instead of real hardware.
+ */
+#if defined(SPI_DRIVER_HOST)
+#define SPI_BACKEND_HOST 1
+#elif defined(__MSP430_HAS_USI__)
+#define SPI_BACKEND_USI 1
+#elif defined(__MSP430_HAS_USCI__) && defined(SPI_DRIVER_USCI_A)
+#define SPI_REG_TXBUF UCA0TXBUF
+#define SPI_REG_RXBUF UCA0RXBUF
+#define SPI_TXREADY (IFG2 & UCA0TXIFG)
+#define SPI_RXREADY (IFG2 & UCA0RXIFG)
+#define SPI_BUSY (UCA0STAT & UCBUSY)
+#elif defined(__MSP430_HAS_USCI__) && defined(SPI_DRIVER_USCI_B)
+#define SPI_REG_TXBUF UCB0TXBUF
+#define SPI_REG_RXBUF UCB0RXBUF
+#define SPI_TXREADY (IFG2 & UCB0TXIFG)
+#define SPI_RXREADY (IFG2 & UCB0RXIFG)
+#define SPI_BUSY (UCB0STAT & UCBUSY)
+#elif defined(__MSP430_HAS_USCI_A0__) && defined(SPI_DRIVER_USCI_A)
+#define SPI_REG_TXBUF UCA0TXBUF
+#define SPI_REG_RXBUF UCA0RXBUF
+#define SPI_TXREADY (UCA0IFG & UCTXIFG)
+#define SPI_RXREADY (UCA0IFG & UCRXIFG)
+#define SPI_BUSY (UCA0STAT & UCBUSY)
+#if defined(__MSP430_HAS_DMAX_3__) && defined(SPI_DRIVER_DMA)
+#define SPI_DMA_TRIG_RX 16  // UCA0RXIFG
+#define SPI_DMA_TRIG_TX 17  // UCA0TXIFG
+#endif
+#elif defined(__MSP430_HAS_USCI_B0__) && defined(SPI_DRIVER_USCI_B)
+#define SPI_REG_TXBUF UCB0TXBUF
+#define SPI_REG_RXBUF UCB0RXBUF
+#define SPI_TXREADY (UCB0IFG & UCTXIFG)
+#define SPI_RXREADY (UCB0IFG & UCRXIFG)
+#define SPI_BUSY (UCB0STAT & UCBUSY)
+#if defined(__MSP430_HAS_DMAX_3__) && defined(SPI_DRIVER_DMA)
+#define SPI_DMA_TRIG_RX 18  // UCB0RXIFG
+#define SPI_DMA_TRIG_TX 19  // UCB0TXIFG
+#endif
+#elif defined(__MSP430_HAS_EUSCI_A0__) && (defined(SPI_DRIVER_USCI_A) || defined(SPI_DRIVER_USCI_A0))
+#define SPI_REG_TXBUF UCA0TXBUF
+#define SPI_REG_RXBUF UCA0RXBUF
+#define SPI_TXREADY (UCA0IFG & UCTXIFG)
+#define SPI_RXREADY (UCA0IFG & UCRXIFG)
+#define SPI_BUSY (UCA0STATW & UCBUSY)
+#if defined(__MSP430_HAS_DMAX_3__) && defined(SPI_DRIVER_DMA) && defined(__MSP430FR5969__)
+#define SPI_DMA_TRIG_RX 14  // UCA0RXIFG
+#define SPI_DMA_TRIG_TX 15  // UCA0TXIFG
+#endif
+#elif defined(__MSP430_HAS_EUSCI_A1__) && defined(SPI_DRIVER_USCI_A1)
+#define SPI_REG_TXBUF UCA1TXBUF
+#define SPI_REG_RXBUF UCA1RXBUF
+#define SPI_TXREADY (UCA1IFG & UCTXIFG)
+#define SPI_RXREADY (UCA1IFG & UCRXIFG)
+#define SPI_BUSY (UCA1STATW & UCBUSY)
+#if defined(__MSP430_HAS_DMAX_3__) && defined(SPI_DRIVER_DMA) && defined(__MSP430FR5969__)
+#define SPI_DMA_TRIG_RX 16  // UCA1RXIFG
+#define SPI_DMA_TRIG_TX 17  // UCA1TXIFG
+#endif
+#elif defined(__MSP430_HAS_EUSCI_B0__) && (defined(SPI_DRIVER_USCI_B) || defined(SPI_DRIVER_USCI_B0))
+#define SPI_REG_TXBUF UCB0TXBUF
+#define SPI_REG_RXBUF UCB0RXBUF
+#define SPI_TXREADY (UCB0IFG & UCTXIFG)
+#define SPI_RXREADY (UCB0IFG & UCRXIFG)
+#define SPI_BUSY (UCB0STATW & UCBUSY)
+#if defined(__MSP430_HAS_DMAX_3__) && defined(SPI_DRIVER_DMA) && defined(__MSP430FR5969__)
+#define SPI_DMA_TRIG_RX 18  // UCB0RXIFG0
+#define SPI_DMA_TRIG_TX 19  // UCB0TXIFG0
+#endif
+#endif
+
 void spi_init();
 uint8_t spi_transfer(uint8_t);  // SPI xfer 1 byte
 uint16_t spi_transfer16(uint16_t);  // SPI xfer 2 bytes
 uint16_t spi_transfer9(uint16_t);   // SPI xfer 9 bits (courtesy for driving LCD screens)
+void spi_transfer_block(const uint8_t *, uint8_t *, uint16_t);  // SPI xfer len bytes; either buffer may be NULL
+#ifdef SPI_DMA_TRIG_RX
+#ifdef SPI_DMA_SLEEP
+#define SPI_DMA_IE DMAIE
+#else
+#define SPI_DMA_IE 0
+#endif
+/* spi_transfer_block() in two halves, so the caller can get on with something else (CS still low) while
+ * the DMA clocks the block; spi_transfer_block_start() returns with it running.
+ */
+void spi_transfer_block_start(const uint8_t *, uint8_t *, uint16_t);
+int spi_transfer_block_busy();
+void spi_transfer_block_wait();
+int spi_dma_isr();
+#endif
+
+/* Inline block primitives: no function call per byte, and writes keep TXBUF topped up off TXIFG
+ * so there is no gap between bytes.  Long blocks go through the DMA where it's available.
+ */
+#if defined(SPI_BACKEND_HOST)
+void spi_write_block(const uint8_t *, uint16_t);
+void spi_read_block(uint8_t *, uint16_t);
+void spi_cs_changed();
+#define SPI_CS_CHANGED() spi_cs_changed()
+#elif defined(SPI_BACKEND_USI)
+static inline void spi_write_block(const uint8_t *buf, uint16_t len)
+{
+	SPI_COUNT(len);
+	while (len--) {
+		USISRL = *buf++;
+		USICNT = 8;
+		while ( !(USICTL1 & USIIFG) )
+			;
+	}
+}
+
+static inline void spi_read_block(uint8_t *buf, uint16_t len)
+{
+	SPI_COUNT(len);
+	while (len--) {
+		USISRL = 0xFF;
+		USICNT = 8;
+		while ( !(USICTL1 & USIIFG) )
+			;
+		*buf++ = USISRL;
+	}
+}
+#else
+static inline void spi_write_block(const uint8_t *buf, uint16_t len)
+{
+	#ifdef SPI_DMA_TRIG_RX
+	if (len >= SPI_DMA_MIN_LEN) {
+		spi_transfer_block(buf, 0, len);
+		return;
+	}
+	#endif
+	SPI_COUNT(len);
+	while (len--) {
+		while ( !SPI_TXREADY )
+			;
+		SPI_REG_TXBUF = *buf++;
+	}
+	while ( SPI_BUSY )  // Last byte has to be all the way out before the caller raises CS
+		;
+	(void)SPI_REG_RXBUF;  // Discard what came back, clearing RXIFG
+}
+
+static inline void spi_read_block(uint8_t *buf, uint16_t len)
+{
+	#ifdef SPI_DMA_TRIG_RX
+	if (len >= SPI_DMA_MIN_LEN) {
+		spi_transfer_block(0, buf, len);
+		return;
+	}
+	#endif
+	SPI_COUNT(len);
+	(void)SPI_REG_RXBUF;  // Make sure the first RXIFG we see is ours
+	#ifdef SPI_BLOCK_READ_PIPELINE
+	uint16_t sr;
+
+	if (!len)
+		return;
+	sr = __get_SR_register() & GIE;
+	_DINT();  // An ISR between the two waits below would let RXBUF overrun
+	SPI_REG_TXBUF = 0xFF;
+	while (--len) {
+		while ( !SPI_TXREADY )
+			;
+		SPI_REG_TXBUF = 0xFF;  // Queue the next byte while this one is still shifting
+		while ( !SPI_RXREADY )
+			;
+		*buf++ = SPI_REG_RXBUF;
+	}
+	while ( !SPI_RXREADY )
+		;
+	*buf = SPI_REG_RXBUF;
+	__bis_SR_register(sr);
+	#else
+	while (len--) {
+		SPI_REG_TXBUF = 0xFF;
+		while ( !SPI_RXREADY )
+			;
+		*buf++ = SPI_REG_RXBUF;
+	}
+	#endif
+}
+#endif
+
+// Run by the CAN driver right after it moves a CS line; only the host simulator needs to see those
+#ifndef SPI_CS_CHANGED
+#define SPI_CS_CHANGED()
+#endif
 
 #endif